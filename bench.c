@@ -0,0 +1,166 @@
+/*
+ * Headless benchmark of the cpu solver and the compute pipeline over
+ * generated scenes, see include/bench.h. Built like main_headless, run it
+ * on lavapipe with VK_ICD_FILENAMES=.../lvp_icd.x86_64.json.
+ *
+ * usage: [out.json] [nframes] [baseline.json], exits 1 when a case regressed
+ * against the baseline or let a point fall through the floor
+ */
+#define RENDERER_HEADLESS
+#define RENDERER_NO_MAIN
+#include "main.c"
+
+#include "include/bench.h"
+
+#define BENCH_PATH "bench.json"
+
+/* a few minutes on a single core, scale count and size for bigger machines */
+static const bench_case_t bench_cases[] = {
+        /* one cube dropped on the floor, it must come to rest on top of it */
+        {"soft_cubes_1", BENCH_SCENE_CUBES, 1, 4, PHYSICS_INTEGRATOR_XPBD},
+        {"soft_cubes_8", BENCH_SCENE_CUBES, 8, 4, PHYSICS_INTEGRATOR_XPBD},
+        {"soft_cubes_27", BENCH_SCENE_CUBES, 27, 4, PHYSICS_INTEGRATOR_XPBD},
+        {"cloth_4x32", BENCH_SCENE_CLOTH, 4, 32, PHYSICS_INTEGRATOR_SYMPLECTIC_EULER},
+        {"cloth_1x64", BENCH_SCENE_CLOTH, 1, 64, PHYSICS_INTEGRATOR_IMPLICIT_EULER},
+        {"spring_stack_4x2k", BENCH_SCENE_STACK, 4, 2000, PHYSICS_INTEGRATOR_VERLET},
+        {"spring_stack_2x20k", BENCH_SCENE_STACK, 2, 20000, PHYSICS_INTEGRATOR_RK4},
+};
+
+#define BENCH_NCASES (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+/*
+ * The compute pipeline, renderer_draw with the full step budget as the
+ * headless main does. Every frame waits for the device so its time covers
+ * recording and execution both.
+ */
+static void bench_run_gpu(
+        bench_result_t *pres,
+        const bench_case_t *pcase,
+        renderer_t *prender,
+        uint32_t nframes)
+{
+        bench_scene_t scene;
+        bench_scene_init(&scene, pcase);
+
+        uint64_t *pframe_ns = malloc(sizeof(uint64_t) * (nframes + 1));
+        if (!pframe_ns)
+        {
+                fprintf(stderr, "Cant allocate bench run.\n");
+                abort();
+        }
+
+        VK_TRY(vkDeviceWaitIdle(prender->ldevice));
+        renderer_prepare_scene(
+                prender, scene.pentities, scene.nentities, NULL, 0, NULL, 0);
+
+        /* frames run the variant once it lands, timing its build measures the compiler */
+        if (prender->variant_building)
+        {
+                platform_thread_join(prender->variant_thread);
+                prender->variant_building = false;
+        }
+
+        prender->dt = RENDERER_PHYSICS_STEP * RENDERER_PHYSICS_MAX_STEPS;
+        for (uint32_t i = 0; i < BENCH_WARMUP_FRAMES; i++)
+        {
+                renderer_draw(prender);
+        }
+        VK_TRY(vkDeviceWaitIdle(prender->ldevice));
+
+        uint64_t nsteps = 0;
+        for (uint32_t i = 0; i < nframes; i++)
+        {
+                /* renderer_draw advances the same clock, a copy tells how far */
+                physics_clock_t clock = prender->physics_clock;
+                nsteps += physics_clock_advance(&clock, prender->dt);
+
+                uint64_t begin = platform_time_ns();
+                renderer_draw(prender);
+                VK_TRY(vkDeviceWaitIdle(prender->ldevice));
+                pframe_ns[i] = platform_time_ns() - begin;
+        }
+
+        bench_result_init(pres, pcase, &scene, nsteps, pframe_ns, nframes);
+        pres->pbackend = "gpu";
+
+        tlsf_stats_t stats;
+        renderer_memory_stats(prender, &stats);
+        pres->device_bytes = stats.nused;
+
+        float *ppoints = malloc(sizeof(float) * 3 * (pres->npoint_masses + 1));
+        if (!ppoints)
+        {
+                fprintf(stderr, "Cant allocate bench run.\n");
+                abort();
+        }
+        renderer_read_points(prender, ppoints);
+        pres->min_y = bench_min_y(&scene, ppoints);
+        free(ppoints);
+
+        free(pframe_ns);
+        bench_scene_free(&scene);
+}
+
+static void bench_report(const bench_result_t *pres, FILE *pout)
+{
+        fprintf(pout,
+                "%-24s %-4s %10.1f steps/s %14.0f springs/s p50 %8.3f p99 %8.3f ms "
+                "min y %7.3g%s\n",
+                pres->pcase->pname,
+                pres->pbackend,
+                pres->steps_per_sec,
+                pres->springs_per_sec,
+                pres->p50_ms,
+                pres->p99_ms,
+                pres->min_y,
+                pres->min_y >= BENCH_MIN_Y ? "" : " FELL THROUGH");
+}
+
+int main(int argc, char **argv)
+{
+        const char *ppath     = argc > 1 ? argv[1] : BENCH_PATH;
+        const char *pbaseline = argc > 3 ? argv[3] : NULL;
+        uint32_t nframes      = BENCH_FRAMES;
+        if (argc > 2)
+        {
+                nframes = (uint32_t) strtoul(argv[2], NULL, 10);
+        }
+
+        physics_init_kernels();
+        scheduler_t sched;
+        scheduler_init(&sched, 0);
+
+        renderer_t renderer = {};
+        renderer_init(&renderer, "bench", 0, 0, &sched);
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(renderer.pdevice, &props);
+
+        bench_result_t presults[2 * BENCH_NCASES];
+        uint32_t nresults = 0;
+        for (uint32_t i = 0; i < BENCH_NCASES; i++)
+        {
+                bench_run_cpu(&presults[nresults], &bench_cases[i], &sched, nframes);
+                bench_report(&presults[nresults++], stderr);
+
+                bench_run_gpu(&presults[nresults], &bench_cases[i], &renderer, nframes);
+                bench_report(&presults[nresults++], stderr);
+        }
+
+        renderer_save_pipeline_cache(&renderer);
+
+        bool ok = bench_write(
+                ppath, props.deviceName, sched.nworkers, presults, nresults);
+        for (uint32_t i = 0; i < nresults; i++)
+        {
+                ok &= presults[i].min_y >= BENCH_MIN_Y;
+        }
+        if (pbaseline)
+        {
+                ok &= bench_compare(pbaseline, presults, nresults, stderr);
+        }
+
+        scheduler_free(&sched);
+
+        return ok ? 0 : 1;
+}
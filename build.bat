@@ -10,6 +10,13 @@ set VULKAN_SDK=C:\VulkanSDK\1.3.296.0
 set includes=/I%VULKAN_SDK%\Include
 set links=/link /LIBPATH:%VULKAN_SDK%\Lib vulkan-1.lib SDL2main.lib SDL2.lib
 
+for %%s in (graphics.vert graphics.frag physics.comp cull.comp depth_pyramid.comp) do (
+        %VULKAN_SDK%\Bin\glslc -mfmt=num shader\%%s -o shader\spv\%%s.spv || exit /b 1
+        %VULKAN_SDK%\Bin\glslc shader\%%s -o %TEMP%\%%s.spv || exit /b 1
+        %VULKAN_SDK%\Bin\spirv-val --target-env vulkan1.0 %TEMP%\%%s.spv || exit /b 1
+)
+
+rem no -march, the physics kernels pick their instruction set at startup
 if debug==1 (
         set defines=DEBUG
         clang main.c -o main.exe -I%VULKAN_SDK%\Include -L%VULKAN_SDK%\Lib -lvulkan-1 -lsdl2main -lsdl2 -ggdb -O0 -Wall
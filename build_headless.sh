@@ -0,0 +1,20 @@
+#!/bin/sh
+# headless linux build, runs on lavapipe with VK_ICD_FILENAMES=.../lvp_icd.x86_64.json
+
+set -e
+
+# spirv-val reads binaries only, it checks the vulkan rules glslc leaves to the driver
+for s in graphics.vert graphics.frag physics.comp cull.comp depth_pyramid.comp; do
+        glslc -mfmt=num shader/$s -o shader/spv/$s.spv
+        glslc shader/$s -o "${TMPDIR:-/tmp}/$s.spv"
+        spirv-val --target-env vulkan1.0 "${TMPDIR:-/tmp}/$s.spv"
+done
+
+# no -march, the physics kernels pick their instruction set at startup
+if [ "$1" = "1" ]; then
+        clang main.c -o main_headless -DRENDERER_HEADLESS -DDEBUG -lvulkan -lpthread -lm -ggdb -O0 -Wall
+        clang bench.c -o bench -DDEBUG -lvulkan -lpthread -lm -ggdb -O0 -Wall
+else
+        clang main.c -o main_headless -DRENDERER_HEADLESS -DNDEBUG -lvulkan -lpthread -lm -Ofast -Wall
+        clang bench.c -o bench -DNDEBUG -lvulkan -lpthread -lm -Ofast -Wall
+fi
@@ -0,0 +1,974 @@
+#pragma once
+
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "physics.h"
+#include "physics_world.h"
+#include "platform.h"
+#include "scheduler.h"
+#include "spring_graph.h"
+#include "voxel.h"
+#include "voxel_body.h"
+
+/* bumped whenever a field changes meaning, baselines of another version are ignored */
+#define BENCH_VERSION 2
+/* frames run before timing, first touches and the variant thread settle */
+#define BENCH_WARMUP_FRAMES 8
+#define BENCH_FRAMES 60
+/* a case is a regression once it is this much slower than its baseline */
+#define BENCH_TOLERANCE 0.1
+/* the renderer's step and per frame budget, see RENDERER_PHYSICS_STEP in main.c */
+#define BENCH_STEP (1.0f / 120.0f)
+#define BENCH_MAX_STEPS 8
+
+#define BENCH_SPACING 0.1f
+#define BENCH_GAP 0.05f
+#define BENCH_MASS 0.05f
+/* a lattice point has 26 springs, explicit integrators blow up at 120 hz past this */
+#define BENCH_K 25.0f
+#define BENCH_XPBD_K 1e4f
+#define BENCH_DAMPING 0.5f
+#define BENCH_RADIUS 0.03f
+#define BENCH_FRICTION 0.5f
+/* the floor reaches this far past the bodies on every side */
+#define BENCH_FLOOR_MARGIN 0.5f
+/* a point over the floor ending below this fell through it and fails its case */
+#define BENCH_MIN_Y 0.0f
+/* how far in from the floor's edge that counts, bodies sliding off tip past it */
+#define BENCH_FLOOR_INSET (0.5f * BENCH_FLOOR_MARGIN)
+
+typedef enum
+{
+        BENCH_SCENE_CUBES,
+        BENCH_SCENE_CLOTH,
+        BENCH_SCENE_STACK,
+} bench_scene_kind_t;
+
+/*
+ * Soft cubes are count cubes of size voxels a side, cloth count sheets of
+ * size by size point masses and spring stacks count boxes of at least size
+ * springs each, all above one static floor.
+ */
+typedef struct
+{
+        const char *pname;
+        bench_scene_kind_t kind;
+        uint32_t count, size;
+        physics_integrator_t integrator;
+} bench_case_t;
+
+typedef struct
+{
+        uint32_t nentities, ncapacity;
+        entity_t *pentities;
+} bench_scene_t;
+
+typedef struct
+{
+        const bench_case_t *pcase;
+        const char *pbackend;
+
+        uint32_t nentities, npoint_masses, nsprings, ntriangles;
+        uint64_t nsteps;
+        double seconds, steps_per_sec, springs_per_sec;
+        /* percentiles of the timed frames, each advances the full step budget */
+        double p50_ms, p90_ms, p99_ms, max_ms;
+        /* process high water mark at the end of the case and device memory in use */
+        uint64_t peak_rss_bytes, device_bytes;
+        /* lowest point over the floor at the end, see bench_min_y */
+        float min_y;
+} bench_result_t;
+
+static const char *const bench_integrator_names[] = {
+        [PHYSICS_INTEGRATOR_SYMPLECTIC_EULER] = "symplectic_euler",
+        [PHYSICS_INTEGRATOR_VERLET]           = "verlet",
+        [PHYSICS_INTEGRATOR_RK4]              = "rk4",
+        [PHYSICS_INTEGRATOR_IMPLICIT_EULER]   = "implicit_euler",
+        [PHYSICS_INTEGRATOR_XPBD]             = "xpbd",
+};
+
+/* the 13 forward neighbours of a lattice point, every pair once */
+static const int32_t bench_lattice_offsets[13][3] = {
+        {1, 0, 0},
+        {0, 1, 0},
+        {0, 0, 1},
+        {1, 1, 0},
+        {1, -1, 0},
+        {1, 0, 1},
+        {1, 0, -1},
+        {0, 1, 1},
+        {0, 1, -1},
+        {1, 1, 1},
+        {1, 1, -1},
+        {1, -1, 1},
+        {1, -1, -1},
+};
+
+static entity_t *bench_scene_push(bench_scene_t *pscene)
+{
+        if (pscene->nentities == pscene->ncapacity)
+        {
+                pscene->ncapacity = MAX(2 * pscene->ncapacity, 16);
+                pscene->pentities =
+                        realloc(pscene->pentities, sizeof(entity_t) * pscene->ncapacity);
+                if (!pscene->pentities)
+                {
+                        fprintf(stderr, "Cant allocate bench scene.\n");
+                        abort();
+                }
+        }
+
+        entity_t *pentity = &pscene->pentities[pscene->nentities++];
+        *pentity          = (entity_t){};
+        return pentity;
+}
+
+static void bench_entity_alloc(
+        entity_t *pentity, uint32_t npoint_masses, uint32_t nsprings, uint32_t ntriangles)
+{
+        pentity->npoint_masses = npoint_masses;
+        pentity->nsprings      = nsprings;
+        pentity->ntriangles    = ntriangles;
+        pentity->ppoint_masses = calloc(npoint_masses + 1, sizeof(point_mass_t));
+        pentity->psprings      = malloc(sizeof(spring_t) * (nsprings + 1));
+        pentity->ptriangles    = malloc(sizeof(uint32_t) * 3 * (ntriangles + 1));
+        if (!pentity->ppoint_masses || !pentity->psprings || !pentity->ptriangles)
+        {
+                fprintf(stderr, "Cant allocate bench entity.\n");
+                abort();
+        }
+}
+
+static void bench_entity_contacts(entity_t *pentity)
+{
+        pentity->radius   = BENCH_RADIUS;
+        pentity->friction = BENCH_FRICTION;
+}
+
+/* renumbered for sequential spring reads, as voxel_body_entity does */
+static void bench_entity_reorder(entity_t *pentity)
+{
+        free(entity_reorder(pentity, SPRING_GRAPH_ORDER_RCM));
+}
+
+static float bench_stiffness(physics_integrator_t integrator)
+{
+        return integrator == PHYSICS_INTEGRATOR_XPBD ? BENCH_XPBD_K : BENCH_K;
+}
+
+static void bench_spring(entity_t *pentity, uint32_t *pn, uint32_t a, uint32_t b, float k)
+{
+        vec3_t pa = pentity->ppoint_masses[a].position;
+        vec3_t pb = pentity->ppoint_masses[b].position;
+        float dx = pb.x - pa.x, dy = pb.y - pa.y, dz = pb.z - pa.z;
+
+        pentity->psprings[(*pn)++] =
+                (spring_t){a, b, k, sqrtf(dx * dx + dy * dy + dz * dz)};
+}
+
+static void bench_quad(
+        entity_t *pentity, uint32_t *pn, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+        uint32_t *pt = &pentity->ptriangles[3 * *pn];
+        pt[0]        = a;
+        pt[1]        = b;
+        pt[2]        = c;
+        pt[3]        = a;
+        pt[4]        = c;
+        pt[5]        = d;
+        *pn += 2;
+}
+
+static inline uint32_t bench_lattice_index(
+        const uint32_t pn[3], uint32_t x, uint32_t y, uint32_t z)
+{
+        return (z * pn[1] + y) * pn[0] + x;
+}
+
+/* the springs bench_lattice makes for a box of pn point masses */
+static uint64_t bench_lattice_nsprings(const uint32_t pn[3])
+{
+        uint64_t n = 0;
+        for (uint32_t i = 0; i < 13; i++)
+        {
+                uint64_t m = 1;
+                for (uint32_t a = 0; a < 3; a++)
+                {
+                        uint32_t d = abs(bench_lattice_offsets[i][a]);
+                        m *= pn[a] > d ? pn[a] - d : 0;
+                }
+                n += m;
+        }
+        return n;
+}
+
+/* 4 triangles for every boundary cell, at least 2 point masses on every axis */
+static uint32_t bench_box_ntriangles(const uint32_t pn[3])
+{
+        uint32_t n = 0;
+        for (uint32_t a = 0; a < 3; a++)
+        {
+                n += 4 * (pn[(a + 1) % 3] - 1) * (pn[(a + 2) % 3] - 1);
+        }
+        return n;
+}
+
+/* the six faces of a box whose lattice point (x, y, z) is point mass pidx[...] */
+static void bench_box_surface(
+        entity_t *pentity, const uint32_t *pidx, const uint32_t pn[3])
+{
+        uint32_t ntriangles = 0;
+        for (uint32_t a = 0; a < 3; a++)
+        {
+                uint32_t u = (a + 1) % 3, v = (a + 2) % 3;
+                for (uint32_t side = 0; side < 2; side++)
+                {
+                        for (uint32_t i = 0; i + 1 < pn[u]; i++)
+                        {
+                                for (uint32_t j = 0; j + 1 < pn[v]; j++)
+                                {
+                                        uint32_t pc[3], pq[4];
+                                        for (uint32_t k = 0; k < 4; k++)
+                                        {
+                                                pc[a] = side ? pn[a] - 1 : 0;
+                                                pc[u] = i + (k == 1 || k == 2);
+                                                pc[v] = j + (k >= 2);
+                                                pq[k] = pidx[bench_lattice_index(
+                                                        pn, pc[0], pc[1], pc[2])];
+                                        }
+                                        bench_quad(
+                                                pentity,
+                                                &ntriangles,
+                                                pq[0],
+                                                pq[1],
+                                                pq[2],
+                                                pq[3]);
+                                }
+                        }
+                }
+        }
+
+        pentity->ntriangles = ntriangles;
+}
+
+/* a box of pn point masses BENCH_SPACING apart with its low corner at (x, y, z) */
+static void bench_lattice(
+        entity_t *pentity,
+        const uint32_t pn[3],
+        float x,
+        float y,
+        float z,
+        physics_integrator_t integrator)
+{
+        uint32_t npoint_masses = pn[0] * pn[1] * pn[2];
+        bench_entity_alloc(
+                pentity,
+                npoint_masses,
+                bench_lattice_nsprings(pn),
+                bench_box_ntriangles(pn));
+
+        uint32_t *pidx = malloc(sizeof(uint32_t) * npoint_masses);
+        if (!pidx)
+        {
+                fprintf(stderr, "Cant allocate bench lattice.\n");
+                abort();
+        }
+
+        for (uint32_t k = 0; k < pn[2]; k++)
+        {
+                for (uint32_t j = 0; j < pn[1]; j++)
+                {
+                        for (uint32_t i = 0; i < pn[0]; i++)
+                        {
+                                uint32_t idx = bench_lattice_index(pn, i, j, k);
+                                pidx[idx]    = idx;
+                                pentity->ppoint_masses[idx] = (point_mass_t){
+                                        .mass     = BENCH_MASS,
+                                        .position = {
+                                                x + i * BENCH_SPACING,
+                                                y + j * BENCH_SPACING,
+                                                z + k * BENCH_SPACING}};
+                        }
+                }
+        }
+
+        float k           = bench_stiffness(integrator);
+        uint32_t nsprings = 0;
+        for (uint32_t idx = 0; idx < npoint_masses; idx++)
+        {
+                int32_t pp[3] = {
+                        (int32_t) (idx % pn[0]),
+                        (int32_t) (idx / pn[0] % pn[1]),
+                        (int32_t) (idx / (pn[0] * pn[1]))};
+                for (uint32_t i = 0; i < 13; i++)
+                {
+                        int32_t pq[3];
+                        bool inside = true;
+                        for (uint32_t a = 0; a < 3; a++)
+                        {
+                                pq[a] = pp[a] + bench_lattice_offsets[i][a];
+                                inside &= pq[a] >= 0 && pq[a] < (int32_t) pn[a];
+                        }
+                        if (inside)
+                        {
+                                bench_spring(
+                                        pentity,
+                                        &nsprings,
+                                        idx,
+                                        bench_lattice_index(pn, pq[0], pq[1], pq[2]),
+                                        k);
+                        }
+                }
+        }
+
+        bench_box_surface(pentity, pidx, pn);
+        free(pidx);
+
+        pentity->integrator = integrator;
+        pentity->damping    = BENCH_DAMPING;
+        bench_entity_contacts(pentity);
+        bench_entity_reorder(pentity);
+}
+
+/*
+ * A size^3 soft cube from the voxel path, see voxel_body_entity, with its
+ * surface triangles found by the corner coordinates of its point masses.
+ */
+static void bench_voxel_cube(
+        entity_t *pentity, uint32_t size, physics_integrator_t integrator)
+{
+        voxel_store_t store;
+        voxel_store_init(&store);
+        voxel_store_fill(&store, 0, 0, 0, size, size, size, VOXEL_TYPE_SOFT);
+
+        voxel_body_params_t params = {
+                .voxel_size = BENCH_SPACING,
+                .integrator = integrator,
+                .damping    = BENCH_DAMPING};
+        params.pmass[VOXEL_TYPE_SOFT] = BENCH_MASS;
+        params.pk[VOXEL_TYPE_SOFT]    = bench_stiffness(integrator);
+
+        voxel_body_t body;
+        voxel_body_init(&body, &params, 0, 0, 0, size, size, size);
+        voxel_body_build(&body, &store);
+
+        voxel_body_entity(&body, pentity);
+        voxel_body_free(&body);
+        voxel_store_free(&store);
+
+        uint32_t pn[3]   = {size + 1, size + 1, size + 1};
+        uint32_t ncorners = pn[0] * pn[1] * pn[2];
+        uint32_t *pidx    = malloc(sizeof(uint32_t) * ncorners);
+        pentity->ptriangles =
+                malloc(sizeof(uint32_t) * 3 * (bench_box_ntriangles(pn) + 1));
+        if (!pidx || !pentity->ptriangles)
+        {
+                fprintf(stderr, "Cant allocate bench voxel cube.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < pentity->npoint_masses; i++)
+        {
+                vec3_t p = pentity->ppoint_masses[i].position;
+                pidx[bench_lattice_index(
+                        pn,
+                        (uint32_t) lroundf(p.x / BENCH_SPACING),
+                        (uint32_t) lroundf(p.y / BENCH_SPACING),
+                        (uint32_t) lroundf(p.z / BENCH_SPACING))] = i;
+        }
+
+        bench_box_surface(pentity, pidx, pn);
+        free(pidx);
+
+        bench_entity_contacts(pentity);
+}
+
+/* a deep copy of psrc moved by (x, y, z) */
+static void bench_entity_copy(
+        entity_t *pdst, const entity_t *psrc, float x, float y, float z)
+{
+        *pdst = *psrc;
+        bench_entity_alloc(pdst, psrc->npoint_masses, psrc->nsprings, psrc->ntriangles);
+
+        memcpy(pdst->psprings, psrc->psprings, sizeof(spring_t) * psrc->nsprings);
+        memcpy(pdst->ptriangles,
+               psrc->ptriangles,
+               sizeof(uint32_t) * 3 * psrc->ntriangles);
+
+        pdst->pcluster_offsets = NULL;
+        pdst->pcluster_members = NULL;
+        if (psrc->nclusters)
+        {
+                uint32_t nmembers = psrc->pcluster_offsets[psrc->nclusters];
+                size_t szoffsets  = sizeof(uint32_t) * (psrc->nclusters + 1);
+
+                pdst->pcluster_offsets = malloc(szoffsets);
+                pdst->pcluster_members = malloc(sizeof(uint32_t) * (nmembers + 1));
+                if (!pdst->pcluster_offsets || !pdst->pcluster_members)
+                {
+                        fprintf(stderr, "Cant allocate bench entity.\n");
+                        abort();
+                }
+                memcpy(pdst->pcluster_offsets, psrc->pcluster_offsets, szoffsets);
+                memcpy(pdst->pcluster_members,
+                       psrc->pcluster_members,
+                       sizeof(uint32_t) * nmembers);
+        }
+        for (uint32_t i = 0; i < psrc->npoint_masses; i++)
+        {
+                point_mass_t point = psrc->ppoint_masses[i];
+                point.position.x += x;
+                point.position.y += y;
+                point.position.z += z;
+                pdst->ppoint_masses[i] = point;
+        }
+}
+
+static void bench_entity_free(entity_t *pentity)
+{
+        free(pentity->ppoint_masses);
+        free(pentity->psprings);
+        free(pentity->ptriangles);
+        free(pentity->pcluster_offsets);
+        free(pentity->pcluster_members);
+        *pentity = (entity_t){};
+}
+
+/*
+ * A sheet of size by size point masses held at two corners, with
+ * structural, shear and bend springs.
+ */
+static void bench_cloth(
+        entity_t *pentity,
+        uint32_t size,
+        float x,
+        float y,
+        float z,
+        physics_integrator_t integrator)
+{
+        uint32_t n = MAX(size, 3);
+        bench_entity_alloc(
+                pentity,
+                n * n,
+                2 * n * (n - 1) + 2 * (n - 1) * (n - 1) + 2 * n * (n - 2),
+                2 * (n - 1) * (n - 1));
+
+        for (uint32_t j = 0; j < n; j++)
+        {
+                for (uint32_t i = 0; i < n; i++)
+                {
+                        bool pinned = j == n - 1 && (i == 0 || i == n - 1);
+                        pentity->ppoint_masses[j * n + i] = (point_mass_t){
+                                .mass     = pinned ? 0.0f : BENCH_MASS,
+                                .position = {
+                                        x + i * BENCH_SPACING, y, z + j * BENCH_SPACING}};
+                }
+        }
+
+        float k           = bench_stiffness(integrator);
+        uint32_t nsprings = 0, ntriangles = 0;
+        for (uint32_t j = 0; j < n; j++)
+        {
+                for (uint32_t i = 0; i < n; i++)
+                {
+                        uint32_t a = j * n + i;
+                        if (i + 1 < n)
+                        {
+                                bench_spring(pentity, &nsprings, a, a + 1, k);
+                        }
+                        if (j + 1 < n)
+                        {
+                                bench_spring(pentity, &nsprings, a, a + n, k);
+                        }
+                        if (i + 1 < n && j + 1 < n)
+                        {
+                                bench_spring(pentity, &nsprings, a, a + n + 1, k);
+                                bench_spring(pentity, &nsprings, a + 1, a + n, k);
+                                bench_quad(
+                                        pentity, &ntriangles, a, a + n, a + n + 1, a + 1);
+                        }
+                        if (i + 2 < n)
+                        {
+                                bench_spring(pentity, &nsprings, a, a + 2, k);
+                        }
+                        if (j + 2 < n)
+                        {
+                                bench_spring(pentity, &nsprings, a, a + 2 * n, k);
+                        }
+                }
+        }
+
+        pentity->integrator = integrator;
+        pentity->damping    = BENCH_DAMPING;
+        bench_entity_contacts(pentity);
+        bench_entity_reorder(pentity);
+}
+
+/*
+ * A static grid under every body, contacts only. It takes the bodies'
+ * integrator so a scene of one integrator keeps its physics variant.
+ */
+static void bench_floor(bench_scene_t *pscene, physics_integrator_t integrator)
+{
+        float x0 = INFINITY, z0 = INFINITY, x1 = -INFINITY, z1 = -INFINITY;
+        for (uint32_t i = 0; i < pscene->nentities; i++)
+        {
+                const entity_t *pentity = &pscene->pentities[i];
+                for (uint32_t j = 0; j < pentity->npoint_masses; j++)
+                {
+                        vec3_t p = pentity->ppoint_masses[j].position;
+                        x0       = fminf(x0, p.x);
+                        z0       = fminf(z0, p.z);
+                        x1       = fmaxf(x1, p.x);
+                        z1       = fmaxf(z1, p.z);
+                }
+        }
+        x0 -= BENCH_FLOOR_MARGIN;
+        z0 -= BENCH_FLOOR_MARGIN;
+
+        /* as fine as the bodies, a coarser floor's triangles would all be wide ones */
+        float spacing = BENCH_SPACING;
+        uint32_t nx   = (uint32_t) ceilf((x1 + BENCH_FLOOR_MARGIN - x0) / spacing) + 1;
+        uint32_t nz   = (uint32_t) ceilf((z1 + BENCH_FLOOR_MARGIN - z0) / spacing) + 1;
+
+        entity_t *pentity = bench_scene_push(pscene);
+        bench_entity_alloc(pentity, nx * nz, 0, 2 * (nx - 1) * (nz - 1));
+
+        uint32_t ntriangles = 0;
+        for (uint32_t j = 0; j < nz; j++)
+        {
+                for (uint32_t i = 0; i < nx; i++)
+                {
+                        uint32_t a = j * nx + i;
+                        pentity->ppoint_masses[a].position =
+                                (vec3_t){x0 + i * spacing, 0.0f, z0 + j * spacing};
+                        if (i + 1 < nx && j + 1 < nz)
+                        {
+                                bench_quad(
+                                        pentity,
+                                        &ntriangles,
+                                        a,
+                                        a + nx,
+                                        a + nx + 1,
+                                        a + 1);
+                        }
+                }
+        }
+
+        pentity->integrator = integrator;
+        bench_entity_contacts(pentity);
+}
+
+/* the i-th place on a side by side grid pitch apart, filled layer by layer */
+static uint32_t bench_grid(uint32_t i, uint32_t side, float pitch, float *px, float *pz)
+{
+        uint32_t cell = i % (side * side);
+
+        *px = (cell % side) * pitch;
+        *pz = (cell / side) * pitch;
+        return i / (side * side);
+}
+
+void bench_scene_init(bench_scene_t *pscene, const bench_case_t *pcase)
+{
+        *pscene = (bench_scene_t){};
+
+        switch (pcase->kind)
+        {
+        case BENCH_SCENE_CUBES:
+        {
+                entity_t cube;
+                bench_voxel_cube(&cube, pcase->size, pcase->integrator);
+
+                /* roughly cubic piles, cubes of a layer offset so they land on edges */
+                uint32_t side = (uint32_t) ceil(cbrt((double) pcase->count));
+                float pitch   = pcase->size * BENCH_SPACING + BENCH_GAP;
+                for (uint32_t i = 0; i < pcase->count; i++)
+                {
+                        float x, z;
+                        uint32_t layer = bench_grid(i, side, pitch, &x, &z);
+                        float shift    = (layer & 1) * 0.5f * BENCH_SPACING;
+                        bench_entity_copy(
+                                bench_scene_push(pscene),
+                                &cube,
+                                x + shift,
+                                BENCH_FLOOR_MARGIN + layer * pitch,
+                                z + shift);
+                }
+
+                bench_entity_free(&cube);
+                break;
+        }
+        case BENCH_SCENE_CLOTH:
+        {
+                uint32_t side = (uint32_t) ceil(sqrt((double) pcase->count));
+                float pitch   = pcase->size * BENCH_SPACING + BENCH_GAP;
+                for (uint32_t i = 0; i < pcase->count; i++)
+                {
+                        float x, z;
+                        bench_grid(i, side, pitch, &x, &z);
+                        bench_cloth(
+                                bench_scene_push(pscene),
+                                pcase->size,
+                                x,
+                                BENCH_FLOOR_MARGIN,
+                                z,
+                                pcase->integrator);
+                }
+                break;
+        }
+        case BENCH_SCENE_STACK:
+        {
+                /* boxes grown along their shortest axis until they have size springs */
+                uint32_t pn[3] = {2, 2, 2};
+                while (bench_lattice_nsprings(pn) < pcase->size)
+                {
+                        uint32_t a = pn[1] < pn[0] ? 1 : 0;
+                        a          = pn[2] < pn[a] ? 2 : a;
+                        pn[a]++;
+                }
+
+                float height = (pn[1] - 1) * BENCH_SPACING + BENCH_GAP;
+                for (uint32_t i = 0; i < pcase->count; i++)
+                {
+                        bench_lattice(
+                                bench_scene_push(pscene),
+                                pn,
+                                0.0f,
+                                BENCH_FLOOR_MARGIN + i * height,
+                                0.0f,
+                                pcase->integrator);
+                }
+                break;
+        }
+        }
+
+        bench_floor(pscene, pcase->integrator);
+}
+
+void bench_scene_free(bench_scene_t *pscene)
+{
+        for (uint32_t i = 0; i < pscene->nentities; i++)
+        {
+                bench_entity_free(&pscene->pentities[i]);
+        }
+        free(pscene->pentities);
+        *pscene = (bench_scene_t){};
+}
+
+/*
+ * The lowest y the bodies' points end at over the floor, ppoints holding
+ * the x, y and z streams of every point mass in entity order as
+ * renderer_read_points does. Points that slid off or hang over the floor's
+ * edge fall freely and are skipped, the floor itself is the last entity.
+ * FLT_MAX when none is left over it.
+ */
+float bench_min_y(const bench_scene_t *pscene, const float *ppoints)
+{
+        uint32_t npoint_masses = 0;
+        for (uint32_t i = 0; i < pscene->nentities; i++)
+        {
+                npoint_masses += pscene->pentities[i].npoint_masses;
+        }
+
+        const entity_t *pfloor = &pscene->pentities[pscene->nentities - 1];
+        float x0 = INFINITY, z0 = INFINITY, x1 = -INFINITY, z1 = -INFINITY;
+        for (uint32_t i = 0; i < pfloor->npoint_masses; i++)
+        {
+                vec3_t p = pfloor->ppoint_masses[i].position;
+                x0       = fminf(x0, p.x);
+                z0       = fminf(z0, p.z);
+                x1       = fmaxf(x1, p.x);
+                z1       = fmaxf(z1, p.z);
+        }
+        x0 += BENCH_FLOOR_INSET;
+        z0 += BENCH_FLOOR_INSET;
+        x1 -= BENCH_FLOOR_INSET;
+        z1 -= BENCH_FLOOR_INSET;
+
+        const float *px = ppoints;
+        const float *py = ppoints + npoint_masses;
+        const float *pz = ppoints + 2 * npoint_masses;
+        float min_y     = FLT_MAX;
+        for (uint32_t i = 0; i < npoint_masses - pfloor->npoint_masses; i++)
+        {
+                if (px[i] >= x0 && px[i] <= x1 && pz[i] >= z0 && pz[i] <= z1)
+                {
+                        min_y = fminf(min_y, py[i]);
+                }
+        }
+        return min_y;
+}
+
+static int bench_compare_ns(const void *pa, const void *pb)
+{
+        uint64_t a = *(const uint64_t *) pa, b = *(const uint64_t *) pb;
+        return (a > b) - (a < b);
+}
+
+/*
+ * Fills everything but the backend and device memory from the frame
+ * times, sorts pframe_ns in place.
+ */
+void bench_result_init(
+        bench_result_t *pres,
+        const bench_case_t *pcase,
+        const bench_scene_t *pscene,
+        uint64_t nsteps,
+        uint64_t *pframe_ns,
+        uint32_t nframes)
+{
+        *pres = (bench_result_t){
+                .pcase = pcase, .nentities = pscene->nentities, .nsteps = nsteps};
+        for (uint32_t i = 0; i < pscene->nentities; i++)
+        {
+                pres->npoint_masses += pscene->pentities[i].npoint_masses;
+                pres->nsprings += pscene->pentities[i].nsprings;
+                pres->ntriangles += pscene->pentities[i].ntriangles;
+        }
+
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < nframes; i++)
+        {
+                total += pframe_ns[i];
+        }
+        qsort(pframe_ns, nframes, sizeof(uint64_t), bench_compare_ns);
+
+        pres->seconds         = total * 1e-9;
+        pres->steps_per_sec   = total ? nsteps / pres->seconds : 0.0;
+        pres->springs_per_sec = pres->steps_per_sec * pres->nsprings;
+        if (nframes)
+        {
+                pres->p50_ms = pframe_ns[(nframes - 1) * 50 / 100] * 1e-6;
+                pres->p90_ms = pframe_ns[(nframes - 1) * 90 / 100] * 1e-6;
+                pres->p99_ms = pframe_ns[(nframes - 1) * 99 / 100] * 1e-6;
+                pres->max_ms = pframe_ns[nframes - 1] * 1e-6;
+        }
+        pres->peak_rss_bytes = platform_peak_memory();
+}
+
+/*
+ * The cpu solver, physics_world_advance by the full step budget every
+ * frame as the headless renderer does.
+ */
+void bench_run_cpu(
+        bench_result_t *pres,
+        const bench_case_t *pcase,
+        scheduler_t *psched,
+        uint32_t nframes)
+{
+        bench_scene_t scene;
+        bench_scene_init(&scene, pcase);
+
+        physics_body_t *pbodies = malloc(sizeof(physics_body_t) * (scene.nentities + 1));
+        uint64_t *pframe_ns     = malloc(sizeof(uint64_t) * (nframes + 1));
+        if (!pbodies || !pframe_ns)
+        {
+                fprintf(stderr, "Cant allocate bench run.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < scene.nentities; i++)
+        {
+                physics_body_init(&pbodies[i], &scene.pentities[i]);
+        }
+
+        physics_world_t world;
+        physics_world_init(&world, psched, pbodies, scene.nentities);
+
+        physics_clock_t clock = {.step = BENCH_STEP, .max_steps = BENCH_MAX_STEPS};
+        float dt              = BENCH_STEP * BENCH_MAX_STEPS;
+        for (uint32_t i = 0; i < BENCH_WARMUP_FRAMES; i++)
+        {
+                physics_world_advance(&world, &clock, dt);
+        }
+
+        uint64_t nsteps = 0;
+        for (uint32_t i = 0; i < nframes; i++)
+        {
+                uint64_t begin = platform_time_ns();
+                nsteps += physics_world_advance(&world, &clock, dt);
+                pframe_ns[i] = platform_time_ns() - begin;
+        }
+
+        bench_result_init(pres, pcase, &scene, nsteps, pframe_ns, nframes);
+        pres->pbackend = "cpu";
+
+        float *ppoints = malloc(sizeof(float) * 3 * (pres->npoint_masses + 1));
+        if (!ppoints)
+        {
+                fprintf(stderr, "Cant allocate bench run.\n");
+                abort();
+        }
+        for (uint32_t i = 0, n = pres->npoint_masses, base = 0; i < scene.nentities; i++)
+        {
+                const physics_body_t *pbody = &pbodies[i];
+                for (uint32_t j = 0; j < pbody->npoint_masses; j++)
+                {
+                        ppoints[base + j]         = pbody->px[j];
+                        ppoints[n + base + j]     = pbody->py[j];
+                        ppoints[2 * n + base + j] = pbody->pz[j];
+                }
+                base += pbody->npoint_masses;
+        }
+        pres->min_y = bench_min_y(&scene, ppoints);
+        free(ppoints);
+
+        physics_world_free(&world);
+        for (uint32_t i = 0; i < scene.nentities; i++)
+        {
+                physics_body_free(&pbodies[i]);
+        }
+        free(pbodies);
+        free(pframe_ns);
+        bench_scene_free(&scene);
+}
+
+/*
+ * One case per line so bench_compare can read a baseline back with
+ * sscanf, the whole file is still plain json.
+ */
+bool bench_write(
+        const char *ppath,
+        const char *pdevice,
+        uint32_t nworkers,
+        const bench_result_t *presults,
+        uint32_t nresults)
+{
+        FILE *pfile = fopen(ppath, "w");
+        if (!pfile)
+        {
+                fprintf(stderr, "Cant write %s.\n", ppath);
+                return false;
+        }
+
+        fprintf(pfile,
+                "{\"version\":%d,\"workers\":%u,\"isa\":\"%s\",\"device\":\"%s\","
+                "\"cases\":[",
+                BENCH_VERSION,
+                nworkers,
+                platform_isa_names[physics_isa],
+                pdevice);
+
+        for (uint32_t i = 0; i < nresults; i++)
+        {
+                const bench_result_t *pres = &presults[i];
+                fprintf(pfile,
+                        "%s\n{\"name\":\"%s\",\"backend\":\"%s\",\"integrator\":\"%s\","
+                        "\"steps_per_sec\":%.3f,\"springs_per_sec\":%.1f,"
+                        "\"frame_ms\":{\"p50\":%.4f,\"p90\":%.4f,"
+                        "\"p99\":%.4f,\"max\":%.4f},"
+                        "\"entities\":%u,\"point_masses\":%u,\"springs\":%u,"
+                        "\"triangles\":%u,\"steps\":%llu,\"seconds\":%.6f,"
+                        "\"peak_rss_bytes\":%llu,\"device_bytes\":%llu,"
+                        "\"min_y\":%.4g,\"ok\":%s}",
+                        i ? "," : "",
+                        pres->pcase->pname,
+                        pres->pbackend,
+                        bench_integrator_names[pres->pcase->integrator],
+                        pres->steps_per_sec,
+                        pres->springs_per_sec,
+                        pres->p50_ms,
+                        pres->p90_ms,
+                        pres->p99_ms,
+                        pres->max_ms,
+                        pres->nentities,
+                        pres->npoint_masses,
+                        pres->nsprings,
+                        pres->ntriangles,
+                        (unsigned long long) pres->nsteps,
+                        pres->seconds,
+                        (unsigned long long) pres->peak_rss_bytes,
+                        (unsigned long long) pres->device_bytes,
+                        pres->min_y,
+                        pres->min_y >= BENCH_MIN_Y ? "true" : "false");
+        }
+
+        fprintf(pfile, "\n]}\n");
+        fclose(pfile);
+        return true;
+}
+
+/*
+ * Matches cases by name and backend against a file bench_write made and
+ * reports throughput or p99 frame time worse than BENCH_TOLERANCE, false
+ * when anything regressed. Cases missing from the baseline are skipped.
+ */
+bool bench_compare(
+        const char *ppath, const bench_result_t *presults, uint32_t nresults, FILE *pout)
+{
+        FILE *pfile = fopen(ppath, "r");
+        if (!pfile)
+        {
+                fprintf(stderr, "Cant read %s.\n", ppath);
+                return false;
+        }
+
+        char pline[1024];
+        int version = 0;
+        if (!fgets(pline, sizeof(pline), pfile) ||
+            sscanf(pline, "{\"version\":%d", &version) != 1 || version != BENCH_VERSION)
+        {
+                fprintf(stderr,
+                        "Cant compare against %s, not a version %d bench.\n",
+                        ppath,
+                        BENCH_VERSION);
+                fclose(pfile);
+                return false;
+        }
+
+        bool ok = true;
+        while (fgets(pline, sizeof(pline), pfile))
+        {
+                /* every case line but the first follows a comma */
+                const char *pcase = pline + (pline[0] == ',');
+                char pname[128], pbackend[16];
+                double steps_per_sec, p99;
+                if (sscanf(pcase,
+                           "{\"name\":\"%127[^\"]\",\"backend\":\"%15[^\"]\","
+                           "\"integrator\":\"%*[^\"]\",\"steps_per_sec\":%lf,"
+                           "\"springs_per_sec\":%*f,"
+                           "\"frame_ms\":{\"p50\":%*f,\"p90\":%*f,\"p99\":%lf",
+                           pname,
+                           pbackend,
+                           &steps_per_sec,
+                           &p99) != 4)
+                {
+                        continue;
+                }
+
+                for (uint32_t i = 0; i < nresults; i++)
+                {
+                        const bench_result_t *pres = &presults[i];
+                        if (strcmp(pres->pcase->pname, pname) ||
+                            strcmp(pres->pbackend, pbackend))
+                        {
+                                continue;
+                        }
+
+                        double lo    = steps_per_sec * (1.0 - BENCH_TOLERANCE);
+                        bool slower  = pres->steps_per_sec < lo;
+                        bool spikier = pres->p99_ms > p99 * (1.0 + BENCH_TOLERANCE);
+                        fprintf(pout,
+                                "%-24s %-4s %10.1f steps/s (%+6.1f%%) "
+                                "p99 %8.3f ms (%+6.1f%%)%s\n",
+                                pname,
+                                pbackend,
+                                pres->steps_per_sec,
+                                100.0 * (pres->steps_per_sec / steps_per_sec - 1.0),
+                                pres->p99_ms,
+                                100.0 * (pres->p99_ms / p99 - 1.0),
+                                slower || spikier ? " REGRESSED" : "");
+                        ok &= !slower && !spikier;
+                }
+        }
+
+        fclose(pfile);
+        return ok;
+}
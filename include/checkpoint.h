@@ -0,0 +1,456 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "physics.h"
+#include "physics_world.h"
+#include "platform.h"
+#include "voxel.h"
+
+/* "CKPT", bumped with any change to the records, physics_body_bind or voxel_brick_t */
+#define CHECKPOINT_MAGIC 0x54504b43u
+#define CHECKPOINT_VERSION 3
+/* sections start on a cache line, past the PHYSICS_ALIGN the streams need */
+#define CHECKPOINT_ALIGN 64
+#define CHECKPOINT_TMP_SUFFIX ".tmp"
+
+/*
+ * A checkpoint is this header, a record per body, then every body's
+ * stream allocation byte for byte as physics_body_bind lays it out, its
+ * colour offsets, the voxel bricks, the voxel table and the world's rest
+ * windows by collision point. lanes and the sizes pin the layouts the
+ * sections were written with.
+ */
+typedef struct
+{
+        uint32_t magic, version;
+        uint32_t lanes, szbody, szbrick;
+        uint32_t nbodies, nbricks, ntable, npoints;
+        uint64_t size;
+        uint64_t bricks_offset, table_offset, window_offset;
+} checkpoint_header_t;
+
+/*
+ * everything of a physics_body_t but its pointers, where its sections are,
+ * and its sleep state in the world
+ */
+typedef struct
+{
+        uint32_t npoint_masses, npadded_point_masses;
+        uint32_t nsprings, npadded_springs;
+        uint32_t integrator, ncolors, ntriangles;
+        uint32_t nclusters, ncluster_members;
+        uint32_t asleep, resting, island;
+        float damping, radius, friction;
+        uint64_t streams_offset, streams_size;
+        uint64_t colors_offset;
+} checkpoint_body_t;
+
+/*
+ * A mapped checkpoint. The bodies' streams, the bricks and the sleep state
+ * are views of the mapping, which has to outlive them.
+ */
+typedef struct
+{
+        uint32_t nbodies;
+        physics_body_t *pbodies;
+        const checkpoint_body_t *precords;
+
+        uint32_t npoints;
+        const vec3_t *pwindow;
+
+        uint32_t nbricks, ntable;
+        const voxel_brick_t *pbricks;
+        const uint32_t *ptable;
+
+        void *pmapping;
+        size_t szmapping;
+} checkpoint_t;
+
+/* zero fill up to offset, then the section */
+static bool checkpoint_put(
+        FILE *pfile, uint64_t *ppos, uint64_t offset, const void *p, size_t sz)
+{
+        static const uint8_t pzeros[CHECKPOINT_ALIGN];
+
+        while (*ppos < offset)
+        {
+                size_t n = MIN(offset - *ppos, sizeof pzeros);
+                if (fwrite(pzeros, 1, n, pfile) != n)
+                {
+                        return false;
+                }
+                *ppos += n;
+        }
+
+        *ppos += sz;
+        return !sz || fwrite(p, 1, sz, pfile) == sz;
+}
+
+/*
+ * Writes every body of the world and the store, which may be NULL, in one
+ * sequential pass of their arrays. The file goes to ppath.tmp first and
+ * replaces ppath once complete, a crash mid write keeps the last one.
+ */
+bool checkpoint_write(
+        const char *ppath, const physics_world_t *pworld, const voxel_store_t *pstore)
+{
+        uint32_t nbodies            = pworld->nbodies;
+        checkpoint_body_t *precords = calloc(nbodies + 1, sizeof(checkpoint_body_t));
+
+        size_t nsuffix  = strlen(CHECKPOINT_TMP_SUFFIX);
+        size_t npath    = strlen(ppath);
+        char *ptmp_path = malloc(npath + nsuffix + 1);
+        if (!precords || !ptmp_path)
+        {
+                fprintf(stderr, "Cant allocate checkpoint.\n");
+                abort();
+        }
+        memcpy(ptmp_path, ppath, npath);
+        memcpy(ptmp_path + npath, CHECKPOINT_TMP_SUFFIX, nsuffix + 1);
+
+        uint64_t offset = ALIGN_UP(
+                sizeof(checkpoint_header_t) + sizeof(checkpoint_body_t) * nbodies,
+                CHECKPOINT_ALIGN);
+        for (uint32_t i = 0; i < nbodies; i++)
+        {
+                const physics_body_t *pbody = &pworld->pbodies[i];
+                checkpoint_body_t *precord  = &precords[i];
+
+                *precord = (checkpoint_body_t){
+                        .npoint_masses        = pbody->npoint_masses,
+                        .npadded_point_masses = pbody->npadded_point_masses,
+                        .nsprings             = pbody->nsprings,
+                        .npadded_springs      = pbody->npadded_springs,
+                        .integrator           = pbody->integrator,
+                        .ncolors              = pbody->ncolors,
+                        .ntriangles           = pbody->ntriangles,
+                        .nclusters            = pbody->nclusters,
+                        .ncluster_members     = pbody->ncluster_members,
+                        .asleep               = pworld->pasleep[i],
+                        .resting              = pworld->presting[i],
+                        .island               = pworld->pislands[i],
+                        .damping              = pbody->damping,
+                        .radius               = pbody->radius,
+                        .friction             = pbody->friction,
+                        .streams_offset       = offset,
+                        .streams_size         = physics_body_size(pbody)};
+                offset = ALIGN_UP(offset + precord->streams_size, CHECKPOINT_ALIGN);
+
+                if (pbody->pcolor_offsets)
+                {
+                        precord->colors_offset = offset;
+                        offset                 = ALIGN_UP(
+                                offset + sizeof(uint32_t) * (pbody->ncolors + 1),
+                                CHECKPOINT_ALIGN);
+                }
+        }
+
+        uint32_t nbricks = pstore ? pstore->nbricks : 0;
+        uint32_t ntable  = pstore ? pstore->ntable : 0;
+        uint32_t npoints = pworld->collision.npoints;
+
+        checkpoint_header_t header = {
+                .magic         = CHECKPOINT_MAGIC,
+                .version       = CHECKPOINT_VERSION,
+                .lanes         = PHYSICS_LANES,
+                .szbody        = sizeof(checkpoint_body_t),
+                .szbrick       = sizeof(voxel_brick_t),
+                .nbodies       = nbodies,
+                .nbricks       = nbricks,
+                .ntable        = ntable,
+                .npoints       = npoints,
+                .bricks_offset = offset};
+        offset = ALIGN_UP(offset + sizeof(voxel_brick_t) * nbricks, CHECKPOINT_ALIGN);
+        header.table_offset = offset;
+        offset = ALIGN_UP(offset + sizeof(uint32_t) * ntable, CHECKPOINT_ALIGN);
+        header.window_offset = offset;
+        header.size          = offset + sizeof(vec3_t) * npoints;
+
+        FILE *pfile = fopen(ptmp_path, "wb");
+        if (!pfile)
+        {
+                fprintf(stderr, "Cant write %s.\n", ptmp_path);
+                free(precords);
+                free(ptmp_path);
+                return false;
+        }
+
+        uint64_t pos     = 0;
+        size_t szrecords = sizeof(checkpoint_body_t) * nbodies;
+        bool ok          = checkpoint_put(pfile, &pos, 0, &header, sizeof header) &&
+                  checkpoint_put(pfile, &pos, pos, precords, szrecords);
+        for (uint32_t i = 0; ok && i < nbodies; i++)
+        {
+                const physics_body_t *pbody      = &pworld->pbodies[i];
+                const checkpoint_body_t *precord = &precords[i];
+
+                /* px opens the streams whether they are allocated or mapped */
+                ok = checkpoint_put(
+                        pfile,
+                        &pos,
+                        precord->streams_offset,
+                        pbody->px,
+                        precord->streams_size);
+                if (ok && pbody->pcolor_offsets)
+                {
+                        ok = checkpoint_put(
+                                pfile,
+                                &pos,
+                                precord->colors_offset,
+                                pbody->pcolor_offsets,
+                                sizeof(uint32_t) * (pbody->ncolors + 1));
+                }
+        }
+        ok = ok &&
+             checkpoint_put(
+                     pfile,
+                     &pos,
+                     header.bricks_offset,
+                     nbricks ? pstore->pbricks : NULL,
+                     sizeof(voxel_brick_t) * nbricks) &&
+             checkpoint_put(
+                     pfile,
+                     &pos,
+                     header.table_offset,
+                     ntable ? pstore->ptable : NULL,
+                     sizeof(uint32_t) * ntable) &&
+             checkpoint_put(
+                     pfile,
+                     &pos,
+                     header.window_offset,
+                     pworld->pwindow,
+                     sizeof(vec3_t) * npoints);
+        ok &= fclose(pfile) == 0;
+
+        ok = ok && platform_replace_file(ptmp_path, ppath);
+        if (!ok)
+        {
+                fprintf(stderr, "Cant write %s.\n", ppath);
+                remove(ptmp_path);
+        }
+
+        free(precords);
+        free(ptmp_path);
+        return ok;
+}
+
+static bool checkpoint_section(
+        const checkpoint_header_t *pheader, uint64_t offset, uint64_t sz)
+{
+        return offset % CHECKPOINT_ALIGN == 0 && offset <= pheader->size &&
+               sz <= pheader->size - offset;
+}
+
+/* rebinds one body to its sections, false when the record does not add up */
+static bool checkpoint_bind(
+        const checkpoint_header_t *pheader,
+        const checkpoint_body_t *precord,
+        uint8_t *pmapping,
+        physics_body_t *pbody)
+{
+        *pbody = (physics_body_t){
+                .npoint_masses        = precord->npoint_masses,
+                .npadded_point_masses = precord->npadded_point_masses,
+                .nsprings             = precord->nsprings,
+                .npadded_springs      = precord->npadded_springs,
+                .integrator           = precord->integrator,
+                .damping              = precord->damping,
+                .ncolors              = precord->ncolors,
+                .radius               = precord->radius,
+                .friction             = precord->friction,
+                .ntriangles           = precord->ntriangles,
+                .nclusters            = precord->nclusters,
+                .ncluster_members     = precord->ncluster_members};
+
+        bool xpbd         = precord->integrator == PHYSICS_INTEGRATOR_XPBD;
+        uint64_t szcolors = sizeof(uint32_t) * ((uint64_t) precord->ncolors + 1);
+        if (precord->integrator > PHYSICS_INTEGRATOR_XPBD ||
+            precord->npadded_point_masses % PHYSICS_LANES ||
+            precord->npadded_springs % PHYSICS_LANES ||
+            precord->streams_size != physics_body_size(pbody) ||
+            !checkpoint_section(
+                    pheader, precord->streams_offset, precord->streams_size) ||
+            (xpbd && !checkpoint_section(pheader, precord->colors_offset, szcolors)))
+        {
+                return false;
+        }
+
+        physics_body_bind(pbody, (char *) pmapping + precord->streams_offset);
+
+        /* a copy, physics_body_free frees it like any body's */
+        if (xpbd)
+        {
+                pbody->pcolor_offsets = malloc(szcolors);
+                if (!pbody->pcolor_offsets)
+                {
+                        fprintf(stderr, "Cant allocate checkpoint colours.\n");
+                        abort();
+                }
+                memcpy(pbody->pcolor_offsets,
+                       pmapping + precord->colors_offset,
+                       szcolors);
+        }
+        return true;
+}
+
+/*
+ * Maps a checkpoint written by checkpoint_write copy on write. The bodies
+ * step straight from the mapping, nothing is parsed or copied until a page
+ * is first written. pbodies is an array like physics_body_init makes, for
+ * physics_world_init, then checkpoint_sleep, freed with physics_body_free
+ * and free before checkpoint_close. Fails on a missing file or one of
+ * another layout.
+ */
+bool checkpoint_map(const char *ppath, checkpoint_t *pckpt)
+{
+        size_t sz;
+        uint8_t *p = platform_map_file_copy(ppath, &sz);
+        if (!p)
+        {
+                return false;
+        }
+
+        checkpoint_header_t header = {};
+        if (sz >= sizeof header)
+        {
+                memcpy(&header, p, sizeof header);
+        }
+
+        uint64_t szrecords = sizeof(checkpoint_body_t) * (uint64_t) header.nbodies;
+        if (header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION ||
+            header.lanes != PHYSICS_LANES || header.szbody != sizeof(checkpoint_body_t) ||
+            header.szbrick != sizeof(voxel_brick_t) || header.size != sz ||
+            sizeof header + szrecords > sz ||
+            (header.ntable & (header.ntable - 1)) ||
+            !checkpoint_section(
+                    &header,
+                    header.bricks_offset,
+                    sizeof(voxel_brick_t) * (uint64_t) header.nbricks) ||
+            !checkpoint_section(
+                    &header,
+                    header.table_offset,
+                    sizeof(uint32_t) * (uint64_t) header.ntable) ||
+            !checkpoint_section(
+                    &header,
+                    header.window_offset,
+                    sizeof(vec3_t) * (uint64_t) header.npoints))
+        {
+                platform_unmap_file(p, sz);
+                return false;
+        }
+
+        const checkpoint_body_t *precords =
+                (const checkpoint_body_t *) (p + sizeof header);
+        *pckpt = (checkpoint_t){
+                .nbodies   = header.nbodies,
+                .pbodies   = malloc(sizeof(physics_body_t) * (header.nbodies + 1)),
+                .precords  = precords,
+                .npoints   = header.npoints,
+                .pwindow   = (const vec3_t *) (p + header.window_offset),
+                .nbricks   = header.nbricks,
+                .ntable    = header.ntable,
+                .pbricks   = (const voxel_brick_t *) (p + header.bricks_offset),
+                .ptable    = (const uint32_t *) (p + header.table_offset),
+                .pmapping  = p,
+                .szmapping = sz};
+        if (!pckpt->pbodies)
+        {
+                fprintf(stderr, "Cant allocate checkpoint bodies.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < header.nbodies; i++)
+        {
+                if (!checkpoint_bind(&header, &precords[i], p, &pckpt->pbodies[i]))
+                {
+                        for (uint32_t j = 0; j < i; j++)
+                        {
+                                physics_body_free(&pckpt->pbodies[j]);
+                        }
+                        free(pckpt->pbodies);
+                        platform_unmap_file(p, sz);
+                        *pckpt = (checkpoint_t){};
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+/*
+ * Puts the world physics_world_init made of the checkpoint's bodies back
+ * to sleep as it was written, so it steps on exactly as the saved one
+ * would have. False and left awake when the world is not the checkpoint's.
+ */
+bool checkpoint_sleep(const checkpoint_t *pckpt, physics_world_t *pworld)
+{
+        if (pworld->nbodies != pckpt->nbodies ||
+            pworld->collision.npoints != pckpt->npoints)
+        {
+                return false;
+        }
+
+        for (uint32_t i = 0; i < pckpt->nbodies; i++)
+        {
+                const checkpoint_body_t *precord = &pckpt->precords[i];
+                if (precord->asleep > PHYSICS_WORLD_PINNED ||
+                    precord->island >= pckpt->nbodies)
+                {
+                        return false;
+                }
+        }
+
+        for (uint32_t i = 0; i < pckpt->nbodies; i++)
+        {
+                pworld->pasleep[i]  = pckpt->precords[i].asleep;
+                pworld->presting[i] = pckpt->precords[i].resting;
+                pworld->pislands[i] = pckpt->precords[i].island;
+        }
+        memcpy(pworld->pwindow, pckpt->pwindow, sizeof(vec3_t) * pckpt->npoints);
+        physics_world_compact(pworld);
+        return true;
+}
+
+/*
+ * Fills an empty store from the checkpoint. Stores grow and rehash in
+ * place, so the bricks and table are copied out rather than mapped, both
+ * ready to use as they are.
+ */
+void checkpoint_voxels(const checkpoint_t *pckpt, voxel_store_t *pstore)
+{
+        if (!pckpt->ntable)
+        {
+                voxel_store_init(pstore);
+                return;
+        }
+
+        *pstore = (voxel_store_t){
+                .nbricks         = pckpt->nbricks,
+                .nbrick_capacity = MAX(pckpt->nbricks, 1),
+                .pbricks         = malloc(sizeof(voxel_brick_t) * MAX(pckpt->nbricks, 1)),
+                .ntable          = pckpt->ntable,
+                .ptable          = malloc(sizeof(uint32_t) * pckpt->ntable)};
+        if (!pstore->pbricks || !pstore->ptable)
+        {
+                fprintf(stderr, "Cant allocate voxel store.\n");
+                abort();
+        }
+
+        memcpy(pstore->pbricks, pckpt->pbricks, sizeof(voxel_brick_t) * pckpt->nbricks);
+        memcpy(pstore->ptable, pckpt->ptable, sizeof(uint32_t) * pckpt->ntable);
+}
+
+/* the bodies must be gone, their streams are the mapping */
+void checkpoint_close(checkpoint_t *pckpt)
+{
+        if (pckpt->pmapping)
+        {
+                platform_unmap_file(pckpt->pmapping, pckpt->szmapping);
+        }
+        *pckpt = (checkpoint_t){};
+}
@@ -0,0 +1,1189 @@
+#pragma once
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "physics.h"
+#include "scheduler.h"
+
+/* items per hashing and contact task, cells per prefix sum block */
+#define COLLISION_TASK_ITEMS 4096
+#define COLLISION_SCAN_BLOCK 4096
+/* hash buckets per item, rounded up to a power of two */
+#define COLLISION_CELLS_PER_ITEM 2
+/* widest triangle the fine cells are sized for, over the median at rest */
+#define COLLISION_TRIANGLE_SLACK 2.0f
+/* must match COLLISION_COARSE_SALT in physics.comp */
+#define COLLISION_COARSE_SALT 2654435761u
+/* barycentric weight above rounding, past it a point is over the triangle */
+#define COLLISION_INSIDE_WEIGHT 1e-4f
+/* share of the way back a point must get to count as on its side again */
+#define COLLISION_RESOLVED 0.99f
+/* no other body touched the item this step */
+#define COLLISION_NO_BODY UINT32_MAX
+
+/*
+ * What the contacts of one point or triangle corner add up to. Contacts
+ * count by how much of them lands on the point, a corner share by its
+ * barycentric weight. Push, stop and back are the deepest of those asked
+ * by pinned bodies, see collision_contact_t.
+ */
+typedef struct
+{
+        vec3_t dx, dv, push, stop, back;
+        float weight;
+} collision_delta_t;
+
+/*
+ * Uniform spatial hash over the point masses and surface triangles of every
+ * body with a contact radius, rebuilt each step by a counting sort: count
+ * the items per bucket, prefix sum the counts into bucket starts and
+ * scatter the item ids, then sort each bucket so the order and with it the
+ * contacts do not depend on the workers. Points are hashed where they are
+ * and triangles at their centroid, both copied next to the sorted ids.
+ * Cells are the widest triangle plus two radii across, so the 27 cells
+ * around a point hold every point and every triangle centroid it can
+ * touch. Triangles count up to triangle_limit, twice the median at rest,
+ * wider ones such as a floor quad or a stretched sheet go into coarse
+ * cells as wide as the widest of them plus two radii, salted into the same
+ * buckets. Points in reach of the bounds of the wide triangles look
+ * through the 27 coarse cells as well, and a wide triangle walks the fine
+ * cells its bounds cover, or every point when those are more cells than
+ * there are buckets.
+ *
+ * Contacts are gathered, nothing is written but the item's own delta.
+ * Triangles resolve the points near them into a delta per corner, then
+ * each point resolves the points and triangles near it and adds up the
+ * corners it is. Points of one body never collide with each other, self
+ * contacts go through the surface and skip the triangles a point is a
+ * corner of, so the radius must stay under the spacing of the body's
+ * points. The GPU passes in physics.comp do the same.
+ *
+ * Bodies set in pasleep take part as if pinned, see physics_world_t. Each
+ * point and triangle keeps another body it touched for the world's
+ * islands.
+ */
+typedef struct
+{
+        uint32_t nbodies, npoints, ntriangles;
+        physics_body_t *pbodies;
+        scheduler_t *psched;
+
+        /* body b's point masses are global points pfirst_points[b] .. [b + 1] */
+        uint32_t *pfirst_points;
+        uint32_t *ppoint_bodies;
+        /*
+         * Three global points per triangle, corner i being ptriangles[i].
+         * The corners point g is are ppoint_corners[poffsets[g]] .. [g + 1].
+         */
+        uint32_t *ptriangles;
+        uint32_t *ppoint_corner_offsets, *ppoint_corners;
+
+        /* points, then npoints + triangle, of the colliding bodies */
+        uint32_t nitems, ncolliding_points;
+        uint32_t *pitems;
+
+        uint32_t ncells;
+        /* triangle_limit is fixed at init, the sizes follow the triangles */
+        float max_radius, triangle_limit, cell_size, coarse_size;
+        /* bounds of the triangles wider than triangle_limit, empty when none are */
+        vec3_t wide_lo, wide_hi;
+        uint32_t *pitem_cells;
+        vec3_t *pitem_positions;
+        /* items per bucket, then the scatter's cursors */
+        atomic_uint *pcounts;
+        /* items of bucket c are psorted[pcell_starts[c]] .. [c + 1] */
+        uint32_t *pcell_starts;
+        uint32_t *psorted;
+        vec3_t *psorted_positions;
+        uint32_t *pblock_sums;
+        /* centroid to farthest corner per triangle, the widest per task */
+        float *ptriangle_extents, *pextents;
+        /* per task, the bounds of its wide triangles */
+        vec3_t *pwide_bounds;
+
+        /* per global point and per corner, averaged over the contacts */
+        collision_delta_t *pdeltas, *pcorner_deltas;
+        /* where each point was after the last step, friction holds it there */
+        vec3_t *panchors;
+
+        /* per body, NULL when none sleeps */
+        const uint8_t *pasleep;
+        /* per global point and per triangle, or COLLISION_NO_BODY */
+        uint32_t *ppoint_touches, *ptriangle_touches;
+
+        float dt;
+} collision_t;
+
+/*
+ * The position and velocity change of a contact, per unit inverse mass.
+ * Against a pinned body the push apart and the stop of the approach are
+ * kept apart too, as the least the point gets however many other contacts
+ * it has, and back is the part of the push that brings a point pushed
+ * through to its side again.
+ */
+typedef struct
+{
+        vec3_t dx, dv, push, stop, back;
+} collision_contact_t;
+
+typedef struct
+{
+        int32_t x, y, z;
+} collision_cell_t;
+
+static inline vec3_t collision_sub(vec3_t a, vec3_t b)
+{
+        return (vec3_t){a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static inline vec3_t collision_mad(vec3_t a, vec3_t b, float s)
+{
+        return (vec3_t){a.x + b.x * s, a.y + b.y * s, a.z + b.z * s};
+}
+
+static inline vec3_t collision_min(vec3_t a, vec3_t b)
+{
+        return (vec3_t){fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)};
+}
+
+static inline vec3_t collision_max(vec3_t a, vec3_t b)
+{
+        return (vec3_t){fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)};
+}
+
+static inline float collision_dot(vec3_t a, vec3_t b)
+{
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline vec3_t collision_cross(vec3_t a, vec3_t b)
+{
+        return (vec3_t){
+                a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+static inline vec3_t collision_position(const collision_t *pcoll, uint32_t g)
+{
+        const physics_body_t *pbody = &pcoll->pbodies[pcoll->ppoint_bodies[g]];
+        uint32_t i                  = g - pcoll->pfirst_points[pcoll->ppoint_bodies[g]];
+
+        return (vec3_t){pbody->px[i], pbody->py[i], pbody->pz[i]};
+}
+
+static inline vec3_t collision_centroid(const collision_t *pcoll, uint32_t t)
+{
+        const uint32_t *pids = &pcoll->ptriangles[t * 3];
+        vec3_t a = collision_position(pcoll, pids[0]);
+        vec3_t b = collision_position(pcoll, pids[1]);
+        vec3_t c = collision_position(pcoll, pids[2]);
+
+        return (vec3_t){(a.x + b.x + c.x) / 3.0f,
+                        (a.y + b.y + c.y) / 3.0f,
+                        (a.z + b.z + c.z) / 3.0f};
+}
+
+/* centroid to farthest corner of triangle t */
+static float collision_extent(const collision_t *pcoll, uint32_t t)
+{
+        vec3_t c     = collision_centroid(pcoll, t);
+        float radius = 0.0f;
+        for (uint32_t k = 0; k < 3; k++)
+        {
+                uint32_t g = pcoll->ptriangles[t * 3 + k];
+                vec3_t d   = collision_sub(collision_position(pcoll, g), c);
+                radius     = fmaxf(radius, collision_dot(d, d));
+        }
+
+        return sqrtf(radius);
+}
+
+static int collision_cmp_float(const void *pa, const void *pb)
+{
+        float a = *(const float *) pa, b = *(const float *) pb;
+        return (a > b) - (a < b);
+}
+
+/* the triangle_limit of n triangle extents at rest, which it sorts */
+float collision_triangle_limit(float *pextents, uint32_t n)
+{
+        qsort(pextents, n, sizeof(float), collision_cmp_float);
+        return n ? COLLISION_TRIANGLE_SLACK * pextents[n / 2] : 0.0f;
+}
+
+static void *collision_alloc(size_t sz)
+{
+        void *p = malloc(sz ? sz : 1);
+        if (!p)
+        {
+                fprintf(stderr, "Cant allocate collision state.\n");
+                abort();
+        }
+
+        return p;
+}
+
+void collision_init(
+        collision_t *pcoll,
+        scheduler_t *psched,
+        physics_body_t *pbodies,
+        uint32_t nbodies)
+{
+        *pcoll = (collision_t){
+                .nbodies       = nbodies,
+                .pbodies       = pbodies,
+                .psched        = psched,
+                .pfirst_points = collision_alloc(sizeof(uint32_t) * (nbodies + 1))};
+
+        pcoll->pfirst_points[0] = 0;
+        for (uint32_t i = 0; i < nbodies; i++)
+        {
+                physics_body_t *pbody = &pbodies[i];
+
+                pcoll->pfirst_points[i + 1] = pcoll->npoints + pbody->npoint_masses;
+                pcoll->npoints += pbody->npoint_masses;
+                if (pbody->radius > 0.0f)
+                {
+                        pcoll->ntriangles += pbody->ntriangles;
+                        pcoll->ncolliding_points += pbody->npoint_masses;
+                        pcoll->max_radius = fmaxf(pcoll->max_radius, pbody->radius);
+                }
+        }
+
+        uint32_t npoints = pcoll->npoints, ntriangles = pcoll->ntriangles;
+
+        pcoll->nitems = pcoll->ncolliding_points + ntriangles;
+        pcoll->ncells = 1;
+        while (pcoll->ncells < pcoll->nitems * COLLISION_CELLS_PER_ITEM)
+        {
+                pcoll->ncells <<= 1;
+        }
+
+        uint32_t nitems  = pcoll->nitems;
+        uint32_t ncells  = pcoll->ncells;
+        uint32_t ntasks  = DIV_UP(ntriangles, COLLISION_TASK_ITEMS);
+        uint32_t nblocks = DIV_UP(ncells, COLLISION_SCAN_BLOCK);
+
+        pcoll->ppoint_bodies     = collision_alloc(sizeof(uint32_t) * npoints);
+        pcoll->ptriangles        = collision_alloc(sizeof(uint32_t) * 3 * ntriangles);
+        pcoll->ppoint_corner_offsets = collision_alloc(sizeof(uint32_t) * (npoints + 1));
+        pcoll->ppoint_corners    = collision_alloc(sizeof(uint32_t) * 3 * ntriangles);
+        pcoll->pitems            = collision_alloc(sizeof(uint32_t) * nitems);
+        pcoll->pitem_cells       = collision_alloc(sizeof(uint32_t) * nitems);
+        pcoll->pitem_positions   = collision_alloc(sizeof(vec3_t) * nitems);
+        pcoll->pcounts           = collision_alloc(sizeof(atomic_uint) * ncells);
+        pcoll->pcell_starts      = collision_alloc(sizeof(uint32_t) * (ncells + 1));
+        pcoll->psorted           = collision_alloc(sizeof(uint32_t) * nitems);
+        pcoll->psorted_positions = collision_alloc(sizeof(vec3_t) * nitems);
+        pcoll->pblock_sums       = collision_alloc(sizeof(uint32_t) * nblocks);
+        pcoll->ptriangle_extents = collision_alloc(sizeof(float) * ntriangles);
+        pcoll->pextents          = collision_alloc(sizeof(float) * ntasks);
+        pcoll->pwide_bounds      = collision_alloc(sizeof(vec3_t) * 2 * ntasks);
+        pcoll->pdeltas           = collision_alloc(sizeof(collision_delta_t) * npoints);
+        pcoll->panchors          = collision_alloc(sizeof(vec3_t) * npoints);
+        pcoll->ppoint_touches    = collision_alloc(sizeof(uint32_t) * npoints);
+        pcoll->ptriangle_touches = collision_alloc(sizeof(uint32_t) * ntriangles);
+        pcoll->pcorner_deltas =
+                collision_alloc(sizeof(collision_delta_t) * 3 * ntriangles);
+
+        uint32_t *poffsets = pcoll->ppoint_corner_offsets;
+        uint32_t nitem = 0, ncorner = 0;
+        memset(poffsets, 0, sizeof(uint32_t) * (npoints + 1));
+        for (uint32_t i = 0; i < nbodies; i++)
+        {
+                physics_body_t *pbody = &pbodies[i];
+                uint32_t first        = pcoll->pfirst_points[i];
+
+                for (uint32_t j = 0; j < pbody->npoint_masses; j++)
+                {
+                        pcoll->ppoint_bodies[first + j] = i;
+                        pcoll->panchors[first + j] =
+                                (vec3_t){pbody->px[j], pbody->py[j], pbody->pz[j]};
+                        if (pbody->radius > 0.0f)
+                        {
+                                pcoll->pitems[nitem++] = first + j;
+                        }
+                }
+
+                uint32_t ncorners = pbody->radius > 0.0f ? pbody->ntriangles * 3 : 0;
+                for (uint32_t j = 0; j < ncorners; j++)
+                {
+                        uint32_t g = first + pbody->ptriangles[j];
+
+                        pcoll->ptriangles[ncorner++] = g;
+                        poffsets[g + 1]++;
+                }
+        }
+        for (uint32_t i = 0; i < ntriangles; i++)
+        {
+                pcoll->pitems[nitem++] = npoints + i;
+        }
+
+        /* counts to starts, then fill using the starts as cursors and shift back */
+        for (uint32_t i = 0; i < npoints; i++)
+        {
+                poffsets[i + 1] += poffsets[i];
+        }
+        for (uint32_t i = 0; i < ntriangles * 3; i++)
+        {
+                pcoll->ppoint_corners[poffsets[pcoll->ptriangles[i]]++] = i;
+        }
+        for (uint32_t i = npoints; i > 0; i--)
+        {
+                poffsets[i] = poffsets[i - 1];
+        }
+        poffsets[0] = 0;
+
+        /* the extents are scratch until the first step measures them again */
+        for (uint32_t i = 0; i < ntriangles; i++)
+        {
+                pcoll->ptriangle_extents[i] = collision_extent(pcoll, i);
+        }
+        pcoll->triangle_limit =
+                collision_triangle_limit(pcoll->ptriangle_extents, ntriangles);
+}
+
+void collision_free(collision_t *pcoll)
+{
+        free(pcoll->pfirst_points);
+        free(pcoll->ppoint_bodies);
+        free(pcoll->ptriangles);
+        free(pcoll->ppoint_corner_offsets);
+        free(pcoll->ppoint_corners);
+        free(pcoll->pitems);
+        free(pcoll->pitem_cells);
+        free(pcoll->pitem_positions);
+        free(pcoll->pcounts);
+        free(pcoll->pcell_starts);
+        free(pcoll->psorted);
+        free(pcoll->psorted_positions);
+        free(pcoll->pblock_sums);
+        free(pcoll->ptriangle_extents);
+        free(pcoll->pextents);
+        free(pcoll->pwide_bounds);
+        free(pcoll->pdeltas);
+        free(pcoll->pcorner_deltas);
+        free(pcoll->panchors);
+        free(pcoll->ppoint_touches);
+        free(pcoll->ptriangle_touches);
+        *pcoll = (collision_t){};
+}
+
+static inline collision_cell_t collision_cell(vec3_t p, float size)
+{
+        return (collision_cell_t){(int32_t) floorf(p.x / size),
+                                  (int32_t) floorf(p.y / size),
+                                  (int32_t) floorf(p.z / size)};
+}
+
+/* cell i of the 27 around c */
+static inline collision_cell_t collision_neighbor(collision_cell_t c, uint32_t i)
+{
+        return (collision_cell_t){c.x + (int32_t) (i % 3) - 1,
+                                  c.y + (int32_t) (i / 3 % 3) - 1,
+                                  c.z + (int32_t) (i / 9) - 1};
+}
+
+/*
+ * Neighbouring cells may share a bucket, so items are taken only from the
+ * cell being visited, which also drops strangers hashed in from afar.
+ */
+static inline bool collision_in_cell(vec3_t p, collision_cell_t c, float size)
+{
+        collision_cell_t d = collision_cell(p, size);
+        return d.x == c.x && d.y == c.y && d.z == c.z;
+}
+
+/* must match cell_hash in physics.comp, level 1 for the coarse cells */
+static inline uint32_t collision_hash(
+        const collision_t *pcoll, collision_cell_t c, uint32_t level)
+{
+        uint32_t h = (uint32_t) c.x * 73856093u ^ (uint32_t) c.y * 19349663u ^
+                     (uint32_t) c.z * 83492791u ^ level * COLLISION_COARSE_SALT;
+        return h & (pcoll->ncells - 1);
+}
+
+/* whether triangle t is hashed into the coarse cells this step */
+static inline bool collision_wide(const collision_t *pcoll, uint32_t t)
+{
+        return pcoll->ptriangle_extents[t] > pcoll->triangle_limit;
+}
+
+/* whether p can be in reach of triangle t centred at c, before the exact test */
+static inline bool collision_near(
+        const collision_t *pcoll, vec3_t p, vec3_t c, uint32_t t)
+{
+        float reach = pcoll->ptriangle_extents[t] + 2.0f * pcoll->max_radius;
+        vec3_t d    = collision_sub(p, c);
+
+        return collision_dot(d, d) < reach * reach;
+}
+
+/* barycentric weights of the point of triangle abc closest to p (Ericson 5.1.5) */
+static void collision_closest(vec3_t p, vec3_t a, vec3_t b, vec3_t c, float pw[3])
+{
+        vec3_t ab = collision_sub(b, a), ac = collision_sub(c, a);
+        vec3_t ap = collision_sub(p, a), bp = collision_sub(p, b);
+        vec3_t cp = collision_sub(p, c);
+
+        float d1 = collision_dot(ab, ap), d2 = collision_dot(ac, ap);
+        float d3 = collision_dot(ab, bp), d4 = collision_dot(ac, bp);
+        float d5 = collision_dot(ab, cp), d6 = collision_dot(ac, cp);
+        float va = d3 * d6 - d5 * d4;
+        float vb = d5 * d2 - d1 * d6;
+        float vc = d1 * d4 - d3 * d2;
+
+        float v = 0.0f, w = 0.0f;
+        if (d1 <= 0.0f && d2 <= 0.0f)
+        {
+        }
+        else if (d3 >= 0.0f && d4 <= d3)
+        {
+                v = 1.0f;
+        }
+        else if (d6 >= 0.0f && d5 <= d6)
+        {
+                w = 1.0f;
+        }
+        else if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        {
+                v = d1 / (d1 - d3);
+        }
+        else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        {
+                w = d2 / (d2 - d6);
+        }
+        else if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+        {
+                w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+                v = 1.0f - w;
+        }
+        else
+        {
+                float denom = 1.0f / (va + vb + vc);
+                v           = vb * denom;
+                w           = vc * denom;
+        }
+
+        pw[0] = 1.0f - v - w;
+        pw[1] = v;
+        pw[2] = w;
+}
+
+/* point i of body, sleeping bodies weigh nothing like pinned points */
+static inline float collision_weight(const collision_t *pcoll, uint32_t body, uint32_t i)
+{
+        if (pcoll->pasleep && pcoll->pasleep[body])
+        {
+                return 0.0f;
+        }
+        return pcoll->pbodies[body].pinv_mass[i];
+}
+
+/*
+ * Contact of point a with the point sum pw[k] x_k of the n points in pids,
+ * one point mass or a spot on a triangle, false when they are apart. The
+ * push apart is a position projection, the velocity change takes away the
+ * approach and as much sliding as Coulomb friction allows. Sliding since
+ * the last step is taken back the same way, velocity friction alone lets a
+ * pile creep apart under the projections. Point a moves by w_a dx and w_a dv,
+ * point k of the other side by -w_k pw[k] of the same.
+ */
+static bool collision_contact(
+        const collision_t *pcoll,
+        uint32_t a,
+        const uint32_t *pids,
+        const float *pw,
+        uint32_t n,
+        collision_contact_t *pcontact)
+{
+        uint32_t body_a          = pcoll->ppoint_bodies[a];
+        uint32_t body_b          = pcoll->ppoint_bodies[pids[0]];
+        const physics_body_t *pa = &pcoll->pbodies[body_a];
+        const physics_body_t *pb = &pcoll->pbodies[body_b];
+        uint32_t ia              = a - pcoll->pfirst_points[body_a];
+        uint32_t first           = pcoll->pfirst_points[body_b];
+
+        float wa = collision_weight(pcoll, body_a, ia), wb = 0.0f;
+        vec3_t xa = {pa->px[ia], pa->py[ia], pa->pz[ia]};
+        vec3_t xb = {}, vb = {}, slip_b = {};
+        bool inside = n == 3;
+        for (uint32_t k = 0; k < n; k++)
+        {
+                uint32_t i = pids[k] - first;
+                vec3_t x   = {pb->px[i], pb->py[i], pb->pz[i]};
+                vec3_t v   = {pb->pvx[i], pb->pvy[i], pb->pvz[i]};
+
+                vec3_t slip = collision_sub(x, pcoll->panchors[pids[k]]);
+
+                xb     = collision_mad(xb, x, pw[k]);
+                vb     = collision_mad(vb, v, pw[k]);
+                slip_b = collision_mad(slip_b, slip, pw[k]);
+                wb += pw[k] * pw[k] * collision_weight(pcoll, body_b, i);
+                inside = inside && pw[k] > COLLISION_INSIDE_WEIGHT;
+        }
+
+        vec3_t d        = collision_sub(xa, xb);
+        float thickness = pa->radius + pb->radius;
+        float w         = wa + wb;
+        if (w <= 0.0f)
+        {
+                return false;
+        }
+
+        /*
+         * A point belongs on the side of a triangle it was on at its anchor.
+         * Over the inside the contact is along the triangle's normal, a point
+         * pushed through is pushed back. Past an edge or corner it is along
+         * the line between the two, from a point past the triangle's plane
+         * mirrored back to its side. Two points touch along their line.
+         */
+        vec3_t normal = d;
+        if (n == 3)
+        {
+                vec3_t x0   = collision_position(pcoll, pids[0]);
+                vec3_t e1   = collision_sub(collision_position(pcoll, pids[1]), x0);
+                vec3_t e2   = collision_sub(collision_position(pcoll, pids[2]), x0);
+                vec3_t face = collision_cross(e1, e2);
+                vec3_t side = collision_sub(pcoll->panchors[a], xb);
+                side        = collision_mad(side, slip_b, 1.0f);
+                if (collision_dot(side, face) < 0.0f)
+                {
+                        face = collision_mad((vec3_t){}, face, -1.0f);
+                }
+
+                float past = collision_dot(d, face);
+                if (inside)
+                {
+                        normal = face;
+                }
+                else if (past < 0.0f)
+                {
+                        float mirror = -2.0f * past / collision_dot(face, face);
+                        d            = collision_mad(d, face, mirror);
+                        normal       = d;
+                }
+        }
+        float len = sqrtf(collision_dot(normal, normal));
+        if (len <= PHYSICS_EPSILON)
+        {
+                return false;
+        }
+
+        vec3_t nrm  = {normal.x / len, normal.y / len, normal.z / len};
+        float depth = thickness - collision_dot(d, nrm);
+        if (depth <= 0.0f)
+        {
+                return false;
+        }
+
+        vec3_t va    = {pa->pvx[ia], pa->pvy[ia], pa->pvz[ia]};
+        vec3_t vrel  = collision_sub(va, vb);
+        float vn     = collision_dot(vrel, nrm);
+        vec3_t vt    = collision_mad(vrel, nrm, -vn);
+        float vt_len = sqrtf(collision_dot(vt, vt));
+
+        /* friction is bounded by the normal impulse, the projection's included */
+        float mu = 0.5f * (pa->friction + pb->friction);
+        float s  = depth / w;
+        float jn = fmaxf(-vn, 0.0f) / w;
+        float jt = 0.0f;
+        if (vt_len > PHYSICS_EPSILON)
+        {
+                jt = fminf(vt_len / w, mu * (jn + s / pcoll->dt)) / vt_len;
+        }
+
+        /* and the slip back toward the anchors by the depth */
+        vec3_t slip    = collision_sub(collision_sub(xa, pcoll->panchors[a]), slip_b);
+        vec3_t st      = collision_mad(slip, nrm, -collision_dot(slip, nrm));
+        float st_len   = sqrtf(collision_dot(st, st));
+        float st_scale = 0.0f;
+        if (st_len > PHYSICS_EPSILON)
+        {
+                st_scale = fminf(st_len, mu * depth) / (st_len * w);
+        }
+
+        pcontact->dx = collision_mad((vec3_t){}, nrm, s);
+        pcontact->dx = collision_mad(pcontact->dx, st, -st_scale);
+        pcontact->dv = collision_mad((vec3_t){}, nrm, jn);
+        pcontact->dv = collision_mad(pcontact->dv, vt, -jt);
+
+        /* one side pinned, the other takes all of it */
+        bool pinned    = wa == 0.0f || wb == 0.0f;
+        float back     = fmaxf(depth - thickness, 0.0f) / w;
+        pcontact->push = collision_mad((vec3_t){}, nrm, pinned ? s : 0.0f);
+        pcontact->stop = collision_mad((vec3_t){}, nrm, pinned ? jn : 0.0f);
+        pcontact->back = collision_mad((vec3_t){}, nrm, pinned ? back : 0.0f);
+        return true;
+}
+
+static inline float collision_inv_mass(const collision_t *pcoll, uint32_t g)
+{
+        uint32_t body = pcoll->ppoint_bodies[g];
+        return collision_weight(pcoll, body, g - pcoll->pfirst_points[body]);
+}
+
+static inline void collision_deepest(vec3_t *pa, vec3_t b)
+{
+        if (collision_dot(b, b) > collision_dot(*pa, *pa))
+        {
+                *pa = b;
+        }
+}
+
+static inline void collision_hold(
+        collision_delta_t *pdelta, vec3_t push, vec3_t stop, vec3_t back)
+{
+        collision_deepest(&pdelta->push, push);
+        collision_deepest(&pdelta->stop, stop);
+        collision_deepest(&pdelta->back, back);
+}
+
+/* w scales the contact onto the point, weight is how much of it lands there */
+static inline void collision_add(
+        collision_delta_t *pdelta,
+        const collision_contact_t *pcontact,
+        float w,
+        float weight)
+{
+        pdelta->dx = collision_mad(pdelta->dx, pcontact->dx, w);
+        pdelta->dv = collision_mad(pdelta->dv, pcontact->dv, w);
+        pdelta->weight += weight;
+        collision_hold(pdelta,
+                       collision_mad((vec3_t){}, pcontact->push, w),
+                       collision_mad((vec3_t){}, pcontact->stop, w),
+                       collision_mad((vec3_t){}, pcontact->back, w));
+}
+
+/* x with at least all of h along h */
+static inline vec3_t collision_at_least(vec3_t x, vec3_t h)
+{
+        float hh      = collision_dot(h, h);
+        float missing = hh - collision_dot(x, h);
+        return missing > 0.0f ? collision_mad(x, h, missing / hh) : x;
+}
+
+/* the items and points of task idx */
+static inline void collision_task_range(
+        uint32_t idx, uint32_t n, uint32_t size, uint32_t *pfirst, uint32_t *plast)
+{
+        *pfirst = idx * size;
+        *plast  = MIN(*pfirst + size, n);
+}
+
+static void collision_bounds_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        collision_t *pcoll = pctx;
+        uint32_t first, last;
+        float extent = 0.0f;
+        vec3_t lo = {INFINITY, INFINITY, INFINITY};
+        vec3_t hi = {-INFINITY, -INFINITY, -INFINITY};
+
+        collision_task_range(idx, pcoll->ntriangles, COLLISION_TASK_ITEMS, &first, &last);
+        for (uint32_t i = first; i < last; i++)
+        {
+                pcoll->ptriangle_extents[i] = collision_extent(pcoll, i);
+                extent                      = fmaxf(extent, pcoll->ptriangle_extents[i]);
+                for (uint32_t k = 0; k < 3 && collision_wide(pcoll, i); k++)
+                {
+                        uint32_t g = pcoll->ptriangles[i * 3 + k];
+                        vec3_t p   = collision_position(pcoll, g);
+                        lo         = collision_min(lo, p);
+                        hi         = collision_max(hi, p);
+                }
+        }
+
+        pcoll->pextents[idx]             = extent;
+        pcoll->pwide_bounds[idx * 2]     = lo;
+        pcoll->pwide_bounds[idx * 2 + 1] = hi;
+}
+
+static void collision_count_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        collision_t *pcoll = pctx;
+        uint32_t first, last;
+
+        collision_task_range(idx, pcoll->nitems, COLLISION_TASK_ITEMS, &first, &last);
+        for (uint32_t i = first; i < last; i++)
+        {
+                uint32_t item    = pcoll->pitems[i];
+                uint32_t npoints = pcoll->npoints;
+                vec3_t p         = item < npoints
+                                           ? collision_position(pcoll, item)
+                                           : collision_centroid(pcoll, item - npoints);
+
+                uint32_t level = item >= npoints && collision_wide(pcoll, item - npoints);
+                float size     = level ? pcoll->coarse_size : pcoll->cell_size;
+                uint32_t h     = collision_hash(pcoll, collision_cell(p, size), level);
+
+                pcoll->pitem_cells[i]     = h;
+                pcoll->pitem_positions[i] = p;
+                atomic_fetch_add_explicit(&pcoll->pcounts[h], 1, memory_order_relaxed);
+        }
+}
+
+static void collision_sum_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        collision_t *pcoll = pctx;
+        uint32_t first, last, sum = 0;
+
+        collision_task_range(idx, pcoll->ncells, COLLISION_SCAN_BLOCK, &first, &last);
+        for (uint32_t i = first; i < last; i++)
+        {
+                sum += atomic_load_explicit(&pcoll->pcounts[i], memory_order_relaxed);
+        }
+
+        pcoll->pblock_sums[idx] = sum;
+}
+
+/* block sums are exclusive by now, counts turn into starts and cursors */
+static void collision_scan_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        collision_t *pcoll = pctx;
+        uint32_t first, last, start = pcoll->pblock_sums[idx];
+
+        collision_task_range(idx, pcoll->ncells, COLLISION_SCAN_BLOCK, &first, &last);
+        for (uint32_t i = first; i < last; i++)
+        {
+                uint32_t n =
+                        atomic_load_explicit(&pcoll->pcounts[i], memory_order_relaxed);
+
+                pcoll->pcell_starts[i] = start;
+                atomic_store_explicit(&pcoll->pcounts[i], start, memory_order_relaxed);
+                start += n;
+        }
+}
+
+static void collision_scatter_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        collision_t *pcoll = pctx;
+        uint32_t first, last;
+
+        collision_task_range(idx, pcoll->nitems, COLLISION_TASK_ITEMS, &first, &last);
+        for (uint32_t i = first; i < last; i++)
+        {
+                uint32_t slot = atomic_fetch_add_explicit(
+                        &pcoll->pcounts[pcoll->pitem_cells[i]], 1, memory_order_relaxed);
+
+                pcoll->psorted[slot]           = pcoll->pitems[i];
+                pcoll->psorted_positions[slot] = pcoll->pitem_positions[i];
+        }
+}
+
+/* buckets hold a handful of items, insertion sort undoes the scatter's races */
+static void collision_order_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        collision_t *pcoll = pctx;
+        uint32_t first, last;
+
+        collision_task_range(idx, pcoll->ncells, COLLISION_SCAN_BLOCK, &first, &last);
+        for (uint32_t c = first; c < last; c++)
+        {
+                uint32_t *psorted    = pcoll->psorted;
+                vec3_t *ppositions   = pcoll->psorted_positions;
+                uint32_t start       = pcoll->pcell_starts[c];
+                for (uint32_t i = start + 1; i < pcoll->pcell_starts[c + 1]; i++)
+                {
+                        uint32_t item = psorted[i], j = i;
+                        vec3_t p      = ppositions[i];
+                        for (; j > start && psorted[j - 1] > item; j--)
+                        {
+                                psorted[j]    = psorted[j - 1];
+                                ppositions[j] = ppositions[j - 1];
+                        }
+                        psorted[j]    = item;
+                        ppositions[j] = p;
+                }
+        }
+}
+
+/* a triangle as its gather sees it */
+typedef struct
+{
+        uint32_t t;
+        vec3_t centroid;
+        vec3_t pcorners[3];
+        float pw_corners[3];
+} collision_triangle_t;
+
+/* point item at x near the triangle, pushing the corners by their share */
+static inline void collision_touch_triangle(
+        collision_t *pcoll, const collision_triangle_t *ptri, uint32_t item, vec3_t x)
+{
+        const uint32_t *pids       = &pcoll->ptriangles[ptri->t * 3];
+        collision_delta_t *pdeltas = &pcoll->pcorner_deltas[ptri->t * 3];
+        const vec3_t *pcorners     = ptri->pcorners;
+        float pw[3];
+        collision_contact_t contact;
+
+        if (item == pids[0] || item == pids[1] || item == pids[2])
+        {
+                return;
+        }
+
+        collision_closest(x, pcorners[0], pcorners[1], pcorners[2], pw);
+        if (!collision_contact(pcoll, item, pids, pw, 3, &contact))
+        {
+                return;
+        }
+
+        for (uint32_t k = 0; k < 3; k++)
+        {
+                float share = -ptri->pw_corners[k] * pw[k];
+                collision_add(&pdeltas[k], &contact, share, pw[k]);
+        }
+        if (pcoll->ppoint_bodies[item] != pcoll->ppoint_bodies[pids[0]])
+        {
+                pcoll->ptriangle_touches[ptri->t] = pcoll->ppoint_bodies[item];
+        }
+}
+
+/* the points of a fine cell, buckets are sorted so they come first */
+static inline void collision_touch_cell(
+        collision_t *pcoll, const collision_triangle_t *ptri, collision_cell_t cell)
+{
+        uint32_t h = collision_hash(pcoll, cell, 0);
+        for (uint32_t j = pcoll->pcell_starts[h];
+             j < pcoll->pcell_starts[h + 1] && pcoll->psorted[j] < pcoll->npoints;
+             j++)
+        {
+                vec3_t x = pcoll->psorted_positions[j];
+                if (collision_near(pcoll, x, ptri->centroid, ptri->t) &&
+                    collision_in_cell(x, cell, pcoll->cell_size))
+                {
+                        collision_touch_triangle(pcoll, ptri, pcoll->psorted[j], x);
+                }
+        }
+}
+
+/*
+ * The points near triangle t, from the 27 fine cells around its centroid.
+ * A wide one walks the fine cells its bounds cover instead, or every point
+ * when those cells outnumber the buckets.
+ */
+static void collision_gather_triangle(collision_t *pcoll, uint32_t t)
+{
+        const uint32_t *pids       = &pcoll->ptriangles[t * 3];
+        collision_delta_t *pdeltas = &pcoll->pcorner_deltas[t * 3];
+        collision_triangle_t tri   = {.t = t, .centroid = collision_centroid(pcoll, t)};
+
+        pcoll->ptriangle_touches[t] = COLLISION_NO_BODY;
+        for (uint32_t k = 0; k < 3; k++)
+        {
+                pdeltas[k]        = (collision_delta_t){};
+                tri.pw_corners[k] = collision_inv_mass(pcoll, pids[k]);
+                tri.pcorners[k]   = collision_position(pcoll, pids[k]);
+        }
+        if (tri.pw_corners[0] == 0.0f && tri.pw_corners[1] == 0.0f &&
+            tri.pw_corners[2] == 0.0f)
+        {
+                return;
+        }
+
+        if (!collision_wide(pcoll, t))
+        {
+                collision_cell_t center = collision_cell(tri.centroid, pcoll->cell_size);
+                for (uint32_t i = 0; i < 27; i++)
+                {
+                        collision_touch_cell(pcoll, &tri, collision_neighbor(center, i));
+                }
+                return;
+        }
+
+        /* contacts are at most two radii off the triangle */
+        vec3_t reach = {2.0f * pcoll->max_radius, 2.0f * pcoll->max_radius,
+                        2.0f * pcoll->max_radius};
+        vec3_t lo    = collision_min(tri.pcorners[0], tri.pcorners[1]);
+        vec3_t hi    = collision_max(tri.pcorners[0], tri.pcorners[1]);
+        lo           = collision_sub(collision_min(lo, tri.pcorners[2]), reach);
+        hi           = collision_mad(collision_max(hi, tri.pcorners[2]), reach, 1.0f);
+
+        collision_cell_t first = collision_cell(lo, pcoll->cell_size);
+        collision_cell_t last  = collision_cell(hi, pcoll->cell_size);
+        double ncovered        = ((double) last.x - first.x + 1.0) *
+                          ((double) last.y - first.y + 1.0) *
+                          ((double) last.z - first.z + 1.0);
+        if (ncovered > pcoll->ncells)
+        {
+                for (uint32_t j = 0; j < pcoll->nitems; j++)
+                {
+                        uint32_t item = pcoll->psorted[j];
+                        vec3_t x      = pcoll->psorted_positions[j];
+                        if (item < pcoll->npoints &&
+                            collision_near(pcoll, x, tri.centroid, t))
+                        {
+                                collision_touch_triangle(pcoll, &tri, item, x);
+                        }
+                }
+                return;
+        }
+
+        collision_cell_t cell;
+        for (cell.z = first.z; cell.z <= last.z; cell.z++)
+        {
+                for (cell.y = first.y; cell.y <= last.y; cell.y++)
+                {
+                        for (cell.x = first.x; cell.x <= last.x; cell.x++)
+                        {
+                                collision_touch_cell(pcoll, &tri, cell);
+                        }
+                }
+        }
+}
+
+/*
+ * Contact of point g at p with sorted item j, visited in a cell of level,
+ * false when they are apart or the item is not hashed into that cell.
+ */
+static inline bool collision_point_contact(
+        const collision_t *pcoll,
+        uint32_t g,
+        vec3_t p,
+        uint32_t level,
+        collision_cell_t cell,
+        uint32_t j,
+        uint32_t *pother,
+        collision_contact_t *pcontact)
+{
+        uint32_t item = pcoll->psorted[j];
+        vec3_t x      = pcoll->psorted_positions[j];
+        float size    = level ? pcoll->coarse_size : pcoll->cell_size;
+        float reach   = 2.0f * pcoll->max_radius;
+
+        if (item < pcoll->npoints)
+        {
+                vec3_t d    = collision_sub(p, x);
+                float pw[1] = {1.0f};
+                *pother     = pcoll->ppoint_bodies[item];
+                return !level && collision_dot(d, d) < reach * reach &&
+                       *pother != pcoll->ppoint_bodies[g] &&
+                       collision_in_cell(x, cell, size) &&
+                       collision_contact(pcoll, g, &item, pw, 1, pcontact);
+        }
+
+        uint32_t t           = item - pcoll->npoints;
+        const uint32_t *pids = &pcoll->ptriangles[t * 3];
+        float pw[3];
+        *pother = pcoll->ppoint_bodies[pids[0]];
+        if (collision_wide(pcoll, t) != level || pids[0] == g || pids[1] == g ||
+            pids[2] == g || !collision_near(pcoll, p, x, t) ||
+            !collision_in_cell(x, cell, size))
+        {
+                return false;
+        }
+
+        collision_closest(p,
+                          collision_position(pcoll, pids[0]),
+                          collision_position(pcoll, pids[1]),
+                          collision_position(pcoll, pids[2]),
+                          pw);
+        return collision_contact(pcoll, g, pids, pw, 3, pcontact);
+}
+
+/* the points and triangles near point g, then the corners g is */
+static void collision_gather_point(collision_t *pcoll, uint32_t g)
+{
+        collision_delta_t *pdelta = &pcoll->pdeltas[g];
+        uint32_t body             = pcoll->ppoint_bodies[g];
+        float wg                  = collision_inv_mass(pcoll, g);
+        vec3_t p                  = collision_position(pcoll, g);
+
+        /* pinned points stay put whatever touches them */
+        *pdelta                  = (collision_delta_t){};
+        pcoll->ppoint_touches[g] = COLLISION_NO_BODY;
+        if (wg == 0.0f)
+        {
+                return;
+        }
+
+        /* the fine cells, then the coarse ones when a wide triangle may be in reach */
+        vec3_t lo = pcoll->wide_lo, hi = pcoll->wide_hi;
+        bool coarse = p.x >= lo.x && p.y >= lo.y && p.z >= lo.z && p.x <= hi.x &&
+                      p.y <= hi.y && p.z <= hi.z;
+        for (uint32_t level = 0; level < 1u + coarse; level++)
+        {
+                float size              = level ? pcoll->coarse_size : pcoll->cell_size;
+                collision_cell_t center = collision_cell(p, size);
+                for (uint32_t i = 0; i < 27; i++)
+                {
+                        collision_cell_t cell = collision_neighbor(center, i);
+                        uint32_t h            = collision_hash(pcoll, cell, level);
+
+                        for (uint32_t j = pcoll->pcell_starts[h];
+                             j < pcoll->pcell_starts[h + 1];
+                             j++)
+                        {
+                                uint32_t other;
+                                collision_contact_t contact;
+                                if (!collision_point_contact(pcoll,
+                                                             g,
+                                                             p,
+                                                             level,
+                                                             cell,
+                                                             j,
+                                                             &other,
+                                                             &contact))
+                                {
+                                        continue;
+                                }
+
+                                collision_add(pdelta, &contact, wg, 1.0f);
+                                if (other != body)
+                                {
+                                        pcoll->ppoint_touches[g] = other;
+                                }
+                        }
+                }
+        }
+
+        for (uint32_t i = pcoll->ppoint_corner_offsets[g];
+             i < pcoll->ppoint_corner_offsets[g + 1];
+             i++)
+        {
+                const collision_delta_t *pcorner =
+                        &pcoll->pcorner_deltas[pcoll->ppoint_corners[i]];
+
+                pdelta->dx = collision_mad(pdelta->dx, pcorner->dx, 1.0f);
+                pdelta->dv = collision_mad(pdelta->dv, pcorner->dv, 1.0f);
+                pdelta->weight += pcorner->weight;
+                collision_hold(pdelta, pcorner->push, pcorner->stop, pcorner->back);
+        }
+}
+
+static void collision_triangles_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        collision_t *pcoll = pctx;
+        uint32_t first, last;
+
+        collision_task_range(idx, pcoll->ntriangles, COLLISION_TASK_ITEMS, &first, &last);
+        for (uint32_t i = first; i < last; i++)
+        {
+                collision_gather_triangle(pcoll, i);
+        }
+}
+
+static void collision_points_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        collision_t *pcoll = pctx;
+        uint32_t first, last;
+
+        collision_task_range(
+                idx, pcoll->ncolliding_points, COLLISION_TASK_ITEMS, &first, &last);
+        for (uint32_t i = first; i < last; i++)
+        {
+                collision_gather_point(pcoll, pcoll->pitems[i]);
+        }
+}
+
+/*
+ * Each point takes the mean of its contacts' corrections as Jacobi xpbd
+ * does, weighed by how much of each lands on it. Shares that add up to
+ * less than one whole contact are not scaled up. A pinned body's push and
+ * stop are not averaged away, a floor holds up whatever rests on it. A
+ * point still past a pinned body keeps its anchor, and with it the side
+ * it came from.
+ */
+static void collision_apply_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        collision_t *pcoll = pctx;
+        uint32_t first, last;
+
+        collision_task_range(
+                idx, pcoll->ncolliding_points, COLLISION_TASK_ITEMS, &first, &last);
+        for (uint32_t i = first; i < last; i++)
+        {
+                uint32_t g                      = pcoll->pitems[i];
+                const collision_delta_t *pdelta = &pcoll->pdeltas[g];
+                uint32_t body                   = pcoll->ppoint_bodies[g];
+                physics_body_t *pbody           = &pcoll->pbodies[body];
+                uint32_t j                      = g - pcoll->pfirst_points[body];
+
+                float s   = 1.0f / fmaxf(pdelta->weight, 1.0f);
+                vec3_t dx = collision_mad((vec3_t){}, pdelta->dx, s);
+                vec3_t dv = collision_mad((vec3_t){}, pdelta->dv, s);
+                dx        = collision_at_least(dx, pdelta->push);
+                dv        = collision_at_least(dv, pdelta->stop);
+
+                pbody->px[j] += dx.x;
+                pbody->py[j] += dx.y;
+                pbody->pz[j] += dx.z;
+                pbody->pvx[j] += dv.x;
+                pbody->pvy[j] += dv.y;
+                pbody->pvz[j] += dv.z;
+
+                float way = collision_dot(pdelta->back, pdelta->back);
+                if (collision_dot(dx, pdelta->back) >= COLLISION_RESOLVED * way)
+                {
+                        pcoll->panchors[g] =
+                                (vec3_t){pbody->px[j], pbody->py[j], pbody->pz[j]};
+                }
+        }
+}
+
+static void collision_run(collision_t *pcoll, scheduler_fn_t pfn, uint32_t n)
+{
+        atomic_uint counter = 0;
+
+        scheduler_submit_range(pcoll->psched, 0, pfn, pcoll, n, &counter);
+        scheduler_wait(pcoll->psched, 0, &counter);
+}
+
+/*
+ * Hashes the bodies where they stand and resolves their contacts, run after
+ * every body stepped. Must be called from worker 0.
+ */
+void collision_step(collision_t *pcoll, float dt)
+{
+        if (!pcoll->ncolliding_points)
+        {
+                return;
+        }
+
+        uint32_t ntriangle_tasks = DIV_UP(pcoll->ntriangles, COLLISION_TASK_ITEMS);
+        uint32_t nitem_tasks     = DIV_UP(pcoll->nitems, COLLISION_TASK_ITEMS);
+        uint32_t npoint_tasks    = DIV_UP(pcoll->ncolliding_points, COLLISION_TASK_ITEMS);
+        uint32_t nblocks         = DIV_UP(pcoll->ncells, COLLISION_SCAN_BLOCK);
+
+        pcoll->dt = dt;
+
+        collision_run(pcoll, collision_bounds_task, ntriangle_tasks);
+        float reach  = 2.0f * pcoll->max_radius;
+        float extent = 0.0f;
+        vec3_t lo = {INFINITY, INFINITY, INFINITY};
+        vec3_t hi = {-INFINITY, -INFINITY, -INFINITY};
+        for (uint32_t i = 0; i < ntriangle_tasks; i++)
+        {
+                extent = fmaxf(extent, pcoll->pextents[i]);
+                lo     = collision_min(lo, pcoll->pwide_bounds[i * 2]);
+                hi     = collision_max(hi, pcoll->pwide_bounds[i * 2 + 1]);
+        }
+        pcoll->cell_size   = fminf(extent, pcoll->triangle_limit) + reach;
+        pcoll->coarse_size = extent + reach;
+        pcoll->wide_lo     = collision_sub(lo, (vec3_t){reach, reach, reach});
+        pcoll->wide_hi     = collision_mad(hi, (vec3_t){reach, reach, reach}, 1.0f);
+
+        memset(pcoll->pcounts, 0, sizeof(atomic_uint) * pcoll->ncells);
+        collision_run(pcoll, collision_count_task, nitem_tasks);
+
+        collision_run(pcoll, collision_sum_task, nblocks);
+        for (uint32_t i = 0, sum = 0; i < nblocks; i++)
+        {
+                uint32_t n            = pcoll->pblock_sums[i];
+                pcoll->pblock_sums[i] = sum;
+                sum += n;
+        }
+        collision_run(pcoll, collision_scan_task, nblocks);
+        pcoll->pcell_starts[pcoll->ncells] = pcoll->nitems;
+
+        collision_run(pcoll, collision_scatter_task, nitem_tasks);
+        collision_run(pcoll, collision_order_task, nblocks);
+
+        collision_run(pcoll, collision_triangles_task, ntriangle_tasks);
+        collision_run(pcoll, collision_points_task, npoint_tasks);
+        collision_run(pcoll, collision_apply_task, npoint_tasks);
+}
@@ -0,0 +1,645 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh_opt.h"
+#include "platform.h"
+
+/* "MSCH", bumped with any change to the header, mesh_vertex_t or mesh_meshlet_t */
+#define MESH_CACHE_MAGIC 0x4843534du
+#define MESH_CACHE_VERSION 2
+#define MESH_CACHE_SUFFIX ".cache"
+
+/* corners of one obj face, larger polygons fail the parse */
+#define MESH_OBJ_MAX_CORNERS 64
+#define MESH_NO_NORMAL UINT32_MAX
+
+/* pulled by graphics.vert, see VERTEX_STRIDE there */
+typedef struct
+{
+        float position[3], normal[3];
+} mesh_vertex_t;
+
+/*
+ * Vertices and a triangle list into them, cut into meshlets once optimized.
+ * A mesh loaded from a cache points into pmapping and owns no arrays of its
+ * own, see mesh_free.
+ */
+typedef struct
+{
+        uint32_t nvertices, nindices, nmeshlets;
+        mesh_vertex_t *pvertices;
+        uint32_t *pindices;
+        mesh_meshlet_t *pmeshlets;
+
+        void *pmapping;
+        size_t szmapping;
+} mesh_t;
+
+/* source_time is the platform_file_time of the file the cache was built from */
+typedef struct
+{
+        uint32_t magic, version;
+        uint64_t source_time;
+        uint32_t nvertices, nindices;
+        uint32_t szvertex;
+        uint32_t nmeshlets;
+} mesh_cache_header_t;
+
+void mesh_free(mesh_t *pmesh)
+{
+        if (pmesh->pmapping)
+        {
+                platform_unmap_file(pmesh->pmapping, pmesh->szmapping);
+        }
+        else
+        {
+                free(pmesh->pvertices);
+                free(pmesh->pindices);
+                free(pmesh->pmeshlets);
+        }
+        *pmesh = (mesh_t){};
+}
+
+/* grows *pp to hold n elements, doubling so appends stay amortised */
+static void mesh_reserve(void **pp, uint32_t *pcapacity, uint32_t n, size_t sz)
+{
+        if (n <= *pcapacity)
+        {
+                return;
+        }
+
+        uint32_t capacity = MAX(*pcapacity * 2, MAX(n, 64));
+        *pp               = realloc(*pp, sz * capacity);
+        if (!*pp)
+        {
+                fprintf(stderr, "Cant grow mesh arrays.\n");
+                abort();
+        }
+        *pcapacity = capacity;
+}
+
+/*
+ * Vertices keyed on their (position, normal) index pair. The position
+ * index is its own perfect hash, pheads[position] starts a chain through
+ * pnext of the vertices made from that position and pnormals tells them
+ * apart. Chains are a vertex or two and faces reuse nearby positions, so
+ * lookups stay in cache where a hashed table would scatter.
+ */
+typedef struct
+{
+        uint32_t nheads, nhead_capacity, nvertex_capacity;
+        uint32_t *pheads;
+        uint32_t *pnext, *pnormals;
+} mesh_dedup_t;
+
+static void mesh_dedup_add_position(mesh_dedup_t *pdedup)
+{
+        mesh_reserve(
+                (void **) &pdedup->pheads,
+                &pdedup->nhead_capacity,
+                pdedup->nheads + 1,
+                sizeof(uint32_t));
+        pdedup->pheads[pdedup->nheads++] = UINT32_MAX;
+}
+
+/* the vertex made for the pair, UINT32_MAX when there is none yet */
+static inline uint32_t mesh_dedup_find(
+        const mesh_dedup_t *pdedup, uint32_t idx_position, uint32_t idx_normal)
+{
+        uint32_t id = pdedup->pheads[idx_position];
+        while (id != UINT32_MAX && pdedup->pnormals[id] != idx_normal)
+        {
+                id = pdedup->pnext[id];
+        }
+        return id;
+}
+
+/* ids are handed out in order, id is the number of vertices added so far */
+static void mesh_dedup_add(
+        mesh_dedup_t *pdedup, uint32_t idx_position, uint32_t idx_normal, uint32_t id)
+{
+        uint32_t capacity = pdedup->nvertex_capacity;
+        mesh_reserve((void **) &pdedup->pnext, &capacity, id + 1, sizeof(uint32_t));
+        mesh_reserve(
+                (void **) &pdedup->pnormals,
+                &pdedup->nvertex_capacity,
+                id + 1,
+                sizeof(uint32_t));
+
+        pdedup->pnext[id]            = pdedup->pheads[idx_position];
+        pdedup->pnormals[id]         = idx_normal;
+        pdedup->pheads[idx_position] = id;
+}
+
+static inline bool mesh_is_space(char c)
+{
+        return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *mesh_skip_spaces(const char *p, const char *pend)
+{
+        while (p < pend && mesh_is_space(*p))
+        {
+                p++;
+        }
+        return p;
+}
+
+static inline const char *mesh_skip_line(const char *p, const char *pend)
+{
+        while (p < pend && *p != '\n')
+        {
+                p++;
+        }
+        return p < pend ? p + 1 : p;
+}
+
+/*
+ * Decimal float with optional sign, fraction and exponent. Digits gather
+ * in an integer mantissa and are scaled once, which is exact to float
+ * precision for anything an exporter writes and avoids strtof's locale.
+ */
+static const char *mesh_parse_float(const char *p, const char *pend, float *pf)
+{
+        static const double ppow10[] = {
+                1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+        p              = mesh_skip_spaces(p, pend);
+        const char *p0 = p;
+
+        bool negative = p < pend && *p == '-';
+        p += p < pend && (*p == '-' || *p == '+');
+
+        uint64_t mantissa = 0;
+        int32_t exponent  = 0;
+        bool digits       = false;
+        for (; p < pend && *p >= '0' && *p <= '9'; p++, digits = true)
+        {
+                if (mantissa < 1000000000000000000ull)
+                {
+                        mantissa = mantissa * 10 + (*p - '0');
+                }
+                else
+                {
+                        exponent++;
+                }
+        }
+        if (p < pend && *p == '.')
+        {
+                for (p++; p < pend && *p >= '0' && *p <= '9'; p++, digits = true)
+                {
+                        if (mantissa < 1000000000000000000ull)
+                        {
+                                mantissa = mantissa * 10 + (*p - '0');
+                                exponent--;
+                        }
+                }
+        }
+        if (!digits)
+        {
+                return p0;
+        }
+
+        if (p < pend && (*p == 'e' || *p == 'E'))
+        {
+                p++;
+                bool negative_exp = p < pend && *p == '-';
+                p += p < pend && (*p == '-' || *p == '+');
+
+                int32_t e = 0;
+                for (; p < pend && *p >= '0' && *p <= '9'; p++)
+                {
+                        e = MIN(e * 10 + (*p - '0'), 1000);
+                }
+                exponent += negative_exp ? -e : e;
+        }
+
+        double v = (double) mantissa;
+        for (; exponent > 22; exponent -= 22)
+        {
+                v *= 1e22;
+        }
+        for (; exponent < -22; exponent += 22)
+        {
+                v /= 1e22;
+        }
+        v = exponent < 0 ? v / ppow10[-exponent] : v * ppow10[exponent];
+
+        *pf = (float) (negative ? -v : v);
+        return p;
+}
+
+/* one index of a face corner, 1 based or negative from the end, *pidx 0 based */
+static const char *mesh_parse_index(
+        const char *p, const char *pend, uint32_t n, uint32_t *pidx, bool *pvalid)
+{
+        bool negative = p < pend && *p == '-';
+        p += negative;
+
+        int64_t v = 0;
+        bool digits = false;
+        for (; p < pend && *p >= '0' && *p <= '9'; p++, digits = true)
+        {
+                v = MIN(v * 10 + (*p - '0'), (int64_t) UINT32_MAX + 1);
+        }
+
+        int64_t idx = negative ? (int64_t) n - v : v - 1;
+        *pvalid     = digits && idx >= 0 && idx < n;
+        *pidx       = (uint32_t) idx;
+        return p;
+}
+
+/*
+ * Area weighted normals for the vertices whose corners named none, their
+ * normal index is MESH_NO_NORMAL. Those share one vertex per position, so
+ * the result is smooth across faces.
+ */
+static void mesh_generate_normals(mesh_t *pmesh, const uint32_t *pidx_normals)
+{
+        for (uint32_t i = 0; i < pmesh->nindices; i += 3)
+        {
+                mesh_vertex_t *pa = &pmesh->pvertices[pmesh->pindices[i]];
+                mesh_vertex_t *pb = &pmesh->pvertices[pmesh->pindices[i + 1]];
+                mesh_vertex_t *pc = &pmesh->pvertices[pmesh->pindices[i + 2]];
+
+                float e1[3], e2[3];
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        e1[c] = pb->position[c] - pa->position[c];
+                        e2[c] = pc->position[c] - pa->position[c];
+                }
+                float n[3] = {
+                        e1[1] * e2[2] - e1[2] * e2[1],
+                        e1[2] * e2[0] - e1[0] * e2[2],
+                        e1[0] * e2[1] - e1[1] * e2[0]};
+
+                for (uint32_t j = 0; j < 3; j++)
+                {
+                        uint32_t idx = pmesh->pindices[i + j];
+                        bool needs   = pidx_normals[idx] == MESH_NO_NORMAL;
+                        for (uint32_t c = 0; needs && c < 3; c++)
+                        {
+                                pmesh->pvertices[idx].normal[c] += n[c];
+                        }
+                }
+        }
+
+        for (uint32_t i = 0; i < pmesh->nvertices; i++)
+        {
+                float *n = pmesh->pvertices[i].normal;
+                if (pidx_normals[i] != MESH_NO_NORMAL)
+                {
+                        continue;
+                }
+
+                float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (len > 0.0f)
+                {
+                        n[0] /= len;
+                        n[1] /= len;
+                        n[2] /= len;
+                }
+                else
+                {
+                        n[0] = 0.0f;
+                        n[1] = 1.0f;
+                        n[2] = 0.0f;
+                }
+        }
+}
+
+/*
+ * Parses the v, vn and f lines of an obj held in pdata, anything else is
+ * skipped. Corners are deduplicated on their position and normal index, so
+ * vertices come out in first use order, and polygons are fanned into
+ * triangles. Returns false on malformed faces, *pmesh is then left empty.
+ */
+bool mesh_parse_obj(const char *pdata, size_t sz, mesh_t *pmesh)
+{
+        const char *p    = pdata;
+        const char *pend = pdata + sz;
+
+        uint32_t npositions = 0, nposition_capacity = 0;
+        uint32_t nnormals = 0, nnormal_capacity = 0;
+        float *ppositions = NULL, *pnormals = NULL;
+
+        uint32_t nvertex_capacity = 0, nindex_capacity = 0;
+
+        *pmesh             = (mesh_t){};
+        mesh_dedup_t dedup = {};
+
+        bool ok = true;
+        while (ok && p < pend)
+        {
+                p = mesh_skip_spaces(p, pend);
+                if (p + 1 >= pend)
+                {
+                        break;
+                }
+
+                if (p[0] == 'v' && mesh_is_space(p[1]))
+                {
+                        mesh_reserve(
+                                (void **) &ppositions,
+                                &nposition_capacity,
+                                npositions + 1,
+                                sizeof(float) * 3);
+                        float *pv = &ppositions[3 * npositions++];
+                        mesh_dedup_add_position(&dedup);
+                        p += 1;
+                        p = mesh_parse_float(p, pend, &pv[0]);
+                        p = mesh_parse_float(p, pend, &pv[1]);
+                        p = mesh_parse_float(p, pend, &pv[2]);
+                }
+                else if (p[0] == 'v' && p[1] == 'n')
+                {
+                        mesh_reserve(
+                                (void **) &pnormals,
+                                &nnormal_capacity,
+                                nnormals + 1,
+                                sizeof(float) * 3);
+                        float *pn = &pnormals[3 * nnormals++];
+                        p += 2;
+                        p = mesh_parse_float(p, pend, &pn[0]);
+                        p = mesh_parse_float(p, pend, &pn[1]);
+                        p = mesh_parse_float(p, pend, &pn[2]);
+                }
+                else if (p[0] == 'f' && mesh_is_space(p[1]))
+                {
+                        uint32_t pcorners[MESH_OBJ_MAX_CORNERS];
+                        uint32_t ncorners = 0;
+
+                        p = mesh_skip_spaces(p + 1, pend);
+                        while (ok && p < pend && *p != '\n' && *p != '#')
+                        {
+                                uint32_t idx_position, idx_normal = MESH_NO_NORMAL;
+                                uint32_t idx_unused;
+                                bool ignored;
+
+                                p = mesh_parse_index(
+                                        p, pend, npositions, &idx_position, &ok);
+                                if (p < pend && *p == '/')
+                                {
+                                        /* texture coordinates are not kept */
+                                        p++;
+                                        if (p < pend && *p != '/')
+                                        {
+                                                p = mesh_parse_index(
+                                                        p,
+                                                        pend,
+                                                        UINT32_MAX,
+                                                        &idx_unused,
+                                                        &ignored);
+                                        }
+                                }
+                                if (ok && p < pend && *p == '/')
+                                {
+                                        p = mesh_parse_index(
+                                                p + 1, pend, nnormals, &idx_normal, &ok);
+                                }
+                                ok &= ncorners < MESH_OBJ_MAX_CORNERS;
+                                if (!ok)
+                                {
+                                        break;
+                                }
+
+                                uint32_t idx =
+                                        mesh_dedup_find(&dedup, idx_position, idx_normal);
+                                if (idx == UINT32_MAX)
+                                {
+                                        idx = pmesh->nvertices++;
+                                        mesh_dedup_add(
+                                                &dedup, idx_position, idx_normal, idx);
+                                        mesh_reserve(
+                                                (void **) &pmesh->pvertices,
+                                                &nvertex_capacity,
+                                                idx + 1,
+                                                sizeof(mesh_vertex_t));
+
+                                        mesh_vertex_t *pv = &pmesh->pvertices[idx];
+                                        memcpy(pv->position,
+                                               &ppositions[3 * idx_position],
+                                               sizeof pv->position);
+                                        if (idx_normal == MESH_NO_NORMAL)
+                                        {
+                                                memset(pv->normal, 0, sizeof pv->normal);
+                                        }
+                                        else
+                                        {
+                                                memcpy(pv->normal,
+                                                       &pnormals[3 * idx_normal],
+                                                       sizeof pv->normal);
+                                        }
+                                }
+
+                                pcorners[ncorners++] = idx;
+                                p                    = mesh_skip_spaces(p, pend);
+                        }
+                        ok &= ncorners >= 3 || !ncorners;
+
+                        mesh_reserve(
+                                (void **) &pmesh->pindices,
+                                &nindex_capacity,
+                                pmesh->nindices + 3 * (MAX(ncorners, 2) - 2),
+                                sizeof(uint32_t));
+                        for (uint32_t i = 2; ok && i < ncorners; i++)
+                        {
+                                pmesh->pindices[pmesh->nindices++] = pcorners[0];
+                                pmesh->pindices[pmesh->nindices++] = pcorners[i - 1];
+                                pmesh->pindices[pmesh->nindices++] = pcorners[i];
+                        }
+                }
+
+                p = mesh_skip_line(p, pend);
+        }
+
+        if (ok)
+        {
+                mesh_generate_normals(pmesh, dedup.pnormals);
+        }
+        else
+        {
+                free(pmesh->pvertices);
+                free(pmesh->pindices);
+                *pmesh = (mesh_t){};
+        }
+
+        free(ppositions);
+        free(pnormals);
+        free(dedup.pheads);
+        free(dedup.pnext);
+        free(dedup.pnormals);
+        return ok;
+}
+
+/*
+ * Import time pass, run once before the cache is written: triangles in
+ * vertex cache order, clusters of it in overdraw order, vertices in fetch
+ * order and the result cut into meshlets.
+ */
+void mesh_optimize(mesh_t *pmesh)
+{
+        const float *ppositions = (const float *) pmesh->pvertices;
+        uint32_t stride         = sizeof(mesh_vertex_t) / sizeof(float);
+
+        mesh_optimize_vertex_cache(pmesh->pindices, pmesh->nindices, pmesh->nvertices);
+        mesh_optimize_overdraw(
+                pmesh->pindices,
+                pmesh->nindices,
+                ppositions,
+                stride,
+                pmesh->nvertices,
+                MESH_OPT_OVERDRAW_THRESHOLD);
+        pmesh->nvertices = mesh_optimize_vertex_fetch(
+                pmesh->pvertices,
+                sizeof(mesh_vertex_t),
+                pmesh->nvertices,
+                pmesh->pindices,
+                pmesh->nindices);
+
+        free(pmesh->pmeshlets);
+        pmesh->nmeshlets = mesh_build_meshlets(
+                pmesh->pindices,
+                pmesh->nindices,
+                ppositions,
+                stride,
+                pmesh->nvertices,
+                &pmesh->pmeshlets);
+}
+
+/* header, vertices, indices, then meshlets, as mesh_map_cache expects them */
+bool mesh_write_cache(const mesh_t *pmesh, const char *ppath, uint64_t source_time)
+{
+        FILE *pfile = fopen(ppath, "wb");
+        if (!pfile)
+        {
+                return false;
+        }
+
+        mesh_cache_header_t header = {
+                .magic       = MESH_CACHE_MAGIC,
+                .version     = MESH_CACHE_VERSION,
+                .source_time = source_time,
+                .nvertices   = pmesh->nvertices,
+                .nindices    = pmesh->nindices,
+                .szvertex    = sizeof(mesh_vertex_t),
+                .nmeshlets   = pmesh->nmeshlets};
+
+        uint32_t nvertices = pmesh->nvertices, nindices = pmesh->nindices;
+        uint32_t nmeshlets = pmesh->nmeshlets;
+        bool ok            = fwrite(&header, sizeof header, 1, pfile) == 1 &&
+                  fwrite(pmesh->pvertices, sizeof(mesh_vertex_t), nvertices, pfile) ==
+                          nvertices &&
+                  fwrite(pmesh->pindices, sizeof(uint32_t), nindices, pfile) ==
+                          nindices &&
+                  fwrite(pmesh->pmeshlets, sizeof(mesh_meshlet_t), nmeshlets, pfile) ==
+                          nmeshlets;
+        ok &= fclose(pfile) == 0;
+
+        if (!ok)
+        {
+                remove(ppath);
+        }
+        return ok;
+}
+
+/*
+ * Maps a cache written by mesh_write_cache. The mesh reads straight from
+ * the mapping, nothing is parsed or copied. Fails when the cache is
+ * missing, stale against source_time or from another version.
+ */
+bool mesh_map_cache(const char *ppath, uint64_t source_time, mesh_t *pmesh)
+{
+        size_t sz;
+        uint8_t *p = platform_map_file(ppath, &sz);
+        if (!p)
+        {
+                return false;
+        }
+
+        mesh_cache_header_t header = {};
+        if (sz >= sizeof header)
+        {
+                memcpy(&header, p, sizeof header);
+        }
+
+        uint64_t szexpected = sizeof header +
+                              (uint64_t) header.nvertices * sizeof(mesh_vertex_t) +
+                              (uint64_t) header.nindices * sizeof(uint32_t) +
+                              (uint64_t) header.nmeshlets * sizeof(mesh_meshlet_t);
+        if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION ||
+            header.source_time != source_time ||
+            header.szvertex != sizeof(mesh_vertex_t) || sz != szexpected)
+        {
+                platform_unmap_file(p, sz);
+                return false;
+        }
+
+        mesh_vertex_t *pvertices = (mesh_vertex_t *) (p + sizeof header);
+        uint32_t *pindices       = (uint32_t *) (pvertices + header.nvertices);
+        *pmesh                   = (mesh_t){
+                .nvertices = header.nvertices,
+                .nindices  = header.nindices,
+                .nmeshlets = header.nmeshlets,
+                .pvertices = pvertices,
+                .pindices  = pindices,
+                .pmeshlets = (mesh_meshlet_t *) (pindices + header.nindices),
+                .pmapping  = p,
+                .szmapping = sz};
+        return true;
+}
+
+/*
+ * Loads the obj at ppath through its cache next to it, rebuilding the cache
+ * whenever the obj is newer. A cache that cannot be written only costs the
+ * parse and mesh_optimize again next time.
+ */
+bool mesh_load(const char *ppath, mesh_t *pmesh)
+{
+        uint64_t source_time = platform_file_time(ppath);
+        if (!source_time)
+        {
+                return false;
+        }
+
+        size_t nsuffix    = strlen(MESH_CACHE_SUFFIX);
+        size_t npath      = strlen(ppath);
+        char *pcache_path = malloc(npath + nsuffix + 1);
+        if (!pcache_path)
+        {
+                fprintf(stderr, "Cant allocate the mesh cache path.\n");
+                abort();
+        }
+        memcpy(pcache_path, ppath, npath);
+        memcpy(pcache_path + npath, MESH_CACHE_SUFFIX, nsuffix + 1);
+
+        bool ok = mesh_map_cache(pcache_path, source_time, pmesh);
+        if (!ok)
+        {
+                size_t sz;
+                void *pdata = platform_map_file(ppath, &sz);
+                ok          = pdata && mesh_parse_obj(pdata, sz, pmesh);
+                if (pdata)
+                {
+                        platform_unmap_file(pdata, sz);
+                }
+                if (ok)
+                {
+                        mesh_optimize(pmesh);
+                }
+                if (ok && !mesh_write_cache(pmesh, pcache_path, source_time))
+                {
+                        fprintf(stderr, "Cant write %s.\n", pcache_path);
+                }
+        }
+
+        free(pcache_path);
+        return ok;
+}
@@ -0,0 +1,597 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+/* the post transform cache the vertex order is scored against */
+#define MESH_OPT_CACHE_SIZE 32
+/* the fifo the overdraw pass measures clusters with, and how much worse they may get */
+#define MESH_OPT_OVERDRAW_CACHE 16
+#define MESH_OPT_OVERDRAW_THRESHOLD 1.05f
+
+#define MESH_MESHLET_VERTICES 64
+#define MESH_MESHLET_TRIANGLES 124
+
+/*
+ * A contiguous run of at most MESH_MESHLET_TRIANGLES triangles using at
+ * most MESH_MESHLET_VERTICES vertices. The sphere bounds its vertices, the
+ * cone its face normals: seen from e the whole meshlet faces away when
+ * dot(center - e, cone_axis) >= cone_cutoff * |center - e| + radius. A
+ * cutoff of 1 never passes, for meshlets too curved to have a cone.
+ */
+typedef struct
+{
+        uint32_t first_index, nindices;
+        float center[3], radius;
+        float cone_axis[3], cone_cutoff;
+} mesh_meshlet_t;
+
+static void *mesh_opt_alloc(size_t sz)
+{
+        void *p = malloc(MAX(sz, 1));
+        if (!p)
+        {
+                fprintf(stderr, "Cant allocate mesh optimizer scratch.\n");
+                abort();
+        }
+        return p;
+}
+
+/* Forsyth's scores, recently used vertices and ones with few triangles left win */
+static float mesh_opt_vertex_score(int32_t cache_pos, uint32_t nlive)
+{
+        if (!nlive)
+        {
+                return -1.0f;
+        }
+
+        float score = 0.0f;
+        if (cache_pos >= 0 && cache_pos < 3)
+        {
+                /* the last triangle's vertices, a fixed score so strips do not win */
+                score = 0.75f;
+        }
+        else if (cache_pos >= 0)
+        {
+                float scale = 1.0f / (MESH_OPT_CACHE_SIZE - 3);
+                score       = powf(1.0f - (cache_pos - 3) * scale, 1.5f);
+        }
+
+        return score + 2.0f / sqrtf((float) nlive);
+}
+
+/*
+ * Reorders the triangles of pindices for post transform cache hits with
+ * Forsyth's linear speed greedy: the next triangle is the best scored one
+ * around the simulated cache, or the first one left when none is.
+ */
+void mesh_optimize_vertex_cache(uint32_t *pindices, uint32_t nindices, uint32_t nvertices)
+{
+        uint32_t ntris = nindices / 3;
+        if (ntris < 2)
+        {
+                return;
+        }
+
+        /* triangles of each vertex, live ones first in pfirst[v] .. pfirst[v] + nlive */
+        uint32_t *pnlive  = mesh_opt_alloc(sizeof(uint32_t) * nvertices);
+        uint32_t *pfirst  = mesh_opt_alloc(sizeof(uint32_t) * (nvertices + 1));
+        uint32_t *padj    = mesh_opt_alloc(sizeof(uint32_t) * nindices);
+        float *pvscores   = mesh_opt_alloc(sizeof(float) * nvertices);
+        int32_t *pcache_p = mesh_opt_alloc(sizeof(int32_t) * nvertices);
+        float *ptscores   = mesh_opt_alloc(sizeof(float) * ntris);
+        bool *pemitted    = mesh_opt_alloc(sizeof(bool) * ntris);
+        uint32_t *pout    = mesh_opt_alloc(sizeof(uint32_t) * nindices);
+
+        memset(pnlive, 0, sizeof(uint32_t) * nvertices);
+        for (uint32_t i = 0; i < nindices; i++)
+        {
+                pnlive[pindices[i]]++;
+        }
+        pfirst[0] = 0;
+        for (uint32_t v = 0; v < nvertices; v++)
+        {
+                pfirst[v + 1] = pfirst[v] + pnlive[v];
+                pnlive[v]     = 0;
+        }
+        for (uint32_t i = 0; i < nindices; i++)
+        {
+                uint32_t v                   = pindices[i];
+                padj[pfirst[v] + pnlive[v]++] = i / 3;
+        }
+
+        for (uint32_t v = 0; v < nvertices; v++)
+        {
+                pcache_p[v] = -1;
+                pvscores[v] = mesh_opt_vertex_score(-1, pnlive[v]);
+        }
+        for (uint32_t t = 0; t < ntris; t++)
+        {
+                ptscores[t] = pvscores[pindices[3 * t]] + pvscores[pindices[3 * t + 1]] +
+                              pvscores[pindices[3 * t + 2]];
+                pemitted[t] = false;
+        }
+
+        uint32_t pcache[MESH_OPT_CACHE_SIZE + 3];
+        uint32_t ncache = 0;
+        uint32_t cursor = 0;
+        uint32_t best   = 0;
+
+        for (uint32_t nout = 0; nout < ntris; nout++)
+        {
+                /* nothing scored around the cache, resume from the first triangle left */
+                if (best == UINT32_MAX)
+                {
+                        while (pemitted[cursor])
+                        {
+                                cursor++;
+                        }
+                        best = cursor;
+                }
+
+                const uint32_t *ptri = &pindices[3 * best];
+                memcpy(&pout[3 * nout], ptri, sizeof(uint32_t) * 3);
+                pemitted[best] = true;
+
+                /* the triangle leaves its vertices' live lists */
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        uint32_t v     = ptri[c];
+                        uint32_t *plst = &padj[pfirst[v]];
+                        for (uint32_t j = 0; j < pnlive[v]; j++)
+                        {
+                                if (plst[j] == best)
+                                {
+                                        plst[j] = plst[--pnlive[v]];
+                                        break;
+                                }
+                        }
+                }
+
+                /* its vertices move to the front, the rest shift back */
+                uint32_t pnext[MESH_OPT_CACHE_SIZE + 3];
+                uint32_t nnext = 0;
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        pnext[nnext++] = ptri[c];
+                }
+                for (uint32_t j = 0; j < ncache; j++)
+                {
+                        uint32_t v = pcache[j];
+                        if (v != ptri[0] && v != ptri[1] && v != ptri[2])
+                        {
+                                pnext[nnext++] = v;
+                        }
+                }
+
+                /* evicted vertices fall out of the cache score */
+                for (uint32_t j = MESH_OPT_CACHE_SIZE; j < nnext; j++)
+                {
+                        pcache_p[pnext[j]] = -1;
+                        pvscores[pnext[j]] = mesh_opt_vertex_score(-1, pnlive[pnext[j]]);
+                }
+                ncache = MIN(nnext, MESH_OPT_CACHE_SIZE);
+                memcpy(pcache, pnext, sizeof(uint32_t) * ncache);
+
+                for (uint32_t j = 0; j < ncache; j++)
+                {
+                        uint32_t v  = pcache[j];
+                        pcache_p[v] = j;
+                        pvscores[v] = mesh_opt_vertex_score(j, pnlive[v]);
+                }
+
+                /* rescore the live triangles around the cache and keep the best */
+                best             = UINT32_MAX;
+                float best_score = -INFINITY;
+                for (uint32_t j = 0; j < nnext; j++)
+                {
+                        uint32_t v = pnext[j];
+                        for (uint32_t k = 0; k < pnlive[v]; k++)
+                        {
+                                uint32_t t         = padj[pfirst[v] + k];
+                                const uint32_t *pt = &pindices[3 * t];
+                                ptscores[t]        = pvscores[pt[0]] + pvscores[pt[1]];
+                                ptscores[t] += pvscores[pt[2]];
+                                if (ptscores[t] > best_score)
+                                {
+                                        best       = t;
+                                        best_score = ptscores[t];
+                                }
+                        }
+                }
+        }
+
+        memcpy(pindices, pout, sizeof(uint32_t) * 3 * ntris);
+
+        free(pnlive);
+        free(pfirst);
+        free(padj);
+        free(pvscores);
+        free(pcache_p);
+        free(ptscores);
+        free(pemitted);
+        free(pout);
+}
+
+typedef struct
+{
+        float key;
+        uint32_t first, ntris;
+} mesh_opt_cluster_t;
+
+static int mesh_opt_cluster_cmp(const void *pa, const void *pb)
+{
+        float a = ((const mesh_opt_cluster_t *) pa)->key;
+        float b = ((const mesh_opt_cluster_t *) pb)->key;
+        return (a < b) - (a > b);
+}
+
+static float mesh_opt_length(const float v[3])
+{
+        return sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+static void mesh_opt_triangle(
+        const uint32_t *ptri,
+        const float *ppositions,
+        uint32_t stride,
+        float pcentroid[3],
+        float pnormal[3])
+{
+        const float *pa = &ppositions[stride * ptri[0]];
+        const float *pb = &ppositions[stride * ptri[1]];
+        const float *pc = &ppositions[stride * ptri[2]];
+
+        float e1[3], e2[3];
+        for (uint32_t c = 0; c < 3; c++)
+        {
+                e1[c]        = pb[c] - pa[c];
+                e2[c]        = pc[c] - pa[c];
+                pcentroid[c] = (pa[c] + pb[c] + pc[c]) / 3.0f;
+        }
+
+        /* twice the area long */
+        pnormal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        pnormal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        pnormal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+/*
+ * Sander et al.'s overdraw ordering over a cache optimized pindices. The
+ * order is cut into clusters where the cache restarts or a cluster's miss
+ * rate is already within threshold of the whole mesh's, then clusters
+ * facing out from the mesh centroid are sorted to the front so they
+ * occlude the rest. Within a cluster the cache order stays. ppositions
+ * holds a position every stride floats.
+ */
+void mesh_optimize_overdraw(
+        uint32_t *pindices,
+        uint32_t nindices,
+        const float *ppositions,
+        uint32_t stride,
+        uint32_t nvertices,
+        float threshold)
+{
+        uint32_t ntris = nindices / 3;
+        if (ntris < 2)
+        {
+                return;
+        }
+
+        /* fifo simulation, a vertex stays cached until the cache size misses later */
+        uint32_t *pstamps = mesh_opt_alloc(sizeof(uint32_t) * nvertices);
+        uint8_t *pmisses  = mesh_opt_alloc(ntris);
+        memset(pstamps, 0, sizeof(uint32_t) * nvertices);
+
+        uint32_t time = MESH_OPT_OVERDRAW_CACHE + 1, nmisses = 0;
+        for (uint32_t t = 0; t < ntris; t++)
+        {
+                pmisses[t] = 0;
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        uint32_t v = pindices[3 * t + c];
+                        if (time - pstamps[v] > MESH_OPT_OVERDRAW_CACHE)
+                        {
+                                pstamps[v] = time++;
+                                pmisses[t]++;
+                        }
+                }
+                nmisses += pmisses[t];
+        }
+        float acmr = (float) nmisses / ntris;
+
+        /*
+         * A cluster is drawn after an unrelated one, so it is measured from a
+         * flushed cache and may close once it has won back to within threshold
+         * of the whole order. Triangles missing all three vertices start one
+         * regardless, the cache was lost there anyway.
+         */
+        mesh_opt_cluster_t *pclusters = mesh_opt_alloc(sizeof(*pclusters) * ntris);
+        uint32_t nclusters            = 0;
+        uint32_t cluster_misses       = 0;
+        bool closed                   = true;
+        memset(pstamps, 0, sizeof(uint32_t) * nvertices);
+        for (uint32_t t = 0; t < ntris; t++)
+        {
+                if (closed || pmisses[t] == 3)
+                {
+                        pclusters[nclusters++] = (mesh_opt_cluster_t){0.0f, t, 0};
+                        cluster_misses         = 0;
+                        time += MESH_OPT_OVERDRAW_CACHE + 1;
+                }
+
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        uint32_t v = pindices[3 * t + c];
+                        if (time - pstamps[v] > MESH_OPT_OVERDRAW_CACHE)
+                        {
+                                pstamps[v] = time++;
+                                cluster_misses++;
+                        }
+                }
+
+                mesh_opt_cluster_t *plast = &pclusters[nclusters - 1];
+                plast->ntris++;
+                closed = cluster_misses <= threshold * acmr * plast->ntris;
+        }
+
+        /* area weighted centroids, of the mesh and each cluster with its normal */
+        float pmesh_centroid[3] = {};
+        float mesh_area         = 0.0f;
+        for (uint32_t t = 0; t < ntris; t++)
+        {
+                const uint32_t *ptri = &pindices[3 * t];
+                float pcentroid[3], pnormal[3];
+                mesh_opt_triangle(ptri, ppositions, stride, pcentroid, pnormal);
+
+                float area = mesh_opt_length(pnormal);
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        pmesh_centroid[c] += pcentroid[c] * area;
+                }
+                mesh_area += area;
+        }
+        for (uint32_t c = 0; mesh_area > 0.0f && c < 3; c++)
+        {
+                pmesh_centroid[c] /= mesh_area;
+        }
+
+        for (uint32_t i = 0; i < nclusters; i++)
+        {
+                mesh_opt_cluster_t *pcluster = &pclusters[i];
+
+                float psum_centroid[3] = {}, psum_normal[3] = {};
+                float area = 0.0f;
+                for (uint32_t j = 0; j < pcluster->ntris; j++)
+                {
+                        const uint32_t *ptri = &pindices[3 * (pcluster->first + j)];
+                        float pcentroid[3], pnormal[3];
+                        mesh_opt_triangle(ptri, ppositions, stride, pcentroid, pnormal);
+
+                        float a = mesh_opt_length(pnormal);
+                        for (uint32_t c = 0; c < 3; c++)
+                        {
+                                psum_centroid[c] += pcentroid[c] * a;
+                                psum_normal[c] += pnormal[c];
+                        }
+                        area += a;
+                }
+
+                float key = 0.0f;
+                for (uint32_t c = 0; area > 0.0f && c < 3; c++)
+                {
+                        float d = psum_centroid[c] / area - pmesh_centroid[c];
+                        key += d * psum_normal[c];
+                }
+                float len     = mesh_opt_length(psum_normal);
+                pcluster->key = len > 0.0f ? key / len : 0.0f;
+        }
+
+        qsort(pclusters, nclusters, sizeof(mesh_opt_cluster_t), mesh_opt_cluster_cmp);
+
+        uint32_t *pout = mesh_opt_alloc(sizeof(uint32_t) * 3 * ntris);
+        uint32_t nout  = 0;
+        for (uint32_t i = 0; i < nclusters; i++)
+        {
+                uint32_t first = 3 * pclusters[i].first;
+                uint32_t n     = 3 * pclusters[i].ntris;
+                memcpy(&pout[nout], &pindices[first], sizeof(uint32_t) * n);
+                nout += n;
+        }
+        memcpy(pindices, pout, sizeof(uint32_t) * nout);
+
+        free(pstamps);
+        free(pmisses);
+        free(pclusters);
+        free(pout);
+}
+
+/*
+ * Renumbers vertices in the order pindices first uses them, so vertex
+ * fetches walk memory forward, and drops unused ones. Returns the vertices
+ * left, pvertices holds nvertices of szvertex bytes.
+ */
+uint32_t mesh_optimize_vertex_fetch(
+        void *pvertices,
+        size_t szvertex,
+        uint32_t nvertices,
+        uint32_t *pindices,
+        uint32_t nindices)
+{
+        uint32_t *premap = mesh_opt_alloc(sizeof(uint32_t) * nvertices);
+        uint8_t *pout    = mesh_opt_alloc(szvertex * nvertices);
+        memset(premap, 0xff, sizeof(uint32_t) * nvertices);
+
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < nindices; i++)
+        {
+                uint32_t v = pindices[i];
+                if (premap[v] == UINT32_MAX)
+                {
+                        uint8_t *pvertex = (uint8_t *) pvertices + szvertex * v;
+                        memcpy(&pout[szvertex * n], pvertex, szvertex);
+                        premap[v] = n++;
+                }
+                pindices[i] = premap[v];
+        }
+        memcpy(pvertices, pout, szvertex * n);
+
+        free(premap);
+        free(pout);
+        return n;
+}
+
+static void mesh_opt_meshlet_bounds(
+        mesh_meshlet_t *pmeshlet,
+        const uint32_t *pindices,
+        const float *ppositions,
+        uint32_t stride)
+{
+        const uint32_t *pfirst = &pindices[pmeshlet->first_index];
+
+        /* sphere about the box centre */
+        float pmin[3] = {INFINITY, INFINITY, INFINITY};
+        float pmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+        for (uint32_t i = 0; i < pmeshlet->nindices; i++)
+        {
+                const float *p = &ppositions[stride * pfirst[i]];
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        pmin[c] = fminf(pmin[c], p[c]);
+                        pmax[c] = fmaxf(pmax[c], p[c]);
+                }
+        }
+        for (uint32_t c = 0; c < 3; c++)
+        {
+                pmeshlet->center[c] = 0.5f * (pmin[c] + pmax[c]);
+        }
+        for (uint32_t i = 0; i < pmeshlet->nindices; i++)
+        {
+                const float *p = &ppositions[stride * pfirst[i]];
+                float d[3]     = {
+                        p[0] - pmeshlet->center[0],
+                        p[1] - pmeshlet->center[1],
+                        p[2] - pmeshlet->center[2]};
+
+                pmeshlet->radius = fmaxf(pmeshlet->radius, mesh_opt_length(d));
+        }
+
+        /* the cone's axis averages the unit face normals, its spread is the widest one */
+        float pnormals[MESH_MESHLET_TRIANGLES][3];
+        float paxis[3] = {};
+        uint32_t ntris = 0;
+        for (uint32_t i = 0; i < pmeshlet->nindices; i += 3)
+        {
+                float pcentroid[3], *pn = pnormals[ntris];
+                mesh_opt_triangle(&pfirst[i], ppositions, stride, pcentroid, pn);
+
+                float len = mesh_opt_length(pn);
+                if (len <= 0.0f)
+                {
+                        continue;
+                }
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        pn[c] /= len;
+                        paxis[c] += pn[c];
+                }
+                ntris++;
+        }
+
+        pmeshlet->cone_cutoff = 1.0f;
+        float len             = mesh_opt_length(paxis);
+        if (len <= 0.0f)
+        {
+                return;
+        }
+
+        float mindp = 1.0f;
+        for (uint32_t c = 0; c < 3; c++)
+        {
+                pmeshlet->cone_axis[c] = paxis[c] / len;
+        }
+        for (uint32_t i = 0; i < ntris; i++)
+        {
+                const float *pn = pnormals[i];
+                const float *pa = pmeshlet->cone_axis;
+                mindp = fminf(mindp, pn[0] * pa[0] + pn[1] * pa[1] + pn[2] * pa[2]);
+        }
+
+        /* a spread of 90 degrees or more faces every way */
+        if (mindp > 0.0f)
+        {
+                pmeshlet->cone_cutoff = sqrtf(1.0f - mindp * mindp);
+        }
+}
+
+/*
+ * Cuts pindices into meshlets in order, a meshlet closing when its next
+ * triangle would take it past the vertex or triangle limit, so each is a
+ * plain index range the existing indexed draws can issue. Run it after
+ * the reorders, their locality is what keeps meshlets full. Returns the
+ * count, *ppmeshlets is allocated for the caller.
+ */
+uint32_t mesh_build_meshlets(
+        const uint32_t *pindices,
+        uint32_t nindices,
+        const float *ppositions,
+        uint32_t stride,
+        uint32_t nvertices,
+        mesh_meshlet_t **ppmeshlets)
+{
+        uint32_t ntris = nindices / 3;
+
+        /* at least a meshlet per MESH_MESHLET_TRIANGLES, at most one per triangle */
+        mesh_meshlet_t *pmeshlets = mesh_opt_alloc(sizeof(*pmeshlets) * MAX(ntris, 1));
+        uint32_t *pseen           = mesh_opt_alloc(sizeof(uint32_t) * nvertices);
+        memset(pseen, 0xff, sizeof(uint32_t) * nvertices);
+
+        uint32_t nmeshlets = 0, nunique = 0;
+        for (uint32_t t = 0; t < ntris; t++)
+        {
+                const uint32_t *ptri = &pindices[3 * t];
+                mesh_meshlet_t *plast = nmeshlets ? &pmeshlets[nmeshlets - 1] : NULL;
+
+                /* vertices the triangle would add, a repeated one counted once */
+                uint32_t nnew = 0;
+                for (uint32_t c = 0; plast && c < 3; c++)
+                {
+                        bool repeat = (c > 0 && ptri[c] == ptri[0]) ||
+                                      (c > 1 && ptri[c] == ptri[1]);
+                        nnew += pseen[ptri[c]] != nmeshlets - 1 && !repeat;
+                }
+
+                if (!plast || nunique + nnew > MESH_MESHLET_VERTICES ||
+                    plast->nindices == 3 * MESH_MESHLET_TRIANGLES)
+                {
+                        pmeshlets[nmeshlets++] = (mesh_meshlet_t){.first_index = 3 * t};
+                        plast                  = &pmeshlets[nmeshlets - 1];
+                        nunique                = 0;
+                }
+
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        if (pseen[ptri[c]] != nmeshlets - 1)
+                        {
+                                pseen[ptri[c]] = nmeshlets - 1;
+                                nunique++;
+                        }
+                }
+                plast->nindices += 3;
+        }
+
+        for (uint32_t i = 0; i < nmeshlets; i++)
+        {
+                mesh_opt_meshlet_bounds(&pmeshlets[i], pindices, ppositions, stride);
+        }
+
+        free(pseen);
+        *ppmeshlets = pmeshlets;
+        return nmeshlets;
+}
@@ -0,0 +1,1993 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#if defined(PLATFORM_X86)
+        #include <immintrin.h>
+#endif
+
+/*
+ * Every stream is padded to a multiple of PHYSICS_LANES. Kernels wider
+ * than that mask off the tail of a range instead.
+ */
+#define PHYSICS_LANES 8
+#define PHYSICS_ALIGN 32
+/* names a PLATFORM_ISA_ tier to force its kernels, see physics_init_kernels */
+#define PHYSICS_ISA_ENV "PHYSICS_ISA"
+
+#define PHYSICS_GRAVITY -9.81f
+#define PHYSICS_EPSILON 1e-12f
+
+/* Jacobi sweeps per implicit step, the same count on the GPU */
+#define PHYSICS_IMPLICIT_ITERATIONS 8
+/* passes over every constraint colour per xpbd step */
+#define PHYSICS_XPBD_ITERATIONS 4
+/* warm started, so a few iterations track a cluster's rotation from step to step */
+#define PHYSICS_CLUSTER_ROTATION_ITERATIONS 8
+
+typedef enum
+{
+        PHYSICS_INTEGRATOR_SYMPLECTIC_EULER,
+        PHYSICS_INTEGRATOR_VERLET,
+        PHYSICS_INTEGRATOR_RK4,
+        PHYSICS_INTEGRATOR_IMPLICIT_EULER,
+        /* springs become distance constraints with compliance 1 / k */
+        PHYSICS_INTEGRATOR_XPBD
+} physics_integrator_t;
+
+typedef struct
+{
+        float x, y, z;
+} vec3_t;
+
+typedef struct
+{
+        float mass;
+        vec3_t position, velocity, acceleration;
+} point_mass_t;
+
+typedef struct
+{
+        uint32_t idx_a, idx_b;
+        float k, rest_distance;
+} spring_t;
+
+typedef struct
+{
+        uint32_t npoint_masses, nsprings;
+        point_mass_t *ppoint_masses;
+        spring_t *psprings;
+
+        physics_integrator_t integrator;
+        float damping;
+
+        /*
+         * Contacts, see collision.h. Point masses keep radius away from those
+         * of other entities and from every surface, none when radius is 0.
+         * The surface is optional, ntriangles triples of point mass indices.
+         */
+        float radius, friction;
+        uint32_t ntriangles;
+        uint32_t *ptriangles;
+
+        /*
+         * Rigid clusters, optional. Cluster c holds the point masses
+         * pcluster_members[pcluster_offsets[c]] .. [c + 1] in the pose
+         * they start in, see physics_body_clusters.
+         */
+        uint32_t nclusters;
+        uint32_t *pcluster_offsets, *pcluster_members;
+} entity_t;
+
+/*
+ * Structure of arrays copy of an entity that the solver steps.
+ * Point masses past npoint_masses have an inverse mass of zero and
+ * springs past nsprings have k = 0 so the kernels never need a tail.
+ */
+typedef struct
+{
+        uint32_t npoint_masses, npadded_point_masses;
+        uint32_t nsprings, npadded_springs;
+
+        float *px, *py, *pz;
+        float *pvx, *pvy, *pvz;
+        float *pfx, *pfy, *pfz;
+        float *pmass, *pinv_mass;
+
+        uint32_t *pidx_a, *pidx_b;
+        float *pk, *prest_distance;
+
+        physics_integrator_t integrator;
+        float damping;
+
+        /* more point mass streams, see physics_integrator_scratch_streams */
+        float *pscratch;
+
+        /*
+         * xpbd only. Springs are sorted by colour, colour c spanning
+         * pcolor_offsets[c] .. [c + 1] padded to PHYSICS_LANES with null
+         * springs, and plambda is a fifth spring stream.
+         */
+        float *plambda;
+        uint32_t ncolors;
+        uint32_t *pcolor_offsets;
+
+        /* contact radius, friction and surface of the entity, after the streams */
+        float radius, friction;
+        uint32_t ntriangles;
+        uint32_t *ptriangles;
+
+        /*
+         * The entity's clusters, after the surface. pcluster_rest holds each
+         * member's offset from its cluster's centre of mass at rest,
+         * pcluster_quats a rotation per cluster that warm starts the next
+         * step and pcluster_goals an xyzw sum per point mass.
+         */
+        uint32_t nclusters, ncluster_members;
+        float *pcluster_rest, *pcluster_quats, *pcluster_goals;
+        uint32_t *pcluster_offsets, *pcluster_members;
+
+        /* behind every stream, NULL when they live in a checkpoint's mapping */
+        void *pmem;
+} physics_body_t;
+
+/* rk4 scratch */
+#define PHYSICS_SCRATCH_X0 0
+#define PHYSICS_SCRATCH_V0 3
+#define PHYSICS_SCRATCH_SUM_X 6
+#define PHYSICS_SCRATCH_SUM_V 9
+
+/* implicit scratch, P is the Jacobian's input and Q its output */
+#define PHYSICS_SCRATCH_P 0
+#define PHYSICS_SCRATCH_Q 3
+#define PHYSICS_SCRATCH_B 6
+#define PHYSICS_SCRATCH_DV 9
+#define PHYSICS_SCRATCH_KSUM 12
+
+/* xpbd scratch, positions at the start of the step */
+#define PHYSICS_SCRATCH_PREV 0
+
+static inline float *physics_body_scratch(const physics_body_t *pbody, uint32_t stream)
+{
+        return pbody->pscratch + (size_t) stream * pbody->npadded_point_masses;
+}
+
+static inline uint32_t physics_integrator_scratch_streams(physics_integrator_t integrator)
+{
+        switch (integrator)
+        {
+        case PHYSICS_INTEGRATOR_RK4:
+                return 12;
+        case PHYSICS_INTEGRATOR_IMPLICIT_EULER:
+                return 13;
+        case PHYSICS_INTEGRATOR_XPBD:
+                return 3;
+        default:
+                return 0;
+        }
+}
+
+/*
+ * Greedy edge colouring, springs of one colour share no point mass and can
+ * be solved in parallel. Colours are handed out 64 at a time with a bit mask
+ * per point mass, springs left over move on to the next 64.
+ */
+uint32_t physics_spring_colors(const entity_t *pentity, uint32_t *pcolors)
+{
+        uint64_t *pused  = malloc(sizeof(uint64_t) * (pentity->npoint_masses + 1));
+        uint32_t ncolors = 0, nleft = pentity->nsprings;
+        if (!pused)
+        {
+                fprintf(stderr, "Cant allocate spring colours.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < pentity->nsprings; i++)
+        {
+                pcolors[i] = UINT32_MAX;
+        }
+
+        for (uint32_t base = 0; nleft; base += 64)
+        {
+                memset(pused, 0, sizeof(uint64_t) * pentity->npoint_masses);
+
+                for (uint32_t i = 0; i < pentity->nsprings; i++)
+                {
+                        uint32_t a    = pentity->psprings[i].idx_a;
+                        uint32_t b    = pentity->psprings[i].idx_b;
+                        uint64_t used = pused[a] | pused[b];
+                        if (pcolors[i] != UINT32_MAX || used == UINT64_MAX)
+                        {
+                                continue;
+                        }
+
+                        uint32_t c = 0;
+                        while (used >> c & 1)
+                        {
+                                c++;
+                        }
+
+                        pused[a] |= 1ULL << c;
+                        pused[b] |= 1ULL << c;
+                        pcolors[i] = base + c;
+                        ncolors    = MAX(ncolors, base + c + 1);
+                        nleft--;
+                }
+        }
+
+        free(pused);
+        return ncolors;
+}
+
+static void physics_body_forces(physics_body_t *pbody);
+
+/* bytes of the one allocation behind a body's streams, see physics_body_bind */
+size_t physics_body_size(const physics_body_t *pbody)
+{
+        uint32_t nscratch        = physics_integrator_scratch_streams(pbody->integrator);
+        uint32_t nspring_streams = pbody->integrator == PHYSICS_INTEGRATOR_XPBD ? 5 : 4;
+
+        size_t szpoints  = sizeof(float) * pbody->npadded_point_masses;
+        size_t szsprings = sizeof(float) * pbody->npadded_springs;
+        size_t sztris    = sizeof(uint32_t) * 3 * pbody->ntriangles;
+
+        size_t szclusters = 0;
+        if (pbody->nclusters)
+        {
+                szclusters = sizeof(float) * (3 * pbody->ncluster_members +
+                                              4 * pbody->nclusters +
+                                              4 * pbody->npadded_point_masses) +
+                             sizeof(uint32_t) *
+                                     (pbody->nclusters + 1 + pbody->ncluster_members);
+        }
+
+        return szpoints * (11 + nscratch) + szsprings * nspring_streams + sztris +
+               szclusters;
+}
+
+/*
+ * Points the streams into pmem, PHYSICS_ALIGN aligned and
+ * physics_body_size long. Point mass streams come first, then spring
+ * streams, scratch, the surface and the clusters, so px is always the start.
+ */
+void physics_body_bind(physics_body_t *pbody, char *pmem)
+{
+        uint32_t nscratch        = physics_integrator_scratch_streams(pbody->integrator);
+        bool xpbd                = pbody->integrator == PHYSICS_INTEGRATOR_XPBD;
+        uint32_t nspring_streams = xpbd ? 5 : 4;
+
+        size_t szpoints  = sizeof(float) * pbody->npadded_point_masses;
+        size_t szsprings = sizeof(float) * pbody->npadded_springs;
+
+        float **ppoint_streams[] = {
+                &pbody->px,
+                &pbody->py,
+                &pbody->pz,
+                &pbody->pvx,
+                &pbody->pvy,
+                &pbody->pvz,
+                &pbody->pfx,
+                &pbody->pfy,
+                &pbody->pfz,
+                &pbody->pmass,
+                &pbody->pinv_mass};
+        for (uint32_t i = 0; i < 11; i++, pmem += szpoints)
+        {
+                *ppoint_streams[i] = (float *) pmem;
+        }
+
+        pbody->pidx_a         = (uint32_t *) pmem;
+        pbody->pidx_b         = (uint32_t *) (pmem + szsprings);
+        pbody->pk             = (float *) (pmem + szsprings * 2);
+        pbody->prest_distance = (float *) (pmem + szsprings * 3);
+        pbody->plambda        = xpbd ? (float *) (pmem + szsprings * 4) : NULL;
+        pbody->pscratch =
+                nscratch ? (float *) (pmem + szsprings * nspring_streams) : NULL;
+        pbody->ptriangles = (uint32_t *) (pmem + szsprings * nspring_streams +
+                                          szpoints * nscratch);
+
+        if (pbody->nclusters)
+        {
+                uint32_t nmembers = pbody->ncluster_members;
+                float *prest      = (float *) (pbody->ptriangles + 3 * pbody->ntriangles);
+
+                pbody->pcluster_rest    = prest;
+                pbody->pcluster_quats   = prest + 3 * nmembers;
+                pbody->pcluster_goals   = pbody->pcluster_quats + 4 * pbody->nclusters;
+                pbody->pcluster_offsets = (uint32_t *) (pbody->pcluster_goals +
+                                                        4 * pbody->npadded_point_masses);
+                pbody->pcluster_members = pbody->pcluster_offsets + pbody->nclusters + 1;
+        }
+}
+
+void physics_body_init(physics_body_t *pbody, const entity_t *pentity)
+{
+        uint32_t npoints  = ALIGN_UP(pentity->npoint_masses, PHYSICS_LANES);
+        uint32_t nsprings = ALIGN_UP(pentity->nsprings, PHYSICS_LANES);
+        bool xpbd         = pentity->integrator == PHYSICS_INTEGRATOR_XPBD;
+
+        *pbody = (physics_body_t){
+                .npoint_masses        = pentity->npoint_masses,
+                .npadded_point_masses = npoints,
+                .nsprings             = pentity->nsprings,
+                .integrator           = pentity->integrator,
+                .damping              = pentity->damping,
+                .radius               = pentity->radius,
+                .friction             = pentity->friction,
+                .ntriangles           = pentity->ntriangles,
+                .nclusters            = pentity->nclusters};
+        if (pentity->nclusters)
+        {
+                pbody->ncluster_members = pentity->pcluster_offsets[pentity->nclusters];
+        }
+
+        /* spring i goes to slot pslots[i], null springs pad every colour */
+        uint32_t *pslots = NULL;
+        if (xpbd)
+        {
+                pslots         = malloc(sizeof(uint32_t) * (pentity->nsprings + 1));
+                pbody->ncolors = physics_spring_colors(pentity, pslots);
+
+                uint32_t ncolors      = pbody->ncolors;
+                uint32_t *poffsets    = calloc(ncolors + 1, sizeof(uint32_t));
+                uint32_t *pcursors    = calloc(ncolors + 1, sizeof(uint32_t));
+                pbody->pcolor_offsets = poffsets;
+                if (!pslots || !poffsets || !pcursors)
+                {
+                        fprintf(stderr, "Cant allocate physics body colours.\n");
+                        abort();
+                }
+
+                for (uint32_t i = 0; i < pentity->nsprings; i++)
+                {
+                        pcursors[pslots[i]]++;
+                }
+                for (uint32_t c = 0; c < ncolors; c++)
+                {
+                        poffsets[c + 1] =
+                                poffsets[c] + ALIGN_UP(pcursors[c], PHYSICS_LANES);
+                        pcursors[c] = poffsets[c];
+                }
+                for (uint32_t i = 0; i < pentity->nsprings; i++)
+                {
+                        pslots[i] = pcursors[pslots[i]]++;
+                }
+                free(pcursors);
+
+                nsprings        = poffsets[ncolors];
+                pbody->nsprings = nsprings;
+        }
+        pbody->npadded_springs = nsprings;
+
+        /* every stream is one allocation */
+        size_t sz  = physics_body_size(pbody);
+        char *pmem = platform_aligned_alloc(sz ? sz : PHYSICS_ALIGN, PHYSICS_ALIGN);
+        if (!pmem)
+        {
+                fprintf(stderr, "Cant allocate physics body.\n");
+                abort();
+        }
+        memset(pmem, 0, sz);
+        pbody->pmem = pmem;
+        physics_body_bind(pbody, pmem);
+
+        size_t sztris = sizeof(uint32_t) * 3 * pentity->ntriangles;
+        if (sztris)
+        {
+                memcpy(pbody->ptriangles, pentity->ptriangles, sztris);
+        }
+
+        for (uint32_t i = 0; i < pentity->npoint_masses; i++)
+        {
+                const point_mass_t *ppoint = &pentity->ppoint_masses[i];
+
+                pbody->px[i]        = ppoint->position.x;
+                pbody->py[i]        = ppoint->position.y;
+                pbody->pz[i]        = ppoint->position.z;
+                pbody->pvx[i]       = ppoint->velocity.x;
+                pbody->pvy[i]       = ppoint->velocity.y;
+                pbody->pvz[i]       = ppoint->velocity.z;
+                pbody->pmass[i]     = ppoint->mass;
+                pbody->pinv_mass[i] = ppoint->mass > 0.0f ? 1.0f / ppoint->mass : 0.0f;
+        }
+
+        for (uint32_t i = 0; i < pentity->nsprings; i++)
+        {
+                const spring_t *pspring = &pentity->psprings[i];
+                uint32_t slot           = pslots ? pslots[i] : i;
+
+                pbody->pidx_a[slot]         = pspring->idx_a;
+                pbody->pidx_b[slot]         = pspring->idx_b;
+                pbody->pk[slot]             = pspring->k;
+                pbody->prest_distance[slot] = pspring->rest_distance;
+        }
+        free(pslots);
+
+        for (uint32_t c = 0; c < pbody->nclusters; c++)
+        {
+                uint32_t first = pentity->pcluster_offsets[c];
+                uint32_t last  = pentity->pcluster_offsets[c + 1];
+                float mass = 0.0f, cx = 0.0f, cy = 0.0f, cz = 0.0f;
+
+                for (uint32_t m = first; m < last; m++)
+                {
+                        uint32_t i = pentity->pcluster_members[m];
+                        mass += pbody->pmass[i];
+                        cx += pbody->pmass[i] * pbody->px[i];
+                        cy += pbody->pmass[i] * pbody->py[i];
+                        cz += pbody->pmass[i] * pbody->pz[i];
+                }
+                cx /= mass;
+                cy /= mass;
+                cz /= mass;
+
+                for (uint32_t m = first; m < last; m++)
+                {
+                        uint32_t i = pentity->pcluster_members[m];
+
+                        pbody->pcluster_members[m]      = i;
+                        pbody->pcluster_rest[m * 3]     = pbody->px[i] - cx;
+                        pbody->pcluster_rest[m * 3 + 1] = pbody->py[i] - cy;
+                        pbody->pcluster_rest[m * 3 + 2] = pbody->pz[i] - cz;
+                }
+
+                pbody->pcluster_offsets[c] = first;
+                float *pquat               = &pbody->pcluster_quats[c * 4];
+                pquat[0] = pquat[1] = pquat[2] = 0.0f;
+                pquat[3]                       = 1.0f;
+        }
+        if (pbody->nclusters)
+        {
+                pbody->pcluster_offsets[pbody->nclusters] = pbody->ncluster_members;
+        }
+
+        if (pbody->integrator == PHYSICS_INTEGRATOR_IMPLICIT_EULER)
+        {
+                float *pksum = physics_body_scratch(pbody, PHYSICS_SCRATCH_KSUM);
+                for (uint32_t i = 0; i < pentity->nsprings; i++)
+                {
+                        pksum[pentity->psprings[i].idx_a] += pentity->psprings[i].k;
+                        pksum[pentity->psprings[i].idx_b] += pentity->psprings[i].k;
+                }
+        }
+
+        /* velocity verlet opens every step with the previous step's forces */
+        if (pbody->integrator == PHYSICS_INTEGRATOR_VERLET)
+        {
+                physics_body_forces(pbody);
+        }
+}
+
+/* a body bound to memory it does not own, see checkpoint_map, only frees its colours */
+void physics_body_free(physics_body_t *pbody)
+{
+        platform_aligned_free(pbody->pmem);
+        free(pbody->pcolor_offsets);
+        *pbody = (physics_body_t){};
+}
+
+/* copies the simulated state back into the entity's point masses */
+void physics_body_store(const physics_body_t *pbody, entity_t *pentity)
+{
+        for (uint32_t i = 0; i < pbody->npoint_masses; i++)
+        {
+                point_mass_t *ppoint = &pentity->ppoint_masses[i];
+                float inv_mass       = pbody->pinv_mass[i];
+
+                ppoint->position = (vec3_t){pbody->px[i], pbody->py[i], pbody->pz[i]};
+                ppoint->velocity = (vec3_t){pbody->pvx[i], pbody->pvy[i], pbody->pvz[i]};
+                ppoint->acceleration = (vec3_t){
+                        pbody->pfx[i] * inv_mass,
+                        pbody->pfy[i] * inv_mass,
+                        pbody->pfz[i] * inv_mass};
+        }
+}
+
+/*
+ * Kernels. Ranges are in stream elements and `first` must be a multiple of
+ * PHYSICS_LANES. Spring kernels accumulate into the force streams passed in
+ * rather than the body's own so callers can hand out private buffers.
+ */
+
+static void physics_forces_clear_scalar(
+        physics_body_t *pbody, uint32_t first, uint32_t last)
+{
+        for (uint32_t i = first; i < last; i++)
+        {
+                pbody->pfx[i] = 0.0f;
+                pbody->pfy[i] = pbody->pmass[i] * PHYSICS_GRAVITY;
+                pbody->pfz[i] = 0.0f;
+        }
+}
+
+static void physics_springs_scalar(
+        const physics_body_t *pbody,
+        uint32_t first,
+        uint32_t last,
+        float *pfx,
+        float *pfy,
+        float *pfz)
+{
+        for (uint32_t i = first; i < last; i++)
+        {
+                uint32_t a = pbody->pidx_a[i];
+                uint32_t b = pbody->pidx_b[i];
+
+                float dx = pbody->px[b] - pbody->px[a];
+                float dy = pbody->py[b] - pbody->py[a];
+                float dz = pbody->pz[b] - pbody->pz[a];
+
+                float len = sqrtf(fmaxf(dx * dx + dy * dy + dz * dz, PHYSICS_EPSILON));
+                float s   = pbody->pk[i] * (len - pbody->prest_distance[i]) / len;
+
+                pfx[a] += s * dx;
+                pfy[a] += s * dy;
+                pfz[a] += s * dz;
+                pfx[b] -= s * dx;
+                pfy[b] -= s * dy;
+                pfz[b] -= s * dz;
+        }
+}
+
+static void physics_integrate_scalar(
+        physics_body_t *pbody, float dt, uint32_t first, uint32_t last)
+{
+        float damp = 1.0f - pbody->damping * dt;
+
+        for (uint32_t i = first; i < last; i++)
+        {
+                float s = dt * pbody->pinv_mass[i];
+
+                pbody->pvx[i] = (pbody->pvx[i] + s * pbody->pfx[i]) * damp;
+                pbody->pvy[i] = (pbody->pvy[i] + s * pbody->pfy[i]) * damp;
+                pbody->pvz[i] = (pbody->pvz[i] + s * pbody->pfz[i]) * damp;
+
+                pbody->px[i] += dt * pbody->pvx[i];
+                pbody->py[i] += dt * pbody->pvy[i];
+                pbody->pz[i] += dt * pbody->pvz[i];
+        }
+}
+
+/*
+ * One Gauss-Seidel pass of xpbd distance constraints over [first, last) of
+ * a single colour. The update is the usual
+ * dlambda = (-C - alpha lambda) / (w + alpha) with alpha = 1 / (k dt^2),
+ * multiplied through by k dt^2 so null springs (k = 0) do nothing. Null
+ * springs join point 0 to itself and write nothing, batches of one colour
+ * run in parallel and point 0 may belong to a real spring of another.
+ */
+static void physics_constraints_scalar(
+        physics_body_t *pbody, float dt, uint32_t first, uint32_t last)
+{
+        for (uint32_t i = first; i < last; i++)
+        {
+                uint32_t a = pbody->pidx_a[i];
+                uint32_t b = pbody->pidx_b[i];
+                if (a == b)
+                {
+                        continue;
+                }
+
+                float dx = pbody->px[a] - pbody->px[b];
+                float dy = pbody->py[a] - pbody->py[b];
+                float dz = pbody->pz[a] - pbody->pz[b];
+
+                float len = sqrtf(fmaxf(dx * dx + dy * dy + dz * dz, PHYSICS_EPSILON));
+                float kdt = pbody->pk[i] * dt * dt;
+                float wa  = pbody->pinv_mass[a];
+                float wb  = pbody->pinv_mass[b];
+
+                float c       = len - pbody->prest_distance[i];
+                float dlambda = -(kdt * c + pbody->plambda[i]) / (kdt * (wa + wb) + 1.0f);
+                pbody->plambda[i] += dlambda;
+
+                float s = dlambda / len;
+
+                pbody->px[a] += wa * s * dx;
+                pbody->py[a] += wa * s * dy;
+                pbody->pz[a] += wa * s * dz;
+                pbody->px[b] -= wb * s * dx;
+                pbody->py[b] -= wb * s * dy;
+                pbody->pz[b] -= wb * s * dz;
+        }
+}
+
+#if defined(PLATFORM_X86)
+
+/* no gather instruction before AVX2 */
+PLATFORM_TARGET("sse4.1")
+static inline __m128 physics_gather_sse4(const float *p, const uint32_t *pidx)
+{
+        return _mm_set_ps(p[pidx[3]], p[pidx[2]], p[pidx[1]], p[pidx[0]]);
+}
+
+PLATFORM_TARGET("sse4.1")
+static void physics_forces_clear_sse4(
+        physics_body_t *pbody, uint32_t first, uint32_t last)
+{
+        __m128 g    = _mm_set1_ps(PHYSICS_GRAVITY);
+        __m128 zero = _mm_setzero_ps();
+
+        for (uint32_t i = first; i < last; i += 4)
+        {
+                _mm_store_ps(&pbody->pfx[i], zero);
+                _mm_store_ps(
+                        &pbody->pfy[i], _mm_mul_ps(_mm_load_ps(&pbody->pmass[i]), g));
+                _mm_store_ps(&pbody->pfz[i], zero);
+        }
+}
+
+PLATFORM_TARGET("sse4.1")
+static void physics_springs_sse4(
+        const physics_body_t *pbody,
+        uint32_t first,
+        uint32_t last,
+        float *pfx,
+        float *pfy,
+        float *pfz)
+{
+        const uint32_t *pa = pbody->pidx_a;
+        const uint32_t *pb = pbody->pidx_b;
+        const float *px    = pbody->px;
+        const float *py    = pbody->py;
+        const float *pz    = pbody->pz;
+
+        __m128 eps = _mm_set1_ps(PHYSICS_EPSILON);
+
+        _Alignas(16) float psx[4], psy[4], psz[4];
+
+        for (uint32_t i = first; i < last; i += 4)
+        {
+                __m128 dx = _mm_sub_ps(
+                        physics_gather_sse4(px, &pb[i]), physics_gather_sse4(px, &pa[i]));
+                __m128 dy = _mm_sub_ps(
+                        physics_gather_sse4(py, &pb[i]), physics_gather_sse4(py, &pa[i]));
+                __m128 dz = _mm_sub_ps(
+                        physics_gather_sse4(pz, &pb[i]), physics_gather_sse4(pz, &pa[i]));
+
+                __m128 len2 = _mm_add_ps(
+                        _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                        _mm_mul_ps(dz, dz));
+                __m128 len  = _mm_sqrt_ps(_mm_max_ps(len2, eps));
+                __m128 s    = _mm_div_ps(
+                        _mm_mul_ps(
+                                _mm_load_ps(&pbody->pk[i]),
+                                _mm_sub_ps(len, _mm_load_ps(&pbody->prest_distance[i]))),
+                        len);
+
+                _mm_store_ps(psx, _mm_mul_ps(s, dx));
+                _mm_store_ps(psy, _mm_mul_ps(s, dy));
+                _mm_store_ps(psz, _mm_mul_ps(s, dz));
+
+                /* lanes can share endpoints so the scatter stays scalar */
+                uint32_t n = last - i < 4 ? last - i : 4;
+                for (uint32_t j = 0; j < n; j++)
+                {
+                        uint32_t a = pa[i + j];
+                        uint32_t b = pb[i + j];
+
+                        pfx[a] += psx[j];
+                        pfy[a] += psy[j];
+                        pfz[a] += psz[j];
+                        pfx[b] -= psx[j];
+                        pfy[b] -= psy[j];
+                        pfz[b] -= psz[j];
+                }
+        }
+}
+
+PLATFORM_TARGET("sse4.1")
+static void physics_integrate_sse4(
+        physics_body_t *pbody, float dt, uint32_t first, uint32_t last)
+{
+        __m128 vdt  = _mm_set1_ps(dt);
+        __m128 damp = _mm_set1_ps(1.0f - pbody->damping * dt);
+
+        for (uint32_t i = first; i < last; i += 4)
+        {
+                __m128 s = _mm_mul_ps(vdt, _mm_load_ps(&pbody->pinv_mass[i]));
+
+                __m128 vx = _mm_mul_ps(
+                        _mm_add_ps(
+                                _mm_load_ps(&pbody->pvx[i]),
+                                _mm_mul_ps(s, _mm_load_ps(&pbody->pfx[i]))),
+                        damp);
+                __m128 vy = _mm_mul_ps(
+                        _mm_add_ps(
+                                _mm_load_ps(&pbody->pvy[i]),
+                                _mm_mul_ps(s, _mm_load_ps(&pbody->pfy[i]))),
+                        damp);
+                __m128 vz = _mm_mul_ps(
+                        _mm_add_ps(
+                                _mm_load_ps(&pbody->pvz[i]),
+                                _mm_mul_ps(s, _mm_load_ps(&pbody->pfz[i]))),
+                        damp);
+
+                _mm_store_ps(&pbody->pvx[i], vx);
+                _mm_store_ps(&pbody->pvy[i], vy);
+                _mm_store_ps(&pbody->pvz[i], vz);
+
+                _mm_store_ps(
+                        &pbody->px[i],
+                        _mm_add_ps(_mm_load_ps(&pbody->px[i]), _mm_mul_ps(vdt, vx)));
+                _mm_store_ps(
+                        &pbody->py[i],
+                        _mm_add_ps(_mm_load_ps(&pbody->py[i]), _mm_mul_ps(vdt, vy)));
+                _mm_store_ps(
+                        &pbody->pz[i],
+                        _mm_add_ps(_mm_load_ps(&pbody->pz[i]), _mm_mul_ps(vdt, vz)));
+        }
+}
+
+
+PLATFORM_TARGET("sse4.1")
+static void physics_constraints_sse4(
+        physics_body_t *pbody, float dt, uint32_t first, uint32_t last)
+{
+        const uint32_t *pa = pbody->pidx_a;
+        const uint32_t *pb = pbody->pidx_b;
+
+        __m128 eps  = _mm_set1_ps(PHYSICS_EPSILON);
+        __m128 one  = _mm_set1_ps(1.0f);
+        __m128 dt2  = _mm_set1_ps(dt * dt);
+        __m128 zero = _mm_setzero_ps();
+
+        _Alignas(16) float pax[4], pay[4], paz[4], pbx[4], pby[4], pbz[4];
+
+        for (uint32_t i = first; i < last; i += 4)
+        {
+                __m128 dx = _mm_sub_ps(
+                        physics_gather_sse4(pbody->px, &pa[i]),
+                        physics_gather_sse4(pbody->px, &pb[i]));
+                __m128 dy = _mm_sub_ps(
+                        physics_gather_sse4(pbody->py, &pa[i]),
+                        physics_gather_sse4(pbody->py, &pb[i]));
+                __m128 dz = _mm_sub_ps(
+                        physics_gather_sse4(pbody->pz, &pa[i]),
+                        physics_gather_sse4(pbody->pz, &pb[i]));
+                __m128 wa = physics_gather_sse4(pbody->pinv_mass, &pa[i]);
+                __m128 wb = physics_gather_sse4(pbody->pinv_mass, &pb[i]);
+
+                __m128 len2 = _mm_add_ps(
+                        _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                        _mm_mul_ps(dz, dz));
+                __m128 len    = _mm_sqrt_ps(_mm_max_ps(len2, eps));
+                __m128 kdt    = _mm_mul_ps(_mm_load_ps(&pbody->pk[i]), dt2);
+                __m128 lambda = _mm_load_ps(&pbody->plambda[i]);
+
+                __m128 c       = _mm_sub_ps(len, _mm_load_ps(&pbody->prest_distance[i]));
+                __m128 dlambda = _mm_div_ps(
+                        _mm_sub_ps(zero, _mm_add_ps(_mm_mul_ps(kdt, c), lambda)),
+                        _mm_add_ps(_mm_mul_ps(kdt, _mm_add_ps(wa, wb)), one));
+                _mm_store_ps(&pbody->plambda[i], _mm_add_ps(lambda, dlambda));
+
+                __m128 s  = _mm_div_ps(dlambda, len);
+                __m128 sa = _mm_mul_ps(wa, s);
+                __m128 sb = _mm_mul_ps(wb, s);
+
+                _mm_store_ps(pax, _mm_mul_ps(sa, dx));
+                _mm_store_ps(pay, _mm_mul_ps(sa, dy));
+                _mm_store_ps(paz, _mm_mul_ps(sa, dz));
+                _mm_store_ps(pbx, _mm_mul_ps(sb, dx));
+                _mm_store_ps(pby, _mm_mul_ps(sb, dy));
+                _mm_store_ps(pbz, _mm_mul_ps(sb, dz));
+
+                /* a colour shares no point mass, null springs are skipped */
+                for (uint32_t j = 0; j < 4; j++)
+                {
+                        uint32_t a = pa[i + j];
+                        uint32_t b = pb[i + j];
+                        if (a == b)
+                        {
+                                continue;
+                        }
+
+                        pbody->px[a] += pax[j];
+                        pbody->py[a] += pay[j];
+                        pbody->pz[a] += paz[j];
+                        pbody->px[b] -= pbx[j];
+                        pbody->py[b] -= pby[j];
+                        pbody->pz[b] -= pbz[j];
+                }
+        }
+}
+
+PLATFORM_TARGET("avx2")
+static void physics_forces_clear_avx2(
+        physics_body_t *pbody, uint32_t first, uint32_t last)
+{
+        __m256 g    = _mm256_set1_ps(PHYSICS_GRAVITY);
+        __m256 zero = _mm256_setzero_ps();
+
+        for (uint32_t i = first; i < last; i += 8)
+        {
+                __m256 m = _mm256_load_ps(&pbody->pmass[i]);
+
+                _mm256_store_ps(&pbody->pfx[i], zero);
+                _mm256_store_ps(&pbody->pfy[i], _mm256_mul_ps(m, g));
+                _mm256_store_ps(&pbody->pfz[i], zero);
+        }
+}
+
+PLATFORM_TARGET("avx2")
+static void physics_springs_avx2(
+        const physics_body_t *pbody,
+        uint32_t first,
+        uint32_t last,
+        float *pfx,
+        float *pfy,
+        float *pfz)
+{
+        const uint32_t *pa = pbody->pidx_a;
+        const uint32_t *pb = pbody->pidx_b;
+
+        __m256 eps = _mm256_set1_ps(PHYSICS_EPSILON);
+
+        _Alignas(32) float psx[8], psy[8], psz[8];
+
+        for (uint32_t i = first; i < last; i += 8)
+        {
+                __m256i ia = _mm256_load_si256((const __m256i *) &pa[i]);
+                __m256i ib = _mm256_load_si256((const __m256i *) &pb[i]);
+
+                __m256 dx = _mm256_sub_ps(
+                        _mm256_i32gather_ps(pbody->px, ib, 4),
+                        _mm256_i32gather_ps(pbody->px, ia, 4));
+                __m256 dy = _mm256_sub_ps(
+                        _mm256_i32gather_ps(pbody->py, ib, 4),
+                        _mm256_i32gather_ps(pbody->py, ia, 4));
+                __m256 dz = _mm256_sub_ps(
+                        _mm256_i32gather_ps(pbody->pz, ib, 4),
+                        _mm256_i32gather_ps(pbody->pz, ia, 4));
+
+                __m256 len2 = _mm256_add_ps(
+                        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                        _mm256_mul_ps(dz, dz));
+                __m256 len  = _mm256_sqrt_ps(_mm256_max_ps(len2, eps));
+                __m256 s    = _mm256_div_ps(
+                        _mm256_mul_ps(
+                                _mm256_load_ps(&pbody->pk[i]),
+                                _mm256_sub_ps(
+                                        len, _mm256_load_ps(&pbody->prest_distance[i]))),
+                        len);
+
+                _mm256_store_ps(psx, _mm256_mul_ps(s, dx));
+                _mm256_store_ps(psy, _mm256_mul_ps(s, dy));
+                _mm256_store_ps(psz, _mm256_mul_ps(s, dz));
+
+                /* lanes can share endpoints so the scatter stays scalar */
+                uint32_t n = last - i < 8 ? last - i : 8;
+                for (uint32_t j = 0; j < n; j++)
+                {
+                        uint32_t a = pa[i + j];
+                        uint32_t b = pb[i + j];
+
+                        pfx[a] += psx[j];
+                        pfy[a] += psy[j];
+                        pfz[a] += psz[j];
+                        pfx[b] -= psx[j];
+                        pfy[b] -= psy[j];
+                        pfz[b] -= psz[j];
+                }
+        }
+}
+
+PLATFORM_TARGET("avx2")
+static void physics_integrate_avx2(
+        physics_body_t *pbody, float dt, uint32_t first, uint32_t last)
+{
+        __m256 vdt  = _mm256_set1_ps(dt);
+        __m256 damp = _mm256_set1_ps(1.0f - pbody->damping * dt);
+
+        for (uint32_t i = first; i < last; i += 8)
+        {
+                __m256 s = _mm256_mul_ps(vdt, _mm256_load_ps(&pbody->pinv_mass[i]));
+
+                __m256 vx = _mm256_mul_ps(
+                        _mm256_add_ps(
+                                _mm256_load_ps(&pbody->pvx[i]),
+                                _mm256_mul_ps(s, _mm256_load_ps(&pbody->pfx[i]))),
+                        damp);
+                __m256 vy = _mm256_mul_ps(
+                        _mm256_add_ps(
+                                _mm256_load_ps(&pbody->pvy[i]),
+                                _mm256_mul_ps(s, _mm256_load_ps(&pbody->pfy[i]))),
+                        damp);
+                __m256 vz = _mm256_mul_ps(
+                        _mm256_add_ps(
+                                _mm256_load_ps(&pbody->pvz[i]),
+                                _mm256_mul_ps(s, _mm256_load_ps(&pbody->pfz[i]))),
+                        damp);
+
+                _mm256_store_ps(&pbody->pvx[i], vx);
+                _mm256_store_ps(&pbody->pvy[i], vy);
+                _mm256_store_ps(&pbody->pvz[i], vz);
+
+                _mm256_store_ps(
+                        &pbody->px[i],
+                        _mm256_add_ps(
+                                _mm256_load_ps(&pbody->px[i]), _mm256_mul_ps(vdt, vx)));
+                _mm256_store_ps(
+                        &pbody->py[i],
+                        _mm256_add_ps(
+                                _mm256_load_ps(&pbody->py[i]), _mm256_mul_ps(vdt, vy)));
+                _mm256_store_ps(
+                        &pbody->pz[i],
+                        _mm256_add_ps(
+                                _mm256_load_ps(&pbody->pz[i]), _mm256_mul_ps(vdt, vz)));
+        }
+}
+
+
+PLATFORM_TARGET("avx2")
+static void physics_constraints_avx2(
+        physics_body_t *pbody, float dt, uint32_t first, uint32_t last)
+{
+        const uint32_t *pa = pbody->pidx_a;
+        const uint32_t *pb = pbody->pidx_b;
+
+        __m256 eps  = _mm256_set1_ps(PHYSICS_EPSILON);
+        __m256 one  = _mm256_set1_ps(1.0f);
+        __m256 dt2  = _mm256_set1_ps(dt * dt);
+        __m256 zero = _mm256_setzero_ps();
+
+        _Alignas(32) float pax[8], pay[8], paz[8], pbx[8], pby[8], pbz[8];
+
+        for (uint32_t i = first; i < last; i += 8)
+        {
+                __m256i ia = _mm256_load_si256((const __m256i *) &pa[i]);
+                __m256i ib = _mm256_load_si256((const __m256i *) &pb[i]);
+
+                __m256 dx = _mm256_sub_ps(
+                        _mm256_i32gather_ps(pbody->px, ia, 4),
+                        _mm256_i32gather_ps(pbody->px, ib, 4));
+                __m256 dy = _mm256_sub_ps(
+                        _mm256_i32gather_ps(pbody->py, ia, 4),
+                        _mm256_i32gather_ps(pbody->py, ib, 4));
+                __m256 dz = _mm256_sub_ps(
+                        _mm256_i32gather_ps(pbody->pz, ia, 4),
+                        _mm256_i32gather_ps(pbody->pz, ib, 4));
+                __m256 wa = _mm256_i32gather_ps(pbody->pinv_mass, ia, 4);
+                __m256 wb = _mm256_i32gather_ps(pbody->pinv_mass, ib, 4);
+
+                __m256 len2 = _mm256_add_ps(
+                        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                        _mm256_mul_ps(dz, dz));
+                __m256 len    = _mm256_sqrt_ps(_mm256_max_ps(len2, eps));
+                __m256 kdt    = _mm256_mul_ps(_mm256_load_ps(&pbody->pk[i]), dt2);
+                __m256 lambda = _mm256_load_ps(&pbody->plambda[i]);
+
+                __m256 c = _mm256_sub_ps(len, _mm256_load_ps(&pbody->prest_distance[i]));
+                __m256 dlambda = _mm256_div_ps(
+                        _mm256_sub_ps(zero, _mm256_add_ps(_mm256_mul_ps(kdt, c), lambda)),
+                        _mm256_add_ps(_mm256_mul_ps(kdt, _mm256_add_ps(wa, wb)), one));
+                _mm256_store_ps(&pbody->plambda[i], _mm256_add_ps(lambda, dlambda));
+
+                __m256 s  = _mm256_div_ps(dlambda, len);
+                __m256 sa = _mm256_mul_ps(wa, s);
+                __m256 sb = _mm256_mul_ps(wb, s);
+
+                _mm256_store_ps(pax, _mm256_mul_ps(sa, dx));
+                _mm256_store_ps(pay, _mm256_mul_ps(sa, dy));
+                _mm256_store_ps(paz, _mm256_mul_ps(sa, dz));
+                _mm256_store_ps(pbx, _mm256_mul_ps(sb, dx));
+                _mm256_store_ps(pby, _mm256_mul_ps(sb, dy));
+                _mm256_store_ps(pbz, _mm256_mul_ps(sb, dz));
+
+                /* a colour shares no point mass, null springs are skipped */
+                for (uint32_t j = 0; j < 8; j++)
+                {
+                        uint32_t a = pa[i + j];
+                        uint32_t b = pb[i + j];
+                        if (a == b)
+                        {
+                                continue;
+                        }
+
+                        pbody->px[a] += pax[j];
+                        pbody->py[a] += pay[j];
+                        pbody->pz[a] += paz[j];
+                        pbody->px[b] -= pbx[j];
+                        pbody->py[b] -= pby[j];
+                        pbody->pz[b] -= pbz[j];
+                }
+        }
+}
+/* the lanes of [i, last) in a 16 wide step, ranges are only padded to 8 */
+static inline __mmask16 physics_mask_avx512(uint32_t i, uint32_t last)
+{
+        uint32_t n = last - i;
+        return n >= 16 ? (__mmask16) 0xffff : (__mmask16) ((1u << n) - 1);
+}
+
+PLATFORM_TARGET("avx512f")
+static void physics_forces_clear_avx512(
+        physics_body_t *pbody, uint32_t first, uint32_t last)
+{
+        __m512 g    = _mm512_set1_ps(PHYSICS_GRAVITY);
+        __m512 zero = _mm512_setzero_ps();
+
+        for (uint32_t i = first; i < last; i += 16)
+        {
+                __mmask16 m = physics_mask_avx512(i, last);
+                __m512 mass = _mm512_maskz_loadu_ps(m, &pbody->pmass[i]);
+
+                _mm512_mask_storeu_ps(&pbody->pfx[i], m, zero);
+                _mm512_mask_storeu_ps(&pbody->pfy[i], m, _mm512_mul_ps(mass, g));
+                _mm512_mask_storeu_ps(&pbody->pfz[i], m, zero);
+        }
+}
+
+PLATFORM_TARGET("avx512f")
+static void physics_springs_avx512(
+        const physics_body_t *pbody,
+        uint32_t first,
+        uint32_t last,
+        float *pfx,
+        float *pfy,
+        float *pfz)
+{
+        const uint32_t *pa = pbody->pidx_a;
+        const uint32_t *pb = pbody->pidx_b;
+
+        __m512 eps  = _mm512_set1_ps(PHYSICS_EPSILON);
+        __m512 zero = _mm512_setzero_ps();
+
+        _Alignas(64) float psx[16], psy[16], psz[16];
+
+        for (uint32_t i = first; i < last; i += 16)
+        {
+                __mmask16 m = physics_mask_avx512(i, last);
+                __m512i ia  = _mm512_maskz_loadu_epi32(m, &pa[i]);
+                __m512i ib  = _mm512_maskz_loadu_epi32(m, &pb[i]);
+
+                __m512 dx = _mm512_sub_ps(
+                        _mm512_mask_i32gather_ps(zero, m, ib, pbody->px, 4),
+                        _mm512_mask_i32gather_ps(zero, m, ia, pbody->px, 4));
+                __m512 dy = _mm512_sub_ps(
+                        _mm512_mask_i32gather_ps(zero, m, ib, pbody->py, 4),
+                        _mm512_mask_i32gather_ps(zero, m, ia, pbody->py, 4));
+                __m512 dz = _mm512_sub_ps(
+                        _mm512_mask_i32gather_ps(zero, m, ib, pbody->pz, 4),
+                        _mm512_mask_i32gather_ps(zero, m, ia, pbody->pz, 4));
+
+                __m512 len2 = _mm512_fmadd_ps(
+                        dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+                __m512 len  = _mm512_sqrt_ps(_mm512_max_ps(len2, eps));
+                __m512 s    = _mm512_div_ps(
+                        _mm512_mul_ps(
+                                _mm512_maskz_loadu_ps(m, &pbody->pk[i]),
+                                _mm512_sub_ps(
+                                        len,
+                                        _mm512_maskz_loadu_ps(
+                                                m, &pbody->prest_distance[i]))),
+                        len);
+
+                _mm512_store_ps(psx, _mm512_mul_ps(s, dx));
+                _mm512_store_ps(psy, _mm512_mul_ps(s, dy));
+                _mm512_store_ps(psz, _mm512_mul_ps(s, dz));
+
+                /* lanes can share endpoints so the scatter stays scalar */
+                uint32_t n = last - i < 16 ? last - i : 16;
+                for (uint32_t j = 0; j < n; j++)
+                {
+                        uint32_t a = pa[i + j];
+                        uint32_t b = pb[i + j];
+
+                        pfx[a] += psx[j];
+                        pfy[a] += psy[j];
+                        pfz[a] += psz[j];
+                        pfx[b] -= psx[j];
+                        pfy[b] -= psy[j];
+                        pfz[b] -= psz[j];
+                }
+        }
+}
+
+PLATFORM_TARGET("avx512f")
+static void physics_integrate_avx512(
+        physics_body_t *pbody, float dt, uint32_t first, uint32_t last)
+{
+        __m512 vdt  = _mm512_set1_ps(dt);
+        __m512 damp = _mm512_set1_ps(1.0f - pbody->damping * dt);
+
+        for (uint32_t i = first; i < last; i += 16)
+        {
+                __mmask16 m = physics_mask_avx512(i, last);
+                __m512 s    = _mm512_mul_ps(
+                        vdt, _mm512_maskz_loadu_ps(m, &pbody->pinv_mass[i]));
+
+                __m512 vx = _mm512_mul_ps(
+                        _mm512_fmadd_ps(
+                                s,
+                                _mm512_maskz_loadu_ps(m, &pbody->pfx[i]),
+                                _mm512_maskz_loadu_ps(m, &pbody->pvx[i])),
+                        damp);
+                __m512 vy = _mm512_mul_ps(
+                        _mm512_fmadd_ps(
+                                s,
+                                _mm512_maskz_loadu_ps(m, &pbody->pfy[i]),
+                                _mm512_maskz_loadu_ps(m, &pbody->pvy[i])),
+                        damp);
+                __m512 vz = _mm512_mul_ps(
+                        _mm512_fmadd_ps(
+                                s,
+                                _mm512_maskz_loadu_ps(m, &pbody->pfz[i]),
+                                _mm512_maskz_loadu_ps(m, &pbody->pvz[i])),
+                        damp);
+
+                _mm512_mask_storeu_ps(&pbody->pvx[i], m, vx);
+                _mm512_mask_storeu_ps(&pbody->pvy[i], m, vy);
+                _mm512_mask_storeu_ps(&pbody->pvz[i], m, vz);
+
+                _mm512_mask_storeu_ps(
+                        &pbody->px[i],
+                        m,
+                        _mm512_fmadd_ps(
+                                vdt, vx, _mm512_maskz_loadu_ps(m, &pbody->px[i])));
+                _mm512_mask_storeu_ps(
+                        &pbody->py[i],
+                        m,
+                        _mm512_fmadd_ps(
+                                vdt, vy, _mm512_maskz_loadu_ps(m, &pbody->py[i])));
+                _mm512_mask_storeu_ps(
+                        &pbody->pz[i],
+                        m,
+                        _mm512_fmadd_ps(
+                                vdt, vz, _mm512_maskz_loadu_ps(m, &pbody->pz[i])));
+        }
+}
+
+PLATFORM_TARGET("avx512f")
+static void physics_constraints_avx512(
+        physics_body_t *pbody, float dt, uint32_t first, uint32_t last)
+{
+        const uint32_t *pa = pbody->pidx_a;
+        const uint32_t *pb = pbody->pidx_b;
+
+        __m512 eps  = _mm512_set1_ps(PHYSICS_EPSILON);
+        __m512 one  = _mm512_set1_ps(1.0f);
+        __m512 dt2  = _mm512_set1_ps(dt * dt);
+        __m512 zero = _mm512_setzero_ps();
+
+        _Alignas(64) float pax[16], pay[16], paz[16], pbx[16], pby[16], pbz[16];
+
+        for (uint32_t i = first; i < last; i += 16)
+        {
+                __mmask16 m = physics_mask_avx512(i, last);
+                __m512i ia  = _mm512_maskz_loadu_epi32(m, &pa[i]);
+                __m512i ib  = _mm512_maskz_loadu_epi32(m, &pb[i]);
+
+                __m512 dx = _mm512_sub_ps(
+                        _mm512_mask_i32gather_ps(zero, m, ia, pbody->px, 4),
+                        _mm512_mask_i32gather_ps(zero, m, ib, pbody->px, 4));
+                __m512 dy = _mm512_sub_ps(
+                        _mm512_mask_i32gather_ps(zero, m, ia, pbody->py, 4),
+                        _mm512_mask_i32gather_ps(zero, m, ib, pbody->py, 4));
+                __m512 dz = _mm512_sub_ps(
+                        _mm512_mask_i32gather_ps(zero, m, ia, pbody->pz, 4),
+                        _mm512_mask_i32gather_ps(zero, m, ib, pbody->pz, 4));
+                __m512 wa = _mm512_mask_i32gather_ps(zero, m, ia, pbody->pinv_mass, 4);
+                __m512 wb = _mm512_mask_i32gather_ps(zero, m, ib, pbody->pinv_mass, 4);
+
+                __m512 len2 = _mm512_fmadd_ps(
+                        dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+                __m512 len    = _mm512_sqrt_ps(_mm512_max_ps(len2, eps));
+                __m512 k      = _mm512_maskz_loadu_ps(m, &pbody->pk[i]);
+                __m512 kdt    = _mm512_mul_ps(k, dt2);
+                __m512 lambda = _mm512_maskz_loadu_ps(m, &pbody->plambda[i]);
+
+                __m512 c = _mm512_sub_ps(
+                        len, _mm512_maskz_loadu_ps(m, &pbody->prest_distance[i]));
+                __m512 dlambda = _mm512_div_ps(
+                        _mm512_sub_ps(zero, _mm512_fmadd_ps(kdt, c, lambda)),
+                        _mm512_fmadd_ps(kdt, _mm512_add_ps(wa, wb), one));
+                _mm512_mask_storeu_ps(
+                        &pbody->plambda[i], m, _mm512_add_ps(lambda, dlambda));
+
+                __m512 s  = _mm512_div_ps(dlambda, len);
+                __m512 sa = _mm512_mul_ps(wa, s);
+                __m512 sb = _mm512_mul_ps(wb, s);
+
+                _mm512_store_ps(pax, _mm512_mul_ps(sa, dx));
+                _mm512_store_ps(pay, _mm512_mul_ps(sa, dy));
+                _mm512_store_ps(paz, _mm512_mul_ps(sa, dz));
+                _mm512_store_ps(pbx, _mm512_mul_ps(sb, dx));
+                _mm512_store_ps(pby, _mm512_mul_ps(sb, dy));
+                _mm512_store_ps(pbz, _mm512_mul_ps(sb, dz));
+
+                /* a colour shares no point mass, null springs are skipped */
+                uint32_t n = last - i < 16 ? last - i : 16;
+                for (uint32_t j = 0; j < n; j++)
+                {
+                        uint32_t a = pa[i + j];
+                        uint32_t b = pb[i + j];
+                        if (a == b)
+                        {
+                                continue;
+                        }
+
+                        pbody->px[a] += pax[j];
+                        pbody->py[a] += pay[j];
+                        pbody->pz[a] += paz[j];
+                        pbody->px[b] -= pbx[j];
+                        pbody->py[b] -= pby[j];
+                        pbody->pz[b] -= pbz[j];
+                }
+        }
+}
+#endif
+
+typedef struct
+{
+        void (*pforces_clear)(physics_body_t *pbody, uint32_t first, uint32_t last);
+        void (*psprings)(
+                const physics_body_t *pbody,
+                uint32_t first,
+                uint32_t last,
+                float *pfx,
+                float *pfy,
+                float *pfz);
+        void (*pintegrate)(
+                physics_body_t *pbody, float dt, uint32_t first, uint32_t last);
+        void (*pconstraints)(
+                physics_body_t *pbody, float dt, uint32_t first, uint32_t last);
+} physics_kernels_t;
+
+/* by PLATFORM_ISA_, tiers this build has no kernels for stay empty */
+static const physics_kernels_t physics_kernel_table[PLATFORM_ISA_COUNT] = {
+        [PLATFORM_ISA_SCALAR] =
+                {physics_forces_clear_scalar,
+                 physics_springs_scalar,
+                 physics_integrate_scalar,
+                 physics_constraints_scalar},
+#if defined(PLATFORM_X86)
+        [PLATFORM_ISA_SSE4] =
+                {physics_forces_clear_sse4,
+                 physics_springs_sse4,
+                 physics_integrate_sse4,
+                 physics_constraints_sse4},
+        [PLATFORM_ISA_AVX2] =
+                {physics_forces_clear_avx2,
+                 physics_springs_avx2,
+                 physics_integrate_avx2,
+                 physics_constraints_avx2},
+        [PLATFORM_ISA_AVX512] =
+                {physics_forces_clear_avx512,
+                 physics_springs_avx512,
+                 physics_integrate_avx512,
+                 physics_constraints_avx512},
+#endif
+};
+
+/* scalar until physics_init_kernels picks a tier */
+static platform_isa_t physics_isa = PLATFORM_ISA_SCALAR;
+static physics_kernels_t physics_kernels = {
+        physics_forces_clear_scalar,
+        physics_springs_scalar,
+        physics_integrate_scalar,
+        physics_constraints_scalar};
+
+/*
+ * Picks the widest kernels the cpu runs, or the tier PHYSICS_ISA_ENV names
+ * to compare them. A tier the cpu lacks falls back to the widest it has.
+ * Call it once at startup before anything steps.
+ */
+platform_isa_t physics_init_kernels(void)
+{
+        platform_isa_t isa = platform_isa();
+
+        const char *pname = getenv(PHYSICS_ISA_ENV);
+        if (pname)
+        {
+                platform_isa_t forced = platform_isa_parse(pname);
+                if (forced == PLATFORM_ISA_COUNT || forced > isa)
+                {
+                        fprintf(stderr,
+                                "Cant use %s kernels, using %s.\n",
+                                pname,
+                                platform_isa_names[isa]);
+                }
+                else
+                {
+                        isa = forced;
+                }
+        }
+
+        while (!physics_kernel_table[isa].pforces_clear)
+        {
+                isa--;
+        }
+
+        physics_isa     = isa;
+        physics_kernels = physics_kernel_table[isa];
+        return isa;
+}
+
+static void physics_springs_jacobian(
+        const physics_body_t *pbody,
+        uint32_t first,
+        uint32_t last,
+        float *pqx,
+        float *pqy,
+        float *pqz);
+
+static void physics_body_forces(physics_body_t *pbody)
+{
+        physics_kernels.pforces_clear(pbody, 0, pbody->npadded_point_masses);
+        physics_kernels.psprings(
+                pbody, 0, pbody->nsprings, pbody->pfx, pbody->pfy, pbody->pfz);
+}
+
+/*
+ * Integrators are a list of phases. A phase optionally runs a spring pass
+ * into its target streams, forces or a Jacobian product, and then a point
+ * wise stage. The threaded world splits both halves across workers and the
+ * physics shader runs the same stages, so every path steps alike. xpbd's
+ * constraint pass moves positions in place one colour at a time instead.
+ */
+typedef enum
+{
+        PHYSICS_SPRINGS_NONE,
+        PHYSICS_SPRINGS_FORCES,
+        PHYSICS_SPRINGS_JACOBIAN,
+        PHYSICS_SPRINGS_CONSTRAINTS
+} physics_springs_op_t;
+
+typedef enum
+{
+        PHYSICS_STAGE_SYMPLECTIC,
+        PHYSICS_STAGE_VERLET_DRIFT,
+        PHYSICS_STAGE_VERLET_KICK,
+        PHYSICS_STAGE_RK4_BEGIN,
+        PHYSICS_STAGE_RK4_0,
+        PHYSICS_STAGE_RK4_1,
+        PHYSICS_STAGE_RK4_2,
+        PHYSICS_STAGE_RK4_3,
+        PHYSICS_STAGE_IMPLICIT_BEGIN,
+        PHYSICS_STAGE_IMPLICIT_RHS,
+        PHYSICS_STAGE_IMPLICIT_ITERATE,
+        PHYSICS_STAGE_IMPLICIT_FINISH,
+        PHYSICS_STAGE_XPBD_PREDICT,
+        PHYSICS_STAGE_XPBD_FINISH
+} physics_stage_t;
+
+typedef struct
+{
+        uint8_t springs, stage;
+} physics_phase_t;
+
+#define PHYSICS_MAX_PHASES (3 + PHYSICS_IMPLICIT_ITERATIONS)
+
+uint32_t physics_integrator_phases(
+        physics_integrator_t integrator, physics_phase_t *pphases)
+{
+        uint32_t n = 0;
+
+        switch (integrator)
+        {
+        case PHYSICS_INTEGRATOR_SYMPLECTIC_EULER:
+                pphases[n++] = (physics_phase_t){
+                        PHYSICS_SPRINGS_FORCES, PHYSICS_STAGE_SYMPLECTIC};
+                break;
+        case PHYSICS_INTEGRATOR_VERLET:
+                pphases[n++] = (physics_phase_t){
+                        PHYSICS_SPRINGS_NONE, PHYSICS_STAGE_VERLET_DRIFT};
+                pphases[n++] = (physics_phase_t){
+                        PHYSICS_SPRINGS_FORCES, PHYSICS_STAGE_VERLET_KICK};
+                break;
+        case PHYSICS_INTEGRATOR_RK4:
+                pphases[n++] = (physics_phase_t){
+                        PHYSICS_SPRINGS_NONE, PHYSICS_STAGE_RK4_BEGIN};
+                for (uint32_t i = 0; i < 4; i++)
+                {
+                        pphases[n++] = (physics_phase_t){
+                                PHYSICS_SPRINGS_FORCES, PHYSICS_STAGE_RK4_0 + i};
+                }
+                break;
+        case PHYSICS_INTEGRATOR_IMPLICIT_EULER:
+                pphases[n++] = (physics_phase_t){
+                        PHYSICS_SPRINGS_FORCES, PHYSICS_STAGE_IMPLICIT_BEGIN};
+                pphases[n++] = (physics_phase_t){
+                        PHYSICS_SPRINGS_JACOBIAN, PHYSICS_STAGE_IMPLICIT_RHS};
+                for (uint32_t i = 0; i < PHYSICS_IMPLICIT_ITERATIONS; i++)
+                {
+                        pphases[n++] = (physics_phase_t){
+                                PHYSICS_SPRINGS_JACOBIAN, PHYSICS_STAGE_IMPLICIT_ITERATE};
+                }
+                pphases[n++] = (physics_phase_t){
+                        PHYSICS_SPRINGS_NONE, PHYSICS_STAGE_IMPLICIT_FINISH};
+                break;
+        case PHYSICS_INTEGRATOR_XPBD:
+                pphases[n++] = (physics_phase_t){
+                        PHYSICS_SPRINGS_NONE, PHYSICS_STAGE_XPBD_PREDICT};
+                pphases[n++] = (physics_phase_t){
+                        PHYSICS_SPRINGS_CONSTRAINTS, PHYSICS_STAGE_XPBD_FINISH};
+                break;
+        }
+
+        return n;
+}
+
+/* the streams a spring pass accumulates into */
+static void physics_springs_target(
+        physics_body_t *pbody,
+        physics_springs_op_t op,
+        float **ppfx,
+        float **ppfy,
+        float **ppfz)
+{
+        if (op == PHYSICS_SPRINGS_JACOBIAN)
+        {
+                *ppfx = physics_body_scratch(pbody, PHYSICS_SCRATCH_Q);
+                *ppfy = physics_body_scratch(pbody, PHYSICS_SCRATCH_Q + 1);
+                *ppfz = physics_body_scratch(pbody, PHYSICS_SCRATCH_Q + 2);
+        }
+        else
+        {
+                *ppfx = pbody->pfx;
+                *ppfy = pbody->pfy;
+                *ppfz = pbody->pfz;
+        }
+}
+
+/* resets the target streams, forces start from gravity */
+static void physics_springs_clear(
+        physics_body_t *pbody, physics_springs_op_t op, uint32_t first, uint32_t last)
+{
+        if (op == PHYSICS_SPRINGS_FORCES)
+        {
+                physics_kernels.pforces_clear(pbody, first, last);
+                return;
+        }
+
+        float *pqx, *pqy, *pqz;
+        physics_springs_target(pbody, op, &pqx, &pqy, &pqz);
+        memset(&pqx[first], 0, sizeof(float) * (last - first));
+        memset(&pqy[first], 0, sizeof(float) * (last - first));
+        memset(&pqz[first], 0, sizeof(float) * (last - first));
+}
+
+static void physics_springs_run(
+        const physics_body_t *pbody,
+        physics_springs_op_t op,
+        uint32_t first,
+        uint32_t last,
+        float *pfx,
+        float *pfy,
+        float *pfz)
+{
+        if (op == PHYSICS_SPRINGS_FORCES)
+        {
+                physics_kernels.psprings(pbody, first, last, pfx, pfy, pfz);
+        }
+        else if (op == PHYSICS_SPRINGS_JACOBIAN)
+        {
+                physics_springs_jacobian(pbody, first, last, pfx, pfy, pfz);
+        }
+}
+
+/*
+ * Adds J p to q for every spring, J being the stiffness matrix dF/dx and p
+ * the PHYSICS_SCRATCH_P streams. The transverse term is clamped at zero for
+ * compressed springs so that M - dt^2 J stays positive definite.
+ */
+static void physics_springs_jacobian(
+        const physics_body_t *pbody,
+        uint32_t first,
+        uint32_t last,
+        float *pqx,
+        float *pqy,
+        float *pqz)
+{
+        const float *ppx = physics_body_scratch(pbody, PHYSICS_SCRATCH_P);
+        const float *ppy = physics_body_scratch(pbody, PHYSICS_SCRATCH_P + 1);
+        const float *ppz = physics_body_scratch(pbody, PHYSICS_SCRATCH_P + 2);
+
+        for (uint32_t i = first; i < last; i++)
+        {
+                uint32_t a = pbody->pidx_a[i];
+                uint32_t b = pbody->pidx_b[i];
+
+                float dx = pbody->px[b] - pbody->px[a];
+                float dy = pbody->py[b] - pbody->py[a];
+                float dz = pbody->pz[b] - pbody->pz[a];
+
+                float len = sqrtf(fmaxf(dx * dx + dy * dy + dz * dz, PHYSICS_EPSILON));
+                float t   = fmaxf(1.0f - pbody->prest_distance[i] / len, 0.0f);
+
+                dx /= len;
+                dy /= len;
+                dz /= len;
+
+                float px = ppx[b] - ppx[a];
+                float py = ppy[b] - ppy[a];
+                float pz = ppz[b] - ppz[a];
+                float dp = dx * px + dy * py + dz * pz;
+
+                float k  = pbody->pk[i];
+                float qx = k * (dp * dx + t * (px - dp * dx));
+                float qy = k * (dp * dy + t * (py - dp * dy));
+                float qz = k * (dp * dz + t * (pz - dp * dz));
+
+                pqx[a] += qx;
+                pqy[a] += qy;
+                pqz[a] += qz;
+                pqx[b] -= qx;
+                pqy[b] -= qy;
+                pqz[b] -= qz;
+        }
+}
+
+static void physics_stage_rk4(
+        physics_body_t *pbody, uint32_t step, float dt, uint32_t first, uint32_t last)
+{
+        static const float pweights[4] = {1.0f, 2.0f, 2.0f, 1.0f};
+        static const float pnext[4]    = {0.5f, 0.5f, 1.0f, 0.0f};
+
+        float *pp[3] = {pbody->px, pbody->py, pbody->pz};
+        float *pv[3] = {pbody->pvx, pbody->pvy, pbody->pvz};
+        float *pf[3] = {pbody->pfx, pbody->pfy, pbody->pfz};
+
+        for (uint32_t c = 0; c < 3; c++)
+        {
+                float *px0 = physics_body_scratch(pbody, PHYSICS_SCRATCH_X0 + c);
+                float *pv0 = physics_body_scratch(pbody, PHYSICS_SCRATCH_V0 + c);
+                float *psx = physics_body_scratch(pbody, PHYSICS_SCRATCH_SUM_X + c);
+                float *psv = physics_body_scratch(pbody, PHYSICS_SCRATCH_SUM_V + c);
+                float w    = pweights[step];
+
+                for (uint32_t i = first; i < last; i++)
+                {
+                        float kx = pv[c][i];
+                        float kv = pf[c][i] * pbody->pinv_mass[i] - pbody->damping * kx;
+
+                        psx[i] += w * kx;
+                        psv[i] += w * kv;
+
+                        if (step < 3)
+                        {
+                                pp[c][i] = px0[i] + pnext[step] * dt * kx;
+                                pv[c][i] = pv0[i] + pnext[step] * dt * kv;
+                        }
+                        else
+                        {
+                                pp[c][i] = px0[i] + dt / 6.0f * psx[i];
+                                pv[c][i] = pv0[i] + dt / 6.0f * psv[i];
+                        }
+                }
+        }
+}
+
+/*
+ * Backward Euler solves (M - dt^2 J) dv = dt (f + dt J v) with Jacobi
+ * sweeps preconditioned by m + dt^2 sum(k), a bound on the diagonal.
+ */
+static void physics_stage_implicit(
+        physics_body_t *pbody,
+        physics_stage_t stage,
+        float dt,
+        uint32_t first,
+        uint32_t last)
+{
+        float *pv[3] = {pbody->pvx, pbody->pvy, pbody->pvz};
+        float *pf[3] = {pbody->pfx, pbody->pfy, pbody->pfz};
+        float damp   = 1.0f - pbody->damping * dt;
+
+        const float *pksum = physics_body_scratch(pbody, PHYSICS_SCRATCH_KSUM);
+
+        for (uint32_t c = 0; c < 3; c++)
+        {
+                float *pp  = physics_body_scratch(pbody, PHYSICS_SCRATCH_P + c);
+                float *pq  = physics_body_scratch(pbody, PHYSICS_SCRATCH_Q + c);
+                float *pb  = physics_body_scratch(pbody, PHYSICS_SCRATCH_B + c);
+                float *pdv = physics_body_scratch(pbody, PHYSICS_SCRATCH_DV + c);
+
+                for (uint32_t i = first; i < last; i++)
+                {
+                        float m     = pbody->pmass[i];
+                        float pivot = m + dt * dt * pksum[i];
+                        bool pinned = pbody->pinv_mass[i] == 0.0f;
+
+                        switch (stage)
+                        {
+                        case PHYSICS_STAGE_IMPLICIT_BEGIN:
+                                pp[i] = pv[c][i];
+                                break;
+                        case PHYSICS_STAGE_IMPLICIT_RHS:
+                                pb[i]  = dt * (pf[c][i] + dt * pq[i]);
+                                pdv[i] = pinned ? 0.0f : pb[i] / pivot;
+                                pp[i]  = pdv[i];
+                                break;
+                        case PHYSICS_STAGE_IMPLICIT_ITERATE:
+                        {
+                                float r = pb[i] - (m * pdv[i] - dt * dt * pq[i]);
+                                pdv[i] += pinned ? 0.0f : r / pivot;
+                                pp[i] = pdv[i];
+                                break;
+                        }
+                        case PHYSICS_STAGE_IMPLICIT_FINISH:
+                                pv[c][i] = (pv[c][i] + pdv[i]) * damp;
+                                break;
+                        default:
+                                break;
+                        }
+                }
+        }
+
+        if (stage == PHYSICS_STAGE_IMPLICIT_FINISH)
+        {
+                for (uint32_t i = first; i < last; i++)
+                {
+                        pbody->px[i] += dt * pbody->pvx[i];
+                        pbody->py[i] += dt * pbody->pvy[i];
+                        pbody->pz[i] += dt * pbody->pvz[i];
+                }
+        }
+}
+
+static void physics_stage_verlet(
+        physics_body_t *pbody,
+        physics_stage_t stage,
+        float dt,
+        uint32_t first,
+        uint32_t last)
+{
+        float damp = 1.0f;
+        if (stage == PHYSICS_STAGE_VERLET_KICK)
+        {
+                damp -= pbody->damping * dt;
+        }
+
+        for (uint32_t i = first; i < last; i++)
+        {
+                float s = 0.5f * dt * pbody->pinv_mass[i];
+
+                pbody->pvx[i] = (pbody->pvx[i] + s * pbody->pfx[i]) * damp;
+                pbody->pvy[i] = (pbody->pvy[i] + s * pbody->pfy[i]) * damp;
+                pbody->pvz[i] = (pbody->pvz[i] + s * pbody->pfz[i]) * damp;
+        }
+
+        if (stage == PHYSICS_STAGE_VERLET_DRIFT)
+        {
+                for (uint32_t i = first; i < last; i++)
+                {
+                        pbody->px[i] += dt * pbody->pvx[i];
+                        pbody->py[i] += dt * pbody->pvy[i];
+                        pbody->pz[i] += dt * pbody->pvz[i];
+                }
+        }
+}
+
+/* saves the start state and zeroes the weighted sums */
+static void physics_stage_rk4_begin(physics_body_t *pbody, uint32_t first, uint32_t last)
+{
+        float *pp[3] = {pbody->px, pbody->py, pbody->pz};
+        float *pv[3] = {pbody->pvx, pbody->pvy, pbody->pvz};
+        size_t sz    = sizeof(float) * (last - first);
+
+        for (uint32_t c = 0; c < 3; c++)
+        {
+                float *px0 = physics_body_scratch(pbody, PHYSICS_SCRATCH_X0 + c);
+                float *pv0 = physics_body_scratch(pbody, PHYSICS_SCRATCH_V0 + c);
+                float *psx = physics_body_scratch(pbody, PHYSICS_SCRATCH_SUM_X + c);
+                float *psv = physics_body_scratch(pbody, PHYSICS_SCRATCH_SUM_V + c);
+
+                memcpy(&px0[first], &pp[c][first], sz);
+                memcpy(&pv0[first], &pv[c][first], sz);
+                memset(&psx[first], 0, sz);
+                memset(&psv[first], 0, sz);
+        }
+}
+
+/* predict moves the points ballistically, finish derives velocity from the move */
+static void physics_stage_xpbd(
+        physics_body_t *pbody,
+        physics_stage_t stage,
+        float dt,
+        uint32_t first,
+        uint32_t last)
+{
+        float *pp[3] = {pbody->px, pbody->py, pbody->pz};
+        float *pv[3] = {pbody->pvx, pbody->pvy, pbody->pvz};
+        float damp   = (1.0f - pbody->damping * dt) / dt;
+
+        if (stage == PHYSICS_STAGE_XPBD_PREDICT)
+        {
+                for (uint32_t i = first; i < last; i++)
+                {
+                        if (pbody->pinv_mass[i] > 0.0f)
+                        {
+                                pbody->pvy[i] += dt * PHYSICS_GRAVITY;
+                        }
+                }
+        }
+
+        for (uint32_t c = 0; c < 3; c++)
+        {
+                float *pprev = physics_body_scratch(pbody, PHYSICS_SCRATCH_PREV + c);
+
+                for (uint32_t i = first; i < last; i++)
+                {
+                        if (stage == PHYSICS_STAGE_XPBD_PREDICT)
+                        {
+                                pprev[i] = pp[c][i];
+                                pp[c][i] += dt * pv[c][i];
+                        }
+                        else
+                        {
+                                pv[c][i] = (pp[c][i] - pprev[i]) * damp;
+                        }
+                }
+        }
+}
+
+/* point wise half of a phase over [first, last) */
+void physics_body_stage(
+        physics_body_t *pbody,
+        physics_stage_t stage,
+        float dt,
+        uint32_t first,
+        uint32_t last)
+{
+        switch (stage)
+        {
+        case PHYSICS_STAGE_SYMPLECTIC:
+                physics_kernels.pintegrate(pbody, dt, first, last);
+                break;
+        case PHYSICS_STAGE_VERLET_DRIFT:
+        case PHYSICS_STAGE_VERLET_KICK:
+                physics_stage_verlet(pbody, stage, dt, first, last);
+                break;
+        case PHYSICS_STAGE_RK4_BEGIN:
+                physics_stage_rk4_begin(pbody, first, last);
+                break;
+        case PHYSICS_STAGE_RK4_0:
+        case PHYSICS_STAGE_RK4_1:
+        case PHYSICS_STAGE_RK4_2:
+        case PHYSICS_STAGE_RK4_3:
+                physics_stage_rk4(pbody, stage - PHYSICS_STAGE_RK4_0, dt, first, last);
+                break;
+        case PHYSICS_STAGE_XPBD_PREDICT:
+        case PHYSICS_STAGE_XPBD_FINISH:
+                physics_stage_xpbd(pbody, stage, dt, first, last);
+                break;
+        default:
+                physics_stage_implicit(pbody, stage, dt, first, last);
+                break;
+        }
+}
+
+/* every constraint colour in order, PHYSICS_XPBD_ITERATIONS times */
+static void physics_body_constraints(physics_body_t *pbody, float dt)
+{
+        memset(pbody->plambda, 0, sizeof(float) * pbody->npadded_springs);
+
+        for (uint32_t i = 0; i < PHYSICS_XPBD_ITERATIONS; i++)
+        {
+                for (uint32_t c = 0; c < pbody->ncolors; c++)
+                {
+                        physics_kernels.pconstraints(
+                                pbody,
+                                dt,
+                                pbody->pcolor_offsets[c],
+                                pbody->pcolor_offsets[c + 1]);
+                }
+        }
+}
+
+static void physics_quat_matrix(const float *pq, float pr[3][3])
+{
+        float x = pq[0], y = pq[1], z = pq[2], w = pq[3];
+
+        pr[0][0] = 1.0f - 2.0f * (y * y + z * z);
+        pr[0][1] = 2.0f * (x * y - w * z);
+        pr[0][2] = 2.0f * (x * z + w * y);
+        pr[1][0] = 2.0f * (x * y + w * z);
+        pr[1][1] = 1.0f - 2.0f * (x * x + z * z);
+        pr[1][2] = 2.0f * (y * z - w * x);
+        pr[2][0] = 2.0f * (x * z - w * y);
+        pr[2][1] = 2.0f * (y * z + w * x);
+        pr[2][2] = 1.0f - 2.0f * (x * x + y * y);
+}
+
+/*
+ * Rotational part of pa, iterated from the rotation in pq rather than
+ * found by a full polar decomposition (Muller et al. 2016).
+ */
+static void physics_quat_extract(const float pa[3][3], float *pq, float pr[3][3])
+{
+        for (uint32_t it = 0; it < PHYSICS_CLUSTER_ROTATION_ITERATIONS; it++)
+        {
+                physics_quat_matrix(pq, pr);
+
+                /* sum of the columns' cross products over the sum of their dots */
+                float ox = 0.0f, oy = 0.0f, oz = 0.0f, dot = 0.0f;
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        float rx = pr[0][c], ry = pr[1][c], rz = pr[2][c];
+                        float ax = pa[0][c], ay = pa[1][c], az = pa[2][c];
+
+                        ox += ry * az - rz * ay;
+                        oy += rz * ax - rx * az;
+                        oz += rx * ay - ry * ax;
+                        dot += rx * ax + ry * ay + rz * az;
+                }
+
+                float s = 1.0f / (fabsf(dot) + 1e-9f);
+                ox *= s;
+                oy *= s;
+                oz *= s;
+
+                float angle = sqrtf(ox * ox + oy * oy + oz * oz);
+                if (angle < 1e-9f)
+                {
+                        break;
+                }
+
+                float h = sinf(0.5f * angle) / angle;
+                float dx = ox * h, dy = oy * h, dz = oz * h, dw = cosf(0.5f * angle);
+                float x = pq[0], y = pq[1], z = pq[2], w = pq[3];
+
+                pq[0] = dw * x + dx * w + dy * z - dz * y;
+                pq[1] = dw * y + dy * w + dz * x - dx * z;
+                pq[2] = dw * z + dz * w + dx * y - dy * x;
+                pq[3] = dw * w - dx * x - dy * y - dz * z;
+
+                float inv = 1.0f / sqrtf(pq[0] * pq[0] + pq[1] * pq[1] + pq[2] * pq[2] +
+                                         pq[3] * pq[3]);
+                pq[0] *= inv;
+                pq[1] *= inv;
+                pq[2] *= inv;
+                pq[3] *= inv;
+        }
+
+        physics_quat_matrix(pq, pr);
+}
+
+/*
+ * Shape matching, the end of every step of a body with clusters. Every
+ * cluster's members move to its best fit rigid pose, points in several
+ * clusters to the mean of their goals, and velocities take the correction
+ * so the clusters move as rigid bodies.
+ */
+void physics_body_clusters(physics_body_t *pbody, float dt)
+{
+        float *pgoals = pbody->pcluster_goals;
+        memset(pgoals, 0, sizeof(float[4]) * pbody->npoint_masses);
+
+        for (uint32_t c = 0; c < pbody->nclusters; c++)
+        {
+                uint32_t first = pbody->pcluster_offsets[c];
+                uint32_t last  = pbody->pcluster_offsets[c + 1];
+                float mass = 0.0f, cx = 0.0f, cy = 0.0f, cz = 0.0f;
+
+                for (uint32_t m = first; m < last; m++)
+                {
+                        uint32_t i = pbody->pcluster_members[m];
+                        mass += pbody->pmass[i];
+                        cx += pbody->pmass[i] * pbody->px[i];
+                        cy += pbody->pmass[i] * pbody->py[i];
+                        cz += pbody->pmass[i] * pbody->pz[i];
+                }
+                cx /= mass;
+                cy /= mass;
+                cz /= mass;
+
+                float pa[3][3] = {}, pr[3][3];
+                for (uint32_t m = first; m < last; m++)
+                {
+                        uint32_t i      = pbody->pcluster_members[m];
+                        const float *pq = &pbody->pcluster_rest[m * 3];
+                        float pd[3]     = {
+                                pbody->pmass[i] * (pbody->px[i] - cx),
+                                pbody->pmass[i] * (pbody->py[i] - cy),
+                                pbody->pmass[i] * (pbody->pz[i] - cz)};
+
+                        for (uint32_t r = 0; r < 3; r++)
+                        {
+                                pa[r][0] += pd[r] * pq[0];
+                                pa[r][1] += pd[r] * pq[1];
+                                pa[r][2] += pd[r] * pq[2];
+                        }
+                }
+
+                physics_quat_extract(pa, &pbody->pcluster_quats[c * 4], pr);
+
+                for (uint32_t m = first; m < last; m++)
+                {
+                        float *pgoal    = &pgoals[pbody->pcluster_members[m] * 4];
+                        const float *pq = &pbody->pcluster_rest[m * 3];
+                        float qx = pq[0], qy = pq[1], qz = pq[2];
+
+                        pgoal[0] += cx + pr[0][0] * qx + pr[0][1] * qy + pr[0][2] * qz;
+                        pgoal[1] += cy + pr[1][0] * qx + pr[1][1] * qy + pr[1][2] * qz;
+                        pgoal[2] += cz + pr[2][0] * qx + pr[2][1] * qy + pr[2][2] * qz;
+                        pgoal[3] += 1.0f;
+                }
+        }
+
+        float inv_dt = 1.0f / dt;
+        for (uint32_t i = 0; i < pbody->npoint_masses; i++)
+        {
+                float *pgoal = &pgoals[i * 4];
+
+                /* pinned points stay put */
+                if (pgoal[3] == 0.0f || pbody->pinv_mass[i] == 0.0f)
+                {
+                        continue;
+                }
+
+                float s  = 1.0f / pgoal[3];
+                float dx = pgoal[0] * s - pbody->px[i];
+                float dy = pgoal[1] * s - pbody->py[i];
+                float dz = pgoal[2] * s - pbody->pz[i];
+
+                pbody->px[i] += dx;
+                pbody->py[i] += dy;
+                pbody->pz[i] += dz;
+                pbody->pvx[i] += dx * inv_dt;
+                pbody->pvy[i] += dy * inv_dt;
+                pbody->pvz[i] += dz * inv_dt;
+        }
+}
+
+/* one step of the whole body on the calling thread */
+void physics_body_step(physics_body_t *pbody, float dt)
+{
+        physics_phase_t pphases[PHYSICS_MAX_PHASES];
+        uint32_t nphases = physics_integrator_phases(pbody->integrator, pphases);
+
+        for (uint32_t i = 0; i < nphases; i++)
+        {
+                physics_springs_op_t op = pphases[i].springs;
+
+                if (op == PHYSICS_SPRINGS_CONSTRAINTS)
+                {
+                        physics_body_constraints(pbody, dt);
+                }
+                else if (op != PHYSICS_SPRINGS_NONE)
+                {
+                        float *pfx, *pfy, *pfz;
+                        physics_springs_target(pbody, op, &pfx, &pfy, &pfz);
+                        physics_springs_clear(pbody, op, 0, pbody->npadded_point_masses);
+                        physics_springs_run(pbody, op, 0, pbody->nsprings, pfx, pfy, pfz);
+                }
+
+                physics_body_stage(
+                        pbody, pphases[i].stage, dt, 0, pbody->npadded_point_masses);
+        }
+
+        if (pbody->nclusters)
+        {
+                physics_body_clusters(pbody, dt);
+        }
+}
+
+/*
+ * Fixed timestep accumulator. Frame time goes in, whole steps come out and
+ * anything past max_steps is dropped rather than spiralling.
+ */
+typedef struct
+{
+        float step, accumulator;
+        uint32_t max_steps;
+} physics_clock_t;
+
+static inline uint32_t physics_clock_advance(physics_clock_t *pclock, float dt)
+{
+        float max_accumulator = pclock->step * pclock->max_steps;
+
+        pclock->accumulator = fminf(pclock->accumulator + dt, max_accumulator);
+
+        uint32_t nsteps = (uint32_t) (pclock->accumulator / pclock->step);
+        pclock->accumulator -= nsteps * pclock->step;
+        return nsteps;
+}
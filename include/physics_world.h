@@ -0,0 +1,874 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "collision.h"
+#include "physics.h"
+#include "scheduler.h"
+
+/* bodies with more springs than this are cut into spring partitions */
+#define PHYSICS_WORLD_PARTITION_SPRINGS 16384
+#define PHYSICS_WORLD_BLOCK_POINTS 16384
+/*
+ * A body rests while the mean kinetic energy per unit mass its points would
+ * have moving straight from where the rest window began stays under this,
+ * in J/kg, for the window's steps. Contacts leave velocities on points
+ * that hold still, so the positions tell and not the velocities.
+ */
+#define PHYSICS_WORLD_SLEEP_ENERGY 5e-4f
+#define PHYSICS_WORLD_SLEEP_STEPS 60
+
+typedef enum
+{
+        PHYSICS_WORLD_AWAKE,
+        PHYSICS_WORLD_ASLEEP,
+        /* every point pinned and still, never stepped nor part of an island */
+        PHYSICS_WORLD_PINNED,
+} physics_world_sleep_t;
+
+/*
+ * A contiguous range of one body's springs. The partition accumulates into
+ * private force streams covering only the point masses it touches,
+ * [lo, hi), so partitions never write to shared memory. Entities that went
+ * through entity_reorder keep these windows narrow.
+ */
+typedef struct
+{
+        uint32_t idx_body;
+        uint32_t first, last;
+        uint32_t lo, hi;
+        float *pfx, *pfy, *pfz;
+} physics_partition_t;
+
+/* a range of one partitioned body's point masses, reduced then staged */
+typedef struct
+{
+        uint32_t idx_body;
+        uint32_t first, last;
+} physics_block_t;
+
+/* a range of one colour of a partitioned xpbd body's constraints */
+typedef struct
+{
+        uint32_t idx_body;
+        uint32_t first, last;
+} physics_batch_t;
+
+typedef struct
+{
+        uint32_t nbodies;
+        physics_body_t *pbodies;
+
+        /* body i owns partitions ppartition_offsets[i] .. [i + 1], none if small */
+        uint32_t npartitions;
+        uint32_t *ppartition_offsets;
+        physics_partition_t *ppartitions;
+
+        uint32_t nblocks;
+        physics_block_t *pblocks;
+
+        /* colour c owns batches pcolor_offsets[c] .. [c + 1] across all bodies */
+        uint32_t nbatches, ncolors;
+        uint32_t *pcolor_offsets;
+        physics_batch_t *pbatches;
+
+        /* bodies stepped whole as a single task */
+        uint32_t nsmall_bodies;
+        uint32_t *psmall_bodies;
+
+        /* partitioned bodies with clusters, matched once their phases are done */
+        uint32_t nclustered_bodies;
+        uint32_t *pclustered_bodies;
+
+        /* integrator phases of every body, partitioned bodies run them in lockstep */
+        uint32_t *pnphases;
+        physics_phase_t (*pphases)[PHYSICS_MAX_PHASES];
+        uint32_t nmax_phases;
+
+        /* contacts between and within bodies with a radius, after every step */
+        collision_t collision;
+
+        /*
+         * Sleep, see physics_world_sleep. pasleep holds a physics_world_sleep_t
+         * per body, presting the steps of its rest window, pwindow where its
+         * points were when the window began, by collision point, and pislands
+         * the island a sleeping body went to sleep with. The steps only run
+         * the awake small bodies, partitions, blocks, batches and clustered
+         * bodies, by index into the arrays above and the colours in
+         * pawake_color_offsets.
+         */
+        uint8_t *pasleep;
+        uint32_t *presting, *pislands, *pparents;
+        vec3_t *pwindow;
+        uint8_t *prested;
+        uint32_t nawake_small, nawake_partitions, nawake_blocks, nawake_clustered;
+        uint32_t *pawake_small, *pawake_partitions, *pawake_blocks, *pawake_clustered;
+        uint32_t *pawake_color_offsets, *pawake_batches;
+
+        scheduler_t *psched;
+        float dt;
+        uint32_t idx_phase, idx_iteration;
+} physics_world_t;
+
+/* batches of colour c across the partitioned xpbd bodies, written if pbatches */
+static uint32_t physics_world_color_batches(
+        physics_world_t *pworld, uint32_t c, physics_batch_t *pbatches)
+{
+        uint32_t n = 0;
+
+        for (uint32_t i = 0; i < pworld->nbodies; i++)
+        {
+                physics_body_t *pbody = &pworld->pbodies[i];
+                if (pbody->nsprings <= PHYSICS_WORLD_PARTITION_SPRINGS ||
+                    pbody->integrator != PHYSICS_INTEGRATOR_XPBD || c >= pbody->ncolors)
+                {
+                        continue;
+                }
+
+                uint32_t end  = pbody->pcolor_offsets[c + 1];
+                uint32_t step = PHYSICS_WORLD_PARTITION_SPRINGS;
+                for (uint32_t first = pbody->pcolor_offsets[c]; first < end;
+                     first += step, n++)
+                {
+                        if (pbatches)
+                        {
+                                uint32_t last = MIN(first + step, end);
+                                pbatches[n]   = (physics_batch_t){i, first, last};
+                        }
+                }
+        }
+
+        return n;
+}
+
+static void physics_world_init_batches(physics_world_t *pworld)
+{
+        pworld->pcolor_offsets = calloc(pworld->ncolors + 1, sizeof(uint32_t));
+        if (!pworld->pcolor_offsets)
+        {
+                fprintf(stderr, "Cant allocate world colours.\n");
+                abort();
+        }
+
+        for (uint32_t c = 0; c < pworld->ncolors; c++)
+        {
+                uint32_t n = physics_world_color_batches(pworld, c, NULL);
+                pworld->pcolor_offsets[c + 1] = pworld->pcolor_offsets[c] + n;
+        }
+
+        pworld->nbatches = pworld->pcolor_offsets[pworld->ncolors];
+        pworld->pbatches = malloc(sizeof(physics_batch_t) * (pworld->nbatches + 1));
+        if (!pworld->pbatches)
+        {
+                fprintf(stderr, "Cant allocate world batches.\n");
+                abort();
+        }
+
+        for (uint32_t c = 0; c < pworld->ncolors; c++)
+        {
+                physics_world_color_batches(
+                        pworld, c, &pworld->pbatches[pworld->pcolor_offsets[c]]);
+        }
+}
+
+static void physics_world_init_sleep(physics_world_t *pworld)
+{
+        uint32_t n = pworld->nbodies;
+
+        pworld->pasleep              = calloc(n + 1, sizeof(uint8_t));
+        pworld->prested              = calloc(n + 1, sizeof(uint8_t));
+        pworld->presting             = calloc(n + 1, sizeof(uint32_t));
+        pworld->pislands             = malloc(sizeof(uint32_t) * (n + 1));
+        pworld->pparents             = malloc(sizeof(uint32_t) * (n + 1));
+        pworld->pawake_small         = calloc(n + 1, sizeof(uint32_t));
+        pworld->pawake_clustered     = calloc(n + 1, sizeof(uint32_t));
+        pworld->pawake_partitions    = calloc(pworld->npartitions + 1, sizeof(uint32_t));
+        pworld->pawake_blocks        = calloc(pworld->nblocks + 1, sizeof(uint32_t));
+        pworld->pawake_batches       = calloc(pworld->nbatches + 1, sizeof(uint32_t));
+        pworld->pawake_color_offsets = calloc(pworld->ncolors + 1, sizeof(uint32_t));
+        pworld->pwindow = calloc(pworld->collision.npoints + 1, sizeof(vec3_t));
+        if (!pworld->pasleep || !pworld->prested || !pworld->presting ||
+            !pworld->pislands || !pworld->pparents || !pworld->pwindow ||
+            !pworld->pawake_small || !pworld->pawake_clustered ||
+            !pworld->pawake_partitions ||
+            !pworld->pawake_blocks || !pworld->pawake_batches ||
+            !pworld->pawake_color_offsets)
+        {
+                fprintf(stderr, "Cant allocate world sleep.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+                const physics_body_t *pbody = &pworld->pbodies[i];
+                bool pinned                 = true;
+
+                for (uint32_t j = 0; j < pbody->npoint_masses && pinned; j++)
+                {
+                        pinned = pbody->pinv_mass[j] == 0.0f && pbody->pvx[j] == 0.0f &&
+                                 pbody->pvy[j] == 0.0f && pbody->pvz[j] == 0.0f;
+                }
+
+                pworld->pasleep[i]  = pinned ? PHYSICS_WORLD_PINNED : PHYSICS_WORLD_AWAKE;
+                pworld->pislands[i] = i;
+        }
+}
+
+/* the task lists of the awake bodies, after some fell asleep or woke */
+static void physics_world_compact(physics_world_t *pworld)
+{
+        const uint8_t *pasleep = pworld->pasleep;
+        uint32_t n;
+
+        n = 0;
+        for (uint32_t i = 0; i < pworld->nsmall_bodies; i++)
+        {
+                uint32_t body = pworld->psmall_bodies[i];
+                if (pasleep[body] == PHYSICS_WORLD_AWAKE)
+                {
+                        pworld->pawake_small[n++] = body;
+                }
+        }
+        pworld->nawake_small = n;
+
+        n = 0;
+        for (uint32_t i = 0; i < pworld->nclustered_bodies; i++)
+        {
+                uint32_t body = pworld->pclustered_bodies[i];
+                if (pasleep[body] == PHYSICS_WORLD_AWAKE)
+                {
+                        pworld->pawake_clustered[n++] = body;
+                }
+        }
+        pworld->nawake_clustered = n;
+
+        n = 0;
+        for (uint32_t i = 0; i < pworld->npartitions; i++)
+        {
+                if (pasleep[pworld->ppartitions[i].idx_body] == PHYSICS_WORLD_AWAKE)
+                {
+                        pworld->pawake_partitions[n++] = i;
+                }
+        }
+        pworld->nawake_partitions = n;
+
+        n = 0;
+        for (uint32_t i = 0; i < pworld->nblocks; i++)
+        {
+                if (pasleep[pworld->pblocks[i].idx_body] == PHYSICS_WORLD_AWAKE)
+                {
+                        pworld->pawake_blocks[n++] = i;
+                }
+        }
+        pworld->nawake_blocks = n;
+
+        n                               = 0;
+        pworld->pawake_color_offsets[0] = 0;
+        for (uint32_t c = 0; c < pworld->ncolors; c++)
+        {
+                for (uint32_t i = pworld->pcolor_offsets[c];
+                     i < pworld->pcolor_offsets[c + 1];
+                     i++)
+                {
+                        if (pasleep[pworld->pbatches[i].idx_body] == PHYSICS_WORLD_AWAKE)
+                        {
+                                pworld->pawake_batches[n++] = i;
+                        }
+                }
+                pworld->pawake_color_offsets[c + 1] = n;
+        }
+}
+
+/* takes ownership of the bodies array */
+void physics_world_init(
+        physics_world_t *pworld,
+        scheduler_t *psched,
+        physics_body_t *pbodies,
+        uint32_t nbodies)
+{
+        *pworld = (physics_world_t){
+                .nbodies            = nbodies,
+                .pbodies            = pbodies,
+                .ppartition_offsets = calloc(nbodies + 1, sizeof(uint32_t)),
+                .psmall_bodies      = malloc(sizeof(uint32_t) * (nbodies + 1)),
+                .pclustered_bodies  = malloc(sizeof(uint32_t) * (nbodies + 1)),
+                .pnphases           = malloc(sizeof(uint32_t) * (nbodies + 1)),
+                .pphases            = malloc(sizeof(*pworld->pphases) * (nbodies + 1)),
+                .psched             = psched};
+
+        uint32_t npartitions = 0, nblocks = 0;
+        for (uint32_t i = 0; i < nbodies; i++)
+        {
+                physics_body_t *pbody = &pbodies[i];
+
+                pworld->pnphases[i] =
+                        physics_integrator_phases(pbody->integrator, pworld->pphases[i]);
+
+                if (pbody->nsprings > PHYSICS_WORLD_PARTITION_SPRINGS && pbody->nclusters)
+                {
+                        pworld->pclustered_bodies[pworld->nclustered_bodies++] = i;
+                }
+
+                if (pbody->nsprings <= PHYSICS_WORLD_PARTITION_SPRINGS)
+                {
+                        pworld->psmall_bodies[pworld->nsmall_bodies++] = i;
+                }
+                else if (pbody->integrator == PHYSICS_INTEGRATOR_XPBD)
+                {
+                        pworld->nmax_phases =
+                                MAX(pworld->nmax_phases, pworld->pnphases[i]);
+                        pworld->ncolors = MAX(pworld->ncolors, pbody->ncolors);
+                        nblocks += DIV_UP(
+                                pbody->npadded_point_masses, PHYSICS_WORLD_BLOCK_POINTS);
+                }
+                else
+                {
+                        pworld->nmax_phases =
+                                MAX(pworld->nmax_phases, pworld->pnphases[i]);
+                        npartitions +=
+                                DIV_UP(pbody->nsprings, PHYSICS_WORLD_PARTITION_SPRINGS);
+                        nblocks += DIV_UP(
+                                pbody->npadded_point_masses, PHYSICS_WORLD_BLOCK_POINTS);
+                }
+
+                pworld->ppartition_offsets[i + 1] = npartitions;
+        }
+
+        pworld->npartitions = npartitions;
+        pworld->ppartitions = malloc(sizeof(physics_partition_t) * (npartitions + 1));
+        pworld->nblocks     = nblocks;
+        pworld->pblocks     = malloc(sizeof(physics_block_t) * (nblocks + 1));
+
+        uint32_t idx_partition = 0, idx_block = 0;
+        for (uint32_t i = 0; i < nbodies; i++)
+        {
+                physics_body_t *pbody = &pbodies[i];
+                if (pbody->nsprings <= PHYSICS_WORLD_PARTITION_SPRINGS)
+                {
+                        continue;
+                }
+
+                for (uint32_t first = 0; first < pbody->npadded_point_masses;
+                     first += PHYSICS_WORLD_BLOCK_POINTS)
+                {
+                        uint32_t last = MIN(
+                                first + PHYSICS_WORLD_BLOCK_POINTS,
+                                pbody->npadded_point_masses);
+
+                        pworld->pblocks[idx_block++] = (physics_block_t){i, first, last};
+                }
+
+                if (pbody->integrator == PHYSICS_INTEGRATOR_XPBD)
+                {
+                        continue;
+                }
+
+                for (uint32_t first = 0; first < pbody->nsprings;
+                     first += PHYSICS_WORLD_PARTITION_SPRINGS)
+                {
+                        uint32_t last = MIN(
+                                first + PHYSICS_WORLD_PARTITION_SPRINGS, pbody->nsprings);
+
+                        uint32_t lo = UINT32_MAX, hi = 0;
+                        for (uint32_t j = first; j < last; j++)
+                        {
+                                uint32_t a = pbody->pidx_a[j], b = pbody->pidx_b[j];
+                                lo         = MIN(lo, MIN(a, b));
+                                hi         = MAX(hi, MAX(a, b) + 1);
+                        }
+
+                        float *pforces = malloc(sizeof(float) * 3 * (hi - lo));
+                        if (!pforces)
+                        {
+                                fprintf(stderr, "Cant allocate partition forces.\n");
+                                abort();
+                        }
+
+                        pworld->ppartitions[idx_partition++] = (physics_partition_t){
+                                .idx_body = i,
+                                .first    = first,
+                                .last     = last,
+                                .lo       = lo,
+                                .hi       = hi,
+                                .pfx      = pforces,
+                                .pfy      = pforces + (hi - lo),
+                                .pfz      = pforces + (hi - lo) * 2};
+                }
+        }
+
+        physics_world_init_batches(pworld);
+        collision_init(&pworld->collision, psched, pbodies, nbodies);
+        physics_world_init_sleep(pworld);
+        physics_world_compact(pworld);
+        pworld->collision.pasleep = pworld->pasleep;
+}
+
+void physics_world_free(physics_world_t *pworld)
+{
+        for (uint32_t i = 0; i < pworld->npartitions; i++)
+        {
+                free(pworld->ppartitions[i].pfx);
+        }
+
+        free(pworld->ppartition_offsets);
+        free(pworld->ppartitions);
+        free(pworld->pblocks);
+        free(pworld->psmall_bodies);
+        free(pworld->pclustered_bodies);
+        free(pworld->pnphases);
+        free(pworld->pphases);
+        free(pworld->pcolor_offsets);
+        free(pworld->pbatches);
+        free(pworld->pasleep);
+        free(pworld->prested);
+        free(pworld->presting);
+        free(pworld->pislands);
+        free(pworld->pparents);
+        free(pworld->pwindow);
+        free(pworld->pawake_small);
+        free(pworld->pawake_clustered);
+        free(pworld->pawake_partitions);
+        free(pworld->pawake_blocks);
+        free(pworld->pawake_batches);
+        free(pworld->pawake_color_offsets);
+        collision_free(&pworld->collision);
+        *pworld = (physics_world_t){};
+}
+
+static void physics_world_step_body(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        physics_world_t *pworld = pctx;
+        physics_body_step(&pworld->pbodies[pworld->pawake_small[idx]], pworld->dt);
+}
+
+/* physics_body_step ends with the clusters, partitioned bodies get them here */
+static void physics_world_step_clusters(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        physics_world_t *pworld = pctx;
+        physics_body_t *pbody   = &pworld->pbodies[pworld->pawake_clustered[idx]];
+        physics_body_clusters(pbody, pworld->dt);
+}
+
+/* the current phase of a partitioned body, NULL once it ran out of phases */
+static const physics_phase_t *physics_world_phase(
+        physics_world_t *pworld, uint32_t idx_body)
+{
+        if (pworld->idx_phase >= pworld->pnphases[idx_body])
+        {
+                return NULL;
+        }
+
+        return &pworld->pphases[idx_body][pworld->idx_phase];
+}
+
+static void physics_world_step_partition(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        physics_world_t *pworld         = pctx;
+        uint32_t idx_partition          = pworld->pawake_partitions[idx];
+        physics_partition_t *ppartition = &pworld->ppartitions[idx_partition];
+        uint32_t n                      = ppartition->hi - ppartition->lo;
+
+        const physics_phase_t *pphase = physics_world_phase(pworld, ppartition->idx_body);
+        if (!pphase || pphase->springs == PHYSICS_SPRINGS_NONE ||
+            pphase->springs == PHYSICS_SPRINGS_CONSTRAINTS)
+        {
+                return;
+        }
+
+        memset(ppartition->pfx, 0, sizeof(float) * 3 * n);
+
+        /* shift the window so the kernel can index it with absolute point ids */
+        physics_springs_run(
+                &pworld->pbodies[ppartition->idx_body],
+                pphase->springs,
+                ppartition->first,
+                ppartition->last,
+                ppartition->pfx - ppartition->lo,
+                ppartition->pfy - ppartition->lo,
+                ppartition->pfz - ppartition->lo);
+}
+
+/* sums every partition window overlapping the block, in partition order */
+static void physics_world_step_block(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        physics_world_t *pworld = pctx;
+        physics_block_t *pblock = &pworld->pblocks[pworld->pawake_blocks[idx]];
+        physics_body_t *pbody   = &pworld->pbodies[pblock->idx_body];
+
+        const physics_phase_t *pphase = physics_world_phase(pworld, pblock->idx_body);
+        if (!pphase)
+        {
+                return;
+        }
+
+        if (pphase->springs == PHYSICS_SPRINGS_FORCES ||
+            pphase->springs == PHYSICS_SPRINGS_JACOBIAN)
+        {
+                float *pfx, *pfy, *pfz;
+                physics_springs_target(pbody, pphase->springs, &pfx, &pfy, &pfz);
+                physics_springs_clear(
+                        pbody, pphase->springs, pblock->first, pblock->last);
+
+                uint32_t last = MIN(pblock->last, pbody->npoint_masses);
+
+                for (uint32_t i = pworld->ppartition_offsets[pblock->idx_body];
+                     i < pworld->ppartition_offsets[pblock->idx_body + 1];
+                     i++)
+                {
+                        physics_partition_t *ppartition = &pworld->ppartitions[i];
+
+                        uint32_t lo = MAX(ppartition->lo, pblock->first);
+                        uint32_t hi = MIN(ppartition->hi, last);
+                        for (uint32_t j = lo; j < hi; j++)
+                        {
+                                pfx[j] += ppartition->pfx[j - ppartition->lo];
+                                pfy[j] += ppartition->pfy[j - ppartition->lo];
+                                pfz[j] += ppartition->pfz[j - ppartition->lo];
+                        }
+                }
+        }
+
+        physics_body_stage(pbody, pphase->stage, pworld->dt, pblock->first, pblock->last);
+}
+
+static void physics_world_step_batch(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        physics_world_t *pworld = pctx;
+        physics_batch_t *pbatch = &pworld->pbatches[pworld->pawake_batches[idx]];
+        physics_body_t *pbody   = &pworld->pbodies[pbatch->idx_body];
+
+        const physics_phase_t *pphase = physics_world_phase(pworld, pbatch->idx_body);
+        if (!pphase || pphase->springs != PHYSICS_SPRINGS_CONSTRAINTS)
+        {
+                return;
+        }
+
+        if (pworld->idx_iteration == 0)
+        {
+                memset(&pbody->plambda[pbatch->first],
+                       0,
+                       sizeof(float) * (pbatch->last - pbatch->first));
+        }
+
+        physics_kernels.pconstraints(pbody, pworld->dt, pbatch->first, pbatch->last);
+}
+
+/* colours run one after the other, the batches of one colour in parallel */
+static void physics_world_step_constraints(physics_world_t *pworld, atomic_uint *pcounter)
+{
+        for (uint32_t i = 0; i < PHYSICS_XPBD_ITERATIONS; i++)
+        {
+                pworld->idx_iteration = i;
+
+                for (uint32_t c = 0; c < pworld->ncolors; c++)
+                {
+                        for (uint32_t j = pworld->pawake_color_offsets[c];
+                             j < pworld->pawake_color_offsets[c + 1];
+                             j++)
+                        {
+                                scheduler_submit(
+                                        pworld->psched,
+                                        0,
+                                        physics_world_step_batch,
+                                        pworld,
+                                        j,
+                                        pcounter);
+                        }
+                        scheduler_wait(pworld->psched, 0, pcounter);
+                }
+        }
+}
+
+/*
+ * Counts the steps of an awake body's rest window, a new one begins where
+ * the body is when it moved too far to make the window. The bound holds
+ * the mass weighted mean square distance of the free points.
+ */
+static void physics_world_rest_body(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        physics_world_t *pworld     = pctx;
+        const physics_body_t *pbody = &pworld->pbodies[idx];
+        uint32_t first              = pworld->collision.pfirst_points[idx];
+        vec3_t *pwindow             = &pworld->pwindow[first];
+
+        if (pworld->pasleep[idx] != PHYSICS_WORLD_AWAKE)
+        {
+                return;
+        }
+
+        float span  = PHYSICS_WORLD_SLEEP_STEPS * pworld->dt;
+        float bound = 2.0f * PHYSICS_WORLD_SLEEP_ENERGY * span * span;
+        float sum   = 0.0f, mass = 0.0f;
+        if (pworld->presting[idx])
+        {
+                for (uint32_t i = 0; i < pbody->npoint_masses; i++)
+                {
+                        if (pbody->pinv_mass[i] == 0.0f)
+                        {
+                                continue;
+                        }
+
+                        float dx = pbody->px[i] - pwindow[i].x;
+                        float dy = pbody->py[i] - pwindow[i].y;
+                        float dz = pbody->pz[i] - pwindow[i].z;
+                        sum += pbody->pmass[i] * (dx * dx + dy * dy + dz * dz);
+                        mass += pbody->pmass[i];
+                }
+        }
+
+        if (pworld->presting[idx] && sum <= bound * mass)
+        {
+                pworld->presting[idx] =
+                        MIN(pworld->presting[idx] + 1, PHYSICS_WORLD_SLEEP_STEPS);
+                return;
+        }
+
+        for (uint32_t i = 0; i < pbody->npoint_masses; i++)
+        {
+                pwindow[i] = (vec3_t){pbody->px[i], pbody->py[i], pbody->pz[i]};
+        }
+        pworld->presting[idx] = 1;
+}
+
+static uint32_t physics_world_find(uint32_t *pparents, uint32_t i)
+{
+        while (pparents[i] != i)
+        {
+                pparents[i] = pparents[pparents[i]];
+                i           = pparents[i];
+        }
+
+        return i;
+}
+
+/* pinned bodies hold up anything, they never join islands */
+static void physics_world_union(physics_world_t *pworld, uint32_t a, uint32_t b)
+{
+        if (b == COLLISION_NO_BODY || pworld->pasleep[a] == PHYSICS_WORLD_PINNED ||
+            pworld->pasleep[b] == PHYSICS_WORLD_PINNED)
+        {
+                return;
+        }
+
+        a = physics_world_find(pworld->pparents, a);
+        b = physics_world_find(pworld->pparents, b);
+        pworld->pparents[MAX(a, b)] = MIN(a, b);
+}
+
+/*
+ * Puts islands to sleep and wakes them, after the contacts. An island is
+ * the bodies touching this step and the ones a sleeping body went to sleep
+ * with. It sleeps once every awake body in it rested for
+ * PHYSICS_WORLD_SLEEP_STEPS steps and wakes when one did not, so whatever
+ * moves into a sleeping body wakes it a step later. Must be called from
+ * worker 0.
+ *
+ * The SLEEP_ passes of physics.comp build no islands. A body there only
+ * hears from the bodies it touches this step, so a pile wakes one contact
+ * per step, and a body can sleep while an unrested one it went to sleep
+ * with no longer touches it. Which bodies sleep, and on which step, can
+ * differ between the cpu and gpu paths.
+ */
+static void physics_world_sleep(physics_world_t *pworld)
+{
+        collision_t *pcoll  = &pworld->collision;
+        uint32_t *pparents  = pworld->pparents;
+        atomic_uint counter = 0;
+
+        scheduler_submit_range(
+                pworld->psched,
+                0,
+                physics_world_rest_body,
+                pworld,
+                pworld->nbodies,
+                &counter);
+        scheduler_wait(pworld->psched, 0, &counter);
+
+        for (uint32_t i = 0; i < pworld->nbodies; i++)
+        {
+                pparents[i] = i;
+        }
+        for (uint32_t i = 0; i < pworld->nbodies; i++)
+        {
+                if (pworld->pasleep[i] == PHYSICS_WORLD_ASLEEP)
+                {
+                        physics_world_union(pworld, i, pworld->pislands[i]);
+                }
+        }
+
+        /* collision_step leaves the touches alone when nothing collides */
+        if (pcoll->ncolliding_points)
+        {
+                for (uint32_t i = 0; i < pcoll->ncolliding_points; i++)
+                {
+                        uint32_t g    = pcoll->pitems[i];
+                        uint32_t body = pcoll->ppoint_bodies[g];
+                        physics_world_union(pworld, body, pcoll->ppoint_touches[g]);
+                }
+                for (uint32_t t = 0; t < pcoll->ntriangles; t++)
+                {
+                        uint32_t body = pcoll->ppoint_bodies[pcoll->ptriangles[t * 3]];
+                        physics_world_union(pworld, body, pcoll->ptriangle_touches[t]);
+                }
+        }
+
+        memset(pworld->prested, 1, pworld->nbodies);
+        for (uint32_t i = 0; i < pworld->nbodies; i++)
+        {
+                if (pworld->pasleep[i] == PHYSICS_WORLD_AWAKE &&
+                    pworld->presting[i] < PHYSICS_WORLD_SLEEP_STEPS)
+                {
+                        pworld->prested[physics_world_find(pparents, i)] = 0;
+                }
+        }
+
+        bool changed = false;
+        for (uint32_t i = 0; i < pworld->nbodies; i++)
+        {
+                physics_body_t *pbody = &pworld->pbodies[i];
+                uint32_t island       = physics_world_find(pparents, i);
+                uint8_t asleep        = pworld->pasleep[i];
+
+                if (asleep == PHYSICS_WORLD_PINNED)
+                {
+                        continue;
+                }
+
+                if (asleep == PHYSICS_WORLD_AWAKE && pworld->prested[island])
+                {
+                        size_t sz = sizeof(float) * pbody->npoint_masses;
+                        memset(pbody->pvx, 0, sz);
+                        memset(pbody->pvy, 0, sz);
+                        memset(pbody->pvz, 0, sz);
+                        pworld->pasleep[i] = PHYSICS_WORLD_ASLEEP;
+                        changed            = true;
+                }
+                else if (asleep == PHYSICS_WORLD_ASLEEP && !pworld->prested[island])
+                {
+                        pworld->pasleep[i]  = PHYSICS_WORLD_AWAKE;
+                        pworld->presting[i] = 0;
+                        changed             = true;
+                }
+                pworld->pislands[i] = island;
+        }
+
+        if (changed)
+        {
+                physics_world_compact(pworld);
+        }
+}
+
+/* wakes the island of a body, for when something outside the solver moves it */
+void physics_world_wake(physics_world_t *pworld, uint32_t idx_body)
+{
+        if (pworld->pasleep[idx_body] == PHYSICS_WORLD_PINNED)
+        {
+                return;
+        }
+
+        pworld->presting[idx_body] = 0;
+        if (pworld->pasleep[idx_body] != PHYSICS_WORLD_ASLEEP)
+        {
+                return;
+        }
+
+        uint32_t island = pworld->pislands[idx_body];
+        for (uint32_t i = 0; i < pworld->nbodies; i++)
+        {
+                if (pworld->pasleep[i] == PHYSICS_WORLD_ASLEEP &&
+                    pworld->pislands[i] == island)
+                {
+                        pworld->pasleep[i]  = PHYSICS_WORLD_AWAKE;
+                        pworld->presting[i] = 0;
+                }
+        }
+
+        physics_world_compact(pworld);
+}
+
+/*
+ * Steps every awake body once. Small bodies run whole as independent tasks
+ * next to the first phase of the partitioned ones. Each phase runs its
+ * spring partitions, then reduces them per point block and runs the stage
+ * there. Contacts are resolved once every body has stepped, then islands
+ * that came to rest fall asleep. Must be called from worker 0.
+ */
+void physics_world_step(physics_world_t *pworld, float dt)
+{
+        atomic_uint counter = 0;
+
+        pworld->dt = dt;
+
+        scheduler_submit_range(
+                pworld->psched,
+                0,
+                physics_world_step_body,
+                pworld,
+                pworld->nawake_small,
+                &counter);
+
+        for (uint32_t i = 0; i < pworld->nmax_phases; i++)
+        {
+                pworld->idx_phase = i;
+
+                scheduler_submit_range(
+                        pworld->psched,
+                        0,
+                        physics_world_step_partition,
+                        pworld,
+                        pworld->nawake_partitions,
+                        &counter);
+                scheduler_wait(pworld->psched, 0, &counter);
+
+                /* lockstep phases put every xpbd body's constraints in the same one */
+                const physics_phase_t *pxpbd = NULL;
+                if (pworld->pawake_color_offsets[pworld->ncolors])
+                {
+                        uint32_t first = pworld->pawake_batches[0];
+                        pxpbd          = physics_world_phase(
+                                pworld, pworld->pbatches[first].idx_body);
+                }
+                if (pxpbd && pxpbd->springs == PHYSICS_SPRINGS_CONSTRAINTS)
+                {
+                        physics_world_step_constraints(pworld, &counter);
+                }
+
+                scheduler_submit_range(
+                        pworld->psched,
+                        0,
+                        physics_world_step_block,
+                        pworld,
+                        pworld->nawake_blocks,
+                        &counter);
+                scheduler_wait(pworld->psched, 0, &counter);
+        }
+
+        scheduler_submit_range(
+                pworld->psched,
+                0,
+                physics_world_step_clusters,
+                pworld,
+                pworld->nawake_clustered,
+                &counter);
+        scheduler_wait(pworld->psched, 0, &counter);
+
+        collision_step(&pworld->collision, dt);
+        physics_world_sleep(pworld);
+}
+
+/* runs as many fixed steps as the clock hands out, returns how many */
+uint32_t physics_world_advance(physics_world_t *pworld, physics_clock_t *pclock, float dt)
+{
+        uint32_t nsteps = physics_clock_advance(pclock, dt);
+
+        for (uint32_t i = 0; i < nsteps; i++)
+        {
+                physics_world_step(pworld, pclock->step);
+        }
+
+        return nsteps;
+}
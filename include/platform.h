@@ -0,0 +1,524 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+        #define WIN32_LEAN_AND_MEAN
+        #define NOMINMAX
+        #include <malloc.h>
+        #include <windows.h>
+        #include <psapi.h>
+#else
+        #include <fcntl.h>
+        #include <pthread.h>
+        #include <sched.h>
+        #include <sys/mman.h>
+        #include <sys/resource.h>
+        #include <sys/stat.h>
+        #include <time.h>
+        #include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+        #include <emmintrin.h>
+        #define PLATFORM_PAUSE() _mm_pause()
+#else
+        #define PLATFORM_PAUSE() ((void) 0)
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+        #define PLATFORM_X86
+        #if defined(_MSC_VER) && !defined(__clang__)
+                #include <immintrin.h>
+                #include <intrin.h>
+        #else
+                #include <cpuid.h>
+        #endif
+#endif
+
+/*
+ * Code for a tier above the build's own. Only call it once platform_isa
+ * says the cpu has the tier, cl needs no attribute for intrinsics.
+ */
+#if defined(PLATFORM_X86) && (defined(__GNUC__) || defined(__clang__))
+        #define PLATFORM_TARGET(isa) __attribute__((target(isa)))
+#else
+        #define PLATFORM_TARGET(isa)
+#endif
+
+#define PLATFORM_CACHE_LINE 64
+
+#define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((a) - 1))
+#define DIV_UP(x, a) (((x) + (a) - 1) / (a))
+
+#ifndef MIN
+        #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+        #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+static inline void *platform_aligned_alloc(size_t sz, size_t align)
+{
+#if defined(_WIN32)
+        return _aligned_malloc(sz, align);
+#else
+        return aligned_alloc(align, ALIGN_UP(sz, align));
+#endif
+}
+
+static inline void platform_aligned_free(void *p)
+{
+#if defined(_WIN32)
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+}
+
+#if defined(_WIN32)
+typedef HANDLE platform_thread_t;
+#else
+typedef pthread_t platform_thread_t;
+#endif
+
+typedef void (*platform_thread_fn_t)(void *parg);
+
+typedef struct
+{
+        platform_thread_fn_t pfn;
+        void *parg;
+} platform_thread_start_t;
+
+#if defined(_WIN32)
+static DWORD WINAPI platform_thread_trampoline(LPVOID pstart)
+#else
+static void *platform_thread_trampoline(void *pstart)
+#endif
+{
+        platform_thread_start_t start = *(platform_thread_start_t *) pstart;
+        free(pstart);
+        start.pfn(start.parg);
+        return 0;
+}
+
+static inline void platform_thread_create(
+        platform_thread_t *pthread, platform_thread_fn_t pfn, void *parg)
+{
+        platform_thread_start_t *pstart = malloc(sizeof(platform_thread_start_t));
+        *pstart                         = (platform_thread_start_t){pfn, parg};
+
+#if defined(_WIN32)
+        *pthread = CreateThread(NULL, 0, platform_thread_trampoline, pstart, 0, NULL);
+        if (!*pthread)
+#else
+        if (pthread_create(pthread, NULL, platform_thread_trampoline, pstart) != 0)
+#endif
+        {
+                fprintf(stderr, "Cant create thread.\n");
+                abort();
+        }
+}
+
+static inline void platform_thread_join(platform_thread_t thread)
+{
+#if defined(_WIN32)
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+#else
+        pthread_join(thread, NULL);
+#endif
+}
+
+static inline void platform_yield(void)
+{
+#if defined(_WIN32)
+        SwitchToThread();
+#else
+        sched_yield();
+#endif
+}
+
+#if defined(_WIN32)
+typedef SRWLOCK platform_mutex_t;
+typedef CONDITION_VARIABLE platform_cond_t;
+#else
+typedef pthread_mutex_t platform_mutex_t;
+typedef pthread_cond_t platform_cond_t;
+#endif
+
+static inline void platform_mutex_init(platform_mutex_t *pmutex)
+{
+#if defined(_WIN32)
+        InitializeSRWLock(pmutex);
+#else
+        pthread_mutex_init(pmutex, NULL);
+#endif
+}
+
+static inline void platform_mutex_free(platform_mutex_t *pmutex)
+{
+#if !defined(_WIN32)
+        pthread_mutex_destroy(pmutex);
+#endif
+}
+
+static inline void platform_mutex_lock(platform_mutex_t *pmutex)
+{
+#if defined(_WIN32)
+        AcquireSRWLockExclusive(pmutex);
+#else
+        pthread_mutex_lock(pmutex);
+#endif
+}
+
+static inline void platform_mutex_unlock(platform_mutex_t *pmutex)
+{
+#if defined(_WIN32)
+        ReleaseSRWLockExclusive(pmutex);
+#else
+        pthread_mutex_unlock(pmutex);
+#endif
+}
+
+static inline void platform_cond_init(platform_cond_t *pcond)
+{
+#if defined(_WIN32)
+        InitializeConditionVariable(pcond);
+#else
+        pthread_cond_init(pcond, NULL);
+#endif
+}
+
+static inline void platform_cond_free(platform_cond_t *pcond)
+{
+#if !defined(_WIN32)
+        pthread_cond_destroy(pcond);
+#endif
+}
+
+/* pmutex must be held, it is released while waiting and held again on return */
+static inline void platform_cond_wait(platform_cond_t *pcond, platform_mutex_t *pmutex)
+{
+#if defined(_WIN32)
+        SleepConditionVariableSRW(pcond, pmutex, INFINITE, 0);
+#else
+        pthread_cond_wait(pcond, pmutex);
+#endif
+}
+
+static inline void platform_cond_signal(platform_cond_t *pcond)
+{
+#if defined(_WIN32)
+        WakeConditionVariable(pcond);
+#else
+        pthread_cond_signal(pcond);
+#endif
+}
+
+static inline void platform_cond_broadcast(platform_cond_t *pcond)
+{
+#if defined(_WIN32)
+        WakeAllConditionVariable(pcond);
+#else
+        pthread_cond_broadcast(pcond);
+#endif
+}
+
+/* gives up the core for about ns, for threads polling something slow */
+static inline void platform_sleep_ns(uint64_t ns)
+{
+#if defined(_WIN32)
+        Sleep((DWORD) MAX(ns / 1000000, 1));
+#else
+        struct timespec ts = {
+                .tv_sec  = (time_t) (ns / 1000000000ULL),
+                .tv_nsec = (long) (ns % 1000000000ULL)};
+        nanosleep(&ts, NULL);
+#endif
+}
+
+static inline uint32_t platform_ncores(void)
+{
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors;
+#else
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (uint32_t) n : 1;
+#endif
+}
+
+/* monotonic nanoseconds from an unspecified origin */
+static inline uint64_t platform_time_ns(void)
+{
+#if defined(_WIN32)
+        LARGE_INTEGER freq, now;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&now);
+        return (uint64_t) (now.QuadPart / freq.QuadPart) * 1000000000ULL +
+               (uint64_t) (now.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* high water mark of the process resident set in bytes, 0 when unknown */
+static inline uint64_t platform_peak_memory(void)
+{
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        {
+                return 0;
+        }
+        return counters.PeakWorkingSetSize;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage))
+        {
+                return 0;
+        }
+        /* kilobytes on linux */
+        return (uint64_t) usage.ru_maxrss * 1024;
+#endif
+}
+
+/*
+ * View of a whole file, NULL when it is missing or empty. A copy view is
+ * writable but its writes stay private to the process, pages are copied
+ * as they are first written.
+ */
+static inline void *platform_map(const char *ppath, size_t *psz, bool copy)
+{
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(
+                ppath,
+                GENERIC_READ,
+                FILE_SHARE_READ,
+                NULL,
+                OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL,
+                NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+                return NULL;
+        }
+
+        LARGE_INTEGER sz;
+        HANDLE mapping = NULL;
+        if (GetFileSizeEx(file, &sz) && sz.QuadPart)
+        {
+                mapping = CreateFileMappingA(
+                        file, NULL, copy ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+        }
+        CloseHandle(file);
+        if (!mapping)
+        {
+                return NULL;
+        }
+
+        /* the view keeps the mapping alive */
+        void *p = MapViewOfFile(mapping, copy ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        *psz = (size_t) sz.QuadPart;
+        return p;
+#else
+        int fd = open(ppath, O_RDONLY);
+        if (fd < 0)
+        {
+                return NULL;
+        }
+
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+                int prot = copy ? PROT_READ | PROT_WRITE : PROT_READ;
+                p        = mmap(NULL, st.st_size, prot, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+                return NULL;
+        }
+
+        *psz = st.st_size;
+        return p;
+#endif
+}
+
+static inline void *platform_map_file(const char *ppath, size_t *psz)
+{
+        return platform_map(ppath, psz, false);
+}
+
+static inline void *platform_map_file_copy(const char *ppath, size_t *psz)
+{
+        return platform_map(ppath, psz, true);
+}
+
+/* moves src over dst in one step, readers see the old file or the new one */
+static inline bool platform_replace_file(const char *psrc, const char *pdst)
+{
+#if defined(_WIN32)
+        return MoveFileExA(psrc, pdst, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return rename(psrc, pdst) == 0;
+#endif
+}
+
+static inline void platform_unmap_file(void *p, size_t sz)
+{
+#if defined(_WIN32)
+        UnmapViewOfFile(p);
+#else
+        munmap(p, sz);
+#endif
+}
+
+/* last write time in an os specific unit, 0 when the file is missing */
+static inline uint64_t platform_file_time(const char *ppath)
+{
+#if defined(_WIN32)
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExA(ppath, GetFileExInfoStandard, &data))
+        {
+                return 0;
+        }
+        return (uint64_t) data.ftLastWriteTime.dwHighDateTime << 32 |
+               data.ftLastWriteTime.dwLowDateTime;
+#else
+        struct stat st;
+        if (stat(ppath, &st) != 0)
+        {
+                return 0;
+        }
+        return (uint64_t) st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif
+}
+
+/* index of the highest and lowest set bit, x must not be 0 */
+static inline uint32_t platform_log2(uint64_t x)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long idx;
+        _BitScanReverse64(&idx, x);
+        return idx;
+#else
+        return 63 - __builtin_clzll(x);
+#endif
+}
+
+static inline uint32_t platform_ctz(uint64_t x)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long idx;
+        _BitScanForward64(&idx, x);
+        return idx;
+#else
+        return __builtin_ctzll(x);
+#endif
+}
+
+/* instruction set tiers for runtime dispatch, each implies the ones before it */
+typedef enum
+{
+        PLATFORM_ISA_SCALAR,
+        PLATFORM_ISA_SSE4,
+        PLATFORM_ISA_AVX2,
+        PLATFORM_ISA_AVX512,
+        PLATFORM_ISA_COUNT
+} platform_isa_t;
+
+static const char *const platform_isa_names[PLATFORM_ISA_COUNT] = {
+        [PLATFORM_ISA_SCALAR] = "scalar",
+        [PLATFORM_ISA_SSE4]   = "sse4",
+        [PLATFORM_ISA_AVX2]   = "avx2",
+        [PLATFORM_ISA_AVX512] = "avx512",
+};
+
+#if defined(PLATFORM_X86)
+static inline void platform_cpuid(uint32_t leaf, uint32_t sub, uint32_t pregs[4])
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+        __cpuidex((int *) pregs, leaf, sub);
+#else
+        __cpuid_count(leaf, sub, pregs[0], pregs[1], pregs[2], pregs[3]);
+#endif
+}
+
+/* the register state the os saves on a context switch, xcr0 */
+static inline uint64_t platform_xcr0(void)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+        return _xgetbv(0);
+#else
+        uint32_t lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return (uint64_t) hi << 32 | lo;
+#endif
+}
+#endif
+
+/*
+ * The widest tier the cpu runs. Wide registers also need the os to save
+ * them, a cpu with avx under an os that does not is an sse4 one.
+ */
+static inline platform_isa_t platform_isa(void)
+{
+#if defined(PLATFORM_X86)
+        uint32_t pregs[4];
+        platform_cpuid(0, 0, pregs);
+        uint32_t nleaves = pregs[0];
+
+        platform_cpuid(1, 0, pregs);
+        bool sse4    = pregs[2] >> 19 & 1;
+        bool osxsave = pregs[2] >> 27 & 1;
+        bool avx     = pregs[2] >> 28 & 1;
+        if (!sse4)
+        {
+                return PLATFORM_ISA_SCALAR;
+        }
+
+        uint64_t xcr0 = osxsave ? platform_xcr0() : 0;
+        if (!avx || (xcr0 & 0x6) != 0x6 || nleaves < 7)
+        {
+                return PLATFORM_ISA_SSE4;
+        }
+
+        platform_cpuid(7, 0, pregs);
+        bool avx2    = pregs[1] >> 5 & 1;
+        bool avx512f = pregs[1] >> 16 & 1;
+        if (!avx2)
+        {
+                return PLATFORM_ISA_SSE4;
+        }
+
+        /* opmask and both halves of the 512 bit registers */
+        return avx512f && (xcr0 & 0xe6) == 0xe6 ? PLATFORM_ISA_AVX512 : PLATFORM_ISA_AVX2;
+#else
+        return PLATFORM_ISA_SCALAR;
+#endif
+}
+
+/* PLATFORM_ISA_COUNT for a name that is no tier */
+static inline platform_isa_t platform_isa_parse(const char *pname)
+{
+        for (uint32_t i = 0; i < PLATFORM_ISA_COUNT; i++)
+        {
+                if (!strcmp(pname, platform_isa_names[i]))
+                {
+                        return i;
+                }
+        }
+        return PLATFORM_ISA_COUNT;
+}
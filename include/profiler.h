@@ -0,0 +1,320 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+/* frames kept in the ring, zones past PROFILER_MAX_ZONES in a frame are dropped */
+#define PROFILER_FRAMES 64
+#define PROFILER_MAX_ZONES 512
+#define PROFILER_MAX_STATS 8
+
+/* cpu tracks are worker indices, device zones all go on this one */
+#define PROFILER_TRACK_GPU UINT32_MAX
+
+/* names are not copied, they must outlive the profiler */
+typedef struct
+{
+        const char *pname;
+        uint64_t begin, end;
+        uint32_t idx_track;
+} profiler_zone_t;
+
+/* an open cpu zone, closed with profiler_end on the thread that opened it */
+typedef struct
+{
+        const char *pname;
+        uint64_t begin;
+        uint32_t idx_track;
+} profiler_scope_t;
+
+typedef struct
+{
+        /* the frame the slot holds, UINT64_MAX while unused */
+        uint64_t nframe;
+        uint64_t begin, end;
+        atomic_uint nzones;
+        profiler_zone_t pzones[PROFILER_MAX_ZONES];
+        bool has_stats;
+        uint64_t pstats[PROFILER_MAX_STATS];
+} profiler_frame_t;
+
+/*
+ * Rolling ring of the last PROFILER_FRAMES frames. Zones of the current
+ * frame may be added from any thread, device zones and statistics arrive
+ * frames later and land in their frame as long as it is still in the ring.
+ * Times are platform_time_ns, traces count them from origin.
+ */
+typedef struct
+{
+        profiler_frame_t *pframes;
+        uint64_t nframe;
+        uint64_t origin;
+        uint32_t nstats;
+        const char *const *ppstat_names;
+} profiler_t;
+
+void profiler_init(profiler_t *pprof, uint32_t nstats, const char *const *ppstat_names)
+{
+        if (nstats > PROFILER_MAX_STATS)
+        {
+                fprintf(stderr,
+                        "Cant profile more than %d statistics.\n",
+                        PROFILER_MAX_STATS);
+                abort();
+        }
+
+        *pprof = (profiler_t){
+                .pframes      = malloc(sizeof(profiler_frame_t) * PROFILER_FRAMES),
+                .nframe       = UINT64_MAX,
+                .origin       = platform_time_ns(),
+                .nstats       = nstats,
+                .ppstat_names = ppstat_names};
+        if (!pprof->pframes)
+        {
+                fprintf(stderr, "Cant allocate profiler frames.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < PROFILER_FRAMES; i++)
+        {
+                pprof->pframes[i].nframe = UINT64_MAX;
+        }
+}
+
+void profiler_free(profiler_t *pprof)
+{
+        free(pprof->pframes);
+        *pprof = (profiler_t){};
+}
+
+static profiler_frame_t *profiler_find(profiler_t *pprof, uint64_t nframe)
+{
+        profiler_frame_t *pframe = &pprof->pframes[nframe % PROFILER_FRAMES];
+        return pframe->nframe == nframe ? pframe : NULL;
+}
+
+/* evicts the oldest frame, call before any zone of nframe */
+void profiler_begin_frame(profiler_t *pprof, uint64_t nframe)
+{
+        profiler_frame_t *pframe = &pprof->pframes[nframe % PROFILER_FRAMES];
+
+        pframe->nframe    = nframe;
+        pframe->begin     = platform_time_ns();
+        pframe->end       = 0;
+        pframe->has_stats = false;
+        atomic_store_explicit(&pframe->nzones, 0, memory_order_relaxed);
+
+        pprof->nframe = nframe;
+}
+
+void profiler_add_zone(
+        profiler_t *pprof,
+        uint64_t nframe,
+        const char *pname,
+        uint64_t begin,
+        uint64_t end,
+        uint32_t idx_track)
+{
+        profiler_frame_t *pframe = profiler_find(pprof, nframe);
+        if (!pframe)
+        {
+                return;
+        }
+
+        uint32_t idx =
+                atomic_fetch_add_explicit(&pframe->nzones, 1, memory_order_relaxed);
+        if (idx < PROFILER_MAX_ZONES)
+        {
+                pframe->pzones[idx] = (profiler_zone_t){pname, begin, end, idx_track};
+        }
+}
+
+/* the whole frame is a zone of its own on track 0 */
+void profiler_end_frame(profiler_t *pprof)
+{
+        profiler_frame_t *pframe = profiler_find(pprof, pprof->nframe);
+        if (!pframe)
+        {
+                return;
+        }
+
+        pframe->end = platform_time_ns();
+        profiler_add_zone(pprof, pprof->nframe, "frame", pframe->begin, pframe->end, 0);
+}
+
+profiler_scope_t profiler_begin(profiler_t *pprof, const char *pname, uint32_t idx_track)
+{
+        return (profiler_scope_t){pname, platform_time_ns(), idx_track};
+}
+
+void profiler_end(profiler_t *pprof, profiler_scope_t *pscope)
+{
+        profiler_add_zone(
+                pprof,
+                pprof->nframe,
+                pscope->pname,
+                pscope->begin,
+                platform_time_ns(),
+                pscope->idx_track);
+}
+
+/* pvalues holds the nstats counters the profiler was created with */
+void profiler_set_stats(profiler_t *pprof, uint64_t nframe, const uint64_t *pvalues)
+{
+        profiler_frame_t *pframe = profiler_find(pprof, nframe);
+        if (!pframe)
+        {
+                return;
+        }
+
+        memcpy(pframe->pstats, pvalues, sizeof(uint64_t) * pprof->nstats);
+        pframe->has_stats = true;
+}
+
+/*
+ * Per frame report, zones summed by name and device or host. Device
+ * results lag the frames in flight, so the latest frames report no gpu
+ * zones yet. Returns false once nframe has left the ring.
+ */
+bool profiler_report(profiler_t *pprof, uint64_t nframe, FILE *pfile)
+{
+        profiler_frame_t *pframe = profiler_find(pprof, nframe);
+        if (!pframe)
+        {
+                return false;
+        }
+
+        uint32_t n = MIN(
+                atomic_load_explicit(&pframe->nzones, memory_order_relaxed),
+                PROFILER_MAX_ZONES);
+        fprintf(pfile, "frame %llu:\n", (unsigned long long) nframe);
+
+        /* O(n^2), but n is a frame's worth of zones */
+        for (uint32_t i = 0; i < n; i++)
+        {
+                profiler_zone_t *pzone = &pframe->pzones[i];
+                bool gpu               = pzone->idx_track == PROFILER_TRACK_GPU;
+                bool seen              = false;
+                for (uint32_t j = 0; j < i && !seen; j++)
+                {
+                        profiler_zone_t *pother = &pframe->pzones[j];
+                        seen = (pother->idx_track == PROFILER_TRACK_GPU) == gpu &&
+                               !strcmp(pother->pname, pzone->pname);
+                }
+                if (seen)
+                {
+                        continue;
+                }
+
+                uint64_t total = 0;
+                uint32_t count = 0;
+                for (uint32_t j = i; j < n; j++)
+                {
+                        profiler_zone_t *pother = &pframe->pzones[j];
+                        if ((pother->idx_track == PROFILER_TRACK_GPU) == gpu &&
+                            !strcmp(pother->pname, pzone->pname))
+                        {
+                                total += pother->end - pother->begin;
+                                count++;
+                        }
+                }
+
+                fprintf(pfile,
+                        "        %s %-24s %9.3f ms x%u\n",
+                        gpu ? "gpu" : "cpu",
+                        pzone->pname,
+                        total / 1e6,
+                        count);
+        }
+
+        for (uint32_t i = 0; pframe->has_stats && i < pprof->nstats; i++)
+        {
+                fprintf(pfile,
+                        "        %-28s %12llu\n",
+                        pprof->ppstat_names[i],
+                        (unsigned long long) pframe->pstats[i]);
+        }
+
+        return true;
+}
+
+/*
+ * Writes every frame still in the ring as Chrome trace events, loadable in
+ * chrome://tracing or Perfetto. Host zones go under pid 0 with a thread per
+ * worker, device zones and statistics under pid 1.
+ */
+bool profiler_write_trace(profiler_t *pprof, const char *ppath)
+{
+        FILE *pfile = fopen(ppath, "w");
+        if (!pfile)
+        {
+                fprintf(stderr, "Cant write %s.\n", ppath);
+                return false;
+        }
+
+        fprintf(pfile,
+                "{\"traceEvents\":[\n"
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+                "\"args\":{\"name\":\"cpu\"}},\n"
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"args\":{\"name\":\"gpu\"}}");
+
+        uint64_t last  = pprof->nframe;
+        uint64_t first = last >= PROFILER_FRAMES ? last - PROFILER_FRAMES + 1 : 0;
+        for (uint64_t nframe = first; last != UINT64_MAX && nframe <= last; nframe++)
+        {
+                profiler_frame_t *pframe = profiler_find(pprof, nframe);
+                if (!pframe)
+                {
+                        continue;
+                }
+
+                uint32_t n = MIN(
+                        atomic_load_explicit(&pframe->nzones, memory_order_relaxed),
+                        PROFILER_MAX_ZONES);
+                for (uint32_t i = 0; i < n; i++)
+                {
+                        profiler_zone_t *pzone = &pframe->pzones[i];
+                        bool gpu               = pzone->idx_track == PROFILER_TRACK_GPU;
+
+                        fprintf(pfile,
+                                ",\n{\"name\":\"%s\",\"ph\":\"X\","
+                                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+                                "\"args\":{\"frame\":%llu}}",
+                                pzone->pname,
+                                (int64_t) (pzone->begin - pprof->origin) / 1e3,
+                                (pzone->end - pzone->begin) / 1e3,
+                                gpu,
+                                gpu ? 0 : pzone->idx_track,
+                                (unsigned long long) nframe);
+                }
+
+                if (!pframe->has_stats || !pprof->nstats)
+                {
+                        continue;
+                }
+
+                fprintf(pfile,
+                        ",\n{\"name\":\"pipeline statistics\",\"ph\":\"C\",\"ts\":%.3f,"
+                        "\"pid\":1,\"args\":{",
+                        (int64_t) (pframe->begin - pprof->origin) / 1e3);
+                for (uint32_t i = 0; i < pprof->nstats; i++)
+                {
+                        fprintf(pfile,
+                                "%s\"%s\":%llu",
+                                i ? "," : "",
+                                pprof->ppstat_names[i],
+                                (unsigned long long) pframe->pstats[i]);
+                }
+                fprintf(pfile, "}}");
+        }
+
+        fprintf(pfile, "\n]}\n");
+        return fclose(pfile) == 0;
+}
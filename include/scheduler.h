@@ -0,0 +1,352 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "platform.h"
+
+/* per worker deque capacity, a full deque runs the task inline instead */
+#define SCHEDULER_DEQUE_CAPACITY (1 << 16)
+#define SCHEDULER_MAX_WORKERS 64
+#define SCHEDULER_SPINS_BEFORE_YIELD 64
+/* an idle worker yields this many rounds more before it parks on the condvar */
+#define SCHEDULER_YIELDS_BEFORE_PARK 256
+
+/*
+ * Tasks are a function, a shared context and an index into it so that
+ * fanning out over an array needs no allocation. idx_worker is the worker
+ * running the task, 0 is the thread that created the scheduler.
+ */
+typedef void (*scheduler_fn_t)(void *pctx, uint32_t idx, uint32_t idx_worker);
+
+typedef struct
+{
+        scheduler_fn_t pfn;
+        void *pctx;
+        uint32_t idx;
+        atomic_uint *pcounter;
+} scheduler_task_t;
+
+/* Chase-Lev work stealing deque, the owner pushes and pops at the bottom */
+typedef struct
+{
+        _Alignas(PLATFORM_CACHE_LINE) atomic_llong top;
+        _Alignas(PLATFORM_CACHE_LINE) atomic_llong bottom;
+        scheduler_task_t *ptasks;
+} scheduler_deque_t;
+
+typedef struct scheduler_s scheduler_t;
+
+typedef struct
+{
+        scheduler_t *psched;
+        uint32_t idx_worker;
+} scheduler_worker_t;
+
+struct scheduler_s
+{
+        uint32_t nworkers;
+        scheduler_deque_t *pdeques;
+        scheduler_worker_t *pworkers;
+        platform_thread_t *pthreads;
+        atomic_bool running;
+
+        /* parked workers, submit only takes the lock when some are */
+        platform_mutex_t park_mutex;
+        platform_cond_t park_cond;
+        atomic_uint nparked;
+};
+
+static void scheduler_deque_push(scheduler_deque_t *pdeque, scheduler_task_t task)
+{
+        long long b = atomic_load_explicit(&pdeque->bottom, memory_order_relaxed);
+
+        pdeque->ptasks[b & (SCHEDULER_DEQUE_CAPACITY - 1)] = task;
+        atomic_thread_fence(memory_order_release);
+        atomic_store_explicit(&pdeque->bottom, b + 1, memory_order_relaxed);
+}
+
+static bool scheduler_deque_pop(scheduler_deque_t *pdeque, scheduler_task_t *ptask)
+{
+        long long b = atomic_load_explicit(&pdeque->bottom, memory_order_relaxed) - 1;
+        atomic_store_explicit(&pdeque->bottom, b, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        long long t = atomic_load_explicit(&pdeque->top, memory_order_relaxed);
+
+        if (t > b)
+        {
+                atomic_store_explicit(&pdeque->bottom, b + 1, memory_order_relaxed);
+                return false;
+        }
+
+        *ptask = pdeque->ptasks[b & (SCHEDULER_DEQUE_CAPACITY - 1)];
+        if (t < b)
+        {
+                return true;
+        }
+
+        /* last task, race the thieves for it */
+        bool won = atomic_compare_exchange_strong_explicit(
+                &pdeque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&pdeque->bottom, b + 1, memory_order_relaxed);
+        return won;
+}
+
+static bool scheduler_deque_steal(scheduler_deque_t *pdeque, scheduler_task_t *ptask)
+{
+        long long t = atomic_load_explicit(&pdeque->top, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        long long b = atomic_load_explicit(&pdeque->bottom, memory_order_acquire);
+
+        if (t >= b)
+        {
+                return false;
+        }
+
+        *ptask = pdeque->ptasks[t & (SCHEDULER_DEQUE_CAPACITY - 1)];
+        return atomic_compare_exchange_strong_explicit(
+                &pdeque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+static void scheduler_run(scheduler_task_t *ptask, uint32_t idx_worker)
+{
+        ptask->pfn(ptask->pctx, ptask->idx, idx_worker);
+        atomic_fetch_sub_explicit(ptask->pcounter, 1, memory_order_release);
+}
+
+/* pops local work first, then steals starting from the next worker over */
+static bool scheduler_try_run_one(scheduler_t *psched, uint32_t idx_worker)
+{
+        scheduler_task_t task;
+
+        if (scheduler_deque_pop(&psched->pdeques[idx_worker], &task))
+        {
+                scheduler_run(&task, idx_worker);
+                return true;
+        }
+
+        for (uint32_t i = 1; i < psched->nworkers; i++)
+        {
+                uint32_t victim = (idx_worker + i) % psched->nworkers;
+                if (scheduler_deque_steal(&psched->pdeques[victim], &task))
+                {
+                        scheduler_run(&task, idx_worker);
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+static bool scheduler_has_work(scheduler_t *psched)
+{
+        for (uint32_t i = 0; i < psched->nworkers; i++)
+        {
+                scheduler_deque_t *pdeque = &psched->pdeques[i];
+                if (atomic_load_explicit(&pdeque->bottom, memory_order_relaxed) >
+                    atomic_load_explicit(&pdeque->top, memory_order_relaxed))
+                {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/*
+ * nparked is raised before the deques are checked and submit reads it after
+ * its push, both behind seq_cst, so either the worker sees the task or the
+ * submitter sees the worker and signals under the lock.
+ */
+static void scheduler_park(scheduler_t *psched)
+{
+        platform_mutex_lock(&psched->park_mutex);
+        atomic_fetch_add_explicit(&psched->nparked, 1, memory_order_seq_cst);
+
+        if (atomic_load_explicit(&psched->running, memory_order_seq_cst) &&
+            !scheduler_has_work(psched))
+        {
+                platform_cond_wait(&psched->park_cond, &psched->park_mutex);
+        }
+
+        atomic_fetch_sub_explicit(&psched->nparked, 1, memory_order_relaxed);
+        platform_mutex_unlock(&psched->park_mutex);
+}
+
+static void scheduler_unpark(scheduler_t *psched)
+{
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!atomic_load_explicit(&psched->nparked, memory_order_relaxed))
+        {
+                return;
+        }
+
+        platform_mutex_lock(&psched->park_mutex);
+        platform_cond_signal(&psched->park_cond);
+        platform_mutex_unlock(&psched->park_mutex);
+}
+
+static void scheduler_worker_main(void *parg)
+{
+        scheduler_worker_t *pworker = parg;
+        scheduler_t *psched         = pworker->psched;
+        uint32_t nidle              = 0;
+
+        while (atomic_load_explicit(&psched->running, memory_order_relaxed))
+        {
+                if (scheduler_try_run_one(psched, pworker->idx_worker))
+                {
+                        nidle = 0;
+                }
+                else if (++nidle < SCHEDULER_SPINS_BEFORE_YIELD)
+                {
+                        PLATFORM_PAUSE();
+                }
+                else if (nidle <
+                         SCHEDULER_SPINS_BEFORE_YIELD + SCHEDULER_YIELDS_BEFORE_PARK)
+                {
+                        platform_yield();
+                }
+                else
+                {
+                        scheduler_park(psched);
+                        nidle = 0;
+                }
+        }
+}
+
+/* nworkers counts the calling thread, 0 picks one per core */
+void scheduler_init(scheduler_t *psched, uint32_t nworkers)
+{
+        if (!nworkers)
+        {
+                nworkers = platform_ncores();
+        }
+        if (nworkers > SCHEDULER_MAX_WORKERS)
+        {
+                nworkers = SCHEDULER_MAX_WORKERS;
+        }
+
+        psched->nworkers = nworkers;
+        psched->pdeques  = platform_aligned_alloc(
+                sizeof(scheduler_deque_t) * nworkers, PLATFORM_CACHE_LINE);
+        psched->pworkers = malloc(sizeof(scheduler_worker_t) * nworkers);
+        psched->pthreads = malloc(sizeof(platform_thread_t) * nworkers);
+        if (!psched->pdeques || !psched->pworkers || !psched->pthreads)
+        {
+                fprintf(stderr, "Cant allocate scheduler.\n");
+                abort();
+        }
+
+        atomic_init(&psched->running, true);
+        atomic_init(&psched->nparked, 0);
+        platform_mutex_init(&psched->park_mutex);
+        platform_cond_init(&psched->park_cond);
+
+        for (uint32_t i = 0; i < nworkers; i++)
+        {
+                scheduler_deque_t *pdeque = &psched->pdeques[i];
+
+                atomic_init(&pdeque->top, 0);
+                atomic_init(&pdeque->bottom, 0);
+                pdeque->ptasks =
+                        malloc(sizeof(scheduler_task_t) * SCHEDULER_DEQUE_CAPACITY);
+                if (!pdeque->ptasks)
+                {
+                        fprintf(stderr, "Cant allocate scheduler deque.\n");
+                        abort();
+                }
+
+                psched->pworkers[i] = (scheduler_worker_t){psched, i};
+        }
+
+        for (uint32_t i = 1; i < nworkers; i++)
+        {
+                platform_thread_create(
+                        &psched->pthreads[i],
+                        scheduler_worker_main,
+                        &psched->pworkers[i]);
+        }
+}
+
+void scheduler_free(scheduler_t *psched)
+{
+        atomic_store(&psched->running, false);
+
+        platform_mutex_lock(&psched->park_mutex);
+        platform_cond_broadcast(&psched->park_cond);
+        platform_mutex_unlock(&psched->park_mutex);
+
+        for (uint32_t i = 1; i < psched->nworkers; i++)
+        {
+                platform_thread_join(psched->pthreads[i]);
+        }
+
+        for (uint32_t i = 0; i < psched->nworkers; i++)
+        {
+                free(psched->pdeques[i].ptasks);
+        }
+
+        platform_cond_free(&psched->park_cond);
+        platform_mutex_free(&psched->park_mutex);
+        platform_aligned_free(psched->pdeques);
+        free(psched->pworkers);
+        free(psched->pthreads);
+        *psched = (scheduler_t){};
+}
+
+/* must be called from worker idx_worker, which owns the deque pushed to */
+void scheduler_submit(
+        scheduler_t *psched,
+        uint32_t idx_worker,
+        scheduler_fn_t pfn,
+        void *pctx,
+        uint32_t idx,
+        atomic_uint *pcounter)
+{
+        scheduler_deque_t *pdeque = &psched->pdeques[idx_worker];
+        scheduler_task_t task     = {pfn, pctx, idx, pcounter};
+
+        atomic_fetch_add_explicit(pcounter, 1, memory_order_relaxed);
+
+        long long b = atomic_load_explicit(&pdeque->bottom, memory_order_relaxed);
+        long long t = atomic_load_explicit(&pdeque->top, memory_order_acquire);
+        if (b - t >= SCHEDULER_DEQUE_CAPACITY)
+        {
+                scheduler_run(&task, idx_worker);
+                return;
+        }
+
+        scheduler_deque_push(pdeque, task);
+        scheduler_unpark(psched);
+}
+
+/* fans pfn out over [0, n) */
+void scheduler_submit_range(
+        scheduler_t *psched,
+        uint32_t idx_worker,
+        scheduler_fn_t pfn,
+        void *pctx,
+        uint32_t n,
+        atomic_uint *pcounter)
+{
+        for (uint32_t i = 0; i < n; i++)
+        {
+                scheduler_submit(psched, idx_worker, pfn, pctx, i, pcounter);
+        }
+}
+
+/* runs tasks on the calling worker until the counter drains */
+void scheduler_wait(scheduler_t *psched, uint32_t idx_worker, atomic_uint *pcounter)
+{
+        while (atomic_load_explicit(pcounter, memory_order_acquire) != 0)
+        {
+                if (!scheduler_try_run_one(psched, idx_worker))
+                {
+                        PLATFORM_PAUSE();
+                }
+        }
+}
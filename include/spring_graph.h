@@ -0,0 +1,356 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "physics.h"
+
+/*
+ * Compressed sparse row adjacency over an entity's springs. The neighbours
+ * of point mass i are pneighbors[poffsets[i]] .. pneighbors[poffsets[i + 1]]
+ * and pspring_ids holds the spring joining each pair.
+ */
+typedef struct
+{
+        uint32_t npoint_masses, nsprings;
+        uint32_t *poffsets;
+        uint32_t *pneighbors;
+        uint32_t *pspring_ids;
+} spring_graph_t;
+
+typedef enum
+{
+        SPRING_GRAPH_ORDER_RCM,
+        SPRING_GRAPH_ORDER_MORTON
+} spring_graph_order_t;
+
+void spring_graph_init(spring_graph_t *pgraph, const entity_t *pentity)
+{
+        uint32_t npoints = pentity->npoint_masses;
+
+        pgraph->npoint_masses = npoints;
+        pgraph->nsprings      = pentity->nsprings;
+        pgraph->poffsets      = calloc(npoints + 1, sizeof(uint32_t));
+        pgraph->pneighbors    = malloc(sizeof(uint32_t) * 2 * pentity->nsprings);
+        pgraph->pspring_ids   = malloc(sizeof(uint32_t) * 2 * pentity->nsprings);
+        if (!pgraph->poffsets || (pentity->nsprings && !pgraph->pneighbors) ||
+            (pentity->nsprings && !pgraph->pspring_ids))
+        {
+                fprintf(stderr, "Cant allocate spring graph.\n");
+                abort();
+        }
+
+        /* degree count, exclusive scan, then fill */
+        for (uint32_t i = 0; i < pentity->nsprings; i++)
+        {
+                pgraph->poffsets[pentity->psprings[i].idx_a + 1]++;
+                pgraph->poffsets[pentity->psprings[i].idx_b + 1]++;
+        }
+
+        for (uint32_t i = 0; i < npoints; i++)
+        {
+                pgraph->poffsets[i + 1] += pgraph->poffsets[i];
+        }
+
+        uint32_t *pcursor = malloc(sizeof(uint32_t) * (npoints + 1));
+        memcpy(pcursor, pgraph->poffsets, sizeof(uint32_t) * (npoints + 1));
+
+        for (uint32_t i = 0; i < pentity->nsprings; i++)
+        {
+                uint32_t a = pentity->psprings[i].idx_a;
+                uint32_t b = pentity->psprings[i].idx_b;
+
+                pgraph->pneighbors[pcursor[a]]    = b;
+                pgraph->pspring_ids[pcursor[a]++] = i;
+                pgraph->pneighbors[pcursor[b]]    = a;
+                pgraph->pspring_ids[pcursor[b]++] = i;
+        }
+
+        free(pcursor);
+}
+
+void spring_graph_free(spring_graph_t *pgraph)
+{
+        free(pgraph->poffsets);
+        free(pgraph->pneighbors);
+        free(pgraph->pspring_ids);
+        *pgraph = (spring_graph_t){};
+}
+
+static inline uint32_t spring_graph_degree(const spring_graph_t *pgraph, uint32_t i)
+{
+        return pgraph->poffsets[i + 1] - pgraph->poffsets[i];
+}
+
+/* breadth first search from root, returns the last point mass reached */
+static uint32_t spring_graph_bfs(
+        const spring_graph_t *pgraph,
+        uint32_t root,
+        uint32_t *pqueue,
+        uint32_t *plevel,
+        uint32_t *pnlevels)
+{
+        for (uint32_t i = 0; i < pgraph->npoint_masses; i++)
+        {
+                plevel[i] = UINT32_MAX;
+        }
+
+        uint32_t head = 0, tail = 0, last = root;
+
+        plevel[root]   = 0;
+        pqueue[tail++] = root;
+        while (head < tail)
+        {
+                uint32_t i = pqueue[head++];
+                last       = i;
+
+                for (uint32_t j = pgraph->poffsets[i]; j < pgraph->poffsets[i + 1]; j++)
+                {
+                        uint32_t n = pgraph->pneighbors[j];
+                        if (plevel[n] == UINT32_MAX)
+                        {
+                                plevel[n]      = plevel[i] + 1;
+                                pqueue[tail++] = n;
+                        }
+                }
+        }
+
+        *pnlevels = plevel[last] + 1;
+        return last;
+}
+
+/*
+ * Reverse Cuthill-McKee. pperm[new] = old. Each connected component is
+ * started from a pseudo-peripheral point mass so the bandwidth stays small.
+ */
+void spring_graph_order_rcm(const spring_graph_t *pgraph, uint32_t *pperm)
+{
+        uint32_t npoints = pgraph->npoint_masses;
+
+        uint32_t *pqueue  = malloc(sizeof(uint32_t) * (npoints + 1));
+        uint32_t *plevel  = malloc(sizeof(uint32_t) * (npoints + 1));
+        bool *pvisited    = calloc(npoints + 1, sizeof(bool));
+        uint32_t nordered = 0;
+
+        for (uint32_t seed = 0; seed < npoints; seed++)
+        {
+                if (pvisited[seed])
+                {
+                        continue;
+                }
+
+                /* walk to the far end of the component until depth stops growing */
+                uint32_t root = seed, nlevels = 0, nlevels_next = 0;
+                uint32_t end  = spring_graph_bfs(pgraph, root, pqueue, plevel, &nlevels);
+                for (uint32_t i = 0; i < 8; i++)
+                {
+                        uint32_t next = spring_graph_bfs(
+                                pgraph, end, pqueue, plevel, &nlevels_next);
+                        if (nlevels_next <= nlevels)
+                        {
+                                break;
+                        }
+
+                        root    = end;
+                        end     = next;
+                        nlevels = nlevels_next;
+                }
+
+                /* Cuthill-McKee: visit unvisited neighbours by increasing degree */
+                uint32_t head = nordered;
+
+                pvisited[root]    = true;
+                pperm[nordered++] = root;
+                while (head < nordered)
+                {
+                        uint32_t i     = pperm[head++];
+                        uint32_t first = nordered;
+                        uint32_t last  = pgraph->poffsets[i + 1];
+
+                        for (uint32_t j = pgraph->poffsets[i]; j < last; j++)
+                        {
+                                uint32_t n = pgraph->pneighbors[j];
+                                if (!pvisited[n])
+                                {
+                                        pvisited[n]       = true;
+                                        pperm[nordered++] = n;
+                                }
+                        }
+
+                        for (uint32_t j = first + 1; j < nordered; j++)
+                        {
+                                uint32_t n   = pperm[j];
+                                uint32_t deg = spring_graph_degree(pgraph, n);
+                                uint32_t k   = j;
+                                while (k > first &&
+                                       spring_graph_degree(pgraph, pperm[k - 1]) > deg)
+                                {
+                                        pperm[k] = pperm[k - 1];
+                                        k--;
+                                }
+                                pperm[k] = n;
+                        }
+                }
+        }
+
+        for (uint32_t i = 0; i < npoints / 2; i++)
+        {
+                uint32_t tmp           = pperm[i];
+                pperm[i]               = pperm[npoints - 1 - i];
+                pperm[npoints - 1 - i] = tmp;
+        }
+
+        free(pqueue);
+        free(plevel);
+        free(pvisited);
+}
+
+static inline uint64_t spring_graph_morton_spread(uint32_t v)
+{
+        uint64_t x = v & 0x1fffff;
+        x          = (x | x << 32) & 0x1f00000000ffffULL;
+        x          = (x | x << 16) & 0x1f0000ff0000ffULL;
+        x          = (x | x << 8) & 0x100f00f00f00f00fULL;
+        x          = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+        x          = (x | x << 2) & 0x1249249249249249ULL;
+        return x;
+}
+
+static int spring_graph_cmp_u64_pair(const void *pl, const void *pr)
+{
+        const uint64_t *l = pl, *r = pr;
+        return (l[0] > r[0]) - (l[0] < r[0]);
+}
+
+/* Morton order of the current point mass positions. pperm[new] = old. */
+void spring_graph_order_morton(const entity_t *pentity, uint32_t *pperm)
+{
+        uint32_t npoints = pentity->npoint_masses;
+        if (!npoints)
+        {
+                return;
+        }
+
+        vec3_t lo = pentity->ppoint_masses[0].position;
+        vec3_t hi = lo;
+        for (uint32_t i = 1; i < npoints; i++)
+        {
+                vec3_t p = pentity->ppoint_masses[i].position;
+                lo       = (vec3_t){fminf(lo.x, p.x), fminf(lo.y, p.y), fminf(lo.z, p.z)};
+                hi       = (vec3_t){fmaxf(hi.x, p.x), fmaxf(hi.y, p.y), fmaxf(hi.z, p.z)};
+        }
+
+        float extent = fmaxf(fmaxf(hi.x - lo.x, hi.y - lo.y), fmaxf(hi.z - lo.z, 1e-6f));
+        float scale  = (float) 0x1fffff / extent;
+
+        /* (code, index) pairs */
+        uint64_t *pkeys = malloc(sizeof(uint64_t) * 2 * npoints);
+        for (uint32_t i = 0; i < npoints; i++)
+        {
+                vec3_t p = pentity->ppoint_masses[i].position;
+
+                uint64_t x = spring_graph_morton_spread((p.x - lo.x) * scale);
+                uint64_t y = spring_graph_morton_spread((p.y - lo.y) * scale);
+                uint64_t z = spring_graph_morton_spread((p.z - lo.z) * scale);
+
+                pkeys[i * 2]     = x | y << 1 | z << 2;
+                pkeys[i * 2 + 1] = i;
+        }
+
+        qsort(pkeys, npoints, sizeof(uint64_t) * 2, spring_graph_cmp_u64_pair);
+
+        for (uint32_t i = 0; i < npoints; i++)
+        {
+                pperm[i] = (uint32_t) pkeys[i * 2 + 1];
+        }
+
+        free(pkeys);
+}
+
+static int spring_graph_cmp_spring(const void *pl, const void *pr)
+{
+        const spring_t *l = pl, *r = pr;
+        if (l->idx_a != r->idx_a)
+        {
+                return l->idx_a < r->idx_a ? -1 : 1;
+        }
+        return (l->idx_b > r->idx_b) - (l->idx_b < r->idx_b);
+}
+
+/*
+ * Renumbers the entity's point masses in the requested order, with its
+ * surface and clusters, and then sorts its springs by (lower endpoint,
+ * higher endpoint), so the force loop walks the point mass streams nearly
+ * sequentially. Returns the permutation it applied, pperm[new] = old,
+ * which the caller frees.
+ */
+uint32_t *entity_reorder(entity_t *pentity, spring_graph_order_t order)
+{
+        uint32_t npoints      = pentity->npoint_masses;
+        uint32_t *pperm       = malloc(sizeof(uint32_t) * (npoints + 1));
+        uint32_t *premap      = malloc(sizeof(uint32_t) * (npoints + 1));
+        point_mass_t *ppoints = malloc(sizeof(point_mass_t) * (npoints + 1));
+        if (!pperm || !premap || !ppoints)
+        {
+                fprintf(stderr, "Cant allocate entity reorder.\n");
+                abort();
+        }
+
+        switch (order)
+        {
+        case SPRING_GRAPH_ORDER_RCM:
+        {
+                spring_graph_t graph;
+                spring_graph_init(&graph, pentity);
+                spring_graph_order_rcm(&graph, pperm);
+                spring_graph_free(&graph);
+                break;
+        }
+        case SPRING_GRAPH_ORDER_MORTON:
+                spring_graph_order_morton(pentity, pperm);
+                break;
+        }
+
+        for (uint32_t i = 0; i < npoints; i++)
+        {
+                premap[pperm[i]] = i;
+                ppoints[i]       = pentity->ppoint_masses[pperm[i]];
+        }
+        memcpy(pentity->ppoint_masses, ppoints, sizeof(point_mass_t) * npoints);
+
+        for (uint32_t i = 0; i < pentity->nsprings; i++)
+        {
+                spring_t *pspring = &pentity->psprings[i];
+                uint32_t a        = premap[pspring->idx_a];
+                uint32_t b        = premap[pspring->idx_b];
+
+                /* flipping a spring does not change the forces it applies */
+                pspring->idx_a = a < b ? a : b;
+                pspring->idx_b = a < b ? b : a;
+        }
+        qsort(pentity->psprings,
+              pentity->nsprings,
+              sizeof(spring_t),
+              spring_graph_cmp_spring);
+
+        for (uint32_t i = 0; i < 3 * pentity->ntriangles; i++)
+        {
+                pentity->ptriangles[i] = premap[pentity->ptriangles[i]];
+        }
+        for (uint32_t c = 0; c < pentity->nclusters; c++)
+        {
+                for (uint32_t m = pentity->pcluster_offsets[c];
+                     m < pentity->pcluster_offsets[c + 1];
+                     m++)
+                {
+                        uint32_t *pmember = &pentity->pcluster_members[m];
+                        *pmember          = premap[*pmember];
+                }
+        }
+
+        free(premap);
+        free(ppoints);
+        return pperm;
+}
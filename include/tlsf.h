@@ -0,0 +1,389 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+/*
+ * Two level segregated fit over an abstract range [0, size), it never
+ * touches the memory it manages so the range can be device memory or words
+ * of a buffer. Free blocks sit in lists by first level log2(size) and
+ * second level TLSF_SL_COUNT linear steps inside it, both found with one
+ * bit scan, so alloc and free are O(1) and neighbours coalesce on free.
+ */
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_COUNT 48
+#define TLSF_NONE UINT32_MAX
+
+typedef struct
+{
+        uint64_t offset, size;
+        /* neighbours in address order and in the block's free list */
+        uint32_t prev, next;
+        uint32_t prev_free, next_free;
+        bool free;
+} tlsf_block_t;
+
+typedef struct
+{
+        uint64_t size, nused;
+        uint32_t nallocs;
+
+        uint64_t fl_bitmap;
+        uint32_t psl_bitmaps[TLSF_FL_COUNT];
+        uint32_t pheads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+        /* blocks are handles, unused ones chain through next */
+        uint32_t nblocks, nblock_capacity, idx_unused;
+        tlsf_block_t *pblocks;
+        /* the block ending at size, where tlsf_grow appends */
+        uint32_t idx_last;
+} tlsf_t;
+
+typedef struct
+{
+        uint64_t size, nused, nfree;
+        uint64_t largest_free;
+        uint32_t nallocs, nfree_blocks;
+        /* 1 - largest_free / nfree, 0 when free space is one block */
+        float fragmentation;
+} tlsf_stats_t;
+
+static void tlsf_mapping(uint64_t size, uint32_t *pfl, uint32_t *psl)
+{
+        if (size < TLSF_SL_COUNT)
+        {
+                *pfl = 0;
+                *psl = (uint32_t) size;
+                return;
+        }
+
+        uint32_t log2 = platform_log2(size);
+        *pfl          = log2 - TLSF_SL_LOG2 + 1;
+        *psl          = (uint32_t) (size >> (log2 - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+}
+
+static uint32_t tlsf_new_block(tlsf_t *ptlsf)
+{
+        if (ptlsf->idx_unused != TLSF_NONE)
+        {
+                uint32_t idx      = ptlsf->idx_unused;
+                ptlsf->idx_unused = ptlsf->pblocks[idx].next;
+                return idx;
+        }
+
+        if (ptlsf->nblocks == ptlsf->nblock_capacity)
+        {
+                ptlsf->nblock_capacity = MAX(ptlsf->nblock_capacity * 2, 64);
+                ptlsf->pblocks         = realloc(
+                        ptlsf->pblocks, sizeof(tlsf_block_t) * ptlsf->nblock_capacity);
+                if (!ptlsf->pblocks)
+                {
+                        fprintf(stderr, "Cant grow tlsf blocks.\n");
+                        abort();
+                }
+        }
+        return ptlsf->nblocks++;
+}
+
+static void tlsf_delete_block(tlsf_t *ptlsf, uint32_t idx)
+{
+        ptlsf->pblocks[idx].next = ptlsf->idx_unused;
+        ptlsf->idx_unused        = idx;
+}
+
+static void tlsf_insert_free(tlsf_t *ptlsf, uint32_t idx)
+{
+        tlsf_block_t *pblock = &ptlsf->pblocks[idx];
+        uint32_t fl, sl;
+        tlsf_mapping(pblock->size, &fl, &sl);
+
+        uint32_t head     = ptlsf->pheads[fl][sl];
+        pblock->free      = true;
+        pblock->prev_free = TLSF_NONE;
+        pblock->next_free = head;
+        if (head != TLSF_NONE)
+        {
+                ptlsf->pblocks[head].prev_free = idx;
+        }
+
+        ptlsf->pheads[fl][sl] = idx;
+        ptlsf->fl_bitmap |= 1ULL << fl;
+        ptlsf->psl_bitmaps[fl] |= 1u << sl;
+}
+
+static void tlsf_remove_free(tlsf_t *ptlsf, uint32_t idx)
+{
+        tlsf_block_t *pblock = &ptlsf->pblocks[idx];
+        uint32_t fl, sl;
+        tlsf_mapping(pblock->size, &fl, &sl);
+
+        if (pblock->prev_free != TLSF_NONE)
+        {
+                ptlsf->pblocks[pblock->prev_free].next_free = pblock->next_free;
+        }
+        else
+        {
+                ptlsf->pheads[fl][sl] = pblock->next_free;
+        }
+        if (pblock->next_free != TLSF_NONE)
+        {
+                ptlsf->pblocks[pblock->next_free].prev_free = pblock->prev_free;
+        }
+
+        pblock->free = false;
+        if (ptlsf->pheads[fl][sl] == TLSF_NONE)
+        {
+                ptlsf->psl_bitmaps[fl] &= ~(1u << sl);
+                if (!ptlsf->psl_bitmaps[fl])
+                {
+                        ptlsf->fl_bitmap &= ~(1ULL << fl);
+                }
+        }
+}
+
+/* the first free block in a list at least as big as any size mapping to fl, sl */
+static uint32_t tlsf_find_free(const tlsf_t *ptlsf, uint32_t fl, uint32_t sl)
+{
+        if (fl >= TLSF_FL_COUNT)
+        {
+                return TLSF_NONE;
+        }
+
+        uint32_t sl_bitmap = ptlsf->psl_bitmaps[fl] & (~0u << sl);
+        if (!sl_bitmap)
+        {
+                uint64_t fl_bitmap = ptlsf->fl_bitmap & (~0ULL << fl << 1);
+                if (!fl_bitmap)
+                {
+                        return TLSF_NONE;
+                }
+
+                fl        = platform_ctz(fl_bitmap);
+                sl_bitmap = ptlsf->psl_bitmaps[fl];
+        }
+
+        return ptlsf->pheads[fl][platform_ctz(sl_bitmap)];
+}
+
+/* splits the tail past size off block idx as a new free block */
+static void tlsf_split(tlsf_t *ptlsf, uint32_t idx, uint64_t size)
+{
+        uint32_t idx_rest = tlsf_new_block(ptlsf);
+        tlsf_block_t *pblock = &ptlsf->pblocks[idx];
+        tlsf_block_t *prest  = &ptlsf->pblocks[idx_rest];
+
+        *prest = (tlsf_block_t){
+                .offset = pblock->offset + size,
+                .size   = pblock->size - size,
+                .prev   = idx,
+                .next   = pblock->next};
+        if (pblock->next != TLSF_NONE)
+        {
+                ptlsf->pblocks[pblock->next].prev = idx_rest;
+        }
+        else
+        {
+                ptlsf->idx_last = idx_rest;
+        }
+
+        pblock->size = size;
+        pblock->next = idx_rest;
+        tlsf_insert_free(ptlsf, idx_rest);
+}
+
+/* folds block idx_next into its predecessor idx */
+static void tlsf_merge(tlsf_t *ptlsf, uint32_t idx, uint32_t idx_next)
+{
+        tlsf_block_t *pblock = &ptlsf->pblocks[idx];
+        tlsf_block_t *pnext  = &ptlsf->pblocks[idx_next];
+
+        pblock->size += pnext->size;
+        pblock->next = pnext->next;
+        if (pnext->next != TLSF_NONE)
+        {
+                ptlsf->pblocks[pnext->next].prev = idx;
+        }
+        else
+        {
+                ptlsf->idx_last = idx;
+        }
+
+        tlsf_delete_block(ptlsf, idx_next);
+}
+
+void tlsf_init(tlsf_t *ptlsf, uint64_t size)
+{
+        *ptlsf = (tlsf_t){.size = size, .idx_unused = TLSF_NONE};
+        memset(ptlsf->pheads, 0xff, sizeof ptlsf->pheads);
+
+        uint32_t idx        = tlsf_new_block(ptlsf);
+        ptlsf->pblocks[idx] = (tlsf_block_t){
+                .size = size, .prev = TLSF_NONE, .next = TLSF_NONE};
+        ptlsf->idx_last = idx;
+        if (size)
+        {
+                tlsf_insert_free(ptlsf, idx);
+        }
+}
+
+void tlsf_free(tlsf_t *ptlsf)
+{
+        free(ptlsf->pblocks);
+        *ptlsf = (tlsf_t){};
+}
+
+/*
+ * Returns the handle of a block of size at an offset aligned to align, a
+ * power of two, or TLSF_NONE when no free block fits.
+ */
+uint32_t tlsf_alloc(tlsf_t *ptlsf, uint64_t size, uint64_t align, uint64_t *poffset)
+{
+        size  = MAX(size, 1);
+        align = MAX(align, 1);
+
+        /* round the request up to its list so any block found there fits */
+        uint64_t search = size + align - 1;
+        if (search >= TLSF_SL_COUNT)
+        {
+                search += (1ULL << (platform_log2(search) - TLSF_SL_LOG2)) - 1;
+        }
+
+        uint32_t fl, sl;
+        tlsf_mapping(search, &fl, &sl);
+
+        uint32_t idx = tlsf_find_free(ptlsf, fl, sl);
+        if (idx == TLSF_NONE)
+        {
+                return TLSF_NONE;
+        }
+        tlsf_remove_free(ptlsf, idx);
+
+        /* the alignment gap in front goes back as its own free block */
+        tlsf_block_t *pblock = &ptlsf->pblocks[idx];
+        uint64_t gap         = ALIGN_UP(pblock->offset, align) - pblock->offset;
+        if (gap)
+        {
+                uint32_t idx_gap = idx;
+                tlsf_split(ptlsf, idx_gap, gap);
+                idx = ptlsf->pblocks[idx_gap].next;
+
+                tlsf_remove_free(ptlsf, idx);
+                tlsf_insert_free(ptlsf, idx_gap);
+        }
+
+        if (ptlsf->pblocks[idx].size > size)
+        {
+                tlsf_split(ptlsf, idx, size);
+        }
+
+        ptlsf->nused += size;
+        ptlsf->nallocs++;
+        *poffset = ptlsf->pblocks[idx].offset;
+        return idx;
+}
+
+void tlsf_release(tlsf_t *ptlsf, uint32_t idx)
+{
+        tlsf_block_t *pblock = &ptlsf->pblocks[idx];
+
+        ptlsf->nused -= pblock->size;
+        ptlsf->nallocs--;
+
+        uint32_t next = pblock->next;
+        if (next != TLSF_NONE && ptlsf->pblocks[next].free)
+        {
+                tlsf_remove_free(ptlsf, next);
+                tlsf_merge(ptlsf, idx, next);
+        }
+
+        uint32_t prev = ptlsf->pblocks[idx].prev;
+        if (prev != TLSF_NONE && ptlsf->pblocks[prev].free)
+        {
+                tlsf_remove_free(ptlsf, prev);
+                tlsf_merge(ptlsf, prev, idx);
+                idx = prev;
+        }
+
+        tlsf_insert_free(ptlsf, idx);
+}
+
+/* extends the range to size, the new tail joins the last block when free */
+void tlsf_grow(tlsf_t *ptlsf, uint64_t size)
+{
+        if (size <= ptlsf->size)
+        {
+                return;
+        }
+
+        uint32_t idx_last = ptlsf->idx_last;
+        tlsf_block_t *plast = &ptlsf->pblocks[idx_last];
+
+        if (plast->free || !plast->size)
+        {
+                if (plast->free)
+                {
+                        tlsf_remove_free(ptlsf, idx_last);
+                }
+                ptlsf->pblocks[idx_last].size += size - ptlsf->size;
+                tlsf_insert_free(ptlsf, idx_last);
+        }
+        else
+        {
+                uint32_t idx             = tlsf_new_block(ptlsf);
+                ptlsf->pblocks[idx]      = (tlsf_block_t){
+                        .offset = ptlsf->size,
+                        .size   = size - ptlsf->size,
+                        .prev   = idx_last,
+                        .next   = TLSF_NONE};
+                ptlsf->pblocks[idx_last].next = idx;
+                ptlsf->idx_last               = idx;
+                tlsf_insert_free(ptlsf, idx);
+        }
+
+        ptlsf->size = size;
+}
+
+/* the end of the last allocated block, 0 when nothing is allocated */
+uint64_t tlsf_extent(const tlsf_t *ptlsf)
+{
+        const tlsf_block_t *plast = &ptlsf->pblocks[ptlsf->idx_last];
+        return plast->free ? plast->offset : ptlsf->size;
+}
+
+void tlsf_stats(const tlsf_t *ptlsf, tlsf_stats_t *pstats)
+{
+        *pstats = (tlsf_stats_t){
+                .size    = ptlsf->size,
+                .nused   = ptlsf->nused,
+                .nfree   = ptlsf->size - ptlsf->nused,
+                .nallocs = ptlsf->nallocs};
+
+        for (uint64_t fl_bitmap = ptlsf->fl_bitmap; fl_bitmap; fl_bitmap &= fl_bitmap - 1)
+        {
+                uint32_t fl = platform_ctz(fl_bitmap);
+                for (uint32_t sl_bitmap = ptlsf->psl_bitmaps[fl]; sl_bitmap;
+                     sl_bitmap &= sl_bitmap - 1)
+                {
+                        uint32_t sl = platform_ctz(sl_bitmap);
+                        for (uint32_t idx = ptlsf->pheads[fl][sl]; idx != TLSF_NONE;
+                             idx          = ptlsf->pblocks[idx].next_free)
+                        {
+                                uint64_t size = ptlsf->pblocks[idx].size;
+                                pstats->largest_free = MAX(pstats->largest_free, size);
+                                pstats->nfree_blocks++;
+                        }
+                }
+        }
+
+        if (pstats->nfree)
+        {
+                pstats->fragmentation =
+                        1.0f - (float) pstats->largest_free / (float) pstats->nfree;
+        }
+}
@@ -0,0 +1,656 @@
+#pragma once
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "physics.h"
+#include "physics_world.h"
+#include "platform.h"
+
+/* "TRAJ", bumped with any change to the header or the frame coding */
+#define TRAJECTORY_MAGIC 0x4a415254u
+#define TRAJECTORY_VERSION 1
+
+/* positions are this many bits of their entity's box per axis */
+#define TRAJECTORY_BITS 16
+#define TRAJECTORY_LEVELS ((1u << TRAJECTORY_BITS) - 1)
+/* a new box is this much of the entity wider on every side, to keep it a while */
+#define TRAJECTORY_BOX_MARGIN 0.25f
+#define TRAJECTORY_MIN_EXTENT 1e-3f
+/* frames the step may run ahead of the encoder before it has to wait */
+#define TRAJECTORY_SLOTS 16
+#define TRAJECTORY_IDLE_NS 500000
+
+/*
+ * A trajectory is this header, the point mass count of each entity, then
+ * frames of a byte count and that many bytes. Entities own consecutive
+ * ranges of the points in order, as renderer_pack_scene lays them out.
+ */
+typedef struct
+{
+        uint32_t magic, version;
+        uint32_t nentities, npoint_masses;
+        /* seconds between frames */
+        float step;
+        uint32_t __padding;
+} trajectory_header_t;
+
+/*
+ * Frames code every entity in turn as a flag byte, its box as min and
+ * extent when the flag is set, then the x, y and z quantised streams.
+ * Streams are varints of zigzagged deltas, a 0 starting a run of that
+ * many more zero deltas. Deltas are against the point's last two frames
+ * extrapolated, its last frame alone right after a new box, and the
+ * previous point in the stream in the frame that sets one.
+ */
+typedef struct
+{
+        uint32_t nentities, npoint_masses;
+        uint32_t *pcounts;
+        /* per entity min[3] and extent[3], and frames coded in the box up to 2 */
+        float *pboxes;
+        uint32_t *pframes;
+        /* the last two frames as quantised */
+        uint16_t *pq, *pq_prev;
+} trajectory_codec_t;
+
+/*
+ * Records from the stepping thread without coding anything on it. A frame
+ * is copied into one of TRAJECTORY_SLOTS slots, a thread of its own codes
+ * and writes the slots in order. head and tail count the frames submitted
+ * and written.
+ */
+typedef struct
+{
+        FILE *pfile;
+        trajectory_codec_t codec;
+
+        /* slot i is x, y and z streams of npoint_masses each */
+        float *pslots;
+        _Alignas(PLATFORM_CACHE_LINE) atomic_ullong head;
+        _Alignas(PLATFORM_CACHE_LINE) atomic_ullong tail;
+        atomic_bool running;
+        platform_thread_t thread;
+
+        /* owned by the coding thread until trajectory_recorder_close */
+        uint8_t *pbuf;
+        uint64_t nbytes;
+        bool failed;
+
+        /* frames that found every slot full and waited */
+        uint64_t nstalls;
+} trajectory_recorder_t;
+
+/* plays a mapped trajectory back, px, py and pz hold the last frame read */
+typedef struct
+{
+        trajectory_codec_t codec;
+        float step;
+
+        uint8_t *pmapping;
+        size_t szmapping;
+        size_t first, offset;
+        uint64_t nframe;
+
+        float *px, *py, *pz;
+} trajectory_player_t;
+
+static void trajectory_codec_init(
+        trajectory_codec_t *pcodec, const uint32_t *pcounts, uint32_t nentities)
+{
+        uint32_t npoints = 0;
+        for (uint32_t i = 0; i < nentities; i++)
+        {
+                npoints += pcounts[i];
+        }
+
+        *pcodec = (trajectory_codec_t){
+                .nentities     = nentities,
+                .npoint_masses = npoints,
+                .pcounts       = malloc(sizeof(uint32_t) * (nentities + 1)),
+                .pboxes        = calloc(6 * nentities + 1, sizeof(float)),
+                .pframes       = calloc(nentities + 1, sizeof(uint32_t)),
+                .pq            = calloc(3 * npoints + 1, sizeof(uint16_t)),
+                .pq_prev       = calloc(3 * npoints + 1, sizeof(uint16_t))};
+        if (!pcodec->pcounts || !pcodec->pboxes || !pcodec->pframes || !pcodec->pq ||
+            !pcodec->pq_prev)
+        {
+                fprintf(stderr, "Cant allocate trajectory codec.\n");
+                abort();
+        }
+        memcpy(pcodec->pcounts, pcounts, sizeof(uint32_t) * nentities);
+}
+
+static void trajectory_codec_free(trajectory_codec_t *pcodec)
+{
+        free(pcodec->pcounts);
+        free(pcodec->pboxes);
+        free(pcodec->pframes);
+        free(pcodec->pq);
+        free(pcodec->pq_prev);
+        *pcodec = (trajectory_codec_t){};
+}
+
+/* a flag and box per entity, and 3 bytes for each of the 17 bit zigzagged deltas */
+static size_t trajectory_max_frame_size(const trajectory_codec_t *pcodec)
+{
+        return (size_t) pcodec->nentities * (1 + sizeof(float[6])) +
+               (size_t) pcodec->npoint_masses * 3 * 3;
+}
+
+static inline uint8_t *trajectory_put_varint(uint8_t *pout, uint32_t v)
+{
+        while (v >= 0x80)
+        {
+                *pout++ = (uint8_t) (v | 0x80);
+                v >>= 7;
+        }
+        *pout++ = (uint8_t) v;
+        return pout;
+}
+
+static inline uint8_t *trajectory_put_zeros(uint8_t *pout, uint32_t nzeros)
+{
+        if (!nzeros)
+        {
+                return pout;
+        }
+        return trajectory_put_varint(trajectory_put_varint(pout, 0), nzeros - 1);
+}
+
+static inline bool trajectory_get_varint(
+        const uint8_t **pp, const uint8_t *pend, uint32_t *pv)
+{
+        uint32_t v = 0;
+        for (uint32_t shift = 0; shift < 35 && *pp < pend; shift += 7)
+        {
+                uint8_t byte = *(*pp)++;
+                v |= (uint32_t) (byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                {
+                        *pv = v;
+                        return true;
+                }
+        }
+        return false;
+}
+
+/* the level a point's next one is coded against, nframes in its box so far */
+static inline int32_t trajectory_predict(uint32_t q, uint32_t q_prev, uint32_t nframes)
+{
+        if (nframes < 2)
+        {
+                return (int32_t) q;
+        }
+        int32_t next = 2 * (int32_t) q - (int32_t) q_prev;
+        return MIN(MAX(next, 0), (int32_t) TRAJECTORY_LEVELS);
+}
+
+static uint8_t *trajectory_put_stream(
+        uint8_t *pout,
+        const float *pv,
+        uint16_t *pq,
+        uint16_t *pq_prev,
+        uint32_t n,
+        float min,
+        float scale,
+        uint32_t nframes)
+{
+        uint32_t prev = 0, nzeros = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+                float level = (pv[i] - min) * scale;
+                uint32_t q  = (uint32_t) lrintf(MIN(MAX(level, 0.0f), TRAJECTORY_LEVELS));
+
+                int32_t ref = (int32_t) prev;
+                if (nframes)
+                {
+                        ref = trajectory_predict(pq[i], pq_prev[i], nframes);
+                }
+                int32_t delta = (int32_t) q - ref;
+                prev          = q;
+                pq_prev[i]    = pq[i];
+                pq[i]         = (uint16_t) q;
+
+                if (!delta)
+                {
+                        nzeros++;
+                        continue;
+                }
+                pout   = trajectory_put_zeros(pout, nzeros);
+                nzeros = 0;
+                pout = trajectory_put_varint(
+                        pout, (uint32_t) delta << 1 ^ (uint32_t) (delta >> 31));
+        }
+
+        return trajectory_put_zeros(pout, nzeros);
+}
+
+static bool trajectory_get_stream(
+        const uint8_t **pp,
+        const uint8_t *pend,
+        float *pv,
+        uint16_t *pq,
+        uint16_t *pq_prev,
+        uint32_t n,
+        float min,
+        float step,
+        uint32_t nframes)
+{
+        uint32_t prev = 0;
+        for (uint32_t i = 0; i < n;)
+        {
+                uint32_t token, nrun = 1;
+                if (!trajectory_get_varint(pp, pend, &token) ||
+                    (!token && !trajectory_get_varint(pp, pend, &nrun)))
+                {
+                        return false;
+                }
+
+                int32_t delta = (int32_t) (token >> 1) ^ -(int32_t) (token & 1);
+                nrun          = token ? 1 : nrun + 1;
+                if (nrun > n - i)
+                {
+                        return false;
+                }
+
+                for (uint32_t end = i + nrun; i < end; i++)
+                {
+                        int32_t ref = (int32_t) prev;
+                        if (nframes)
+                        {
+                                ref = trajectory_predict(pq[i], pq_prev[i], nframes);
+                        }
+                        int64_t q = (int64_t) ref + delta;
+                        if (q < 0 || q > TRAJECTORY_LEVELS)
+                        {
+                                return false;
+                        }
+
+                        prev       = (uint32_t) q;
+                        pq_prev[i] = pq[i];
+                        pq[i]      = (uint16_t) q;
+                        pv[i] = min + (float) q * step;
+                }
+        }
+        return true;
+}
+
+/* the box side for an entity spanning lo to hi */
+static inline float trajectory_box_extent(float lo, float hi)
+{
+        float extent = MAX(hi - lo, 0.0f) * (1.0f + 2.0f * TRAJECTORY_BOX_MARGIN);
+        return MAX(extent, TRAJECTORY_MIN_EXTENT);
+}
+
+/* codes a frame of x, y and z streams, pout has trajectory_max_frame_size bytes */
+static size_t trajectory_encode(
+        trajectory_codec_t *pcodec, const float *pframe, uint64_t nframe, uint8_t *pout)
+{
+        uint32_t n           = pcodec->npoint_masses;
+        uint8_t *pbegin      = pout;
+        uint32_t first       = 0;
+        const float *pxyz[3] = {pframe, pframe + n, pframe + 2 * n};
+
+        for (uint32_t e = 0; e < pcodec->nentities; first += pcodec->pcounts[e++])
+        {
+                uint32_t count = pcodec->pcounts[e];
+                float *pbox    = &pcodec->pboxes[6 * e];
+
+                /* a new box once a point leaves the old one or it is twice too wide */
+                bool key = count && nframe == 0;
+                float plo[3], phi[3];
+                for (uint32_t c = 0; c < 3 && count; c++)
+                {
+                        plo[c] = INFINITY;
+                        phi[c] = -INFINITY;
+                        for (uint32_t i = first; i < first + count; i++)
+                        {
+                                plo[c] = MIN(plo[c], pxyz[c][i]);
+                                phi[c] = MAX(phi[c], pxyz[c][i]);
+                        }
+
+                        key |= plo[c] < pbox[c] || phi[c] > pbox[c] + pbox[3 + c] ||
+                               pbox[3 + c] > 2.0f * trajectory_box_extent(plo[c], phi[c]);
+                }
+
+                *pout++ = key;
+                if (key)
+                {
+                        for (uint32_t c = 0; c < 3; c++)
+                        {
+                                pbox[3 + c] = trajectory_box_extent(plo[c], phi[c]);
+                                pbox[c] = (plo[c] + phi[c] - pbox[3 + c]) * 0.5f;
+                        }
+                        memcpy(pout, pbox, sizeof(float[6]));
+                        pout += sizeof(float[6]);
+                }
+
+                uint32_t nframes = key ? 0 : pcodec->pframes[e];
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        size_t idx = (size_t) c * n + first;
+                        pout       = trajectory_put_stream(
+                                pout,
+                                pxyz[c] + first,
+                                pcodec->pq + idx,
+                                pcodec->pq_prev + idx,
+                                count,
+                                pbox[c],
+                                TRAJECTORY_LEVELS / pbox[3 + c],
+                                nframes);
+                }
+                pcodec->pframes[e] = MIN(nframes + 1, 2);
+        }
+
+        return (size_t) (pout - pbegin);
+}
+
+/* the inverse of trajectory_encode into pframe, false on a corrupt frame */
+static bool trajectory_decode(
+        trajectory_codec_t *pcodec, const uint8_t *p, size_t sz, float *pframe)
+{
+        uint32_t n          = pcodec->npoint_masses;
+        const uint8_t *pend = p + sz;
+        uint32_t first      = 0;
+
+        for (uint32_t e = 0; e < pcodec->nentities; first += pcodec->pcounts[e++])
+        {
+                uint32_t count = pcodec->pcounts[e];
+                float *pbox    = &pcodec->pboxes[6 * e];
+
+                if (p == pend || *p > 1)
+                {
+                        return false;
+                }
+                bool key = *p++;
+                if (key)
+                {
+                        if ((size_t) (pend - p) < sizeof(float[6]))
+                        {
+                                return false;
+                        }
+                        memcpy(pbox, p, sizeof(float[6]));
+                        p += sizeof(float[6]);
+                }
+
+                uint32_t nframes = key ? 0 : pcodec->pframes[e];
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                        size_t idx = (size_t) c * n + first;
+                        if (!trajectory_get_stream(
+                                    &p,
+                                    pend,
+                                    pframe + idx,
+                                    pcodec->pq + idx,
+                                    pcodec->pq_prev + idx,
+                                    count,
+                                    pbox[c],
+                                    pbox[3 + c] / TRAJECTORY_LEVELS,
+                                    nframes))
+                        {
+                                return false;
+                        }
+                }
+                pcodec->pframes[e] = MIN(nframes + 1, 2);
+        }
+
+        return p == pend;
+}
+
+static inline float *trajectory_recorder_slot(
+        trajectory_recorder_t *prec, uint64_t nframe)
+{
+        size_t szslot = sizeof(float) * 3 * prec->codec.npoint_masses;
+        return (float *) ((char *) prec->pslots + szslot * (nframe % TRAJECTORY_SLOTS));
+}
+
+static void trajectory_recorder_run(void *parg)
+{
+        trajectory_recorder_t *prec = parg;
+
+        for (;;)
+        {
+                /* running first, a recorder that stopped has published its last head */
+                bool running  = atomic_load(&prec->running);
+                uint64_t tail = atomic_load_explicit(&prec->tail, memory_order_relaxed);
+                uint64_t head = atomic_load_explicit(&prec->head, memory_order_acquire);
+                if (tail == head)
+                {
+                        if (!running)
+                        {
+                                break;
+                        }
+                        platform_sleep_ns(TRAJECTORY_IDLE_NS);
+                        continue;
+                }
+
+                const float *pframe = trajectory_recorder_slot(prec, tail);
+                uint32_t sz         = (uint32_t) trajectory_encode(
+                        &prec->codec, pframe, tail, prec->pbuf);
+
+                /* after a failed write the frames are coded and dropped */
+                if (!prec->failed)
+                {
+                        prec->failed = fwrite(&sz, sizeof sz, 1, prec->pfile) != 1 ||
+                                       fwrite(prec->pbuf, 1, sz, prec->pfile) != sz;
+                        prec->nbytes += sizeof sz + sz;
+                }
+
+                atomic_store_explicit(&prec->tail, tail + 1, memory_order_release);
+        }
+}
+
+/*
+ * Starts a recording of entities with pcounts point masses each, frames
+ * step seconds apart. False when ppath cannot be written.
+ */
+bool trajectory_recorder_open(
+        trajectory_recorder_t *prec,
+        const char *ppath,
+        const uint32_t *pcounts,
+        uint32_t nentities,
+        float step)
+{
+        *prec = (trajectory_recorder_t){.pfile = fopen(ppath, "wb")};
+        if (!prec->pfile)
+        {
+                fprintf(stderr, "Cant write %s.\n", ppath);
+                return false;
+        }
+
+        trajectory_codec_init(&prec->codec, pcounts, nentities);
+
+        trajectory_header_t header = {
+                .magic         = TRAJECTORY_MAGIC,
+                .version       = TRAJECTORY_VERSION,
+                .nentities     = nentities,
+                .npoint_masses = prec->codec.npoint_masses,
+                .step          = step};
+        prec->failed =
+                fwrite(&header, sizeof header, 1, prec->pfile) != 1 ||
+                fwrite(pcounts, sizeof(uint32_t), nentities, prec->pfile) != nentities;
+        prec->nbytes = sizeof header + sizeof(uint32_t) * nentities;
+
+        size_t szslot = sizeof(float) * 3 * prec->codec.npoint_masses;
+        prec->pslots  = platform_aligned_alloc(
+                MAX(szslot * TRAJECTORY_SLOTS, PLATFORM_CACHE_LINE), PLATFORM_CACHE_LINE);
+        prec->pbuf = malloc(trajectory_max_frame_size(&prec->codec) + 1);
+        if (!prec->pslots || !prec->pbuf)
+        {
+                fprintf(stderr, "Cant allocate trajectory recorder.\n");
+                abort();
+        }
+
+        atomic_init(&prec->head, 0);
+        atomic_init(&prec->tail, 0);
+        atomic_init(&prec->running, true);
+        platform_thread_create(&prec->thread, trajectory_recorder_run, prec);
+        return true;
+}
+
+/*
+ * The slot for the next frame, to fill with the x, y then z streams of
+ * every point and pass on with trajectory_recorder_submit. Only waits when
+ * the coding thread is TRAJECTORY_SLOTS frames behind.
+ */
+float *trajectory_recorder_frame(trajectory_recorder_t *prec)
+{
+        uint64_t head = atomic_load_explicit(&prec->head, memory_order_relaxed);
+        uint64_t tail = atomic_load_explicit(&prec->tail, memory_order_acquire);
+        if (head - tail >= TRAJECTORY_SLOTS)
+        {
+                prec->nstalls++;
+                while (head - atomic_load_explicit(&prec->tail, memory_order_acquire) >=
+                       TRAJECTORY_SLOTS)
+                {
+                        platform_yield();
+                }
+        }
+
+        return trajectory_recorder_slot(prec, head);
+}
+
+void trajectory_recorder_submit(trajectory_recorder_t *prec)
+{
+        atomic_fetch_add_explicit(&prec->head, 1, memory_order_release);
+}
+
+/* a frame of every body of the world, its bodies being the recorder's entities */
+void trajectory_record_world(trajectory_recorder_t *prec, const physics_world_t *pworld)
+{
+        uint32_t n    = prec->codec.npoint_masses;
+        float *pframe = trajectory_recorder_frame(prec);
+
+        for (uint32_t i = 0, first = 0; i < pworld->nbodies; i++)
+        {
+                const physics_body_t *pbody = &pworld->pbodies[i];
+                size_t sz                   = sizeof(float) * pbody->npoint_masses;
+
+                memcpy(pframe + first, pbody->px, sz);
+                memcpy(pframe + n + first, pbody->py, sz);
+                memcpy(pframe + 2 * n + first, pbody->pz, sz);
+                first += pbody->npoint_masses;
+        }
+
+        trajectory_recorder_submit(prec);
+}
+
+/* codes the frames still queued, false when any of the file failed to write */
+bool trajectory_recorder_close(trajectory_recorder_t *prec)
+{
+        atomic_store_explicit(&prec->running, false, memory_order_release);
+        platform_thread_join(prec->thread);
+
+        bool ok = !prec->failed;
+        ok &= fclose(prec->pfile) == 0;
+
+        trajectory_codec_free(&prec->codec);
+        platform_aligned_free(prec->pslots);
+        free(prec->pbuf);
+        prec->pfile  = NULL;
+        prec->pslots = NULL;
+        prec->pbuf   = NULL;
+        return ok;
+}
+
+/* maps a recording, the first trajectory_player_next reads its first frame */
+bool trajectory_player_open(trajectory_player_t *pplayer, const char *ppath)
+{
+        *pplayer = (trajectory_player_t){};
+
+        size_t sz;
+        uint8_t *p = platform_map_file(ppath, &sz);
+        if (!p)
+        {
+                return false;
+        }
+
+        trajectory_header_t header = {};
+        if (sz >= sizeof header)
+        {
+                memcpy(&header, p, sizeof header);
+        }
+
+        size_t first = sizeof header + sizeof(uint32_t) * (size_t) header.nentities;
+        if (header.magic != TRAJECTORY_MAGIC || header.version != TRAJECTORY_VERSION ||
+            first > sz)
+        {
+                platform_unmap_file(p, sz);
+                return false;
+        }
+
+        const uint32_t *pcounts = (const uint32_t *) (p + sizeof header);
+        trajectory_codec_init(&pplayer->codec, pcounts, header.nentities);
+        if (pplayer->codec.npoint_masses != header.npoint_masses)
+        {
+                trajectory_codec_free(&pplayer->codec);
+                platform_unmap_file(p, sz);
+                return false;
+        }
+
+        uint32_t n          = header.npoint_masses;
+        pplayer->step      = header.step;
+        pplayer->pmapping  = p;
+        pplayer->szmapping = sz;
+        pplayer->first     = first;
+        pplayer->offset    = first;
+        pplayer->px        = calloc(3 * (size_t) n + 1, sizeof(float));
+        if (!pplayer->px)
+        {
+                fprintf(stderr, "Cant allocate trajectory player.\n");
+                abort();
+        }
+        pplayer->py = pplayer->px + n;
+        pplayer->pz = pplayer->px + 2 * n;
+        return true;
+}
+
+/*
+ * Decodes the next frame into px, py and pz. False at the end of the
+ * recording, or at a frame cut short by a recorder that never closed.
+ */
+bool trajectory_player_next(trajectory_player_t *pplayer)
+{
+        uint32_t sz;
+        size_t left = pplayer->szmapping - pplayer->offset;
+        if (left < sizeof sz)
+        {
+                return false;
+        }
+
+        const uint8_t *p = pplayer->pmapping + pplayer->offset;
+        memcpy(&sz, p, sizeof sz);
+        if (sz > left - sizeof sz ||
+            !trajectory_decode(&pplayer->codec, p + sizeof sz, sz, pplayer->px))
+        {
+                return false;
+        }
+
+        pplayer->offset += sizeof sz + sz;
+        pplayer->nframe++;
+        return true;
+}
+
+/* back to the first frame, every frame deltas against the ones before it */
+void trajectory_player_rewind(trajectory_player_t *pplayer)
+{
+        pplayer->offset = pplayer->first;
+        pplayer->nframe = 0;
+}
+
+void trajectory_player_close(trajectory_player_t *pplayer)
+{
+        if (pplayer->pmapping)
+        {
+                platform_unmap_file(pplayer->pmapping, pplayer->szmapping);
+        }
+        trajectory_codec_free(&pplayer->codec);
+        free(pplayer->px);
+        *pplayer = (trajectory_player_t){};
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#define VOXEL_TYPE_HARD 0b00
+#define VOXEL_TYPE_SOFT 0b11
+#define VOXEL_TYPE_FLUCUATE1 0b10
+#define VOXEL_TYPE_FLUCUATE2 0b01
+
+/* bricks are 8^3 voxels, two material bits each, four to a byte */
+#define VOXEL_BRICK_BITS 3
+#define VOXEL_BRICK_SIZE (1 << VOXEL_BRICK_BITS)
+#define VOXEL_BRICK_MASK (VOXEL_BRICK_SIZE - 1)
+#define VOXEL_BRICK_VOXELS (VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE)
+
+#define VOXEL_STORE_MIN_TABLE 64
+
+/*
+ * HARD is 0b00, so a zero material byte cannot tell hard voxels from empty
+ * ones. Occupancy is a separate bit per voxel and bricks only exist while
+ * at least one of their voxels is set.
+ */
+typedef struct
+{
+        int32_t x, y, z;
+        uint32_t nvoxels;
+        uint64_t poccupied[VOXEL_BRICK_VOXELS / 64];
+        uint8_t pmaterials[VOXEL_BRICK_VOXELS / 4];
+} voxel_brick_t;
+
+/*
+ * Two level grid. Bricks live packed in pbricks, so iterating the store is
+ * a walk over that array, and an open addressing table keyed by brick
+ * coordinate finds them. Table slots hold brick index + 1, 0 is empty.
+ */
+typedef struct
+{
+        uint32_t nbricks, nbrick_capacity;
+        voxel_brick_t *pbricks;
+
+        uint32_t ntable;
+        uint32_t *ptable;
+} voxel_store_t;
+
+static inline uint32_t voxel_brick_hash(int32_t x, int32_t y, int32_t z)
+{
+        return ((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u) ^
+               ((uint32_t) z * 83492791u);
+}
+
+/* voxel index inside its brick, x fastest */
+static inline uint32_t voxel_brick_index(int32_t x, int32_t y, int32_t z)
+{
+        return (x & VOXEL_BRICK_MASK) |
+               (y & VOXEL_BRICK_MASK) << VOXEL_BRICK_BITS |
+               (z & VOXEL_BRICK_MASK) << (VOXEL_BRICK_BITS * 2);
+}
+
+static inline bool voxel_brick_occupied(const voxel_brick_t *pbrick, uint32_t i)
+{
+        return pbrick->poccupied[i >> 6] >> (i & 63) & 1;
+}
+
+static inline uint8_t voxel_brick_material(const voxel_brick_t *pbrick, uint32_t i)
+{
+        return pbrick->pmaterials[i >> 2] >> ((i & 3) * 2) & 0b11;
+}
+
+void voxel_store_init(voxel_store_t *pstore)
+{
+        *pstore = (voxel_store_t){
+                .ntable = VOXEL_STORE_MIN_TABLE,
+                .ptable = calloc(VOXEL_STORE_MIN_TABLE, sizeof(uint32_t))};
+        if (!pstore->ptable)
+        {
+                fprintf(stderr, "Cant allocate voxel store.\n");
+                abort();
+        }
+}
+
+void voxel_store_free(voxel_store_t *pstore)
+{
+        free(pstore->pbricks);
+        free(pstore->ptable);
+        *pstore = (voxel_store_t){};
+}
+
+/* the table slot holding brick (x, y, z), or the empty slot it would go to */
+static uint32_t voxel_store_slot(
+        const voxel_store_t *pstore, int32_t x, int32_t y, int32_t z)
+{
+        uint32_t mask = pstore->ntable - 1;
+
+        for (uint32_t slot = voxel_brick_hash(x, y, z) & mask;; slot = (slot + 1) & mask)
+        {
+                uint32_t entry = pstore->ptable[slot];
+                if (!entry)
+                {
+                        return slot;
+                }
+
+                const voxel_brick_t *pbrick = &pstore->pbricks[entry - 1];
+                if (pbrick->x == x && pbrick->y == y && pbrick->z == z)
+                {
+                        return slot;
+                }
+        }
+}
+
+static void voxel_store_grow_table(voxel_store_t *pstore)
+{
+        free(pstore->ptable);
+
+        pstore->ntable *= 2;
+        pstore->ptable = calloc(pstore->ntable, sizeof(uint32_t));
+        if (!pstore->ptable)
+        {
+                fprintf(stderr, "Cant grow voxel table.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < pstore->nbricks; i++)
+        {
+                const voxel_brick_t *pbrick = &pstore->pbricks[i];
+                uint32_t slot = voxel_store_slot(pstore, pbrick->x, pbrick->y, pbrick->z);
+                pstore->ptable[slot] = i + 1;
+        }
+}
+
+/* brick coordinates, NULL if the brick holds no voxels */
+voxel_brick_t *voxel_store_find(
+        const voxel_store_t *pstore, int32_t x, int32_t y, int32_t z)
+{
+        uint32_t entry = pstore->ptable[voxel_store_slot(pstore, x, y, z)];
+        return entry ? &pstore->pbricks[entry - 1] : NULL;
+}
+
+static voxel_brick_t *voxel_store_insert(
+        voxel_store_t *pstore, int32_t x, int32_t y, int32_t z)
+{
+        uint32_t slot = voxel_store_slot(pstore, x, y, z);
+        if (pstore->ptable[slot])
+        {
+                return &pstore->pbricks[pstore->ptable[slot] - 1];
+        }
+
+        /* keep the load factor under a half */
+        if ((pstore->nbricks + 1) * 2 > pstore->ntable)
+        {
+                voxel_store_grow_table(pstore);
+                slot = voxel_store_slot(pstore, x, y, z);
+        }
+
+        if (pstore->nbricks == pstore->nbrick_capacity)
+        {
+                pstore->nbrick_capacity = MAX(pstore->nbrick_capacity * 2, 16);
+                pstore->pbricks         = realloc(
+                        pstore->pbricks, sizeof(voxel_brick_t) * pstore->nbrick_capacity);
+                if (!pstore->pbricks)
+                {
+                        fprintf(stderr, "Cant grow voxel bricks.\n");
+                        abort();
+                }
+        }
+
+        voxel_brick_t *pbrick = &pstore->pbricks[pstore->nbricks];
+        *pbrick               = (voxel_brick_t){.x = x, .y = y, .z = z};
+        pstore->ptable[slot]  = ++pstore->nbricks;
+        return pbrick;
+}
+
+/*
+ * Drops an empty brick. The last brick moves into its place and the table
+ * closes the gap by shifting back later members of the probe run, so
+ * lookups never need tombstones.
+ */
+static void voxel_store_erase(voxel_store_t *pstore, voxel_brick_t *pbrick)
+{
+        uint32_t mask = pstore->ntable - 1;
+        uint32_t idx  = pbrick - pstore->pbricks;
+        uint32_t hole = voxel_store_slot(pstore, pbrick->x, pbrick->y, pbrick->z);
+
+        for (uint32_t slot = (hole + 1) & mask; pstore->ptable[slot];
+             slot          = (slot + 1) & mask)
+        {
+                const voxel_brick_t *pother = &pstore->pbricks[pstore->ptable[slot] - 1];
+                uint32_t home = voxel_brick_hash(pother->x, pother->y, pother->z) & mask;
+
+                /* an entry may fill the hole unless its home lies in (hole, slot] */
+                if (((slot - home) & mask) >= ((slot - hole) & mask))
+                {
+                        pstore->ptable[hole] = pstore->ptable[slot];
+                        hole                 = slot;
+                }
+        }
+        pstore->ptable[hole] = 0;
+
+        uint32_t last = --pstore->nbricks;
+        if (idx != last)
+        {
+                voxel_brick_t *pmoved = &pstore->pbricks[last];
+                uint32_t slot = voxel_store_slot(pstore, pmoved->x, pmoved->y, pmoved->z);
+                pstore->ptable[slot] = idx + 1;
+                pstore->pbricks[idx] = *pmoved;
+        }
+}
+
+/* false for empty voxels, otherwise writes the VOXEL_TYPE_ to ptype */
+bool voxel_store_get(
+        const voxel_store_t *pstore, int32_t x, int32_t y, int32_t z, uint8_t *ptype)
+{
+        const voxel_brick_t *pbrick = voxel_store_find(
+                pstore,
+                x >> VOXEL_BRICK_BITS,
+                y >> VOXEL_BRICK_BITS,
+                z >> VOXEL_BRICK_BITS);
+        uint32_t i = voxel_brick_index(x, y, z);
+
+        if (!pbrick || !voxel_brick_occupied(pbrick, i))
+        {
+                return false;
+        }
+
+        *ptype = voxel_brick_material(pbrick, i);
+        return true;
+}
+
+void voxel_store_set(voxel_store_t *pstore, int32_t x, int32_t y, int32_t z, uint8_t type)
+{
+        voxel_brick_t *pbrick = voxel_store_insert(
+                pstore,
+                x >> VOXEL_BRICK_BITS,
+                y >> VOXEL_BRICK_BITS,
+                z >> VOXEL_BRICK_BITS);
+        uint32_t i = voxel_brick_index(x, y, z);
+
+        if (!voxel_brick_occupied(pbrick, i))
+        {
+                pbrick->poccupied[i >> 6] |= 1ULL << (i & 63);
+                pbrick->nvoxels++;
+        }
+
+        uint32_t shift = (i & 3) * 2;
+        pbrick->pmaterials[i >> 2] =
+                (pbrick->pmaterials[i >> 2] & ~(0b11 << shift)) | (type & 0b11) << shift;
+}
+
+void voxel_store_clear(voxel_store_t *pstore, int32_t x, int32_t y, int32_t z)
+{
+        voxel_brick_t *pbrick = voxel_store_find(
+                pstore,
+                x >> VOXEL_BRICK_BITS,
+                y >> VOXEL_BRICK_BITS,
+                z >> VOXEL_BRICK_BITS);
+        uint32_t i = voxel_brick_index(x, y, z);
+
+        if (!pbrick || !voxel_brick_occupied(pbrick, i))
+        {
+                return;
+        }
+
+        pbrick->poccupied[i >> 6] &= ~(1ULL << (i & 63));
+        if (!--pbrick->nvoxels)
+        {
+                voxel_store_erase(pstore, pbrick);
+        }
+}
+
+/*
+ * Sets every voxel of the box [x0, x1) x [y0, y1) x [z0, z1) to type. Bricks
+ * the box covers whole are written with memset, partial ones voxel by voxel.
+ */
+void voxel_store_fill(
+        voxel_store_t *pstore,
+        int32_t x0,
+        int32_t y0,
+        int32_t z0,
+        int32_t x1,
+        int32_t y1,
+        int32_t z1,
+        uint8_t type)
+{
+        if (x0 >= x1 || y0 >= y1 || z0 >= z1)
+        {
+                return;
+        }
+
+        /* the material byte of four voxels of one type */
+        uint8_t packed = (type & 0b11) * 0b01010101;
+
+        int32_t bx0 = x0 >> VOXEL_BRICK_BITS, bx1 = (x1 - 1) >> VOXEL_BRICK_BITS;
+        int32_t by0 = y0 >> VOXEL_BRICK_BITS, by1 = (y1 - 1) >> VOXEL_BRICK_BITS;
+        int32_t bz0 = z0 >> VOXEL_BRICK_BITS, bz1 = (z1 - 1) >> VOXEL_BRICK_BITS;
+
+        for (int32_t bz = bz0; bz <= bz1; bz++)
+        for (int32_t by = by0; by <= by1; by++)
+        for (int32_t bx = bx0; bx <= bx1; bx++)
+        {
+                int32_t lx0 = MAX(x0 - bx * VOXEL_BRICK_SIZE, 0);
+                int32_t ly0 = MAX(y0 - by * VOXEL_BRICK_SIZE, 0);
+                int32_t lz0 = MAX(z0 - bz * VOXEL_BRICK_SIZE, 0);
+                int32_t lx1 = MIN(x1 - bx * VOXEL_BRICK_SIZE, VOXEL_BRICK_SIZE);
+                int32_t ly1 = MIN(y1 - by * VOXEL_BRICK_SIZE, VOXEL_BRICK_SIZE);
+                int32_t lz1 = MIN(z1 - bz * VOXEL_BRICK_SIZE, VOXEL_BRICK_SIZE);
+
+                voxel_brick_t *pbrick = voxel_store_insert(pstore, bx, by, bz);
+
+                if (lx0 == 0 && ly0 == 0 && lz0 == 0 && lx1 == VOXEL_BRICK_SIZE &&
+                    ly1 == VOXEL_BRICK_SIZE && lz1 == VOXEL_BRICK_SIZE)
+                {
+                        memset(pbrick->poccupied, 0xff, sizeof pbrick->poccupied);
+                        memset(pbrick->pmaterials, packed, sizeof pbrick->pmaterials);
+                        pbrick->nvoxels = VOXEL_BRICK_VOXELS;
+                        continue;
+                }
+
+                for (int32_t z = lz0; z < lz1; z++)
+                for (int32_t y = ly0; y < ly1; y++)
+                for (int32_t x = lx0; x < lx1; x++)
+                {
+                        uint32_t i     = voxel_brick_index(x, y, z);
+                        uint32_t shift = (i & 3) * 2;
+
+                        if (!voxel_brick_occupied(pbrick, i))
+                        {
+                                pbrick->poccupied[i >> 6] |= 1ULL << (i & 63);
+                                pbrick->nvoxels++;
+                        }
+                        pbrick->pmaterials[i >> 2] = (pbrick->pmaterials[i >> 2] &
+                                                      ~(0b11 << shift)) |
+                                                     (type & 0b11) << shift;
+                }
+        }
+}
+
+/* the voxel coordinate of voxel i of a brick */
+static inline void voxel_brick_voxel(
+        const voxel_brick_t *pbrick, uint32_t i, int32_t *px, int32_t *py, int32_t *pz)
+{
+        *px = pbrick->x * VOXEL_BRICK_SIZE + (int32_t) (i & VOXEL_BRICK_MASK);
+        *py = pbrick->y * VOXEL_BRICK_SIZE +
+              (int32_t) (i >> VOXEL_BRICK_BITS & VOXEL_BRICK_MASK);
+        *pz = pbrick->z * VOXEL_BRICK_SIZE + (int32_t) (i >> (VOXEL_BRICK_BITS * 2));
+}
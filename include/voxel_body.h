@@ -0,0 +1,811 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "physics.h"
+#include "platform.h"
+#include "spring_graph.h"
+#include "voxel.h"
+
+/* 12 edges, 12 face diagonals and 4 body diagonals per soft voxel */
+#define VOXEL_BODY_VOXEL_SPRINGS 28
+
+#define VOXEL_MAP_USED (1ULL << 63)
+#define VOXEL_MAP_NONE UINT32_MAX
+
+/* open addressing uint64 -> uint32, keys carry VOXEL_MAP_USED */
+typedef struct
+{
+        uint32_t nentries, ncapacity;
+        uint64_t *pkeys;
+        uint32_t *pvalues;
+} voxel_map_t;
+
+static inline uint64_t voxel_map_hash(uint64_t key)
+{
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key;
+}
+
+static void voxel_map_alloc(voxel_map_t *pmap, uint32_t ncapacity)
+{
+        pmap->nentries  = 0;
+        pmap->ncapacity = ncapacity;
+        pmap->pkeys     = calloc(ncapacity, sizeof(uint64_t));
+        pmap->pvalues   = malloc(sizeof(uint32_t) * ncapacity);
+        if (!pmap->pkeys || !pmap->pvalues)
+        {
+                fprintf(stderr, "Cant allocate voxel map.\n");
+                abort();
+        }
+}
+
+static void voxel_map_free(voxel_map_t *pmap)
+{
+        free(pmap->pkeys);
+        free(pmap->pvalues);
+        *pmap = (voxel_map_t){};
+}
+
+static uint32_t voxel_map_slot(const voxel_map_t *pmap, uint64_t key)
+{
+        uint32_t mask = pmap->ncapacity - 1;
+        uint32_t slot = voxel_map_hash(key) & mask;
+
+        while (pmap->pkeys[slot] && pmap->pkeys[slot] != key)
+        {
+                slot = (slot + 1) & mask;
+        }
+        return slot;
+}
+
+static uint32_t voxel_map_find(const voxel_map_t *pmap, uint64_t key)
+{
+        uint32_t slot = voxel_map_slot(pmap, key);
+        return pmap->pkeys[slot] ? pmap->pvalues[slot] : VOXEL_MAP_NONE;
+}
+
+static void voxel_map_insert(voxel_map_t *pmap, uint64_t key, uint32_t value)
+{
+        if ((pmap->nentries + 1) * 2 > pmap->ncapacity)
+        {
+                voxel_map_t old = *pmap;
+                voxel_map_alloc(pmap, old.ncapacity * 2);
+
+                for (uint32_t i = 0; i < old.ncapacity; i++)
+                {
+                        if (old.pkeys[i])
+                        {
+                                uint32_t slot       = voxel_map_slot(pmap, old.pkeys[i]);
+                                pmap->pkeys[slot]   = old.pkeys[i];
+                                pmap->pvalues[slot] = old.pvalues[i];
+                        }
+                }
+                pmap->nentries = old.nentries;
+                voxel_map_free(&old);
+        }
+
+        uint32_t slot = voxel_map_slot(pmap, key);
+        if (!pmap->pkeys[slot])
+        {
+                pmap->nentries++;
+        }
+        pmap->pkeys[slot]   = key;
+        pmap->pvalues[slot] = value;
+}
+
+/* backward shift deletion, the same as the voxel store's brick table */
+static void voxel_map_erase(voxel_map_t *pmap, uint64_t key)
+{
+        uint32_t mask = pmap->ncapacity - 1;
+        uint32_t hole = voxel_map_slot(pmap, key);
+
+        if (!pmap->pkeys[hole])
+        {
+                return;
+        }
+
+        for (uint32_t slot = (hole + 1) & mask; pmap->pkeys[slot];
+             slot          = (slot + 1) & mask)
+        {
+                uint32_t home = voxel_map_hash(pmap->pkeys[slot]) & mask;
+                if (((slot - home) & mask) >= ((slot - hole) & mask))
+                {
+                        pmap->pkeys[hole]   = pmap->pkeys[slot];
+                        pmap->pvalues[hole] = pmap->pvalues[slot];
+                        hole                = slot;
+                }
+        }
+        pmap->pkeys[hole] = 0;
+        pmap->nentries--;
+}
+
+/* 21 bits per axis, corners of voxels within a million of the origin */
+static inline uint64_t voxel_corner_key(int32_t x, int32_t y, int32_t z)
+{
+        return VOXEL_MAP_USED | (uint64_t) ((uint32_t) x & 0x1fffff) |
+               (uint64_t) ((uint32_t) y & 0x1fffff) << 21 |
+               (uint64_t) ((uint32_t) z & 0x1fffff) << 42;
+}
+
+
+typedef struct
+{
+        float voxel_size;
+        /* by VOXEL_TYPE_, a voxel's mass and the stiffness it adds to its springs */
+        float pmass[4];
+        float pk[4];
+
+        physics_integrator_t integrator;
+        float damping;
+} voxel_body_params_t;
+
+typedef struct
+{
+        int32_t x, y, z;
+        uint32_t nrefs;
+        float mass;
+} voxel_body_point_t;
+
+typedef struct
+{
+        uint32_t idx_a, idx_b;
+        uint32_t nrefs;
+        float k;
+} voxel_body_spring_t;
+
+/* a use of a point or spring and the mass or stiffness it added */
+typedef struct
+{
+        uint32_t idx;
+        float amount;
+} voxel_body_ref_t;
+
+/*
+ * What one brick adds to the body, so a rebuild takes back exactly what it
+ * gave. The members of each hard cluster come first in ppoints, cluster c
+ * spanning pcluster_offsets[c] .. [c + 1], then the soft voxel corners.
+ */
+typedef struct
+{
+        int32_t x, y, z;
+        uint32_t npoints, npoint_capacity;
+        voxel_body_ref_t *ppoints;
+        uint32_t nsprings, nspring_capacity;
+        voxel_body_ref_t *psprings;
+        uint32_t nclusters, ncluster_capacity;
+        uint32_t *pcluster_offsets;
+} voxel_body_brick_t;
+
+/*
+ * Incremental mesher from a voxel region to a soft body. Soft voxels turn
+ * into point masses at their corners and springs along their edges and
+ * diagonals. Hard voxels turn into rigid clusters, one per face connected
+ * piece of a brick, that keep only the corners on their surface and carry
+ * no springs. Clusters of neighbouring bricks share the corners on the face
+ * between them and soft springs hang off cluster corners, so the pieces
+ * stay coupled. Points and springs are deduplicated by corner and reference
+ * counted, so rebuilding one brick leaves the others alone.
+ */
+typedef struct
+{
+        voxel_body_params_t params;
+        int32_t x0, y0, z0, x1, y1, z1;
+
+        uint32_t npoints, npoint_capacity;
+        voxel_body_point_t *ppoints;
+        uint32_t nfree_points, nfree_point_capacity;
+        uint32_t *pfree_points;
+        voxel_map_t corners;
+
+        uint32_t nsprings, nspring_capacity;
+        voxel_body_spring_t *psprings;
+        uint32_t nfree_springs, nfree_spring_capacity;
+        uint32_t *pfree_springs;
+        voxel_map_t spring_map;
+
+        uint32_t nbricks, nbrick_capacity;
+        voxel_body_brick_t *pbricks;
+        voxel_map_t brick_map;
+} voxel_body_t;
+
+void voxel_body_init(
+        voxel_body_t *pbody,
+        const voxel_body_params_t *pparams,
+        int32_t x0,
+        int32_t y0,
+        int32_t z0,
+        int32_t x1,
+        int32_t y1,
+        int32_t z1)
+{
+        *pbody = (voxel_body_t){.params = *pparams};
+
+        pbody->x0 = x0;
+        pbody->y0 = y0;
+        pbody->z0 = z0;
+        pbody->x1 = x1;
+        pbody->y1 = y1;
+        pbody->z1 = z1;
+
+        voxel_map_alloc(&pbody->corners, 256);
+        voxel_map_alloc(&pbody->spring_map, 1024);
+        voxel_map_alloc(&pbody->brick_map, 64);
+}
+
+void voxel_body_free(voxel_body_t *pbody)
+{
+        for (uint32_t i = 0; i < pbody->nbricks; i++)
+        {
+                free(pbody->pbricks[i].ppoints);
+                free(pbody->pbricks[i].psprings);
+                free(pbody->pbricks[i].pcluster_offsets);
+        }
+
+        free(pbody->ppoints);
+        free(pbody->pfree_points);
+        free(pbody->psprings);
+        free(pbody->pfree_springs);
+        free(pbody->pbricks);
+        voxel_map_free(&pbody->corners);
+        voxel_map_free(&pbody->spring_map);
+        voxel_map_free(&pbody->brick_map);
+        *pbody = (voxel_body_t){};
+}
+
+/* room for n elements of sz bytes, doubling */
+static void *voxel_body_reserve(void *p, uint32_t *pcapacity, uint32_t n, size_t sz)
+{
+        if (n <= *pcapacity)
+        {
+                return p;
+        }
+
+        *pcapacity = MAX(MAX(*pcapacity * 2, n), 64);
+        p          = realloc(p, sz * *pcapacity);
+        if (!p)
+        {
+                fprintf(stderr, "Cant grow voxel body.\n");
+                abort();
+        }
+        return p;
+}
+
+static void voxel_body_push_ref(
+        voxel_body_ref_t **pprefs,
+        uint32_t *pn,
+        uint32_t *pcapacity,
+        uint32_t idx,
+        float amount)
+{
+        *pprefs = voxel_body_reserve(
+                *pprefs, pcapacity, *pn + 1, sizeof(voxel_body_ref_t));
+        (*pprefs)[(*pn)++] = (voxel_body_ref_t){.idx = idx, .amount = amount};
+}
+
+static inline uint64_t voxel_spring_key(uint32_t idx_a, uint32_t idx_b)
+{
+        return VOXEL_MAP_USED | (uint64_t) MIN(idx_a, idx_b) << 32 | MAX(idx_a, idx_b);
+}
+
+static uint32_t voxel_body_acquire_point(
+        voxel_body_t *pbody, int32_t x, int32_t y, int32_t z, float mass)
+{
+        uint64_t key = voxel_corner_key(x, y, z);
+        uint32_t idx = voxel_map_find(&pbody->corners, key);
+
+        if (idx == VOXEL_MAP_NONE)
+        {
+                if (pbody->nfree_points)
+                {
+                        idx = pbody->pfree_points[--pbody->nfree_points];
+                }
+                else
+                {
+                        pbody->ppoints = voxel_body_reserve(
+                                pbody->ppoints,
+                                &pbody->npoint_capacity,
+                                pbody->npoints + 1,
+                                sizeof(voxel_body_point_t));
+                        idx = pbody->npoints++;
+                }
+
+                pbody->ppoints[idx] = (voxel_body_point_t){.x = x, .y = y, .z = z};
+                voxel_map_insert(&pbody->corners, key, idx);
+        }
+
+        pbody->ppoints[idx].nrefs++;
+        pbody->ppoints[idx].mass += mass;
+        return idx;
+}
+
+static void voxel_body_release_point(voxel_body_t *pbody, uint32_t idx, float mass)
+{
+        voxel_body_point_t *ppoint = &pbody->ppoints[idx];
+
+        ppoint->mass -= mass;
+        if (--ppoint->nrefs)
+        {
+                return;
+        }
+
+        voxel_map_erase(
+                &pbody->corners, voxel_corner_key(ppoint->x, ppoint->y, ppoint->z));
+        pbody->pfree_points = voxel_body_reserve(
+                pbody->pfree_points,
+                &pbody->nfree_point_capacity,
+                pbody->nfree_points + 1,
+                sizeof(uint32_t));
+        pbody->pfree_points[pbody->nfree_points++] = idx;
+}
+
+static uint32_t voxel_body_acquire_spring(
+        voxel_body_t *pbody, uint32_t idx_a, uint32_t idx_b, float k)
+{
+        uint64_t key = voxel_spring_key(idx_a, idx_b);
+        uint32_t idx = voxel_map_find(&pbody->spring_map, key);
+
+        if (idx == VOXEL_MAP_NONE)
+        {
+                if (pbody->nfree_springs)
+                {
+                        idx = pbody->pfree_springs[--pbody->nfree_springs];
+                }
+                else
+                {
+                        pbody->psprings = voxel_body_reserve(
+                                pbody->psprings,
+                                &pbody->nspring_capacity,
+                                pbody->nsprings + 1,
+                                sizeof(voxel_body_spring_t));
+                        idx = pbody->nsprings++;
+                }
+
+                pbody->psprings[idx] =
+                        (voxel_body_spring_t){.idx_a = idx_a, .idx_b = idx_b};
+                voxel_map_insert(&pbody->spring_map, key, idx);
+        }
+
+        pbody->psprings[idx].nrefs++;
+        pbody->psprings[idx].k += k;
+        return idx;
+}
+
+static void voxel_body_release_spring(voxel_body_t *pbody, uint32_t idx, float k)
+{
+        voxel_body_spring_t *pspring = &pbody->psprings[idx];
+
+        pspring->k -= k;
+        if (--pspring->nrefs)
+        {
+                return;
+        }
+
+        voxel_map_erase(
+                &pbody->spring_map, voxel_spring_key(pspring->idx_a, pspring->idx_b));
+        pbody->pfree_springs = voxel_body_reserve(
+                pbody->pfree_springs,
+                &pbody->nfree_spring_capacity,
+                pbody->nfree_springs + 1,
+                sizeof(uint32_t));
+        pbody->pfree_springs[pbody->nfree_springs++] = idx;
+}
+
+/* corners of the unit cube, bit 0 x, bit 1 y, bit 2 z */
+static const uint8_t voxel_body_pedges[VOXEL_BODY_VOXEL_SPRINGS][2] = {
+        {0, 1}, {2, 3}, {4, 5}, {6, 7}, {0, 2}, {1, 3}, {4, 6}, {5, 7}, {0, 4}, {1, 5},
+        {2, 6}, {3, 7}, {0, 3}, {1, 2}, {4, 7}, {5, 6}, {0, 5}, {1, 4}, {2, 7}, {3, 6},
+        {0, 6}, {2, 4}, {1, 7}, {3, 5}, {0, 7}, {1, 6}, {2, 5}, {3, 4}};
+
+/*
+ * Floods the hard voxels of a brick into face connected clusters and
+ * references the corners on each cluster's surface. A corner is inside a
+ * cluster only when all eight voxels around it are members, so corners on
+ * the brick's faces always stay and tie the cluster to its neighbours.
+ * pcells holds VOXEL_TYPE_ + 1 per voxel of the brick, 0 when empty.
+ */
+static void voxel_body_mesh_clusters(
+        voxel_body_t *pbody,
+        voxel_body_brick_t *pbrick,
+        const uint8_t *pcells,
+        int32_t x0,
+        int32_t y0,
+        int32_t z0)
+{
+        const int32_t N  = VOXEL_BRICK_SIZE;
+        const uint8_t hard = VOXEL_TYPE_HARD + 1;
+
+        int16_t plabels[VOXEL_BRICK_VOXELS];
+        uint16_t pstack[VOXEL_BRICK_VOXELS];
+
+        pbrick->pcluster_offsets = voxel_body_reserve(
+                pbrick->pcluster_offsets,
+                &pbrick->ncluster_capacity,
+                1,
+                sizeof(uint32_t));
+        pbrick->pcluster_offsets[0] = 0;
+
+        for (uint32_t i = 0; i < VOXEL_BRICK_VOXELS; i++)
+        {
+                plabels[i] = -1;
+        }
+
+        for (uint32_t seed = 0; seed < VOXEL_BRICK_VOXELS; seed++)
+        {
+                if (pcells[seed] != hard || plabels[seed] >= 0)
+                {
+                        continue;
+                }
+
+                int16_t label   = (int16_t) pbrick->nclusters;
+                uint32_t nstack = 0, nvoxels = 0;
+
+                plabels[seed]    = label;
+                pstack[nstack++] = seed;
+                while (nstack)
+                {
+                        uint32_t i = pstack[--nstack];
+                        int32_t x = i % N, y = i / N % N, z = i / (N * N);
+                        nvoxels++;
+
+                        int32_t pneighbors[6][2] = {
+                                {x > 0, -1},
+                                {x < N - 1, 1},
+                                {y > 0, -N},
+                                {y < N - 1, N},
+                                {z > 0, -N * N},
+                                {z < N - 1, N * N}};
+                        for (uint32_t n = 0; n < 6; n++)
+                        {
+                                uint32_t j = i + pneighbors[n][1];
+                                if (pneighbors[n][0] && pcells[j] == hard &&
+                                    plabels[j] < 0)
+                                {
+                                        plabels[j]       = label;
+                                        pstack[nstack++] = j;
+                                }
+                        }
+                }
+
+                /* surface corners, counted first so each gets an equal share of mass */
+                uint8_t psurface[(VOXEL_BRICK_SIZE + 1) * (VOXEL_BRICK_SIZE + 1) *
+                                 (VOXEL_BRICK_SIZE + 1)];
+                uint32_t nsurface = 0;
+
+                for (int32_t cz = 0; cz <= N; cz++)
+                for (int32_t cy = 0; cy <= N; cy++)
+                for (int32_t cx = 0; cx <= N; cx++)
+                {
+                        uint32_t nmembers = 0;
+                        for (uint32_t c = 0; c < 8; c++)
+                        {
+                                int32_t x = cx - 1 + (c & 1);
+                                int32_t y = cy - 1 + (c >> 1 & 1);
+                                int32_t z = cz - 1 + (c >> 2);
+                                uint32_t i = x + y * N + z * N * N;
+                                if (x >= 0 && y >= 0 && z >= 0 && x < N && y < N && z < N)
+                                {
+                                        nmembers += plabels[i] == label;
+                                }
+                        }
+
+                        uint32_t c  = cx + cy * (N + 1) + cz * (N + 1) * (N + 1);
+                        psurface[c] = nmembers > 0 && nmembers < 8;
+                        nsurface += psurface[c];
+                }
+
+                float share = pbody->params.pmass[VOXEL_TYPE_HARD] * nvoxels / nsurface;
+                for (int32_t cz = 0; cz <= N; cz++)
+                for (int32_t cy = 0; cy <= N; cy++)
+                for (int32_t cx = 0; cx <= N; cx++)
+                {
+                        if (psurface[cx + cy * (N + 1) + cz * (N + 1) * (N + 1)])
+                        {
+                                uint32_t idx = voxel_body_acquire_point(
+                                        pbody, x0 + cx, y0 + cy, z0 + cz, share);
+                                voxel_body_push_ref(
+                                        &pbrick->ppoints,
+                                        &pbrick->npoints,
+                                        &pbrick->npoint_capacity,
+                                        idx,
+                                        share);
+                        }
+                }
+
+                pbrick->pcluster_offsets = voxel_body_reserve(
+                        pbrick->pcluster_offsets,
+                        &pbrick->ncluster_capacity,
+                        pbrick->nclusters + 2,
+                        sizeof(uint32_t));
+                pbrick->pcluster_offsets[++pbrick->nclusters] = pbrick->npoints;
+        }
+}
+
+/* corners and springs of every soft voxel of a brick, see voxel_body_mesh_clusters */
+static void voxel_body_mesh_soft(
+        voxel_body_t *pbody,
+        voxel_body_brick_t *pbrick,
+        const uint8_t *pcells,
+        int32_t x0,
+        int32_t y0,
+        int32_t z0)
+{
+        for (uint32_t i = 0; i < VOXEL_BRICK_VOXELS; i++)
+        {
+                if (!pcells[i] || pcells[i] == VOXEL_TYPE_HARD + 1)
+                {
+                        continue;
+                }
+
+                uint8_t type = pcells[i] - 1;
+                float share  = pbody->params.pmass[type] / 8.0f;
+                float k      = pbody->params.pk[type];
+                int32_t x    = x0 + (int32_t) (i & VOXEL_BRICK_MASK);
+                int32_t y    = y0 + (int32_t) (i >> VOXEL_BRICK_BITS & VOXEL_BRICK_MASK);
+                int32_t z    = z0 + (int32_t) (i >> (VOXEL_BRICK_BITS * 2));
+
+                uint32_t pcorners[8];
+                for (uint32_t c = 0; c < 8; c++)
+                {
+                        pcorners[c] = voxel_body_acquire_point(
+                                pbody,
+                                x + (c & 1),
+                                y + (c >> 1 & 1),
+                                z + (c >> 2),
+                                share);
+                        voxel_body_push_ref(
+                                &pbrick->ppoints,
+                                &pbrick->npoints,
+                                &pbrick->npoint_capacity,
+                                pcorners[c],
+                                share);
+                }
+
+                for (uint32_t e = 0; e < VOXEL_BODY_VOXEL_SPRINGS; e++)
+                {
+                        uint32_t idx = voxel_body_acquire_spring(
+                                pbody,
+                                pcorners[voxel_body_pedges[e][0]],
+                                pcorners[voxel_body_pedges[e][1]],
+                                k);
+                        voxel_body_push_ref(
+                                &pbrick->psprings,
+                                &pbrick->nsprings,
+                                &pbrick->nspring_capacity,
+                                idx,
+                                k);
+                }
+        }
+}
+
+/*
+ * Re-meshes brick (bx, by, bz) from the store, the only work an edit of
+ * one of its voxels needs. Voxels outside the body's region are ignored.
+ */
+void voxel_body_update_brick(
+        voxel_body_t *pbody,
+        const voxel_store_t *pstore,
+        int32_t bx,
+        int32_t by,
+        int32_t bz)
+{
+        uint64_t key = voxel_corner_key(bx, by, bz);
+        uint32_t idx = voxel_map_find(&pbody->brick_map, key);
+
+        if (idx == VOXEL_MAP_NONE)
+        {
+                pbody->pbricks = voxel_body_reserve(
+                        pbody->pbricks,
+                        &pbody->nbrick_capacity,
+                        pbody->nbricks + 1,
+                        sizeof(voxel_body_brick_t));
+                idx                 = pbody->nbricks++;
+                pbody->pbricks[idx] = (voxel_body_brick_t){.x = bx, .y = by, .z = bz};
+                voxel_map_insert(&pbody->brick_map, key, idx);
+        }
+
+        /* springs first, they would otherwise outlive the points they join */
+        voxel_body_brick_t *pbrick = &pbody->pbricks[idx];
+        for (uint32_t i = 0; i < pbrick->nsprings; i++)
+        {
+                voxel_body_release_spring(
+                        pbody, pbrick->psprings[i].idx, pbrick->psprings[i].amount);
+        }
+        for (uint32_t i = 0; i < pbrick->npoints; i++)
+        {
+                voxel_body_release_point(
+                        pbody, pbrick->ppoints[i].idx, pbrick->ppoints[i].amount);
+        }
+        pbrick->npoints   = 0;
+        pbrick->nsprings  = 0;
+        pbrick->nclusters = 0;
+
+        const voxel_brick_t *pvoxels = voxel_store_find(pstore, bx, by, bz);
+        if (!pvoxels)
+        {
+                return;
+        }
+
+        uint8_t pcells[VOXEL_BRICK_VOXELS];
+        for (uint32_t i = 0; i < VOXEL_BRICK_VOXELS; i++)
+        {
+                int32_t x, y, z;
+                voxel_brick_voxel(pvoxels, i, &x, &y, &z);
+
+                bool inside = x >= pbody->x0 && y >= pbody->y0 && z >= pbody->z0 &&
+                              x < pbody->x1 && y < pbody->y1 && z < pbody->z1;
+                pcells[i] = inside && voxel_brick_occupied(pvoxels, i)
+                                    ? voxel_brick_material(pvoxels, i) + 1
+                                    : 0;
+        }
+
+        int32_t x0 = bx * VOXEL_BRICK_SIZE, y0 = by * VOXEL_BRICK_SIZE;
+        int32_t z0 = bz * VOXEL_BRICK_SIZE;
+        voxel_body_mesh_clusters(pbody, pbrick, pcells, x0, y0, z0);
+        voxel_body_mesh_soft(pbody, pbrick, pcells, x0, y0, z0);
+}
+
+/* meshes every brick of the store, dropping bricks that have gone */
+void voxel_body_build(voxel_body_t *pbody, const voxel_store_t *pstore)
+{
+        for (uint32_t i = 0; i < pstore->nbricks; i++)
+        {
+                const voxel_brick_t *pbrick = &pstore->pbricks[i];
+                voxel_body_update_brick(pbody, pstore, pbrick->x, pbrick->y, pbrick->z);
+        }
+
+        for (uint32_t i = 0; i < pbody->nbricks; i++)
+        {
+                int32_t bx = pbody->pbricks[i].x, by = pbody->pbricks[i].y;
+                int32_t bz = pbody->pbricks[i].z;
+                if (pbody->pbricks[i].npoints && !voxel_store_find(pstore, bx, by, bz))
+                {
+                        voxel_body_update_brick(pbody, pstore, bx, by, bz);
+                }
+        }
+}
+
+/* edits the store and re-meshes the one brick the voxel lives in */
+void voxel_body_set(
+        voxel_body_t *pbody,
+        voxel_store_t *pstore,
+        int32_t x,
+        int32_t y,
+        int32_t z,
+        uint8_t type)
+{
+        voxel_store_set(pstore, x, y, z, type);
+        voxel_body_update_brick(
+                pbody,
+                pstore,
+                x >> VOXEL_BRICK_BITS,
+                y >> VOXEL_BRICK_BITS,
+                z >> VOXEL_BRICK_BITS);
+}
+
+void voxel_body_clear(
+        voxel_body_t *pbody, voxel_store_t *pstore, int32_t x, int32_t y, int32_t z)
+{
+        voxel_store_clear(pstore, x, y, z);
+        voxel_body_update_brick(
+                pbody,
+                pstore,
+                x >> VOXEL_BRICK_BITS,
+                y >> VOXEL_BRICK_BITS,
+                z >> VOXEL_BRICK_BITS);
+}
+
+/*
+ * Emits the body at rest as an entity with malloc'd point masses, springs
+ * and rigid clusters, which physics_body_clusters keeps rigid. The point
+ * masses come out in entity_reorder's order.
+ */
+void voxel_body_entity(const voxel_body_t *pbody, entity_t *pentity)
+{
+        float size = pbody->params.voxel_size;
+
+        uint32_t *premap = malloc(sizeof(uint32_t) * (pbody->npoints + 1));
+        if (!premap)
+        {
+                fprintf(stderr, "Cant allocate voxel body remap.\n");
+                abort();
+        }
+
+        uint32_t npoints = 0, nsprings = 0, nclusters = 0, nmembers = 0;
+        for (uint32_t i = 0; i < pbody->npoints; i++)
+        {
+                premap[i] = pbody->ppoints[i].nrefs ? npoints++ : VOXEL_MAP_NONE;
+        }
+        for (uint32_t i = 0; i < pbody->nsprings; i++)
+        {
+                nsprings += pbody->psprings[i].nrefs > 0;
+        }
+        for (uint32_t i = 0; i < pbody->nbricks; i++)
+        {
+                const voxel_body_brick_t *pbrick = &pbody->pbricks[i];
+                if (pbrick->nclusters)
+                {
+                        nclusters += pbrick->nclusters;
+                        nmembers += pbrick->pcluster_offsets[pbrick->nclusters];
+                }
+        }
+
+        *pentity = (entity_t){
+                .npoint_masses    = npoints,
+                .nsprings         = nsprings,
+                .ppoint_masses    = malloc(sizeof(point_mass_t) * (npoints + 1)),
+                .psprings         = malloc(sizeof(spring_t) * (nsprings + 1)),
+                .integrator       = pbody->params.integrator,
+                .damping          = pbody->params.damping,
+                .nclusters        = nclusters,
+                .pcluster_offsets = malloc(sizeof(uint32_t) * (nclusters + 1)),
+                .pcluster_members = malloc(sizeof(uint32_t) * (nmembers + 1))};
+        if (!pentity->ppoint_masses || !pentity->psprings ||
+            !pentity->pcluster_offsets || !pentity->pcluster_members)
+        {
+                fprintf(stderr, "Cant allocate voxel body entity.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < pbody->npoints; i++)
+        {
+                const voxel_body_point_t *ppoint = &pbody->ppoints[i];
+                if (premap[i] != VOXEL_MAP_NONE)
+                {
+                        point_mass_t *pout = &pentity->ppoint_masses[premap[i]];
+                        *pout              = (point_mass_t){.mass = ppoint->mass};
+                        pout->position     = (vec3_t){
+                                ppoint->x * size, ppoint->y * size, ppoint->z * size};
+                }
+        }
+
+        nsprings = 0;
+        for (uint32_t i = 0; i < pbody->nsprings; i++)
+        {
+                const voxel_body_spring_t *pspring = &pbody->psprings[i];
+                if (!pspring->nrefs)
+                {
+                        continue;
+                }
+
+                const voxel_body_point_t *pa = &pbody->ppoints[pspring->idx_a];
+                const voxel_body_point_t *pb = &pbody->ppoints[pspring->idx_b];
+                float dx = (float) (pa->x - pb->x), dy = (float) (pa->y - pb->y);
+                float dz = (float) (pa->z - pb->z);
+
+                pentity->psprings[nsprings++] = (spring_t){
+                        .idx_a         = premap[pspring->idx_a],
+                        .idx_b         = premap[pspring->idx_b],
+                        .k             = pspring->k,
+                        .rest_distance = size * sqrtf(dx * dx + dy * dy + dz * dz)};
+        }
+
+        nclusters = 0;
+        nmembers  = 0;
+        for (uint32_t i = 0; i < pbody->nbricks; i++)
+        {
+                const voxel_body_brick_t *pbrick = &pbody->pbricks[i];
+                for (uint32_t c = 0; c < pbrick->nclusters; c++)
+                {
+                        pentity->pcluster_offsets[nclusters++] = nmembers;
+                        for (uint32_t m = pbrick->pcluster_offsets[c];
+                             m < pbrick->pcluster_offsets[c + 1];
+                             m++)
+                        {
+                                pentity->pcluster_members[nmembers++] =
+                                        premap[pbrick->ppoints[m].idx];
+                        }
+                }
+        }
+        pentity->pcluster_offsets[nclusters] = nmembers;
+
+        free(entity_reorder(pentity, SPRING_GRAPH_ORDER_RCM));
+        free(premap);
+}
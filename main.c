@@ -4,63 +4,369 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#define VOXEL_TYPE_HARD 0b00
-#define VOXEL_TYPE_SOFT 0b11
-#define VOXEL_TYPE_FLUCUATE1 0b10
-#define VOXEL_TYPE_FLUCUATE2 0b01
+#define RENDERER_SZPUSH_CONSTANTS sizeof(float[52])
+
+#include "include/checkpoint.h"
+#include "include/mesh.h"
+#include "include/physics.h"
+#include "include/physics_world.h"
+#include "include/profiler.h"
+#include "include/scheduler.h"
+#include "include/spring_graph.h"
+#include "include/tlsf.h"
+#include "include/trajectory.h"
+#include "include/utils.h"
+#include "include/voxel.h"
+#include "include/voxel_body.h"
+
+/* RENDERER_HEADLESS builds without SDL, surface or swapchain */
+#ifndef RENDERER_HEADLESS
+        #define SDL_MAIN_HANDLED
+        #include <SDL2/SDL.h>
+        #include <SDL2/SDL_vulkan.h>
+#endif
+#include <vulkan/vulkan.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* pframe_infos slots, nframes_in_flight of them are used */
+#define RENDERER_MAX_FRAMES_IN_FLIGHT 4
+#define RENDERER_FRAMES_IN_FLIGHT 2
+#define RENDERER_VK_TIMEOUT 9999999
 
-#define RENDERER_SZPUSH_CONSTANTS sizeof(float[36])
+#define RENDERER_SWAPCHAIN_IMAGE_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+/* cleared to 1, nearer is less */
+#define RENDERER_DEPTH_FORMAT VK_FORMAT_D32_SFLOAT
+
+/* hi-z pyramid, level 0 is half the depth buffer and each level halves it to 1x1 */
+#define RENDERER_PYRAMID_FORMAT VK_FORMAT_R32_SFLOAT
+#define RENDERER_MAX_PYRAMID_LEVELS 16
+#define RENDERER_SZPYRAMID_WORKGROUP 8
+
+/* headless frames cycle through this many offscreen images */
+#define RENDERER_OFFSCREEN_IMAGES 2
+#define RENDERER_HEADLESS_FRAMES 1000
+
+/* the layout a finished frame leaves its image in */
+#ifdef RENDERER_HEADLESS
+        #define RENDERER_FRAME_LAYOUT VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+#else
+        #define RENDERER_FRAME_LAYOUT VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+#endif
+
+/* VkPipelineCache data behind a renderer_pipeline_cache_header_t */
+#define RENDERER_PIPELINE_CACHE_PATH "pipeline_cache.bin"
+#define RENDERER_PIPELINE_CACHE_MAGIC 0x31435048u
+
+/* timestamp queries of a frame, a begin and end pair per pass and physics step */
+#define RENDERER_QUERY_CULL 0
+#define RENDERER_QUERY_GRAPHICS 2
+#define RENDERER_QUERY_PYRAMID 4
+#define RENDERER_QUERY_PHYSICS 6
+#define RENDERER_QUERY_COUNT (RENDERER_QUERY_PHYSICS + 2 * RENDERER_PHYSICS_MAX_STEPS)
+
+/* one pipeline statistics query spans the frame, results in bit order */
+#define RENDERER_STATS_FLAGS                                                             \
+        (VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |                       \
+         VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |                     \
+         VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |                     \
+         VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |                           \
+         VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |                   \
+         VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT)
+#define RENDERER_STATS_COUNT 6
+
+static const char *const renderer_stat_names[RENDERER_STATS_COUNT] = {
+        "ia vertices",
+        "ia primitives",
+        "vs invocations",
+        "clip primitives",
+        "fs invocations",
+        "cs invocations"};
+
+/* chrome trace of the frames still in the profiler ring, written on exit */
+#define RENDERER_TRACE_PATH "trace.json"
+
+#define RENDERER_SZWORKGROUP_X 16
+#define RENDERER_SZWORKGROUP_Y 16
+#define RENDERER_SZWORKGROUP_Z 1
+
+#define RENDERER_SZPHYSICS_WORKGROUP 256
+#define RENDERER_SZCULL_WORKGROUP 64
+/* instances per draw batch and secondary command buffer, mirrored by cull.comp */
+#define RENDERER_DRAW_BATCH 1024
+#define RENDERER_PHYSICS_PASS_BEGIN 0
+#define RENDERER_PHYSICS_PASS_FORCES 1
+#define RENDERER_PHYSICS_PASS_STAGE 2
+#define RENDERER_PHYSICS_PASS_IMPLICIT_ITERATE 3
+#define RENDERER_PHYSICS_PASS_IMPLICIT_FINISH 4
+#define RENDERER_PHYSICS_PASS_XPBD_SOLVE 5
+#define RENDERER_PHYSICS_PASS_COLLISION_CLEAR 6
+#define RENDERER_PHYSICS_PASS_COLLISION_BOUNDS 7
+#define RENDERER_PHYSICS_PASS_COLLISION_COUNT 8
+#define RENDERER_PHYSICS_PASS_COLLISION_SCAN_BLOCKS 9
+#define RENDERER_PHYSICS_PASS_COLLISION_SCAN_TOTALS 10
+#define RENDERER_PHYSICS_PASS_COLLISION_SCAN_ADD 11
+#define RENDERER_PHYSICS_PASS_COLLISION_SCATTER 12
+#define RENDERER_PHYSICS_PASS_COLLISION_ORDER 13
+#define RENDERER_PHYSICS_PASS_COLLISION_TRIANGLES 14
+#define RENDERER_PHYSICS_PASS_COLLISION_POINTS 15
+#define RENDERER_PHYSICS_PASS_COLLISION_APPLY 16
+#define RENDERER_PHYSICS_PASS_CLUSTER_FIT 17
+#define RENDERER_PHYSICS_PASS_CLUSTER_APPLY 18
+#define RENDERER_PHYSICS_PASS_SLEEP_REST 19
+#define RENDERER_PHYSICS_PASS_SLEEP_TOUCH 20
+#define RENDERER_PHYSICS_PASS_SLEEP_UPDATE 21
+#define RENDERER_PHYSICS_PASS_SLEEP_COMPACT 22
+
+/* fixed physics step, frames longer than max steps slow the simulation down */
+#define RENDERER_PHYSICS_STEP (1.0f / 120.0f)
+#define RENDERER_PHYSICS_MAX_STEPS 8
+
+/* rk4, implicit and xpbd state, see the SCRATCH_ offsets in physics.comp */
+#define RENDERER_PHYSICS_SCRATCH_STREAMS 12
+/* collision_delta_t as streams, see the DELTA_ offsets in physics.comp */
+#define RENDERER_COLLISION_DELTA_STREAMS 16
+/* a cluster's rotation and centre, see the CLUSTER_FRAME_ offsets in physics.comp */
+#define RENDERER_CLUSTER_FRAME_STRIDE 8
+/* an entity's sleep record, see the SLEEP_ offsets in physics.comp */
+#define RENDERER_SLEEP_STRIDE 3
+
+/* scene_buf streams start on this many words */
+#define RENDERER_SCENE_ALIGN 16
+/* scene_buf is never smaller, and doubles when streamed sections run out of room */
+#define RENDERER_SCENE_MIN_WORDS (1u << 20)
+#define RENDERER_SCENE_USAGE                                                             \
+        (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |         \
+         VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |           \
+         VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+
+/* device memory comes in blocks this big, bigger requests get a block of their own */
+#define RENDERER_MEMORY_BLOCK_SIZE (64ULL << 20)
+/* handle of an allocation owning a dedicated block, tlsf never hands it out */
+#define RENDERER_MEMORY_DEDICATED TLSF_NONE
+
+/* persistently mapped upload ring, and the copy batches that may be in flight from it */
+#define RENDERER_STAGING_SIZE (16ULL << 20)
+#define RENDERER_STAGING_ALIGN 16
+#define RENDERER_UPLOAD_BATCHES 4
 
+/*
+ * Head of scene_buf, mirrored by the scene block in shader/scene.glsl. Every
+ * idx_ is an offset in 32 bit words from the start of scene_buf. Point mass
+ * state is stored as one stream per component and never leaves the device.
+ */
+typedef struct
+{
+        uint32_t npoint_masses;
+        uint32_t nentities;
+        uint32_t idx_entities, idx_point_entities;
+        uint32_t idx_x, idx_y, idx_z;
+        uint32_t idx_vx, idx_vy, idx_vz;
+        uint32_t idx_ax, idx_ay, idx_az;
+        uint32_t idx_mass, idx_inv_mass;
+        uint32_t idx_adjacency, idx_neighbors, idx_k, idx_rest_distance;
+        uint32_t idx_scratch;
+        /* xpbd springs as constraints, sorted by colour */
+        uint32_t idx_constraint_a, idx_constraint_b, idx_constraint_k;
+        uint32_t idx_constraint_rest, idx_lambda;
+        /*
+         * Draw data. An instance is a meshlet of an object, cull.comp
+         * compacts the visible instances of each RENDERER_DRAW_BATCH into
+         * VkDrawIndexedIndirectCommands at idx_draw and their count at
+         * idx_ndraw + batch, graphics.vert pulls vertices from idx_geometry.
+         */
+        uint32_t nmeshes, nobjects;
+        uint32_t idx_geometry, idx_indices, idx_meshes;
+        uint32_t idx_draw, idx_ndraw, idx_object, idx_light;
+        uint32_t nmeshlets, ninstances;
+        uint32_t idx_meshlets, idx_instances;
+        /*
+         * Contacts, see collision.h. Items are the colliding point masses
+         * then npoint_masses + triangle, hashed into ncells buckets each
+         * step. Cells are two max_radius wider than the widest triangle up
+         * to triangle_limit, wider ones go into coarse cells as wide as the
+         * widest, whose extent the bounds pass leaves at idx_collision_extent.
+         */
+        uint32_t ncolliding_points, ntriangles, ncollision_items, ncells;
+        float max_radius;
+        uint32_t idx_triangles, idx_corner_offsets, idx_corners, idx_collision_items;
+        uint32_t idx_item_cells, idx_cell_counts, idx_cell_starts, idx_block_sums;
+        uint32_t idx_sorted, idx_triangle_extents, idx_collision_extent;
+        uint32_t idx_anchors, idx_deltas, idx_corner_deltas;
+        /*
+         * Rigid clusters, see physics_body_clusters, in global point mass
+         * ids with xyz rest offsets per member. CLUSTER_FIT leaves each
+         * cluster's frame at idx_cluster_frames, CLUSTER_APPLY walks the
+         * (cluster, member) pairs of a point mass from idx_membership_offsets.
+         */
+        uint32_t nclusters, ncluster_members;
+        uint32_t idx_cluster_offsets, idx_cluster_members, idx_cluster_rest;
+        uint32_t idx_cluster_frames, idx_membership_offsets, idx_memberships;
+        /*
+         * Set as collision_init does, the bounds pass grows the six words
+         * at idx_wide_bounds, min xyz then max xyz of the wide triangles,
+         * as uints that order like the floats.
+         */
+        float triangle_limit;
+        uint32_t idx_wide_bounds;
+        /*
+         * Sleep, see physics_world_sleep. idx_sleep holds a record per
+         * entity, idx_rest_window where its points were when its rest
+         * window began and idx_touches the entity each collision item last
+         * touched. SLEEP_COMPACT lists the awake points at idx_awake_points
+         * for the point passes, which dispatch from the
+         * VkDispatchIndirectCommand at idx_awake_dispatch, their count next.
+         */
+        uint32_t idx_sleep, idx_rest_window, idx_touches;
+        uint32_t idx_awake_points, idx_awake_dispatch;
+} renderer_scene_t;
+
+/* per entity record in scene_buf, mirrored by the ENTITY_ offsets in physics.comp */
 typedef struct
 {
-        float x, y, z;
-} vec3_t;
+        uint32_t first_point_mass, npoint_masses;
+        float damping;
+        uint32_t integrator;
+        float radius, friction;
+} renderer_entity_t;
+
+/* mesh.h owns the vertex layout, the scene packs it unchanged */
+typedef mesh_vertex_t renderer_vertex_t;
 
+/* an instance of pmeshes[idx_mesh], model_mat column major like the camera */
 typedef struct
 {
-        float mass;
-        vec3_t position, velocity, acceleration;
-} point_mass_t;
+        float model_mat[16];
+        uint32_t idx_mesh;
+} object_t;
 
+/* per mesh record in scene_buf, mirrored by the MESH_ offsets in cull.comp */
 typedef struct
 {
-        float k, rest_distance;
-} spring_t;
+        uint32_t first_index, nindices;
+        int32_t vertex_offset;
+        /* bounding sphere in mesh space */
+        float radius, center[3];
+        uint32_t first_meshlet;
+} renderer_mesh_t;
+
+/*
+ * mesh.h owns the meshlet layout too, packed with first_index rebased onto
+ * the scene's indices, mirrored by the MESHLET_ offsets in cull.comp
+ */
+typedef mesh_meshlet_t renderer_meshlet_t;
 
+/* what cull.comp tests and draws, mirrored by the INSTANCE_ offsets there */
 typedef struct
 {
-        uint32_t npoint_masses, nsprings;
-        point_mass_t *ppoint_masses;
-        spring_t *psprings;
-} entity_t;
+        uint32_t idx_object, idx_meshlet;
+} renderer_instance_t;
 
-#include "include/utils.h"
+/* per object record in scene_buf, mirrored by the OBJECT_ offsets in the shaders */
+typedef struct
+{
+        float model_mat[16];
+        uint32_t idx_mesh;
+        uint32_t __padding[3];
+} renderer_object_t;
 
-#define SDL_MAIN_HANDLED
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_vulkan.h>
-#include <vulkan/vulkan.h>
+/*
+ * Push constants of the cull and graphics pipes, the pc blocks there.
+ * prev_view_proj is the camera the hi-z pyramid was drawn with, occlusion
+ * is 0 until there is a pyramid to test against.
+ */
+typedef struct
+{
+        float dt;
+        uint32_t occlusion;
+        uint32_t __padding[2];
+        float proj_mat[16], view_mat[16];
+        float prev_view_proj[16];
+} renderer_camera_push_t;
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <time.h>
+/*
+ * One vkAllocateMemory of a single memory type, handed out in sub-ranges by
+ * a tlsf over its bytes, or whole to one allocation larger than a block.
+ * Host visible blocks stay mapped for their lifetime.
+ */
+typedef struct
+{
+        VkDeviceMemory mem;
+        uint32_t idx_type;
+        void *pmapped;
+        tlsf_t tlsf;
+        /* size of a dedicated block, which has no tlsf, 0 otherwise */
+        VkDeviceSize dedicated;
+} renderer_memory_block_t;
 
-#define NFRAMES_IN_FLIGHT 2
-#define RENDERER_VK_TIMEOUT 9999999
+typedef struct
+{
+        VkDeviceMemory mem;
+        VkDeviceSize offset, size;
+        uint32_t idx_block, handle;
+        /* NULL unless the memory is host visible */
+        void *pmapped;
+} renderer_allocation_t;
 
-#define RENDERER_TIMELINE_COMMANDS_COMPLETE_VALUE 2ULL
-#define RENDERER_TIMELINE_FRAME_PRESENT_VALUE 3ULL
-#define RENDERER_SWAPCHAIN_IMAGE_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+typedef struct
+{
+        VkCommandBuffer cmd_buf;
+        /* upload_sema reaches value once the copies are done, freeing the ring to head */
+        uint64_t value, head;
+} renderer_upload_batch_t;
 
-#define RENDERER_SZWORKGROUP_X 16
-#define RENDERER_SZWORKGROUP_Y 16
-#define RENDERER_SZWORKGROUP_Z 1
+/*
+ * The driver checks its own header in the cache data, this one also pins
+ * the driver version, which the pipeline cache UUID need not change with.
+ */
+typedef struct
+{
+        uint32_t magic;
+        uint32_t vendor_id, device_id, driver_version;
+        uint8_t puuid[VK_UUID_SIZE];
+        uint64_t sz;
+} renderer_pipeline_cache_header_t;
 
+/* a worker's secondaries for one frame slot, only that worker touches them */
 typedef struct
 {
-        VkFence fence;
-        VkSemaphore time_sema, img_sema;
+        _Alignas(PLATFORM_CACHE_LINE) VkCommandPool pool;
+        uint32_t nbufs, nused;
+        VkCommandBuffer *pbufs;
+} renderer_worker_pool_t;
+
+/*
+ * The pools are reset whole when the slot comes round again, the primary
+ * cmd_buf executes the secondaries the workers recorded from theirs.
+ */
+typedef struct
+{
+        VkSemaphore img_sema;
+        VkCommandPool cmd_pool;
         VkCommandBuffer cmd_buf;
+        renderer_worker_pool_t *pworker_pools;
+        /* the frame that last used the slot, done once frame_sema reaches it */
+        uint64_t value;
+
+        /*
+         * Null when the queue has no timestamps or the device no inherited
+         * statistics. queried is the frame whose results are still unread.
+         */
+        VkQueryPool timestamp_pool, stats_pool;
+        uint64_t queried;
+        uint64_t submit_time;
+
+        /*
+         * Host copy of the point positions, x, y and z streams per step, made
+         * when recording a trajectory or replaying one. npoint_steps steps
+         * wait for the recorder, points_replay uploads the first at the start.
+         */
+        VkBuffer points_buf;
+        renderer_allocation_t points_alloc;
+        uint32_t npoint_steps;
+        bool points_replay;
 } frame_info_t;
 
 typedef struct
@@ -68,19 +374,99 @@ typedef struct
         uint64_t nframe;
 
         VkPipelineLayout pipe_layout;
-        VkPipeline physics_pipe, graphics_pipe;
+        VkPipelineCache pipe_cache;
+        VkPipeline physics_pipe, cull_pipe, graphics_pipe;
+        /*
+         * physics_pipe specialised to the scene's one integrator, built on
+         * its own thread. Frames use physics_pipe until variant_ready.
+         */
+        VkPipeline physics_variant;
+        uint32_t variant_integrators;
+        atomic_bool variant_ready;
+        bool variant_building;
+        platform_thread_t variant_thread;
 
         VkDescriptorSetLayout set_layout;
+        VkDescriptorPool desc_pool;
         VkDescriptorSet scene_desc;
 
-        VkDeviceMemory scene_mem;
+        /*
+         * The frame's depth, reduced to the farthest value under each texel of
+         * every pyramid level once the draws are done. Set 1 of the pipe
+         * layout, ppyramid_descs[i] reads level i - 1, or the depth for 0,
+         * writes level i and samples the whole pyramid for cull.comp. Shared by
+         * the frames in flight, their barriers order them.
+         */
+        VkImage depth_img, pyramid_img;
+        VkImageView depth_view, pyramid_view;
+        VkImageView ppyramid_level_views[RENDERER_MAX_PYRAMID_LEVELS];
+        renderer_allocation_t depth_alloc, pyramid_alloc;
+        uint32_t pyramid_width, pyramid_height, npyramid_levels;
+        VkSampler pyramid_sampler;
+        VkPipeline pyramid_pipe;
+        VkDescriptorSetLayout pyramid_set_layout;
+        VkDescriptorPool pyramid_pool;
+        VkDescriptorSet ppyramid_descs[RENDERER_MAX_PYRAMID_LEVELS];
+        /* the pyramid holds a frame, drawn under prev_view_proj */
+        bool pyramid_valid;
+        float prev_view_proj[16];
+
+        uint32_t nmemory_blocks;
+        renderer_memory_block_t *pmemory_blocks;
+
+        renderer_allocation_t scene_alloc;
         VkBuffer scene_buf;
-        uint32_t idx_geometry, idx_draw, idx_ndraw, idx_object, idx_light;
+        VkDeviceSize szscene;
+        /* words of scene_buf, sections are allocated from it */
+        tlsf_t scene_words;
+        renderer_scene_t scene;
+        /* bit per physics_integrator_t in use, picks the passes to record */
+        uint32_t physics_integrators;
+        physics_clock_t physics_clock;
+        /* NULL unless recording every step, or replaying steps with the solver off */
+        trajectory_recorder_t *precorder;
+        trajectory_player_t *pplayer;
+        /* colour c spans constraints pconstraint_color_offsets[c] .. [c + 1] */
+        uint32_t nconstraint_colors;
+        uint32_t *pconstraint_color_offsets;
 
         VkCommandPool cmd_pool;
         VkCommandBuffer cmd_buf;
 
-        frame_info_t pframe_infos[NFRAMES_IN_FLIGHT];
+        /* records frames in parallel, NULL records on the calling thread alone */
+        scheduler_t *psched;
+        uint32_t nworkers;
+        uint32_t nsecondary_capacity;
+        VkCommandBuffer *psecondaries;
+
+        /*
+         * Staging ring. head and tail count every byte ever staged and
+         * retired, copies gather in pcopies until renderer_flush_uploads
+         * submits them as one batch.
+         */
+        VkBuffer staging_buf;
+        renderer_allocation_t staging_alloc;
+        uint64_t staging_head, staging_tail;
+        uint32_t ncopies, ncopy_capacity;
+        VkBufferCopy *pcopies;
+
+        VkCommandPool upload_pool;
+        VkSemaphore upload_sema;
+        uint64_t upload_value, upload_retired;
+        renderer_upload_batch_t pupload_batches[RENDERER_UPLOAD_BATCHES];
+
+        /* timeline, frame n signals n */
+        VkSemaphore frame_sema;
+        uint32_t nframes_in_flight;
+        frame_info_t pframe_infos[RENDERER_MAX_FRAMES_IN_FLIGHT];
+        /* binary, signalled for present, one per swapchain image */
+        VkSemaphore *ppresent_semas;
+
+        /* timestamp_mask is 0 without timestamps, stats_flags without statistics */
+        profiler_t profiler;
+        uint64_t timestamp_mask;
+        float timestamp_period;
+        VkQueryPipelineStatisticFlags stats_flags;
 
         float dt;
         float proj_mat[16], view_mat[16];
@@ -90,16 +476,22 @@ typedef struct
         VkPhysicalDevice pdevice;
         VkDevice ldevice;
 
-        uint32_t idx_qfam;
-        VkQueue queue;
+        /* the transfer family is idx_qfam when the device has no transfer only one */
+        uint32_t idx_qfam, idx_transfer_qfam;
+        VkQueue queue, transfer_queue;
 
+        /* headless, the images are offscreen ones with their memory in pimage_allocs */
         VkSwapchainKHR swapchain;
         uint32_t nswapchain_images;
         VkImage *pswapchain_images;
+        VkImageView *pswapchain_views;
+        renderer_allocation_t *pimage_allocs;
         VkSurfaceKHR surface;
 
         int width, height;
+#ifndef RENDERER_HEADLESS
         SDL_Window *pwin;
+#endif
 } renderer_t;
 
 void renderer_init_backend(renderer_t *prender, char *pname, int width, int height)
@@ -107,6 +499,10 @@ void renderer_init_backend(renderer_t *prender, char *pname, int width, int heig
         prender->width  = width;
         prender->height = height;
 
+        uint32_t ninstance_exts      = 0;
+        const char **ppinstance_exts = NULL;
+
+#ifndef RENDERER_HEADLESS
         // SDL
         if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
         {
@@ -127,15 +523,31 @@ void renderer_init_backend(renderer_t *prender, char *pname, int width, int heig
                 abort();
         }
 
+        /* the surface extensions of whatever platform SDL runs on */
+        SDL_Vulkan_GetInstanceExtensions(prender->pwin, &ninstance_exts, NULL);
+        ppinstance_exts = malloc(sizeof(char *) * ninstance_exts);
+        if (!ppinstance_exts ||
+            !SDL_Vulkan_GetInstanceExtensions(
+                    prender->pwin, &ninstance_exts, ppinstance_exts))
+        {
+                fprintf(stderr, "Cant get SDL instance extensions.\n");
+                abort();
+        }
+#endif
+
         // Instance
         VkInstanceCreateInfo instance_info = {
-                .sType                 = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-                .enabledLayerCount     = 0,
-                .ppEnabledLayerNames   = (char *[]){"VK_LAYER_KHRONOS_validation"},
-                .enabledExtensionCount = 2,
-                .ppEnabledExtensionNames =
-                        (char *[]){"VK_KHR_surface", "VK_KHR_win32_surface"}};
+                .sType            = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+                .pApplicationInfo = &(VkApplicationInfo){
+                        .sType       = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+                        .pEngineName = "harpy",
+                        .apiVersion  = VK_API_VERSION_1_3},
+                .enabledLayerCount       = 0,
+                .ppEnabledLayerNames     = (char *[]){"VK_LAYER_KHRONOS_validation"},
+                .enabledExtensionCount   = ninstance_exts,
+                .ppEnabledExtensionNames = ppinstance_exts};
         VK_TRY(vkCreateInstance(&instance_info, NULL, &prender->instance));
+        free(ppinstance_exts);
 
         /* pdevice */
         uint32_t npdevices = 0;
@@ -144,38 +556,122 @@ void renderer_init_backend(renderer_t *prender, char *pname, int width, int heig
         VK_TRY(vkEnumeratePhysicalDevices(prender->instance, &npdevices, ppdevices));
         prender->pdevice = ppdevices[0];
 
+        /* queue families, uploads go to a transfer only family when there is one */
+        uint32_t nqfams = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(prender->pdevice, &nqfams, NULL);
+        VkQueueFamilyProperties *pqfams =
+                malloc(sizeof(VkQueueFamilyProperties) * nqfams);
+        vkGetPhysicalDeviceQueueFamilyProperties(prender->pdevice, &nqfams, pqfams);
+
+        prender->idx_qfam          = UINT32_MAX;
+        prender->idx_transfer_qfam = UINT32_MAX;
+        for (uint32_t i = 0; i < nqfams; i++)
+        {
+                VkQueueFlags flags    = pqfams[i].queueFlags;
+                VkQueueFlags graphics = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+
+                if (prender->idx_qfam == UINT32_MAX && (flags & graphics) == graphics)
+                {
+                        prender->idx_qfam = i;
+                }
+                if (prender->idx_transfer_qfam == UINT32_MAX &&
+                    (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & graphics))
+                {
+                        prender->idx_transfer_qfam = i;
+                }
+        }
+
+        if (prender->idx_qfam == UINT32_MAX)
+        {
+                fprintf(stderr, "Cant find a graphics and compute queue family.\n");
+                abort();
+        }
+        if (prender->idx_transfer_qfam == UINT32_MAX)
+        {
+                prender->idx_transfer_qfam = prender->idx_qfam;
+        }
+
+        /* passes are timed on the graphics queue, ticks wrap past the valid bits */
+        uint32_t nbits          = pqfams[prender->idx_qfam].timestampValidBits;
+        prender->timestamp_mask = nbits >= 64 ? UINT64_MAX : (1ULL << nbits) - 1;
+        free(pqfams);
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(prender->pdevice, &props);
+        prender->timestamp_period = props.limits.timestampPeriod;
+
+        /* past the 128 bytes every device has, desktop ones have 256 */
+        if (props.limits.maxPushConstantsSize < RENDERER_SZPUSH_CONSTANTS)
+        {
+                fprintf(stderr,
+                        "Cant push %zu bytes of constants.\n",
+                        RENDERER_SZPUSH_CONSTANTS);
+                abort();
+        }
+
+        /* the frame's statistics query is open while the secondaries execute */
+        VkPhysicalDeviceFeatures feats;
+        vkGetPhysicalDeviceFeatures(prender->pdevice, &feats);
+        bool stats           = feats.pipelineStatisticsQuery && feats.inheritedQueries;
+        prender->stats_flags = stats ? RENDERER_STATS_FLAGS : 0;
+
         /* ldevice */
-        VkPhysicalDeviceTimelineSemaphoreFeatures timeline_feat = {
-                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
-                .timelineSemaphore = VK_TRUE};
+        VkPhysicalDeviceSynchronization2Features sync2_feat = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES,
+                .synchronization2 = VK_TRUE};
+
+        /* the 1.2 struct replaces the timeline one, the two may not share a chain */
+        VkPhysicalDeviceVulkan12Features vk12_feat = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+                .pNext = &sync2_feat,
+                .timelineSemaphore = VK_TRUE,
+                .drawIndirectCount = VK_TRUE};
 
         VkPhysicalDeviceDynamicRenderingFeaturesKHR dyn_rendering_feat = {
                 .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
-                .pNext = &timeline_feat,
+                .pNext = &vk12_feat,
                 .dynamicRendering = VK_TRUE};
 
+        const char *ppdevice_exts[] = {
+                "VK_KHR_dynamic_rendering",
+                "VK_KHR_depth_stencil_resolve",
+                "VK_KHR_create_renderpass2",
+                "VK_KHR_timeline_semaphore",
+#ifndef RENDERER_HEADLESS
+                "VK_KHR_swapchain",
+#endif
+        };
+
         VkDeviceCreateInfo device_info = {
                 .sType                = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
                 .pNext                = &dyn_rendering_feat,
-                .queueCreateInfoCount = 1,
+                .queueCreateInfoCount =
+                        prender->idx_transfer_qfam != prender->idx_qfam ? 2 : 1,
                 .pQueueCreateInfos =
-                        &(VkDeviceQueueCreateInfo){
-                                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-                                .queueFamilyIndex = 0,
-                                .queueCount       = 1,
-                                .pQueuePriorities = (float[]){1.0f}},
-                .enabledExtensionCount   = 5,
-                .ppEnabledExtensionNames = (char *[]){
-                        "VK_KHR_swapchain",
-                        "VK_KHR_dynamic_rendering",
-                        "VK_KHR_depth_stencil_resolve",
-                        "VK_KHR_create_renderpass2",
-                        "VK_KHR_timeline_semaphore"}};
+                        (VkDeviceQueueCreateInfo[]){
+                                {.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                                 .queueFamilyIndex = prender->idx_qfam,
+                                 .queueCount       = 1,
+                                 .pQueuePriorities = (float[]){1.0f}},
+                                {.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                                 .queueFamilyIndex = prender->idx_transfer_qfam,
+                                 .queueCount       = 1,
+                                 .pQueuePriorities = (float[]){1.0f}}},
+                .enabledExtensionCount   = sizeof ppdevice_exts / sizeof *ppdevice_exts,
+                .ppEnabledExtensionNames = ppdevice_exts,
+                .pEnabledFeatures        = &(VkPhysicalDeviceFeatures){
+                        .pipelineStatisticsQuery = stats, .inheritedQueries = stats}};
         VK_TRY(vkCreateDevice(prender->pdevice, &device_info, NULL, &prender->ldevice));
 
         /* queue */
-        vkGetDeviceQueue(prender->ldevice, 0, 0, &prender->queue);
+        vkGetDeviceQueue(prender->ldevice, prender->idx_qfam, 0, &prender->queue);
+        vkGetDeviceQueue(
+                prender->ldevice,
+                prender->idx_transfer_qfam,
+                0,
+                &prender->transfer_queue);
 
+#ifndef RENDERER_HEADLESS
         /* swapchain */
         SDL_Vulkan_CreateSurface(prender->pwin, prender->instance, &prender->surface);
 
@@ -201,7 +697,7 @@ void renderer_init_backend(renderer_t *prender, char *pname, int width, int heig
                         .imageUsage       = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
                         .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
                         .queueFamilyIndexCount = 1,
-                        .pQueueFamilyIndices   = (uint32_t[]){0},
+                        .pQueueFamilyIndices   = &prender->idx_qfam,
                         .preTransform          = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
                         .compositeAlpha        = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
                         .presentMode           = VK_PRESENT_MODE_MAILBOX_KHR,
@@ -217,28 +713,110 @@ void renderer_init_backend(renderer_t *prender, char *pname, int width, int heig
                 prender->swapchain,
                 &prender->nswapchain_images,
                 prender->pswapchain_images));
+
+        prender->pswapchain_views =
+                malloc(sizeof(VkImageView) * prender->nswapchain_images);
+        for (uint32_t i = 0; i < prender->nswapchain_images; i++)
+        {
+                VK_TRY(vkCreateImageView(
+                        prender->ldevice,
+                        &(VkImageViewCreateInfo){
+                                .sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                                .image    = prender->pswapchain_images[i],
+                                .viewType = VK_IMAGE_VIEW_TYPE_2D,
+                                .format   = RENDERER_SWAPCHAIN_IMAGE_FORMAT,
+                                .subresourceRange = {
+                                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                        .levelCount = 1,
+                                        .layerCount = 1}},
+                        NULL,
+                        &prender->pswapchain_views[i]));
+        }
+#endif
 }
 
 void renderer_init_common(renderer_t *prender)
 {
-        VkDescriptorSetLayoutBinding binding = {
-                .binding         = 0,
-                .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                .descriptorCount = 1,
-                .stageFlags      = VK_SHADER_STAGE_ALL};
+        /* 0 is the renderer_scene_t header, 1 the whole of scene_buf as words */
+        VkDescriptorSetLayoutBinding pbindings[2] = {
+                {.binding         = 0,
+                 .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                 .descriptorCount = 1,
+                 .stageFlags      = VK_SHADER_STAGE_ALL},
+                {.binding         = 1,
+                 .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                 .descriptorCount = 1,
+                 .stageFlags      = VK_SHADER_STAGE_ALL}};
 
         VkDescriptorSetLayoutCreateInfo set_layout_info = {
                 .sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-                .bindingCount = 1,
-                .pBindings    = &binding};
+                .bindingCount = 2,
+                .pBindings    = pbindings};
 
         VK_TRY(vkCreateDescriptorSetLayout(
                 prender->ldevice, &set_layout_info, NULL, &prender->set_layout));
 
+        /* 0 the level read, 1 the level written, 2 the whole pyramid */
+        VkDescriptorSetLayoutBinding ppyramid_bindings[3] = {
+                {.binding         = 0,
+                 .descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                 .descriptorCount = 1,
+                 .stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT},
+                {.binding         = 1,
+                 .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                 .descriptorCount = 1,
+                 .stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT},
+                {.binding         = 2,
+                 .descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                 .descriptorCount = 1,
+                 .stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT}};
+
+        set_layout_info.bindingCount = 3;
+        set_layout_info.pBindings    = ppyramid_bindings;
+        VK_TRY(vkCreateDescriptorSetLayout(
+                prender->ldevice, &set_layout_info, NULL, &prender->pyramid_set_layout));
+
+        /* texelFetch only, the shaders pick levels and reduce themselves */
+        VK_TRY(vkCreateSampler(
+                prender->ldevice,
+                &(VkSamplerCreateInfo){
+                        .sType        = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+                        .magFilter    = VK_FILTER_NEAREST,
+                        .minFilter    = VK_FILTER_NEAREST,
+                        .mipmapMode   = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+                        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                        .maxLod       = VK_LOD_CLAMP_NONE},
+                NULL,
+                &prender->pyramid_sampler));
+
+        VK_TRY(vkCreateDescriptorPool(
+                prender->ldevice,
+                &(VkDescriptorPoolCreateInfo){
+                        .sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+                        .maxSets       = 1,
+                        .poolSizeCount = 1,
+                        .pPoolSizes    = &(VkDescriptorPoolSize){
+                                   .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                   .descriptorCount = 2}},
+                NULL,
+                &prender->desc_pool));
+
+        VK_TRY(vkAllocateDescriptorSets(
+                prender->ldevice,
+                &(VkDescriptorSetAllocateInfo){
+                        .sType          = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                        .descriptorPool = prender->desc_pool,
+                        .descriptorSetCount = 1,
+                        .pSetLayouts        = &prender->set_layout},
+                &prender->scene_desc));
+
         VkPipelineLayoutCreateInfo pipe_layout_info = {
-                .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-                .setLayoutCount         = 1,
-                .pSetLayouts            = &prender->set_layout,
+                .sType          = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                .setLayoutCount = 2,
+                .pSetLayouts    = (VkDescriptorSetLayout[]){
+                        prender->set_layout, prender->pyramid_set_layout},
                 .pushConstantRangeCount = 1,
                 .pPushConstantRanges    = &(VkPushConstantRange){
                            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
@@ -296,7 +874,8 @@ void renderer_init_graphics_pipes(renderer_t *prender)
         VkPipelineRenderingCreateInfo render_info = {
                 .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
                 .colorAttachmentCount    = 1,
-                .pColorAttachmentFormats = (VkFormat[]){RENDERER_SWAPCHAIN_IMAGE_FORMAT}};
+                .pColorAttachmentFormats = (VkFormat[]){RENDERER_SWAPCHAIN_IMAGE_FORMAT},
+                .depthAttachmentFormat   = RENDERER_DEPTH_FORMAT};
 
         VkGraphicsPipelineCreateInfo pipe_info = {
                 .sType      = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
@@ -332,6 +911,12 @@ void renderer_init_graphics_pipes(renderer_t *prender)
                 .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
                 .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT};
 
+        pipe_info.pDepthStencilState = &(VkPipelineDepthStencilStateCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+                .depthTestEnable  = VK_TRUE,
+                .depthWriteEnable = VK_TRUE,
+                .depthCompareOp   = VK_COMPARE_OP_LESS};
+
         pipe_info.pColorBlendState = &(VkPipelineColorBlendStateCreateInfo){
                 .sType         = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
                 .logicOpEnable = VK_FALSE,
@@ -348,43 +933,219 @@ void renderer_init_graphics_pipes(renderer_t *prender)
 
         VK_TRY(vkCreateGraphicsPipelines(
                 prender->ldevice,
-                VK_NULL_HANDLE,
+                prender->pipe_cache,
                 1,
                 &pipe_info,
                 NULL,
                 &prender->graphics_pipe));
 }
 
-/*
-void renderer_init_compute_pipes(renderer_t *prender)
+static void renderer_init_compute_pipe(
+        renderer_t *prender,
+        uint32_t *pcode,
+        uint32_t sz,
+        const VkSpecializationInfo *pspec,
+        VkPipeline *ppipe)
 {
-        static uint32_t pphysics_spv[] = {
-#include "shader/spv/physics.comp.spv"
-        };
-
-        VkShaderModule physics_module =
-                init_shader_module(pphysics_spv, sizeof pphysics_spv);
+        VkShaderModule module = renderer_init_shader_module(prender, pcode, sz);
 
-        VkPipelineShaderStageCreateInfo physics_shader_info = {
+        VkPipelineShaderStageCreateInfo shader_info = {
                 .sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                 .stage  = VK_SHADER_STAGE_COMPUTE_BIT,
-                .module = physics_module,
-                .pname  = "main"};
+                .module = module,
+                .pName  = "main",
+                .pSpecializationInfo = pspec};
 
-        VkPipelineInfo pipe_info = {
+        VkComputePipelineCreateInfo pipe_info = {
                 .sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-                .stage  = physics_shader_info,
+                .stage  = shader_info,
                 .layout = prender->pipe_layout};
 
         VK_TRY(vkCreateComputePipelines(
+                prender->ldevice, prender->pipe_cache, 1, &pipe_info, NULL, ppipe));
+
+        vkDestroyShaderModule(prender->ldevice, module, NULL);
+}
+
+static uint32_t pphysics_spv[] = {
+#include "shader/spv/physics.comp.spv"
+};
+
+static uint32_t pcull_spv[] = {
+#include "shader/spv/cull.comp.spv"
+};
+
+static uint32_t ppyramid_spv[] = {
+#include "shader/spv/depth_pyramid.comp.spv"
+};
+
+void renderer_init_compute_pipes(renderer_t *prender)
+{
+        renderer_init_compute_pipe(
+                prender, pphysics_spv, sizeof pphysics_spv, NULL, &prender->physics_pipe);
+        renderer_init_compute_pipe(
+                prender, pcull_spv, sizeof pcull_spv, NULL, &prender->cull_pipe);
+        renderer_init_compute_pipe(
+                prender, ppyramid_spv, sizeof ppyramid_spv, NULL, &prender->pyramid_pipe);
+}
+
+static void renderer_build_physics_variant(void *parg)
+{
+        renderer_t *prender = parg;
+
+        VkSpecializationInfo spec = {
+                .mapEntryCount = 1,
+                .pMapEntries   = &(VkSpecializationMapEntry){
+                          .constantID = 0, .offset = 0, .size = sizeof(uint32_t)},
+                .dataSize = sizeof(uint32_t),
+                .pData    = &prender->variant_integrators};
+
+        renderer_init_compute_pipe(
+                prender,
+                pphysics_spv,
+                sizeof pphysics_spv,
+                &spec,
+                &prender->physics_variant);
+        atomic_store_explicit(&prender->variant_ready, true, memory_order_release);
+}
+
+/* waits out a build still running and drops the variant */
+static void renderer_drop_physics_variant(renderer_t *prender)
+{
+        if (prender->variant_building)
+        {
+                platform_thread_join(prender->variant_thread);
+                prender->variant_building = false;
+        }
+
+        atomic_store(&prender->variant_ready, false);
+        if (prender->physics_variant)
+        {
+                VK_TRY(vkDeviceWaitIdle(prender->ldevice));
+                vkDestroyPipeline(prender->ldevice, prender->physics_variant, NULL);
+                prender->physics_variant = VK_NULL_HANDLE;
+        }
+        prender->variant_integrators = 0;
+}
+
+/*
+ * Starts compiling physics.comp for the one integrator the scene uses,
+ * mixed scenes keep the generic pipeline. Nothing waits on the build.
+ */
+void renderer_request_physics_variant(renderer_t *prender)
+{
+        uint32_t integrators = prender->physics_integrators;
+        if (integrators == prender->variant_integrators)
+        {
+                return;
+        }
+
+        renderer_drop_physics_variant(prender);
+        if (!integrators || (integrators & (integrators - 1)))
+        {
+                return;
+        }
+
+        prender->variant_integrators = integrators;
+        prender->variant_building    = true;
+        platform_thread_create(
+                &prender->variant_thread, renderer_build_physics_variant, prender);
+}
+
+/* a cache written for another device or driver is ignored rather than fed to it */
+void renderer_init_pipeline_cache(renderer_t *prender)
+{
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(prender->pdevice, &props);
+
+        void *pdata = NULL;
+        size_t sz   = 0;
+
+        FILE *pfile = fopen(RENDERER_PIPELINE_CACHE_PATH, "rb");
+        if (pfile)
+        {
+                renderer_pipeline_cache_header_t header;
+                bool valid = fread(&header, sizeof header, 1, pfile) == 1 &&
+                             header.magic == RENDERER_PIPELINE_CACHE_MAGIC &&
+                             header.vendor_id == props.vendorID &&
+                             header.device_id == props.deviceID &&
+                             header.driver_version == props.driverVersion &&
+                             !memcmp(header.puuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+
+                if (valid)
+                {
+                        pdata = malloc(header.sz);
+                        valid = pdata && fread(pdata, 1, header.sz, pfile) == header.sz;
+                }
+                if (valid)
+                {
+                        sz = header.sz;
+                }
+                else
+                {
+                        fprintf(stderr,
+                                "Ignoring stale %s.\n",
+                                RENDERER_PIPELINE_CACHE_PATH);
+                }
+
+                fclose(pfile);
+        }
+
+        VK_TRY(vkCreatePipelineCache(
                 prender->ldevice,
-                VK_NULL_HANDLE,
-                2,
-                pipeline_infos,
+                &(VkPipelineCacheCreateInfo){
+                        .sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+                        .initialDataSize = sz,
+                        .pInitialData    = sz ? pdata : NULL},
                 NULL,
-                &prender->physics_pipe));
+                &prender->pipe_cache));
+        free(pdata);
+}
+
+/* joins a variant build first so it is cached too, a failed write is not fatal */
+void renderer_save_pipeline_cache(renderer_t *prender)
+{
+        if (prender->variant_building)
+        {
+                platform_thread_join(prender->variant_thread);
+                prender->variant_building = false;
+        }
+
+        size_t sz = 0;
+        VK_TRY(vkGetPipelineCacheData(prender->ldevice, prender->pipe_cache, &sz, NULL));
+
+        void *pdata = malloc(sz);
+        if (!pdata)
+        {
+                fprintf(stderr, "Cant allocate pipeline cache data.\n");
+                abort();
+        }
+        VK_TRY(vkGetPipelineCacheData(prender->ldevice, prender->pipe_cache, &sz, pdata));
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(prender->pdevice, &props);
+
+        renderer_pipeline_cache_header_t header = {
+                .magic          = RENDERER_PIPELINE_CACHE_MAGIC,
+                .vendor_id      = props.vendorID,
+                .device_id      = props.deviceID,
+                .driver_version = props.driverVersion,
+                .sz             = sz};
+        memcpy(header.puuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+
+        FILE *pfile = fopen(RENDERER_PIPELINE_CACHE_PATH, "wb");
+        if (!pfile || fwrite(&header, sizeof header, 1, pfile) != 1 ||
+            fwrite(pdata, 1, sz, pfile) != sz)
+        {
+                fprintf(stderr, "Cant write %s.\n", RENDERER_PIPELINE_CACHE_PATH);
+        }
+
+        if (pfile)
+        {
+                fclose(pfile);
+        }
+        free(pdata);
 }
-*/
 
 void create_semaphore(renderer_t *prender, VkSemaphore *psema, uint64_t val, bool is_bin)
 {
@@ -428,557 +1189,3341 @@ void renderer_init_frame_infos(renderer_t *prender)
                 NULL,
                 &prender->cmd_pool));
 
-        for (uint32_t i = 0; i < NFRAMES_IN_FLIGHT; i++)
+        /* frames count from 1, so waiting on a fresh slot's 0 returns at once */
+        create_semaphore(prender, &prender->frame_sema, 0, 1);
+        prender->nframes_in_flight = RENDERER_FRAMES_IN_FLIGHT;
+
+        prender->nworkers = prender->psched ? prender->psched->nworkers : 1;
+
+        for (uint32_t i = 0; i < RENDERER_MAX_FRAMES_IN_FLIGHT; i++)
         {
                 frame_info_t *pframe_info = &prender->pframe_infos[i];
 
                 create_semaphore(prender, &pframe_info->img_sema, 0, 0);
-                create_semaphore(
-                        prender,
-                        &pframe_info->time_sema,
-                        RENDERER_TIMELINE_COMMANDS_COMPLETE_VALUE,
-                        1);
 
-                create_command_buffers(
-                        prender,
-                        &pframe_info->cmd_buf,
-                        1,
-                        VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+                /* no reset flag, the pools are only ever reset whole */
+                VkCommandPoolCreateInfo pool_info = {
+                        .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                        .queueFamilyIndex = prender->idx_qfam};
+                VK_TRY(vkCreateCommandPool(
+                        prender->ldevice, &pool_info, NULL, &pframe_info->cmd_pool));
+                VK_TRY(vkAllocateCommandBuffers(
+                        prender->ldevice,
+                        &(VkCommandBufferAllocateInfo){
+                                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                .commandPool        = pframe_info->cmd_pool,
+                                .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                .commandBufferCount = 1},
+                        &pframe_info->cmd_buf));
+
+                pframe_info->pworker_pools = platform_aligned_alloc(
+                        sizeof(renderer_worker_pool_t) * prender->nworkers,
+                        PLATFORM_CACHE_LINE);
+                if (!pframe_info->pworker_pools)
+                {
+                        fprintf(stderr, "Cant allocate worker command pools.\n");
+                        abort();
+                }
+
+                for (uint32_t j = 0; j < prender->nworkers; j++)
+                {
+                        renderer_worker_pool_t *ppool = &pframe_info->pworker_pools[j];
+
+                        *ppool = (renderer_worker_pool_t){};
+                        VK_TRY(vkCreateCommandPool(
+                                prender->ldevice, &pool_info, NULL, &ppool->pool));
+                }
+
+                if (prender->timestamp_mask)
+                {
+                        VK_TRY(vkCreateQueryPool(
+                                prender->ldevice,
+                                &(VkQueryPoolCreateInfo){
+                                        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                                        .queryType  = VK_QUERY_TYPE_TIMESTAMP,
+                                        .queryCount = RENDERER_QUERY_COUNT},
+                                NULL,
+                                &pframe_info->timestamp_pool));
+                }
+                if (prender->stats_flags)
+                {
+                        VK_TRY(vkCreateQueryPool(
+                                prender->ldevice,
+                                &(VkQueryPoolCreateInfo){
+                                        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                                        .queryType  = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+                                        .queryCount = 1,
+                                        .pipelineStatistics = prender->stats_flags},
+                                NULL,
+                                &pframe_info->stats_pool));
+                }
+        }
+
+#ifndef RENDERER_HEADLESS
+        prender->ppresent_semas =
+                malloc(sizeof(VkSemaphore) * prender->nswapchain_images);
+        if (!prender->ppresent_semas)
+        {
+                fprintf(stderr, "Cant allocate present semaphores.\n");
+                abort();
         }
+        for (uint32_t i = 0; i < prender->nswapchain_images; i++)
+        {
+                create_semaphore(prender, &prender->ppresent_semas[i], 0, 0);
+        }
+#endif
 }
 
-void renderer_init(renderer_t *prender, char *pname, int width, int height)
+static uint32_t renderer_find_memory_type(
+        renderer_t *prender, uint32_t type_bits, VkMemoryPropertyFlags flags)
 {
-        prender->nframe = 1;
+        VkPhysicalDeviceMemoryProperties props;
+        vkGetPhysicalDeviceMemoryProperties(prender->pdevice, &props);
 
-        renderer_init_backend(prender, pname, width, height);
-        renderer_init_common(prender);
-        renderer_init_graphics_pipes(prender);
-        // renderer_init_compute_pipes(prender);
-        renderer_init_frame_infos(prender);
+        for (uint32_t i = 0; i < props.memoryTypeCount; i++)
+        {
+                if ((type_bits & (1 << i)) &&
+                    (props.memoryTypes[i].propertyFlags & flags) == flags)
+                {
+                        return i;
+                }
+        }
+
+        fprintf(stderr, "No memory type with flags %x.\n", flags);
+        abort();
 }
 
-/*
-void renderer_prepare(renderer_t *prender)
+static uint32_t renderer_new_memory_block(
+        renderer_t *prender, uint32_t idx_type, VkDeviceSize sz, bool dedicated)
 {
-
-        uint32_t sz_meshes =
-                prender->sz_meshes + sizeof(object_t) * prender->nmeshes;
-        uint32_t sz_draws =
-                prender->nobjects * sizeof(VkDrawIndexedIndirectCommand);
-        uint32_t sz_objects = prender->nbojects * sizeof(object_t);
-        VK_TRY(vkCreateBuffer(
-                ldevice,
-                &(VkBufferCreateInfo) {
-                        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-                        .size  = sz_meshes + sz_draws + sz_objects +
-                                4 // 4 for the draw count
-                },
+        VkDeviceMemory mem;
+        VK_TRY(vkAllocateMemory(
+                prender->ldevice,
+                &(VkMemoryAllocateInfo){
+                        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                        .allocationSize  = sz,
+                        .memoryTypeIndex = idx_type},
                 NULL,
-                &prender->scene_buf));
+                &mem));
 
-        VK_TRY(vkBindBufferMemory(
-                prender->ldevice,
-                prender->scene_buf,
-                prender->scene_mem,
-                0));
+        VkPhysicalDeviceMemoryProperties props;
+        vkGetPhysicalDeviceMemoryProperties(prender->pdevice, &props);
+
+        VkMemoryPropertyFlags flags = props.memoryTypes[idx_type].propertyFlags;
 
         void *pmapped = NULL;
-        VK_TRY(vkMapMemory(
-                prender->ldevice,
-                prender->scene_mem,
-                0,
-                prender->sz_meshes,
-                0,
-                &pmapped));
+        if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        {
+                VK_TRY(vkMapMemory(prender->ldevice, mem, 0, VK_WHOLE_SIZE, 0, &pmapped));
+        }
 
-        memcpy(pmapped, pmeshes, prender->sz_meshes);
+        /* reuse the slot of a released dedicated block */
+        uint32_t idx = 0;
+        while (idx < prender->nmemory_blocks && prender->pmemory_blocks[idx].mem)
+        {
+                idx++;
+        }
+        if (idx == prender->nmemory_blocks)
+        {
+                prender->pmemory_blocks = realloc(
+                        prender->pmemory_blocks,
+                        sizeof(renderer_memory_block_t) * (prender->nmemory_blocks + 1));
+                if (!prender->pmemory_blocks)
+                {
+                        fprintf(stderr, "Cant grow memory blocks.\n");
+                        abort();
+                }
+                prender->nmemory_blocks++;
+        }
 
-        vkUnmapMemory(prender->ldevice, prender->scene_mem);
+        renderer_memory_block_t *pblock = &prender->pmemory_blocks[idx];
+        *pblock = (renderer_memory_block_t){
+                .mem = mem, .idx_type = idx_type, .pmapped = pmapped};
+        if (dedicated)
+        {
+                pblock->dedicated = sz;
+        }
+        else
+        {
+                tlsf_init(&pblock->tlsf, sz);
+        }
+
+        return idx;
 }
-*/
 
-// void renderer_draw(renderer_t *prender)
-// {
-//         fprintf(stderr, "NFRAME: %llu\n", prender->nframe);
-
-//         uint32_t idx_last  = prender->idx_frame;
-//         prender->idx_frame = (prender->idx_frame + 1) % prender->nswapchain_images;
-//         uint32_t idx_frame = prender->idx_frame;
-
-//         frame_info_t *pframe_info = &prender->pframe_infos[idx_frame];
-//         frame_info_t *plast_info  = &prender->pframe_infos[idx_last];
-
-//         VkFence last_fence         = plast_info->fence;
-//         VkSemaphore last_time_sema = plast_info->time_sema;
-
-//         VkSemaphore time_sema   = pframe_info->time_sema;
-//         VkSemaphore img_sema    = pframe_info->img_sema;
-//         VkCommandBuffer cmd_buf = pframe_info->cmd_buf;
-
-//         VK_TRY(vkWaitForFences(
-//                 prender->ldevice, 1, &last_fence, VK_TRUE, RENDERER_VK_TIMEOUT));
-//         VK_TRY(vkResetFences(prender->ldevice, 1, &last_fence));
-
-//         VkTimelineSemaphoreSubmitInfo time_sema_info = {
-//                 .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
-//                 .waitSemaphoreValueCount = 1,
-//                 .pWaitSemaphoreValues    =
-//                 (uint64_t[]){RENDERER_TIMELINE_INITIAL_VALUE},
-//                 .signalSemaphoreValueCount = 1,
-//                 .pSignalSemaphoreValues =
-//                         (uint64_t[]){RENDERER_TIMELINE_IMAGE_ACQUIRED_VALUE}};
-
-//         uint32_t idx_image;
-//         VkAcquireNextImageInfoKHR image_info = {
-//                 .sType      = VK_STRUCTURE_TYPE_ACQUIRE_NEXT_IMAGE_INFO_KHR,
-//                 .swapchain  = prender->swapchain,
-//                 .timeout    = RENDERER_VK_TIMEOUT,
-//                 .semaphore  = img_sema,
-//                 .deviceMask = 1};
-//         VK_TRY(vkAcquireNextImage2KHR(prender->ldevice, &image_info, &idx_image));
-//         VkImage image = prender->pswapchain_images[idx_image];
-
-//         VK_TRY(vkBeginCommandBuffer(
-//                 cmd_buf,
-//                 &(VkCommandBufferBeginInfo){
-//                         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO}));
-
-//         /* set dynamic state */
-//         VkViewport vport = {
-//                 .x        = 10,
-//                 .y        = 10,
-//                 .width    = prender->width,
-//                 .height   = prender->height,
-//                 .minDepth = 0.0f,
-//                 .maxDepth = 1.0f};
-//         vkCmdSetViewport(cmd_buf, 0, 1, &vport);
-
-//         vkCmdSetScissor(
-//                 cmd_buf, 0, 1, &(VkRect2D){.extent = {prender->width,
-//                 prender->height}});
-
-//         /* transition image */
-//         VkImageMemoryBarrier2 image_barrier = {
-//                 .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-//                 .srcAccessMask       = VK_ACCESS_2_NONE_KHR,
-//                 .dstAccessMask       = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
-//                 .oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
-//                 .newLayout           = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-//                 .srcQueueFamilyIndex = prender->idx_qfam,
-//                 .dstQueueFamilyIndex = prender->idx_qfam,
-//                 .image               = prender->pswapchain_images[idx_image],
-//                 .subresourceRange    = (VkImageSubresourceRange){
-//                         .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-//                         .baseMipLevel   = 0,
-//                         .levelCount     = 1,
-//                         .baseArrayLayer = 0,
-//                         .layerCount     = 1}};
-
-//         VkDependencyInfoKHR dep_info = {
-//                 .sType                   = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-//                 .imageMemoryBarrierCount = 1,
-//                 .pImageMemoryBarriers    = &image_barrier};
-//         vkCmdPipelineBarrier2(cmd_buf, &dep_info);
-
-//         vkCmdClearColorImage(
-//                 cmd_buf,
-//                 image,
-//                 VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-//                 &(VkClearColorValue){.uint32 = {255, 0, 0, 0}},
-//                 1,
-//                 &(VkImageSubresourceRange){
-//                         .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-//                         .baseMipLevel   = 0,
-//                         .levelCount     = 1,
-//                         .baseArrayLayer = 0,
-//                         .layerCount     = 1});
-
-//         // vkCmdBindDescriptorSets(
-//         //         cmd_buf,
-//         //         VK_PIPELINE_BIND_POINT_COMPUTE,
-//         //         prender->pipe_layout,
-//         //         0,
-//         //         1,
-//         //         &prender->scene_desc,
-//         //         0,
-//         //         NULL);
-
-//         // // vkCmdBindPipeline(
-//         // //         cmd_buf,
-//         // //         VK_PIPELINE_BIND_POINT_COMPUTE,
-//         // //         prender->physics_pipe);
-//         // // vkCmdDispatch(ceil(prender->nentities / 256), 1, 1);
-
-//         // vkCmdPushConstants(
-//         //         cmd_buf,
-//         //         prender->pipe_layout,
-//         //         VK_SHADER_STAGE_COMPUTE_BIT,
-//         //         0,
-//         //         RENDERER_SZPUSH_CONSTANTS,
-//         //         &prender->dt);
-
-//         // vkCmdBindPipeline(
-//         //         cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, prender->graphics_pipe);
-//         // vkCmdDraw(cmd_buf, 8, 1, 0, 0);
-
-//         /* transition image */
-//         image_barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
-//         image_barrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT;
-//         image_barrier.oldLayout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-//         image_barrier.newLayout     = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-//         vkCmdPipelineBarrier2(cmd_buf, &dep_info);
-
-//         vkEndCommandBuffer(cmd_buf);
-
-//         time_sema_info.pSignalSemaphoreValues =
-//                 (uint64_t[]){RENDERER_TIMELINE_COMMANDS_COMPLETE_VALUE};
-//         VkSubmitInfo submit_info = {
-//                 .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-//                 .pNext                = &time_sema_info,
-//                 .waitSemaphoreCount   = 1,
-//                 .pWaitSemaphores      = &img_sema,
-//                 .commandBufferCount   = 1,
-//                 .pCommandBuffers      = &cmd_buf,
-//                 .signalSemaphoreCount = 1,
-//                 .pSignalSemaphores    = &time_sema};
-
-//         VK_TRY(vkQueueSubmit(prender->queue, 1, &submit_info, VK_NULL_HANDLE));
-
-//         time_sema_info.pWaitSemaphoreValues =
-//                 (uint64_t[]){RENDERER_TIMELINE_COMMANDS_COMPLETE_VALUE};
-//         time_sema_info.pSignalSemaphoreValues =
-//                 (uint64_t[]){RENDERER_TIMELINE_FRAME_PRESENT_VALUE};
-
-//         VkPresentInfoKHR present_info = {
-//                 .sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-//                 .pNext              = &time_sema_info,
-//                 .waitSemaphoreCount = 1,
-//                 .pWaitSemaphores    = &img_sema,
-//                 .swapchainCount     = 1,
-//                 .pSwapchains        = &prender->swapchain,
-//                 .pImageIndices      = &idx_image};
-
-//         VK_TRY(vkQueuePresentKHR(prender->queue, &present_info));
-
-//         prender->nframe++;
-// }
-
-// void renderer_test_draw(renderer_t *prender)
-// {
-//         fprintf(stderr, "NFRAME: %llu\n", prender->nframe);
-
-//         uint32_t idx_frame = prender->idx_frame % prender->nswapchain_images;
-//         uint32_t idx_last  = (prender->nframe - 1) % prender->nswapchain_images;
-
-//         frame_info_t *pframe_info = &prender->pframe_infos[idx_frame];
-//         frame_info_t *plast_info  = &prender->pframe_infos[idx_last];
-
-//         VkFence last_fence         = plast_info->fence;
-//         VkSemaphore last_time_sema = plast_info->time_sema;
-
-//         VkSemaphore time_sema   = pframe_info->time_sema;
-//         VkSemaphore img_sema    = pframe_info->img_sema;
-//         VkFence fence           = pframe_info->fence;
-//         VkCommandBuffer cmd_buf = pframe_info->cmd_buf;
-
-//         uint32_t idx_image;
-//         VkAcquireNextImageInfoKHR image_info = {
-//                 .sType      = VK_STRUCTURE_TYPE_ACQUIRE_NEXT_IMAGE_INFO_KHR,
-//                 .swapchain  = prender->swapchain,
-//                 .timeout    = RENDERER_VK_TIMEOUT,
-//                 .semaphore  = img_sema,
-//                 .deviceMask = 1};
-//         VK_TRY(vkAcquireNextImage2KHR(prender->ldevice, &image_info, &idx_image));
-//         VkImage image = prender->pswapchain_images[idx_image];
-
-//         VK_TRY(vkResetCommandBuffer)
-//         VK_TRY(vkBeginCommandBuffer(
-//                 cmd_buf,
-//                 &(VkCommandBufferBeginInfo){
-//                         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO}));
-
-//         /* set dynamic state */
-//         VkViewport vport = {
-//                 .x        = 0,
-//                 .y        = 0,
-//                 .width    = prender->width,
-//                 .height   = prender->height,
-//                 .minDepth = 0.0f,
-//                 .maxDepth = 1.0f};
-//         vkCmdSetViewport(cmd_buf, 0, 1, &vport);
-
-//         vkCmdSetScissor(
-//                 cmd_buf, 0, 1, &(VkRect2D){.extent = {prender->width,
-//                 prender->height}});
-
-//         /* transition image */
-//         VkImageMemoryBarrier2 image_barrier = {
-//                 .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-//                 .srcAccessMask       = VK_ACCESS_2_NONE_KHR,
-//                 .dstAccessMask       = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR,
-//                 .oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
-//                 .newLayout           = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-//                 .srcQueueFamilyIndex = prender->idx_qfam,
-//                 .dstQueueFamilyIndex = prender->idx_qfam,
-//                 .image               = prender->pswapchain_images[idx_image],
-//                 .subresourceRange    = (VkImageSubresourceRange){
-//                         .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-//                         .baseMipLevel   = 0,
-//                         .levelCount     = 1,
-//                         .baseArrayLayer = 0,
-//                         .layerCount     = 1}};
-
-//         VkDependencyInfoKHR dep_info = {
-//                 .sType                   = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-//                 .imageMemoryBarrierCount = 1,
-//                 .pImageMemoryBarriers    = &image_barrier};
-//         vkCmdPipelineBarrier2(cmd_buf, &dep_info);
-
-//         vkCmdClearColorImage(
-//                 cmd_buf,
-//                 image,
-//                 VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-//                 &(VkClearColorValue){.uint32 = {0, 255, 0, 0}},
-//                 1,
-//                 &(VkImageSubresourceRange){
-//                         .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-//                         .baseMipLevel   = 0,
-//                         .levelCount     = 1,
-//                         .baseArrayLayer = 0,
-//                         .layerCount     = 1});
-
-//         /* transition image */
-//         image_barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
-//         image_barrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT;
-//         image_barrier.oldLayout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-//         image_barrier.newLayout     = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-//         vkCmdPipelineBarrier2(cmd_buf, &dep_info);
-
-//         vkEndCommandBuffer(cmd_buf);
-
-//         /* submit work */
-//         VkTimelineSemaphoreSubmitInfo time_sema_info = {
-//                 .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
-//                 .waitSemaphoreValueCount = 1,
-//                 .pWaitSemaphoreValues =
-//                         (uint64_t[]){RENDERER_TIMELINE_COMMANDS_COMPLETE_VALUE},
-//                 .signalSemaphoreValueCount = 1,
-//                 .pSignalSemaphoreValues =
-//                         (uint64_t[]){RENDERER_TIMELINE_COMMANDS_COMPLETE_VALUE}};
-
-//         VkSubmitInfo submit_info = {
-//                 .sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-//                 .pNext              = &time_sema_info,
-//                 .waitSemaphoreCount = 2,
-//                 .pWaitSemaphores    = (VkSemaphore[]){img_sema, last_time_sema},
-//                 .pWaitDstStageMask =
-//                         (VkPipelineStageFlags[]){
-//                                 VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-//                                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT},
-//                 .commandBufferCount   = 1,
-//                 .pCommandBuffers      = &cmd_buf,
-//                 .signalSemaphoreCount = 1,
-//                 .pSignalSemaphores    = &time_sema};
-//         VK_TRY(vkQueueSubmit(prender->queue, 1, &submit_info, fence));
-
-//         /* present frame */
-//         time_sema_info.waitSemaphoreValueCount = 1;
-//         time_sema_info.pWaitSemaphoreValues =
-//                 (uint64_t[]){RENDERER_TIMELINE_COMMANDS_COMPLETE_VALUE};
-//         time_sema_info.signalSemaphoreValueCount = 0;
-
-//         VkPresentInfoKHR present_info = {
-//                 .sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-//                 .pNext              = &time_sema_info,
-//                 .waitSemaphoreCount = 1,
-//                 .pWaitSemaphores    = &time_sema,
-//                 .swapchainCount     = 1,
-//                 .pSwapchains        = &prender->swapchain,
-//                 .pImageIndices      = &idx_image};
-
-//         VK_TRY(vkQueuePresentKHR(prender->queue, &present_info));
-
-//         prender->nframe++;
-// }
-
-void renderer_test_prerecord(renderer_t *prender)
+/*
+ * Suballocates preqs from the first block of the right memory type with
+ * room, so the number of vkAllocateMemory calls stays at a handful however
+ * many buffers come and go. Images share the blocks with buffers, so
+ * their requirements are padded to bufferImageGranularity first. Anything
+ * that would not fit an empty block gets a dedicated one of its own.
+ */
+void renderer_alloc_memory(
+        renderer_t *prender,
+        const VkMemoryRequirements *preqs,
+        VkMemoryPropertyFlags flags,
+        renderer_allocation_t *palloc)
 {
-        for (uint32_t i = 0; i < prender->nswapchain_images; i++)
+        uint32_t idx_type =
+                renderer_find_memory_type(prender, preqs->memoryTypeBits, flags);
+
+        /* the tlsf rounds requests up, alignment included, so size alone is not enough */
+        if (preqs->size + preqs->alignment - 1 > RENDERER_MEMORY_BLOCK_SIZE)
         {
-                frame_info_t *pframe_info = &prender->pframe_infos[i];
+                uint32_t idx_block =
+                        renderer_new_memory_block(prender, idx_type, preqs->size, true);
+                renderer_memory_block_t *pblock = &prender->pmemory_blocks[idx_block];
+                *palloc                         = (renderer_allocation_t){
+                        .mem       = pblock->mem,
+                        .size      = preqs->size,
+                        .idx_block = idx_block,
+                        .handle    = RENDERER_MEMORY_DEDICATED,
+                        .pmapped   = pblock->pmapped};
+                return;
+        }
 
-                VkCommandBuffer cmd_buf = pframe_info->cmd_buf;
+        uint64_t offset;
+        uint32_t handle = TLSF_NONE, idx_block = 0;
+        for (; idx_block < prender->nmemory_blocks; idx_block++)
+        {
+                renderer_memory_block_t *pblock = &prender->pmemory_blocks[idx_block];
+                if (!pblock->mem || pblock->dedicated || pblock->idx_type != idx_type)
+                {
+                        continue;
+                }
+
+                handle = tlsf_alloc(
+                        &pblock->tlsf, preqs->size, preqs->alignment, &offset);
+                if (handle != TLSF_NONE)
+                {
+                        break;
+                }
+        }
 
-                VK_TRY(vkResetCommandBuffer(cmd_buf, 0));
-                VK_TRY(vkBeginCommandBuffer(
-                        cmd_buf,
-                        &(VkCommandBufferBeginInfo){
-                                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO}));
-
-                /* set dynamic state */
-                VkViewport vport = {
-                        .x        = 0,
-                        .y        = 0,
-                        .width    = prender->width,
-                        .height   = prender->height,
-                        .minDepth = 0.0f,
-                        .maxDepth = 1.0f};
-                vkCmdSetViewport(cmd_buf, 0, 1, &vport);
+        if (handle == TLSF_NONE)
+        {
+                idx_block = renderer_new_memory_block(
+                        prender, idx_type, RENDERER_MEMORY_BLOCK_SIZE, false);
+                handle = tlsf_alloc(
+                        &prender->pmemory_blocks[idx_block].tlsf,
+                        preqs->size,
+                        preqs->alignment,
+                        &offset);
+                if (handle == TLSF_NONE)
+                {
+                        fprintf(stderr,
+                                "Cant fit %llu bytes in a new memory block.\n",
+                                (unsigned long long) preqs->size);
+                        abort();
+                }
+        }
 
-                vkCmdSetScissor(
-                        cmd_buf,
-                        0,
-                        1,
-                        &(VkRect2D){.extent = {prender->width, prender->height}});
+        renderer_memory_block_t *pblock = &prender->pmemory_blocks[idx_block];
+        *palloc                         = (renderer_allocation_t){
+                .mem       = pblock->mem,
+                .offset    = offset,
+                .size      = preqs->size,
+                .idx_block = idx_block,
+                .handle    = handle,
+                .pmapped   = pblock->pmapped ? (char *) pblock->pmapped + offset : NULL};
+}
 
-                /* transition image */
-                VkImageSubresourceRange all_img = {
-                        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-                        .baseMipLevel   = 0,
-                        .levelCount     = 1,
-                        .baseArrayLayer = 0,
-                        .layerCount     = 1};
+/* blocks are kept once empty, except dedicated ones which go back to the driver */
+void renderer_free_memory(renderer_t *prender, renderer_allocation_t *palloc)
+{
+        renderer_memory_block_t *pblock = &prender->pmemory_blocks[palloc->idx_block];
+        if (palloc->handle == RENDERER_MEMORY_DEDICATED)
+        {
+                vkFreeMemory(prender->ldevice, pblock->mem, NULL);
+                *pblock = (renderer_memory_block_t){};
+        }
+        else
+        {
+                tlsf_release(&pblock->tlsf, palloc->handle);
+        }
 
-                VkImageMemoryBarrier2 undef_to_color = {
-                        .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-                        .srcStageMask        = VK_PIPELINE_STAGE_2_NONE,
-                        .srcAccessMask       = VK_ACCESS_2_MEMORY_READ_BIT,
-                        .dstStageMask        = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                        .dstAccessMask       = VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                        .oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
-                        .newLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-                        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-                        .image               = img,
-                        .subresourceRange    = all_img};
+        *palloc = (renderer_allocation_t){};
+}
 
-                VkDependencyInfoKHR dep_info = {
-                        .sType                   = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-                        .imageMemoryBarrierCount = 1,
-                        .pImageMemoryBarriers    = &undef_to_color};
-                vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+/* totals over every block, fragmentation is against the largest free range anywhere */
+void renderer_memory_stats(renderer_t *prender, tlsf_stats_t *pstats)
+{
+        *pstats = (tlsf_stats_t){};
 
-                vkCmdClearColorImage(
-                        cmd_buf,
-                        img,
-                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                        &(VkClearColorValue){.uint32 = {0, 255, 0, 0}},
-                        1,
-                        &all_img);
+        for (uint32_t i = 0; i < prender->nmemory_blocks; i++)
+        {
+                const renderer_memory_block_t *pblock = &prender->pmemory_blocks[i];
+                if (!pblock->mem)
+                {
+                        continue;
+                }
+
+                /* a dedicated block is one allocation filling it */
+                tlsf_stats_t block_stats = {
+                        .size    = pblock->dedicated,
+                        .nused   = pblock->dedicated,
+                        .nallocs = 1};
+                if (!pblock->dedicated)
+                {
+                        tlsf_stats(&pblock->tlsf, &block_stats);
+                }
+
+                pstats->size += block_stats.size;
+                pstats->nused += block_stats.nused;
+                pstats->nfree += block_stats.nfree;
+                pstats->nallocs += block_stats.nallocs;
+                pstats->nfree_blocks += block_stats.nfree_blocks;
+                pstats->largest_free =
+                        MAX(pstats->largest_free, block_stats.largest_free);
+        }
 
-                /* transition image */
-                VkImageMemoryBarrier2 color_to_present = {
+        if (pstats->nfree)
+        {
+                pstats->fragmentation =
+                        1.0f - (float) pstats->largest_free / (float) pstats->nfree;
+        }
+}
+
+static void renderer_create_buffer(
+        renderer_t *prender,
+        VkDeviceSize sz,
+        VkBufferUsageFlags usage,
+        VkMemoryPropertyFlags flags,
+        VkBuffer *pbuf,
+        renderer_allocation_t *palloc)
+{
+        bool concurrent = prender->idx_transfer_qfam != prender->idx_qfam;
+
+        VK_TRY(vkCreateBuffer(
+                prender->ldevice,
+                &(VkBufferCreateInfo){
+                        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                        .size  = sz,
+                        .usage = usage,
+                        /* shared with the transfer queue rather than handed over */
+                        .sharingMode           = concurrent ? VK_SHARING_MODE_CONCURRENT
+                                                            : VK_SHARING_MODE_EXCLUSIVE,
+                        .queueFamilyIndexCount = concurrent ? 2 : 0,
+                        .pQueueFamilyIndices   = (uint32_t[]){
+                                prender->idx_qfam, prender->idx_transfer_qfam}},
+                NULL,
+                pbuf));
+
+        VkMemoryRequirements reqs;
+        vkGetBufferMemoryRequirements(prender->ldevice, *pbuf, &reqs);
+        renderer_alloc_memory(prender, &reqs, flags, palloc);
+
+        VK_TRY(vkBindBufferMemory(prender->ldevice, *pbuf, palloc->mem, palloc->offset));
+}
+
+static void renderer_destroy_buffer(
+        renderer_t *prender, VkBuffer buf, renderer_allocation_t *palloc)
+{
+        vkDestroyBuffer(prender->ldevice, buf, NULL);
+        renderer_free_memory(prender, palloc);
+}
+
+/* a device local optimal image, padded so no buffer shares a granularity page with it */
+static void renderer_create_image(
+        renderer_t *prender,
+        const VkImageCreateInfo *pinfo,
+        VkImage *pimg,
+        renderer_allocation_t *palloc)
+{
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(prender->pdevice, &props);
+        VkDeviceSize granularity = props.limits.bufferImageGranularity;
+
+        VK_TRY(vkCreateImage(prender->ldevice, pinfo, NULL, pimg));
+
+        VkMemoryRequirements reqs;
+        vkGetImageMemoryRequirements(prender->ldevice, *pimg, &reqs);
+        reqs.alignment = MAX(reqs.alignment, granularity);
+        reqs.size      = ALIGN_UP(reqs.size, granularity);
+
+        renderer_alloc_memory(
+                prender, &reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, palloc);
+        VK_TRY(vkBindImageMemory(prender->ldevice, *pimg, palloc->mem, palloc->offset));
+}
+
+static VkImageView renderer_create_view(
+        renderer_t *prender,
+        VkImage img,
+        VkFormat format,
+        VkImageAspectFlags aspect,
+        uint32_t first_level,
+        uint32_t nlevels)
+{
+        VkImageView view;
+        VK_TRY(vkCreateImageView(
+                prender->ldevice,
+                &(VkImageViewCreateInfo){
+                        .sType            = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                        .image            = img,
+                        .viewType         = VK_IMAGE_VIEW_TYPE_2D,
+                        .format           = format,
+                        .subresourceRange = {
+                                .aspectMask   = aspect,
+                                .baseMipLevel = first_level,
+                                .levelCount   = nlevels,
+                                .layerCount   = 1}},
+                NULL,
+                &view));
+        return view;
+}
+
+/*
+ * Headless frames render into offscreen images in place of a swapchain and
+ * leave them in TRANSFER_SRC_OPTIMAL for readback. Zero width or height
+ * skips rendering, frames then only step the simulation.
+ */
+void renderer_init_offscreen(renderer_t *prender)
+{
+        if (!prender->width || !prender->height)
+        {
+                return;
+        }
+
+        uint32_t n                 = RENDERER_OFFSCREEN_IMAGES;
+        prender->nswapchain_images = n;
+        prender->pswapchain_images = malloc(sizeof(VkImage) * n);
+        prender->pswapchain_views  = malloc(sizeof(VkImageView) * n);
+        prender->pimage_allocs     = malloc(sizeof(renderer_allocation_t) * n);
+        if (!prender->pswapchain_images || !prender->pswapchain_views ||
+            !prender->pimage_allocs)
+        {
+                fprintf(stderr, "Cant allocate offscreen images.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+                renderer_create_image(
+                        prender,
+                        &(VkImageCreateInfo){
+                                .sType       = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                                .imageType   = VK_IMAGE_TYPE_2D,
+                                .format      = RENDERER_SWAPCHAIN_IMAGE_FORMAT,
+                                .extent      = {prender->width, prender->height, 1},
+                                .mipLevels   = 1,
+                                .arrayLayers = 1,
+                                .samples     = VK_SAMPLE_COUNT_1_BIT,
+                                .tiling      = VK_IMAGE_TILING_OPTIMAL,
+                                .usage       = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                         VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                .sharingMode   = VK_SHARING_MODE_EXCLUSIVE,
+                                .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED},
+                        &prender->pswapchain_images[i],
+                        &prender->pimage_allocs[i]);
+
+                prender->pswapchain_views[i] = renderer_create_view(
+                        prender,
+                        prender->pswapchain_images[i],
+                        RENDERER_SWAPCHAIN_IMAGE_FORMAT,
+                        VK_IMAGE_ASPECT_COLOR_BIT,
+                        0,
+                        1);
+        }
+}
+
+/*
+ * The depth attachment and the hi-z pyramid built from it, with a
+ * descriptor set per pyramid level. Nothing without images to render.
+ */
+void renderer_init_depth(renderer_t *prender)
+{
+        if (!prender->nswapchain_images)
+        {
+                return;
+        }
+
+        renderer_create_image(
+                prender,
+                &(VkImageCreateInfo){
+                        .sType       = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                        .imageType   = VK_IMAGE_TYPE_2D,
+                        .format      = RENDERER_DEPTH_FORMAT,
+                        .extent      = {prender->width, prender->height, 1},
+                        .mipLevels   = 1,
+                        .arrayLayers = 1,
+                        .samples     = VK_SAMPLE_COUNT_1_BIT,
+                        .tiling      = VK_IMAGE_TILING_OPTIMAL,
+                        .usage       = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                 VK_IMAGE_USAGE_SAMPLED_BIT,
+                        .sharingMode   = VK_SHARING_MODE_EXCLUSIVE,
+                        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED},
+                &prender->depth_img,
+                &prender->depth_alloc);
+        prender->depth_view = renderer_create_view(
+                prender,
+                prender->depth_img,
+                RENDERER_DEPTH_FORMAT,
+                VK_IMAGE_ASPECT_DEPTH_BIT,
+                0,
+                1);
+
+        uint32_t width   = DIV_UP(prender->width, 2);
+        uint32_t height  = DIV_UP(prender->height, 2);
+        uint32_t nlevels = 1;
+        while (MAX(width, height) >> nlevels && nlevels < RENDERER_MAX_PYRAMID_LEVELS)
+        {
+                nlevels++;
+        }
+        prender->pyramid_width   = width;
+        prender->pyramid_height  = height;
+        prender->npyramid_levels = nlevels;
+
+        renderer_create_image(
+                prender,
+                &(VkImageCreateInfo){
+                        .sType       = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                        .imageType   = VK_IMAGE_TYPE_2D,
+                        .format      = RENDERER_PYRAMID_FORMAT,
+                        .extent      = {width, height, 1},
+                        .mipLevels   = nlevels,
+                        .arrayLayers = 1,
+                        .samples     = VK_SAMPLE_COUNT_1_BIT,
+                        .tiling      = VK_IMAGE_TILING_OPTIMAL,
+                        .usage       = VK_IMAGE_USAGE_STORAGE_BIT |
+                                 VK_IMAGE_USAGE_SAMPLED_BIT,
+                        .sharingMode   = VK_SHARING_MODE_EXCLUSIVE,
+                        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED},
+                &prender->pyramid_img,
+                &prender->pyramid_alloc);
+        prender->pyramid_view = renderer_create_view(
+                prender,
+                prender->pyramid_img,
+                RENDERER_PYRAMID_FORMAT,
+                VK_IMAGE_ASPECT_COLOR_BIT,
+                0,
+                nlevels);
+
+        VK_TRY(vkCreateDescriptorPool(
+                prender->ldevice,
+                &(VkDescriptorPoolCreateInfo){
+                        .sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+                        .maxSets       = nlevels,
+                        .poolSizeCount = 2,
+                        .pPoolSizes    = (VkDescriptorPoolSize[]){
+                                {.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                 .descriptorCount = 2 * nlevels},
+                                {.type            = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                 .descriptorCount = nlevels}}},
+                NULL,
+                &prender->pyramid_pool));
+
+        for (uint32_t i = 0; i < nlevels; i++)
+        {
+                prender->ppyramid_level_views[i] = renderer_create_view(
+                        prender,
+                        prender->pyramid_img,
+                        RENDERER_PYRAMID_FORMAT,
+                        VK_IMAGE_ASPECT_COLOR_BIT,
+                        i,
+                        1);
+
+                VK_TRY(vkAllocateDescriptorSets(
+                        prender->ldevice,
+                        &(VkDescriptorSetAllocateInfo){
+                                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                                .descriptorPool     = prender->pyramid_pool,
+                                .descriptorSetCount = 1,
+                                .pSetLayouts        = &prender->pyramid_set_layout},
+                        &prender->ppyramid_descs[i]));
+        }
+
+        /* the pyramid stays in GENERAL, the depth is read in SHADER_READ_ONLY */
+        for (uint32_t i = 0; i < nlevels; i++)
+        {
+                VkDescriptorImageInfo src = {
+                        .sampler     = prender->pyramid_sampler,
+                        .imageView   = prender->ppyramid_level_views[i - !!i],
+                        .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+                if (!i)
+                {
+                        src.imageView   = prender->depth_view;
+                        src.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+                }
+
+                VkWriteDescriptorSet pwrites[3] = {
+                        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                         .dstSet          = prender->ppyramid_descs[i],
+                         .dstBinding      = 0,
+                         .descriptorCount = 1,
+                         .descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                         .pImageInfo      = &src},
+                        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                         .dstSet          = prender->ppyramid_descs[i],
+                         .dstBinding      = 1,
+                         .descriptorCount = 1,
+                         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                         .pImageInfo      = &(VkDescriptorImageInfo){
+                                 .imageView   = prender->ppyramid_level_views[i],
+                                 .imageLayout = VK_IMAGE_LAYOUT_GENERAL}},
+                        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                         .dstSet          = prender->ppyramid_descs[i],
+                         .dstBinding      = 2,
+                         .descriptorCount = 1,
+                         .descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                         .pImageInfo      = &(VkDescriptorImageInfo){
+                                 .sampler     = prender->pyramid_sampler,
+                                 .imageView   = prender->pyramid_view,
+                                 .imageLayout = VK_IMAGE_LAYOUT_GENERAL}}};
+                vkUpdateDescriptorSets(prender->ldevice, 3, pwrites, 0, NULL);
+        }
+}
+
+void renderer_init_uploads(renderer_t *prender)
+{
+        VK_TRY(vkCreateCommandPool(
+                prender->ldevice,
+                &(VkCommandPoolCreateInfo){
+                        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                        .queueFamilyIndex = prender->idx_transfer_qfam},
+                NULL,
+                &prender->upload_pool));
+
+        for (uint32_t i = 0; i < RENDERER_UPLOAD_BATCHES; i++)
+        {
+                VK_TRY(vkAllocateCommandBuffers(
+                        prender->ldevice,
+                        &(VkCommandBufferAllocateInfo){
+                                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                .commandPool        = prender->upload_pool,
+                                .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                .commandBufferCount = 1},
+                        &prender->pupload_batches[i].cmd_buf));
+        }
+
+        create_semaphore(prender, &prender->upload_sema, 0, 1);
+
+        renderer_create_buffer(
+                prender,
+                RENDERER_STAGING_SIZE,
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                &prender->staging_buf,
+                &prender->staging_alloc);
+}
+
+void renderer_init(
+        renderer_t *prender, char *pname, int width, int height, scheduler_t *psched)
+{
+        prender->nframe        = 1;
+        prender->psched        = psched;
+        prender->physics_clock = (physics_clock_t){
+                .step      = RENDERER_PHYSICS_STEP,
+                .max_steps = RENDERER_PHYSICS_MAX_STEPS};
+        profiler_init(&prender->profiler, RENDERER_STATS_COUNT, renderer_stat_names);
+
+        renderer_init_backend(prender, pname, width, height);
+        renderer_init_common(prender);
+        renderer_init_pipeline_cache(prender);
+        renderer_init_graphics_pipes(prender);
+        renderer_init_compute_pipes(prender);
+#ifdef RENDERER_HEADLESS
+        renderer_init_offscreen(prender);
+#endif
+        renderer_init_depth(prender);
+        renderer_init_frame_infos(prender);
+        renderer_init_uploads(prender);
+}
+
+/* moves the ring tail past finished batches, with wait set blocks on the oldest one */
+static void renderer_retire_uploads(renderer_t *prender, bool wait)
+{
+        if (prender->upload_retired == prender->upload_value)
+        {
+                return;
+        }
+
+        if (wait)
+        {
+                VK_TRY(vkWaitSemaphores(
+                        prender->ldevice,
+                        &(VkSemaphoreWaitInfo){
+                                .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                                .semaphoreCount = 1,
+                                .pSemaphores    = &prender->upload_sema,
+                                .pValues = (uint64_t[]){prender->upload_retired + 1}},
+                        UINT64_MAX));
+        }
+
+        uint64_t done;
+        VK_TRY(vkGetSemaphoreCounterValue(prender->ldevice, prender->upload_sema, &done));
+
+        while (prender->upload_retired < MIN(done, prender->upload_value))
+        {
+                prender->upload_retired++;
+
+                uint32_t idx          = prender->upload_retired % RENDERER_UPLOAD_BATCHES;
+                prender->staging_tail = prender->pupload_batches[idx].head;
+        }
+}
+
+/*
+ * Submits the staged copies as one vkCmdCopyBuffer on the transfer queue
+ * and returns the upload_sema value that marks them done, for the frames
+ * reading the data to wait on. Never waits unless every batch is in flight.
+ */
+uint64_t renderer_flush_uploads(renderer_t *prender)
+{
+        if (!prender->ncopies)
+        {
+                return prender->upload_value;
+        }
+
+        while (prender->upload_value - prender->upload_retired >= RENDERER_UPLOAD_BATCHES)
+        {
+                renderer_retire_uploads(prender, true);
+        }
+
+        uint64_t value = ++prender->upload_value;
+        renderer_upload_batch_t *pbatch =
+                &prender->pupload_batches[value % RENDERER_UPLOAD_BATCHES];
+        pbatch->value = value;
+        pbatch->head  = prender->staging_head;
+
+        VK_TRY(vkResetCommandBuffer(pbatch->cmd_buf, 0));
+        VK_TRY(vkBeginCommandBuffer(
+                pbatch->cmd_buf,
+                &(VkCommandBufferBeginInfo){
+                        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT}));
+        vkCmdCopyBuffer(
+                pbatch->cmd_buf,
+                prender->staging_buf,
+                prender->scene_buf,
+                prender->ncopies,
+                prender->pcopies);
+        VK_TRY(vkEndCommandBuffer(pbatch->cmd_buf));
+
+        VK_TRY(vkQueueSubmit(
+                prender->transfer_queue,
+                1,
+                &(VkSubmitInfo){
+                        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                        .pNext = &(VkTimelineSemaphoreSubmitInfo){
+                                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                                .signalSemaphoreValueCount = 1,
+                                .pSignalSemaphoreValues    = &value},
+                        .commandBufferCount   = 1,
+                        .pCommandBuffers      = &pbatch->cmd_buf,
+                        .signalSemaphoreCount = 1,
+                        .pSignalSemaphores    = &prender->upload_sema},
+                VK_NULL_HANDLE));
+
+        prender->ncopies = 0;
+        return value;
+}
+
+/*
+ * Takes sz bytes of the ring. When full, the staged copies are flushed and
+ * the oldest batch waited on, an idle ring restarts at its beginning.
+ */
+static uint64_t renderer_staging_reserve(renderer_t *prender, uint64_t sz)
+{
+        for (;;)
+        {
+                /* a reservation never wraps, the end of the ring is skipped instead */
+                uint64_t pos  = prender->staging_head % RENDERER_STAGING_SIZE;
+                uint64_t skip = 0;
+                if (pos + sz > RENDERER_STAGING_SIZE)
+                {
+                        skip = RENDERER_STAGING_SIZE - pos;
+                }
+
+                if (prender->staging_head + skip + sz - prender->staging_tail <=
+                    RENDERER_STAGING_SIZE)
+                {
+                        prender->staging_head += skip;
+                        uint64_t offset = prender->staging_head % RENDERER_STAGING_SIZE;
+                        prender->staging_head += sz;
+                        return offset;
+                }
+
+                if (prender->upload_retired != prender->upload_value)
+                {
+                        renderer_retire_uploads(prender, true);
+                }
+                else if (prender->ncopies)
+                {
+                        renderer_flush_uploads(prender);
+                }
+                else
+                {
+                        prender->staging_head =
+                                ALIGN_UP(prender->staging_head, RENDERER_STAGING_SIZE);
+                        prender->staging_tail = prender->staging_head;
+                }
+        }
+}
+
+/*
+ * Copies sz bytes to the ring and queues their copy to dst_offset of
+ * scene_buf, merging with the last copy when both ranges continue it.
+ * Nothing reaches the device before renderer_flush_uploads.
+ */
+void renderer_stage(
+        renderer_t *prender, VkDeviceSize dst_offset, const void *pdata, VkDeviceSize sz)
+{
+        const char *psrc = pdata;
+
+        while (sz)
+        {
+                VkDeviceSize chunk  = MIN(sz, RENDERER_STAGING_SIZE / 4);
+                VkDeviceSize offset = renderer_staging_reserve(
+                        prender, ALIGN_UP(chunk, RENDERER_STAGING_ALIGN));
+                memcpy((char *) prender->staging_alloc.pmapped + offset, psrc, chunk);
+
+                VkBufferCopy *plast =
+                        prender->ncopies ? &prender->pcopies[prender->ncopies - 1] : NULL;
+                if (plast && plast->srcOffset + plast->size == offset &&
+                    plast->dstOffset + plast->size == dst_offset)
+                {
+                        plast->size += chunk;
+                }
+                else
+                {
+                        if (prender->ncopies == prender->ncopy_capacity)
+                        {
+                                prender->ncopy_capacity =
+                                        MAX(prender->ncopy_capacity * 2, 64);
+                                prender->pcopies = realloc(
+                                        prender->pcopies,
+                                        sizeof(VkBufferCopy) * prender->ncopy_capacity);
+                                if (!prender->pcopies)
+                                {
+                                        fprintf(stderr, "Cant grow staged copies.\n");
+                                        abort();
+                                }
+                        }
+
+                        prender->pcopies[prender->ncopies++] = (VkBufferCopy){
+                                .srcOffset = offset,
+                                .dstOffset = dst_offset,
+                                .size      = chunk};
+                }
+
+                psrc += chunk;
+                dst_offset += chunk;
+                sz -= chunk;
+        }
+}
+
+/* sections of scene_buf are tlsf allocations in words, packing grows the range */
+static uint32_t renderer_scene_reserve(tlsf_t *ptlsf, uint32_t n)
+{
+        uint64_t idx;
+        while (tlsf_alloc(ptlsf, n, RENDERER_SCENE_ALIGN, &idx) == TLSF_NONE)
+        {
+                tlsf_grow(ptlsf, MAX(ptlsf->size * 2, RENDERER_SCENE_MIN_WORDS));
+        }
+
+        return (uint32_t) idx;
+}
+
+/*
+ * Colours the springs of every xpbd entity and merges equal colours across
+ * entities, so one dispatch solves a colour scene wide. Returns the
+ * constraint slot of each xpbd spring, counted in entity order.
+ */
+static uint32_t *renderer_color_constraints(
+        renderer_t *prender,
+        const entity_t *pentities,
+        uint32_t nentities,
+        uint32_t *pnconstraints)
+{
+        uint32_t nconstraints = 0, ncolors = 0;
+        for (uint32_t i = 0; i < nentities; i++)
+        {
+                if (pentities[i].integrator == PHYSICS_INTEGRATOR_XPBD)
+                {
+                        nconstraints += pentities[i].nsprings;
+                }
+        }
+
+        uint32_t *pslots = malloc(sizeof(uint32_t) * (nconstraints + 1));
+        if (!pslots)
+        {
+                fprintf(stderr, "Cant allocate constraint colours.\n");
+                abort();
+        }
+
+        uint32_t base = 0;
+        for (uint32_t i = 0; i < nentities; i++)
+        {
+                if (pentities[i].integrator == PHYSICS_INTEGRATOR_XPBD)
+                {
+                        uint32_t n = physics_spring_colors(&pentities[i], &pslots[base]);
+                        ncolors    = MAX(ncolors, n);
+                        base += pentities[i].nsprings;
+                }
+        }
+
+        free(prender->pconstraint_color_offsets);
+        uint32_t *poffsets = calloc(ncolors + 1, sizeof(uint32_t));
+        uint32_t *pcursors = calloc(ncolors + 1, sizeof(uint32_t));
+        if (!poffsets || !pcursors)
+        {
+                fprintf(stderr, "Cant allocate constraint colours.\n");
+                abort();
+        }
+
+        for (uint32_t i = 0; i < nconstraints; i++)
+        {
+                poffsets[pslots[i] + 1]++;
+        }
+        for (uint32_t c = 0; c < ncolors; c++)
+        {
+                poffsets[c + 1] += poffsets[c];
+                pcursors[c] = poffsets[c];
+        }
+        for (uint32_t i = 0; i < nconstraints; i++)
+        {
+                pslots[i] = pcursors[pslots[i]]++;
+        }
+        free(pcursors);
+
+        prender->nconstraint_colors        = ncolors;
+        prender->pconstraint_color_offsets = poffsets;
+        *pnconstraints                     = nconstraints;
+        return pslots;
+}
+
+/*
+ * The items, triangles and corner lists collision_init builds, in global
+ * point mass ids, and the anchors where the point masses start out. Expects
+ * the positions packed.
+ */
+static void renderer_pack_collision(
+        const renderer_scene_t *pscene,
+        uint32_t *pwords,
+        const entity_t *pentities,
+        uint32_t nentities)
+{
+        uint32_t npoints     = pscene->npoint_masses;
+        uint32_t ntriangles  = pscene->ntriangles;
+        uint32_t *pitems     = &pwords[pscene->idx_collision_items];
+        uint32_t *ptriangles = &pwords[pscene->idx_triangles];
+        uint32_t *poffsets   = &pwords[pscene->idx_corner_offsets];
+        if (!pscene->ncollision_items)
+        {
+                return;
+        }
+
+        uint32_t base = 0, nitem = 0, ncorner = 0;
+        for (uint32_t i = 0; i < nentities; i++)
+        {
+                const entity_t *pentity = &pentities[i];
+                if (pentity->radius > 0.0f)
+                {
+                        for (uint32_t j = 0; j < pentity->npoint_masses; j++)
+                        {
+                                pitems[nitem++] = base + j;
+                        }
+                        for (uint32_t j = 0; j < pentity->ntriangles * 3; j++)
+                        {
+                                uint32_t g = base + pentity->ptriangles[j];
+
+                                ptriangles[ncorner++] = g;
+                                poffsets[g + 1]++;
+                        }
+                }
+
+                base += pentity->npoint_masses;
+        }
+        for (uint32_t i = 0; i < ntriangles; i++)
+        {
+                pitems[nitem++] = npoints + i;
+        }
+
+        /* counts to starts, then fill using the starts as cursors and shift back */
+        for (uint32_t i = 0; i < npoints; i++)
+        {
+                poffsets[i + 1] += poffsets[i];
+        }
+        for (uint32_t i = 0; i < ntriangles * 3; i++)
+        {
+                pwords[pscene->idx_corners + poffsets[ptriangles[i]]++] = i;
+        }
+        for (uint32_t i = npoints; i > 0; i--)
+        {
+                poffsets[i] = poffsets[i - 1];
+        }
+        poffsets[0] = 0;
+
+        uint32_t pidx_axes[3] = {pscene->idx_x, pscene->idx_y, pscene->idx_z};
+        for (uint32_t i = 0; i < 3; i++)
+        {
+                memcpy(&pwords[pscene->idx_anchors + i * npoints],
+                       &pwords[pidx_axes[i]],
+                       sizeof(uint32_t) * npoints);
+        }
+}
+
+/* collision_init's triangle_limit over the colliding entities at rest */
+static float renderer_triangle_limit(
+        const entity_t *pentities, uint32_t nentities, uint32_t ntriangles)
+{
+        float *pextents = malloc(sizeof(float) * MAX(ntriangles, 1));
+        if (!pextents)
+        {
+                fprintf(stderr, "Cant allocate triangle extents.\n");
+                abort();
+        }
+
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < nentities; i++)
+        {
+                const entity_t *pentity = &pentities[i];
+                uint32_t ncolliding = pentity->radius > 0.0f ? pentity->ntriangles : 0;
+                for (uint32_t t = 0; t < ncolliding; t++)
+                {
+                        const uint32_t *pids = &pentity->ptriangles[t * 3];
+                        vec3_t pcorners[3]   = {pentity->ppoint_masses[pids[0]].position,
+                                                pentity->ppoint_masses[pids[1]].position,
+                                                pentity->ppoint_masses[pids[2]].position};
+                        vec3_t centroid      = {
+                                (pcorners[0].x + pcorners[1].x + pcorners[2].x) / 3.0f,
+                                (pcorners[0].y + pcorners[1].y + pcorners[2].y) / 3.0f,
+                                (pcorners[0].z + pcorners[1].z + pcorners[2].z) / 3.0f};
+
+                        float radius = 0.0f;
+                        for (uint32_t k = 0; k < 3; k++)
+                        {
+                                vec3_t d = collision_sub(pcorners[k], centroid);
+                                radius   = fmaxf(radius, collision_dot(d, d));
+                        }
+                        pextents[n++] = sqrtf(radius);
+                }
+        }
+
+        float limit = collision_triangle_limit(pextents, n);
+        free(pextents);
+        return limit;
+}
+
+/*
+ * The clusters physics_body_init would set up, over global point mass ids,
+ * and the memberships of every point mass.
+ */
+static void renderer_pack_clusters(
+        const renderer_scene_t *pscene,
+        uint32_t *pwords,
+        const entity_t *pentities,
+        uint32_t nentities)
+{
+        float *pfloats      = (float *) pwords;
+        uint32_t *poffsets  = &pwords[pscene->idx_membership_offsets];
+        uint32_t *pmembers  = &pwords[pscene->idx_cluster_members];
+        uint32_t *pclusters = &pwords[pscene->idx_cluster_offsets];
+        float *prests       = &pfloats[pscene->idx_cluster_rest];
+        if (!pscene->nclusters)
+        {
+                return;
+        }
+
+        uint32_t base = 0, ncluster = 0, nmember = 0;
+        for (uint32_t i = 0; i < nentities; i++)
+        {
+                const entity_t *pentity = &pentities[i];
+                for (uint32_t c = 0; c < pentity->nclusters; c++, ncluster++)
+                {
+                        uint32_t first = pentity->pcluster_offsets[c];
+                        uint32_t last  = pentity->pcluster_offsets[c + 1];
+                        float mass = 0.0f, cx = 0.0f, cy = 0.0f, cz = 0.0f;
+
+                        for (uint32_t m = first; m < last; m++)
+                        {
+                                uint32_t j                 = pentity->pcluster_members[m];
+                                const point_mass_t *ppoint = &pentity->ppoint_masses[j];
+
+                                mass += ppoint->mass;
+                                cx += ppoint->mass * ppoint->position.x;
+                                cy += ppoint->mass * ppoint->position.y;
+                                cz += ppoint->mass * ppoint->position.z;
+                        }
+                        cx /= mass;
+                        cy /= mass;
+                        cz /= mass;
+
+                        pclusters[ncluster] = nmember;
+                        for (uint32_t m = first; m < last; m++, nmember++)
+                        {
+                                uint32_t j   = pentity->pcluster_members[m];
+                                vec3_t p     = pentity->ppoint_masses[j].position;
+                                float *prest = &prests[nmember * 3];
+
+                                pmembers[nmember] = base + j;
+                                poffsets[base + j + 1]++;
+                                prest[0] = p.x - cx;
+                                prest[1] = p.y - cy;
+                                prest[2] = p.z - cz;
+                        }
+
+                        /* identity rotations to warm start from */
+                        pfloats[pscene->idx_cluster_frames +
+                                ncluster * RENDERER_CLUSTER_FRAME_STRIDE + 3] = 1.0f;
+                }
+
+                base += pentity->npoint_masses;
+        }
+        pclusters[ncluster] = nmember;
+
+        /* counts to starts, then fill using the starts as cursors and shift back */
+        for (uint32_t i = 0; i < pscene->npoint_masses; i++)
+        {
+                poffsets[i + 1] += poffsets[i];
+        }
+        for (uint32_t c = 0; c < pscene->nclusters; c++)
+        {
+                for (uint32_t m = pclusters[c]; m < pclusters[c + 1]; m++)
+                {
+                        uint32_t j = poffsets[pmembers[m]]++;
+
+                        pwords[pscene->idx_memberships + j * 2]     = c;
+                        pwords[pscene->idx_memberships + j * 2 + 1] = m;
+                }
+        }
+        for (uint32_t i = pscene->npoint_masses; i > 0; i--)
+        {
+                poffsets[i] = poffsets[i - 1];
+        }
+        poffsets[0] = 0;
+}
+
+/*
+ * Every entity awake but the pinned ones, as physics_world_init_sleep
+ * leaves bodies, and their points listed as SLEEP_COMPACT would.
+ */
+static void renderer_pack_sleep(
+        const renderer_scene_t *pscene,
+        uint32_t *pwords,
+        const entity_t *pentities,
+        uint32_t nentities)
+{
+        const float *pfloats = (const float *) pwords;
+        uint32_t *pawake     = &pwords[pscene->idx_awake_points];
+
+        uint32_t base = 0, nawake = 0;
+        for (uint32_t i = 0; i < nentities; i++)
+        {
+                uint32_t npoint_masses = pentities[i].npoint_masses;
+                bool pinned            = true;
+
+                for (uint32_t j = base; j < base + npoint_masses && pinned; j++)
+                {
+                        pinned = pfloats[pscene->idx_inv_mass + j] == 0.0f &&
+                                 pfloats[pscene->idx_vx + j] == 0.0f &&
+                                 pfloats[pscene->idx_vy + j] == 0.0f &&
+                                 pfloats[pscene->idx_vz + j] == 0.0f;
+                }
+
+                pwords[pscene->idx_sleep + i * RENDERER_SLEEP_STRIDE] =
+                        pinned ? PHYSICS_WORLD_PINNED : PHYSICS_WORLD_AWAKE;
+                for (uint32_t j = base; j < base + npoint_masses && !pinned; j++)
+                {
+                        pawake[nawake++] = j;
+                }
+
+                base += npoint_masses;
+        }
+
+        uint32_t *pdispatch = &pwords[pscene->idx_awake_dispatch];
+        *(VkDispatchIndirectCommand *) pdispatch = (VkDispatchIndirectCommand){
+                .x = DIV_UP(nawake, RENDERER_SZPHYSICS_WORKGROUP), .y = 1, .z = 1};
+        pdispatch[3] = nawake;
+}
+
+/*
+ * Concatenates the meshes' vertices, indices and meshlets, each mesh
+ * drawing from its own first_index and vertex_offset, and writes the mesh
+ * and object records and the instance of every meshlet of every object
+ * that cull.comp turns into draws.
+ */
+static void renderer_pack_geometry(
+        const renderer_scene_t *pscene,
+        uint32_t *pwords,
+        const mesh_t *pmeshes,
+        const object_t *pobjects)
+{
+        renderer_vertex_t *pvertices =
+                (renderer_vertex_t *) &pwords[pscene->idx_geometry];
+        renderer_mesh_t *pmesh_records = (renderer_mesh_t *) &pwords[pscene->idx_meshes];
+        renderer_meshlet_t *pmeshlet_records =
+                (renderer_meshlet_t *) &pwords[pscene->idx_meshlets];
+        renderer_object_t *pobject_records =
+                (renderer_object_t *) &pwords[pscene->idx_object];
+        renderer_instance_t *pinstances =
+                (renderer_instance_t *) &pwords[pscene->idx_instances];
+
+        uint32_t nvertices = 0, nindices = 0, nmeshlets = 0;
+        for (uint32_t i = 0; i < pscene->nmeshes; i++)
+        {
+                const mesh_t *pmesh = &pmeshes[i];
+
+                /* sphere about the box centre, loose but one pass */
+                float pmin[3] = {INFINITY, INFINITY, INFINITY};
+                float pmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+                for (uint32_t j = 0; j < pmesh->nvertices; j++)
+                {
+                        for (uint32_t c = 0; c < 3; c++)
+                        {
+                                pmin[c] = fminf(pmin[c], pmesh->pvertices[j].position[c]);
+                                pmax[c] = fmaxf(pmax[c], pmesh->pvertices[j].position[c]);
+                        }
+                }
+
+                renderer_mesh_t *precord = &pmesh_records[i];
+                *precord                 = (renderer_mesh_t){
+                        .first_index   = nindices,
+                        .nindices      = pmesh->nindices,
+                        .vertex_offset = (int32_t) nvertices,
+                        .first_meshlet = nmeshlets};
+
+                for (uint32_t c = 0; pmesh->nvertices && c < 3; c++)
+                {
+                        precord->center[c] = 0.5f * (pmin[c] + pmax[c]);
+                }
+                for (uint32_t j = 0; j < pmesh->nvertices; j++)
+                {
+                        const float *p = pmesh->pvertices[j].position;
+                        float dx       = p[0] - precord->center[0];
+                        float dy       = p[1] - precord->center[1];
+                        float dz       = p[2] - precord->center[2];
+
+                        float d         = sqrtf(dx * dx + dy * dy + dz * dz);
+                        precord->radius = fmaxf(precord->radius, d);
+                }
+
+                memcpy(&pvertices[nvertices],
+                       pmesh->pvertices,
+                       sizeof(renderer_vertex_t) * pmesh->nvertices);
+                memcpy(&pwords[pscene->idx_indices + nindices],
+                       pmesh->pindices,
+                       sizeof(uint32_t) * pmesh->nindices);
+                for (uint32_t j = 0; j < pmesh->nmeshlets; j++)
+                {
+                        renderer_meshlet_t *pmeshlet = &pmeshlet_records[nmeshlets + j];
+                        *pmeshlet                    = pmesh->pmeshlets[j];
+                        pmeshlet->first_index += nindices;
+                }
+
+                nvertices += pmesh->nvertices;
+                nindices += pmesh->nindices;
+                nmeshlets += pmesh->nmeshlets;
+        }
+
+        /* an object's instances are contiguous, so batches split few objects */
+        uint32_t ninstances = 0;
+        for (uint32_t i = 0; i < pscene->nobjects; i++)
+        {
+                renderer_object_t *precord = &pobject_records[i];
+                *precord = (renderer_object_t){.idx_mesh = pobjects[i].idx_mesh};
+                memcpy(precord->model_mat,
+                       pobjects[i].model_mat,
+                       sizeof precord->model_mat);
+
+                const renderer_mesh_t *pmesh = &pmesh_records[pobjects[i].idx_mesh];
+                for (uint32_t j = 0; j < pmeshes[pobjects[i].idx_mesh].nmeshlets; j++)
+                {
+                        pinstances[ninstances++] = (renderer_instance_t){
+                                .idx_object  = i,
+                                .idx_meshlet = pmesh->first_meshlet + j};
+                }
+        }
+}
+
+/*
+ * Lays the entities' point masses out as per component streams and their
+ * springs as per point mass adjacency lists, so the physics shader gathers
+ * forces without atomics, then the geometry and objects to draw. Returns
+ * the words to upload, header included.
+ */
+static uint32_t *renderer_pack_scene(
+        renderer_t *prender,
+        const entity_t *pentities,
+        uint32_t nentities,
+        const mesh_t *pmeshes,
+        uint32_t nmeshes,
+        const object_t *pobjects,
+        uint32_t nobjects,
+        uint32_t *pnwords)
+{
+        renderer_scene_t *pscene = &prender->scene;
+        uint32_t npoints = 0, nadjacent = 0;
+        uint32_t nvertices = 0, nindices = 0, nmeshlets = 0, ninstances = 0;
+
+        /* meshes from mesh_load come cut, others are cut here as they stand */
+        mesh_t *pviews = malloc(sizeof(mesh_t) * MAX(nmeshes, 1));
+        if (!pviews)
+        {
+                fprintf(stderr, "Cant allocate mesh views.\n");
+                abort();
+        }
+        for (uint32_t i = 0; i < nmeshes; i++)
+        {
+                mesh_t *pview = &pviews[i];
+                *pview        = pmeshes[i];
+                if (!pview->nmeshlets)
+                {
+                        pview->nmeshlets = mesh_build_meshlets(
+                                pview->pindices,
+                                pview->nindices,
+                                (const float *) pview->pvertices,
+                                sizeof(mesh_vertex_t) / sizeof(float),
+                                pview->nvertices,
+                                &pview->pmeshlets);
+                }
+
+                nvertices += pview->nvertices;
+                nindices += pview->nindices;
+                nmeshlets += pview->nmeshlets;
+        }
+        for (uint32_t i = 0; i < nobjects; i++)
+        {
+                ninstances += pviews[pobjects[i].idx_mesh].nmeshlets;
+        }
+
+        uint32_t ncolliding = 0, ntriangles = 0, nclusters = 0, ncluster_members = 0;
+        float max_radius    = 0.0f;
+        prender->physics_integrators = 0;
+        for (uint32_t i = 0; i < nentities; i++)
+        {
+                npoints += pentities[i].npoint_masses;
+                nadjacent += pentities[i].nsprings * 2;
+                prender->physics_integrators |= 1 << pentities[i].integrator;
+                if (pentities[i].nclusters)
+                {
+                        nclusters += pentities[i].nclusters;
+                        ncluster_members +=
+                                pentities[i].pcluster_offsets[pentities[i].nclusters];
+                }
+                if (pentities[i].radius > 0.0f)
+                {
+                        ncolliding += pentities[i].npoint_masses;
+                        ntriangles += pentities[i].ntriangles;
+                        max_radius = fmaxf(max_radius, pentities[i].radius);
+                }
+        }
+
+        /* as collision_init sizes its hash, the point streams only when it is used */
+        uint32_t nitems = ncolliding + ntriangles, ncells = 1;
+        while (ncells < nitems * COLLISION_CELLS_PER_ITEM)
+        {
+                ncells <<= 1;
+        }
+        uint32_t ncontact_points = nitems ? npoints : 0;
+        uint32_t nblocks         = DIV_UP(ncells, RENDERER_SZPHYSICS_WORKGROUP);
+
+        uint32_t nscratch = 0;
+        if (prender->physics_integrators & ~(1 << PHYSICS_INTEGRATOR_SYMPLECTIC_EULER |
+                                             1 << PHYSICS_INTEGRATOR_VERLET))
+        {
+                nscratch = npoints * RENDERER_PHYSICS_SCRATCH_STREAMS;
+        }
+
+        uint32_t nconstraints;
+        uint32_t *pslots =
+                renderer_color_constraints(prender, pentities, nentities, &nconstraints);
+
+        uint32_t nentity_words = nentities * sizeof(renderer_entity_t) / sizeof(uint32_t);
+
+        /* a fresh range, the header lands at word 0 */
+        tlsf_t *ptlsf = &prender->scene_words;
+        tlsf_free(ptlsf);
+        tlsf_init(ptlsf, 0);
+        renderer_scene_reserve(ptlsf, sizeof(renderer_scene_t) / sizeof(uint32_t));
+
+        /* reserved in order, an initializer list would not sequence the calls */
+        *pscene = (renderer_scene_t){.npoint_masses = npoints, .nentities = nentities};
+        pscene->idx_entities        = renderer_scene_reserve(ptlsf, nentity_words);
+        pscene->idx_point_entities  = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_x               = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_y               = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_z               = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_vx              = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_vy              = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_vz              = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_ax              = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_ay              = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_az              = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_mass            = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_inv_mass        = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_adjacency       = renderer_scene_reserve(ptlsf, npoints + 1);
+        pscene->idx_neighbors       = renderer_scene_reserve(ptlsf, nadjacent);
+        pscene->idx_k               = renderer_scene_reserve(ptlsf, nadjacent);
+        pscene->idx_rest_distance   = renderer_scene_reserve(ptlsf, nadjacent);
+        pscene->idx_scratch         = renderer_scene_reserve(ptlsf, nscratch);
+        pscene->idx_constraint_a    = renderer_scene_reserve(ptlsf, nconstraints);
+        pscene->idx_constraint_b    = renderer_scene_reserve(ptlsf, nconstraints);
+        pscene->idx_constraint_k    = renderer_scene_reserve(ptlsf, nconstraints);
+        pscene->idx_constraint_rest = renderer_scene_reserve(ptlsf, nconstraints);
+        pscene->idx_lambda          = renderer_scene_reserve(ptlsf, nconstraints);
+
+        pscene->ncolliding_points = ncolliding;
+        pscene->ntriangles        = ntriangles;
+        pscene->ncollision_items  = nitems;
+        pscene->ncells            = ncells;
+        pscene->max_radius        = max_radius;
+        pscene->idx_triangles     = renderer_scene_reserve(ptlsf, 3 * ntriangles);
+        pscene->idx_corner_offsets =
+                renderer_scene_reserve(ptlsf, nitems ? npoints + 1 : 0);
+        pscene->idx_corners          = renderer_scene_reserve(ptlsf, 3 * ntriangles);
+        pscene->idx_collision_items  = renderer_scene_reserve(ptlsf, nitems);
+        pscene->idx_item_cells       = renderer_scene_reserve(ptlsf, nitems);
+        pscene->idx_cell_counts      = renderer_scene_reserve(ptlsf, ncells);
+        pscene->idx_cell_starts      = renderer_scene_reserve(ptlsf, ncells + 1);
+        pscene->idx_block_sums       = renderer_scene_reserve(ptlsf, nblocks);
+        pscene->idx_sorted           = renderer_scene_reserve(ptlsf, nitems);
+        pscene->idx_triangle_extents = renderer_scene_reserve(ptlsf, ntriangles);
+        pscene->idx_collision_extent = renderer_scene_reserve(ptlsf, 1);
+        pscene->idx_wide_bounds      = renderer_scene_reserve(ptlsf, 6);
+        pscene->triangle_limit =
+                renderer_triangle_limit(pentities, nentities, ntriangles);
+        pscene->idx_anchors = renderer_scene_reserve(ptlsf, 3 * ncontact_points);
+        pscene->idx_deltas  = renderer_scene_reserve(
+                ptlsf, RENDERER_COLLISION_DELTA_STREAMS * ncontact_points);
+        pscene->idx_corner_deltas = renderer_scene_reserve(
+                ptlsf, RENDERER_COLLISION_DELTA_STREAMS * 3 * ntriangles);
+
+        pscene->nclusters           = nclusters;
+        pscene->ncluster_members    = ncluster_members;
+        pscene->idx_cluster_offsets = renderer_scene_reserve(ptlsf, nclusters + 1);
+        pscene->idx_cluster_members = renderer_scene_reserve(ptlsf, ncluster_members);
+        pscene->idx_cluster_rest    = renderer_scene_reserve(ptlsf, 3 * ncluster_members);
+        pscene->idx_cluster_frames  = renderer_scene_reserve(
+                ptlsf, RENDERER_CLUSTER_FRAME_STRIDE * nclusters);
+        pscene->idx_membership_offsets =
+                renderer_scene_reserve(ptlsf, nclusters ? npoints + 1 : 0);
+        pscene->idx_memberships = renderer_scene_reserve(ptlsf, 2 * ncluster_members);
+
+        pscene->idx_sleep =
+                renderer_scene_reserve(ptlsf, RENDERER_SLEEP_STRIDE * nentities);
+        pscene->idx_rest_window = renderer_scene_reserve(ptlsf, 3 * npoints);
+        pscene->idx_touches =
+                renderer_scene_reserve(ptlsf, nitems ? npoints + ntriangles : 0);
+        pscene->idx_awake_points   = renderer_scene_reserve(ptlsf, npoints);
+        pscene->idx_awake_dispatch = renderer_scene_reserve(ptlsf, 4);
+
+        uint32_t nvertex_words = nvertices * sizeof(renderer_vertex_t) / sizeof(uint32_t);
+        uint32_t nmesh_words   = nmeshes * sizeof(renderer_mesh_t) / sizeof(uint32_t);
+        uint32_t nmeshlet_words =
+                nmeshlets * sizeof(renderer_meshlet_t) / sizeof(uint32_t);
+        uint32_t nobject_words = nobjects * sizeof(renderer_object_t) / sizeof(uint32_t);
+        uint32_t ninstance_words =
+                ninstances * sizeof(renderer_instance_t) / sizeof(uint32_t);
+        uint32_t ndraw_words =
+                ninstances * sizeof(VkDrawIndexedIndirectCommand) / sizeof(uint32_t);
+        uint32_t nbatches = DIV_UP(ninstances, RENDERER_DRAW_BATCH);
+
+        pscene->nmeshes       = nmeshes;
+        pscene->nobjects      = nobjects;
+        pscene->nmeshlets     = nmeshlets;
+        pscene->ninstances    = ninstances;
+        pscene->idx_geometry  = renderer_scene_reserve(ptlsf, nvertex_words);
+        pscene->idx_indices   = renderer_scene_reserve(ptlsf, nindices);
+        pscene->idx_meshes    = renderer_scene_reserve(ptlsf, nmesh_words);
+        pscene->idx_meshlets  = renderer_scene_reserve(ptlsf, nmeshlet_words);
+        pscene->idx_object    = renderer_scene_reserve(ptlsf, nobject_words);
+        pscene->idx_instances = renderer_scene_reserve(ptlsf, ninstance_words);
+        pscene->idx_draw      = renderer_scene_reserve(ptlsf, ndraw_words);
+        pscene->idx_ndraw     = renderer_scene_reserve(ptlsf, nbatches);
+        /* no lights yet */
+        pscene->idx_light = renderer_scene_reserve(ptlsf, 0);
+
+        uint32_t nwords = (uint32_t) tlsf_extent(ptlsf);
+        uint32_t *pwords = calloc(nwords, sizeof(uint32_t));
+        float *pfloats   = (float *) pwords;
+        if (!pwords)
+        {
+                fprintf(stderr, "Cant allocate scene upload.\n");
+                abort();
+        }
+        memcpy(pwords, pscene, sizeof(renderer_scene_t));
+
+        renderer_entity_t *precords = (renderer_entity_t *) &pwords[pscene->idx_entities];
+
+        uint32_t base = 0, adjacent = 0, constraint = 0;
+        for (uint32_t i = 0; i < nentities; i++)
+        {
+                const entity_t *pentity = &pentities[i];
+
+                precords[i] = (renderer_entity_t){
+                        .first_point_mass = base,
+                        .npoint_masses    = pentity->npoint_masses,
+                        .damping          = pentity->damping,
+                        .integrator       = pentity->integrator,
+                        .radius           = pentity->radius,
+                        .friction         = pentity->friction};
+
+                /* verlet opens each step with the forces at the uploaded state */
+                physics_body_t body = {};
+                if (pentity->integrator == PHYSICS_INTEGRATOR_VERLET)
+                {
+                        physics_body_init(&body, pentity);
+                }
+
+                spring_graph_t graph;
+                spring_graph_init(&graph, pentity);
+
+                for (uint32_t j = 0; j < pentity->npoint_masses; j++)
+                {
+                        const point_mass_t *ppoint = &pentity->ppoint_masses[j];
+                        uint32_t id                = base + j;
+
+                        pwords[pscene->idx_point_entities + id] = i;
+                        pfloats[pscene->idx_x + id]             = ppoint->position.x;
+                        pfloats[pscene->idx_y + id]             = ppoint->position.y;
+                        pfloats[pscene->idx_z + id]             = ppoint->position.z;
+                        pfloats[pscene->idx_vx + id]            = ppoint->velocity.x;
+                        pfloats[pscene->idx_vy + id]            = ppoint->velocity.y;
+                        pfloats[pscene->idx_vz + id]            = ppoint->velocity.z;
+                        pfloats[pscene->idx_mass + id]          = ppoint->mass;
+                        pfloats[pscene->idx_inv_mass + id] =
+                                ppoint->mass > 0.0f ? 1.0f / ppoint->mass : 0.0f;
+
+                        if (body.pmem)
+                        {
+                                float inv_mass = body.pinv_mass[j];
+
+                                pfloats[pscene->idx_ax + id] = body.pfx[j] * inv_mass;
+                                pfloats[pscene->idx_ay + id] = body.pfy[j] * inv_mass;
+                                pfloats[pscene->idx_az + id] = body.pfz[j] * inv_mass;
+                        }
+
+                        pwords[pscene->idx_adjacency + id] = adjacent + graph.poffsets[j];
+                }
+
+                for (uint32_t j = 0; j < pentity->nsprings * 2; j++)
+                {
+                        uint32_t id       = adjacent + j;
+                        uint32_t neighbor = base + graph.pneighbors[j];
+                        const spring_t sp = pentity->psprings[graph.pspring_ids[j]];
+
+                        pwords[pscene->idx_neighbors + id]      = neighbor;
+                        pfloats[pscene->idx_k + id]             = sp.k;
+                        pfloats[pscene->idx_rest_distance + id] = sp.rest_distance;
+                }
+
+                bool xpbd = pentity->integrator == PHYSICS_INTEGRATOR_XPBD;
+                for (uint32_t j = 0; xpbd && j < pentity->nsprings; j++)
+                {
+                        uint32_t id       = pslots[constraint++];
+                        const spring_t sp = pentity->psprings[j];
+
+                        pwords[pscene->idx_constraint_a + id]     = base + sp.idx_a;
+                        pwords[pscene->idx_constraint_b + id]     = base + sp.idx_b;
+                        pfloats[pscene->idx_constraint_k + id]    = sp.k;
+                        pfloats[pscene->idx_constraint_rest + id] = sp.rest_distance;
+                }
+
+                base += pentity->npoint_masses;
+                adjacent += pentity->nsprings * 2;
+                spring_graph_free(&graph);
+                if (body.pmem)
+                {
+                        physics_body_free(&body);
+                }
+        }
+        pwords[pscene->idx_adjacency + npoints] = adjacent;
+        free(pslots);
+
+        renderer_pack_collision(pscene, pwords, pentities, nentities);
+        renderer_pack_clusters(pscene, pwords, pentities, nentities);
+        renderer_pack_sleep(pscene, pwords, pentities, nentities);
+
+        renderer_pack_geometry(pscene, pwords, pviews, pobjects);
+        for (uint32_t i = 0; i < nmeshes; i++)
+        {
+                if (!pmeshes[i].nmeshlets)
+                {
+                        free(pviews[i].pmeshlets);
+                }
+        }
+        free(pviews);
+
+        *pnwords = nwords;
+        return pwords;
+}
+
+static void renderer_write_scene_desc(renderer_t *prender)
+{
+        vkUpdateDescriptorSets(
+                prender->ldevice,
+                2,
+                (VkWriteDescriptorSet[]){
+                        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                         .dstSet          = prender->scene_desc,
+                         .dstBinding      = 0,
+                         .descriptorCount = 1,
+                         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         .pBufferInfo     = &(VkDescriptorBufferInfo){
+                                     .buffer = prender->scene_buf,
+                                     .offset = 0,
+                                     .range  = sizeof(renderer_scene_t)}},
+                        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                         .dstSet          = prender->scene_desc,
+                         .dstBinding      = 1,
+                         .descriptorCount = 1,
+                         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         .pBufferInfo     = &(VkDescriptorBufferInfo){
+                                     .buffer = prender->scene_buf,
+                                     .offset = 0,
+                                     .range  = VK_WHOLE_SIZE}}},
+                0,
+                NULL);
+}
+
+/* copies src_buf into scene_buf on the graphics queue and waits for it */
+static void renderer_copy_to_scene(
+        renderer_t *prender, VkBuffer src_buf, VkDeviceSize dst_offset, VkDeviceSize sz)
+{
+        VkCommandBuffer cmd_buf;
+        create_command_buffers(prender, &cmd_buf, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+        VK_TRY(vkBeginCommandBuffer(
+                cmd_buf,
+                &(VkCommandBufferBeginInfo){
+                        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT}));
+        vkCmdCopyBuffer(
+                cmd_buf,
+                src_buf,
+                prender->scene_buf,
+                1,
+                &(VkBufferCopy){.dstOffset = dst_offset, .size = sz});
+        VK_TRY(vkEndCommandBuffer(cmd_buf));
+
+        VK_TRY(vkQueueSubmit(
+                prender->queue,
+                1,
+                &(VkSubmitInfo){
+                        .sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                        .commandBufferCount = 1,
+                        .pCommandBuffers    = &cmd_buf},
+                VK_NULL_HANDLE));
+        VK_TRY(vkQueueWaitIdle(prender->queue));
+
+        vkFreeCommandBuffers(prender->ldevice, prender->cmd_pool, 1, &cmd_buf);
+}
+
+/*
+ * Creates scene_buf in device local memory and uploads the entities and
+ * geometry once through the staging ring, frames wait on upload_value.
+ * From here on the physics shader owns the point mass state and cull.comp
+ * the draws. scene_buf keeps the free words of its range for
+ * renderer_scene_alloc.
+ */
+void renderer_prepare_scene(
+        renderer_t *prender,
+        const entity_t *pentities,
+        uint32_t nentities,
+        const mesh_t *pmeshes,
+        uint32_t nmeshes,
+        const object_t *pobjects,
+        uint32_t nobjects)
+{
+        uint32_t nwords;
+        uint32_t *pwords = renderer_pack_scene(
+                prender,
+                pentities,
+                nentities,
+                pmeshes,
+                nmeshes,
+                pobjects,
+                nobjects,
+                &nwords);
+
+        if (prender->scene_buf)
+        {
+                renderer_flush_uploads(prender);
+                VK_TRY(vkDeviceWaitIdle(prender->ldevice));
+                renderer_destroy_buffer(
+                        prender, prender->scene_buf, &prender->scene_alloc);
+        }
+
+        prender->szscene = sizeof(uint32_t) * prender->scene_words.size;
+        renderer_create_buffer(
+                prender,
+                prender->szscene,
+                RENDERER_SCENE_USAGE,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                &prender->scene_buf,
+                &prender->scene_alloc);
+
+        renderer_stage(prender, 0, pwords, sizeof(uint32_t) * nwords);
+        renderer_flush_uploads(prender);
+        free(pwords);
+
+        renderer_write_scene_desc(prender);
+        renderer_request_physics_variant(prender);
+}
+
+/*
+ * Moves scene_buf to a buffer of nwords, for when streamed sections no
+ * longer fit. Command buffers recorded against the old scene_buf have to
+ * be recorded again.
+ */
+static void renderer_grow_scene(renderer_t *prender, uint32_t nwords)
+{
+        renderer_flush_uploads(prender);
+        VK_TRY(vkDeviceWaitIdle(prender->ldevice));
+
+        VkBuffer old_buf                = prender->scene_buf;
+        renderer_allocation_t old_alloc = prender->scene_alloc;
+        VkDeviceSize old_sz             = prender->szscene;
+
+        prender->szscene = sizeof(uint32_t) * nwords;
+        renderer_create_buffer(
+                prender,
+                prender->szscene,
+                RENDERER_SCENE_USAGE,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                &prender->scene_buf,
+                &prender->scene_alloc);
+
+        renderer_copy_to_scene(prender, old_buf, 0, old_sz);
+        renderer_destroy_buffer(prender, old_buf, &old_alloc);
+
+        tlsf_grow(&prender->scene_words, nwords);
+        renderer_write_scene_desc(prender);
+}
+
+/*
+ * Hands out n words of scene_buf for data streamed in after
+ * renderer_prepare_scene. Freed words are reused first, scene_buf only
+ * grows once none of its free ranges fit.
+ */
+uint32_t renderer_scene_alloc(renderer_t *prender, uint32_t n, uint32_t *phandle)
+{
+        tlsf_t *ptlsf = &prender->scene_words;
+
+        uint64_t idx;
+        while ((*phandle = tlsf_alloc(ptlsf, n, RENDERER_SCENE_ALIGN, &idx)) == TLSF_NONE)
+        {
+                renderer_grow_scene(
+                        prender, (uint32_t) MAX(ptlsf->size * 2, ptlsf->size + n));
+        }
+
+        return (uint32_t) idx;
+}
+
+/* the words must not be read by a frame still in flight */
+void renderer_scene_release(renderer_t *prender, uint32_t handle)
+{
+        tlsf_release(&prender->scene_words, handle);
+}
+
+static void renderer_physics_barrier(VkCommandBuffer cmd_buf, VkPipelineStageFlags2 dst)
+{
+        VkMemoryBarrier2 barrier = {
+                .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                .dstStageMask  = dst,
+                .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                                 VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+        if (dst & VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT)
+        {
+                barrier.dstAccessMask |= VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+        }
+
+        vkCmdPipelineBarrier2(
+                cmd_buf,
+                &(VkDependencyInfo){
+                        .sType              = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                        .memoryBarrierCount = 1,
+                        .pMemoryBarriers    = &barrier});
+}
+
+static void renderer_physics_push(
+        renderer_t *prender,
+        VkCommandBuffer cmd_buf,
+        uint32_t pass,
+        uint32_t stage,
+        uint32_t first,
+        uint32_t count)
+{
+        struct
+        {
+                float dt;
+                uint32_t pass, stage, first, count;
+        } push = {prender->physics_clock.step, pass, stage, first, count};
+
+        vkCmdPushConstants(
+                cmd_buf,
+                prender->pipe_layout,
+                VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
+                        VK_SHADER_STAGE_COMPUTE_BIT,
+                0,
+                sizeof push,
+                &push);
+}
+
+/*
+ * xpbd solves dispatch over constraints [first, first + count), collision
+ * and sleep passes over count of whatever they run on
+ */
+static void renderer_physics_pass_range(
+        renderer_t *prender,
+        VkCommandBuffer cmd_buf,
+        uint32_t pass,
+        uint32_t stage,
+        uint32_t first,
+        uint32_t count)
+{
+        renderer_physics_push(prender, cmd_buf, pass, stage, first, count);
+        vkCmdDispatch(cmd_buf, DIV_UP(count, RENDERER_SZPHYSICS_WORKGROUP), 1, 1);
+}
+
+/* a point pass, over the points the last SLEEP_COMPACT left awake */
+static void renderer_physics_pass(
+        renderer_t *prender, VkCommandBuffer cmd_buf, uint32_t pass, uint32_t stage)
+{
+        renderer_physics_push(prender, cmd_buf, pass, stage, 0, 0);
+        vkCmdDispatchIndirect(
+                cmd_buf,
+                prender->scene_buf,
+                sizeof(uint32_t) * prender->scene.idx_awake_dispatch);
+}
+
+/* the constraint colours in order, a barrier between each */
+static void renderer_record_constraints(renderer_t *prender, VkCommandBuffer cmd_buf)
+{
+        for (uint32_t i = 0; i < PHYSICS_XPBD_ITERATIONS; i++)
+        {
+                for (uint32_t c = 0; c < prender->nconstraint_colors; c++)
+                {
+                        uint32_t first = prender->pconstraint_color_offsets[c];
+                        uint32_t last  = prender->pconstraint_color_offsets[c + 1];
+
+                        renderer_physics_pass_range(
+                                prender,
+                                cmd_buf,
+                                RENDERER_PHYSICS_PASS_XPBD_SOLVE,
+                                i,
+                                first,
+                                last - first);
+                        renderer_physics_barrier(
+                                cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+                }
+        }
+}
+
+/*
+ * The hash and contacts collision_step runs on the CPU, a pass and a
+ * barrier per phase. Without triangles the bounds leave the extent 0.
+ */
+static void renderer_record_collision(renderer_t *prender, VkCommandBuffer cmd_buf)
+{
+        const renderer_scene_t *pscene = &prender->scene;
+        struct
+        {
+                uint32_t pass, count;
+        } ppasses[] = {
+                {RENDERER_PHYSICS_PASS_COLLISION_CLEAR, pscene->ncells},
+                {RENDERER_PHYSICS_PASS_COLLISION_BOUNDS, pscene->ntriangles},
+                {RENDERER_PHYSICS_PASS_COLLISION_COUNT, pscene->ncollision_items},
+                {RENDERER_PHYSICS_PASS_COLLISION_SCAN_BLOCKS, pscene->ncells},
+                /* one workgroup scans the block sums */
+                {RENDERER_PHYSICS_PASS_COLLISION_SCAN_TOTALS,
+                 RENDERER_SZPHYSICS_WORKGROUP},
+                {RENDERER_PHYSICS_PASS_COLLISION_SCAN_ADD, pscene->ncells},
+                {RENDERER_PHYSICS_PASS_COLLISION_SCATTER, pscene->ncollision_items},
+                {RENDERER_PHYSICS_PASS_COLLISION_ORDER, pscene->ncells},
+                {RENDERER_PHYSICS_PASS_COLLISION_TRIANGLES, pscene->ntriangles},
+                {RENDERER_PHYSICS_PASS_COLLISION_POINTS, pscene->ncolliding_points},
+                {RENDERER_PHYSICS_PASS_COLLISION_APPLY, pscene->ncolliding_points}};
+
+        for (uint32_t i = 0; i < sizeof ppasses / sizeof ppasses[0]; i++)
+        {
+                if (!ppasses[i].count)
+                {
+                        continue;
+                }
+
+                renderer_physics_pass_range(
+                        prender, cmd_buf, ppasses[i].pass, 0, 0, ppasses[i].count);
+                renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+        }
+}
+
+/*
+ * The rest windows, the contacts and the entities falling asleep or waking,
+ * then the awake points for the next step's point passes to dispatch over,
+ * the last barrier hands them to the indirect stage.
+ */
+static void renderer_record_sleep(renderer_t *prender, VkCommandBuffer cmd_buf)
+{
+        const renderer_scene_t *pscene = &prender->scene;
+        uint32_t nentity_threads       = pscene->nentities * RENDERER_SZPHYSICS_WORKGROUP;
+
+        renderer_physics_pass_range(
+                prender,
+                cmd_buf,
+                RENDERER_PHYSICS_PASS_SLEEP_REST,
+                0,
+                0,
+                nentity_threads);
+        renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+        if (pscene->ncollision_items)
+        {
+                renderer_physics_pass_range(
+                        prender,
+                        cmd_buf,
+                        RENDERER_PHYSICS_PASS_SLEEP_TOUCH,
+                        0,
+                        0,
+                        pscene->ncollision_items);
+                renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+        }
+        renderer_physics_pass_range(
+                prender,
+                cmd_buf,
+                RENDERER_PHYSICS_PASS_SLEEP_UPDATE,
+                0,
+                0,
+                nentity_threads);
+        renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+        renderer_physics_pass_range(
+                prender,
+                cmd_buf,
+                RENDERER_PHYSICS_PASS_SLEEP_COMPACT,
+                0,
+                0,
+                pscene->npoint_masses);
+        renderer_physics_barrier(
+                cmd_buf,
+                VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+}
+
+/*
+ * One fixed step for every awake entity, each pass running its own
+ * integrator's stage. Passes only rk4, implicit or xpbd entities need are
+ * left out when the scene has none, the same phases
+ * physics_integrator_phases hands the CPU. Sleeping entities collide as if
+ * pinned.
+ */
+static void renderer_record_physics_step(renderer_t *prender, VkCommandBuffer cmd_buf)
+{
+        uint32_t integrators = prender->physics_integrators;
+
+        if (integrators & (1 << PHYSICS_INTEGRATOR_VERLET | 1 << PHYSICS_INTEGRATOR_RK4 |
+                           1 << PHYSICS_INTEGRATOR_XPBD))
+        {
+                renderer_physics_pass(prender, cmd_buf, RENDERER_PHYSICS_PASS_BEGIN, 0);
+                renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+        }
+
+        /* xpbd entities predicted in BEGIN and finish in the first STAGE */
+        if (integrators & (1 << PHYSICS_INTEGRATOR_XPBD))
+        {
+                renderer_record_constraints(prender, cmd_buf);
+        }
+
+        uint32_t nstages = integrators & (1 << PHYSICS_INTEGRATOR_RK4) ? 4 : 1;
+        for (uint32_t i = 0; i < nstages; i++)
+        {
+                renderer_physics_pass(prender, cmd_buf, RENDERER_PHYSICS_PASS_FORCES, i);
+                renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+                renderer_physics_pass(prender, cmd_buf, RENDERER_PHYSICS_PASS_STAGE, i);
+                renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+        }
+
+        if (integrators & (1 << PHYSICS_INTEGRATOR_IMPLICIT_EULER))
+        {
+                for (uint32_t i = 1; i <= PHYSICS_IMPLICIT_ITERATIONS; i++)
+                {
+                        renderer_physics_pass(
+                                prender,
+                                cmd_buf,
+                                RENDERER_PHYSICS_PASS_IMPLICIT_ITERATE,
+                                i);
+                        renderer_physics_barrier(
+                                cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+                }
+
+                renderer_physics_pass(
+                        prender,
+                        cmd_buf,
+                        RENDERER_PHYSICS_PASS_IMPLICIT_FINISH,
+                        PHYSICS_IMPLICIT_ITERATIONS);
+                renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+        }
+
+        /* shape matching closes every entity's step, as in physics_body_step */
+        if (prender->scene.nclusters)
+        {
+                renderer_physics_pass_range(
+                        prender,
+                        cmd_buf,
+                        RENDERER_PHYSICS_PASS_CLUSTER_FIT,
+                        0,
+                        0,
+                        prender->scene.nclusters);
+                renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+                renderer_physics_pass(
+                        prender, cmd_buf, RENDERER_PHYSICS_PASS_CLUSTER_APPLY, 0);
+                renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+        }
+
+        /* contacts once every entity has stepped, as physics_world_step does */
+        if (prender->scene.ncollision_items)
+        {
+                renderer_record_collision(prender, cmd_buf);
+        }
+
+        renderer_record_sleep(prender, cmd_buf);
+}
+
+/* the scene's x, y and z streams, and where step idx_step has them in a points_buf */
+static void renderer_points_regions(
+        const renderer_t *prender, uint32_t idx_step, bool upload, VkBufferCopy *pregions)
+{
+        const renderer_scene_t *pscene = &prender->scene;
+        VkDeviceSize sz                = sizeof(float) * pscene->npoint_masses;
+        uint32_t pidx[3] = {pscene->idx_x, pscene->idx_y, pscene->idx_z};
+
+        for (uint32_t c = 0; c < 3; c++)
+        {
+                VkDeviceSize scene_offset  = sizeof(uint32_t) * pidx[c];
+                VkDeviceSize points_offset = sz * (3 * idx_step + c);
+                pregions[c]                = (VkBufferCopy){
+                        .srcOffset = upload ? points_offset : scene_offset,
+                        .dstOffset = upload ? scene_offset : points_offset,
+                        .size      = sz};
+        }
+}
+
+/* copies the positions of the step just recorded to step idx_step of points_buf */
+static void renderer_record_points_readback(
+        renderer_t *prender,
+        VkCommandBuffer cmd_buf,
+        VkBuffer points_buf,
+        uint32_t idx_step)
+{
+        VkMemoryBarrier2 barrier = {
+                .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                .dstStageMask  = VK_PIPELINE_STAGE_2_COPY_BIT,
+                .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT};
+        VkDependencyInfo dep_info = {
+                .sType              = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .memoryBarrierCount = 1,
+                .pMemoryBarriers    = &barrier};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+
+        VkBufferCopy pregions[3];
+        renderer_points_regions(prender, idx_step, false, pregions);
+        vkCmdCopyBuffer(cmd_buf, prender->scene_buf, points_buf, 3, pregions);
+
+        /* the next step overwrites what was read, the host reads the copy */
+        barrier = (VkMemoryBarrier2){
+                .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask  = VK_PIPELINE_STAGE_2_COPY_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT |
+                                VK_PIPELINE_STAGE_2_HOST_BIT,
+                .dstAccessMask = VK_ACCESS_2_HOST_READ_BIT};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+}
+
+/*
+ * Overwrites the positions with step 0 of points_buf, after every earlier
+ * frame has read them and before this one's passes do.
+ */
+static void renderer_record_points_upload(
+        renderer_t *prender, VkCommandBuffer cmd_buf, VkBuffer points_buf)
+{
+        VkMemoryBarrier2 barrier = {
+                .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT |
+                                VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+                .dstStageMask  = VK_PIPELINE_STAGE_2_COPY_BIT};
+        VkDependencyInfo dep_info = {
+                .sType              = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .memoryBarrierCount = 1,
+                .pMemoryBarriers    = &barrier};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+
+        VkBufferCopy pregions[3];
+        renderer_points_regions(prender, 0, true, pregions);
+        vkCmdCopyBuffer(cmd_buf, points_buf, prender->scene_buf, 3, pregions);
+
+        barrier = (VkMemoryBarrier2){
+                .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask  = VK_PIPELINE_STAGE_2_COPY_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT |
+                                VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+                .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                                 VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+}
+
+/* writes the begin or end of timestamp pair idx, nothing without a pool */
+static void renderer_write_timestamp(
+        VkCommandBuffer cmd_buf, VkQueryPool pool, uint32_t idx, bool end)
+{
+        if (!pool)
+        {
+                return;
+        }
+
+        vkCmdWriteTimestamp2(
+                cmd_buf,
+                end ? VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+                    : VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+                pool,
+                idx + end);
+}
+
+/*
+ * Records nsteps fixed physics steps ahead of the graphics pass, callers get
+ * the count from physics_clock_advance on renderer_t.dt. State stays in
+ * scene_buf between frames, the last barrier hands it to the vertex stage.
+ * Each step is timed into timestamp_pool when there is one, and its
+ * positions copied to points_buf when there is one.
+ */
+void renderer_record_physics(
+        renderer_t *prender,
+        VkCommandBuffer cmd_buf,
+        uint32_t nsteps,
+        VkQueryPool timestamp_pool,
+        VkBuffer points_buf)
+{
+        if (!prender->scene.npoint_masses || !nsteps)
+        {
+                return;
+        }
+
+        VkPipeline pipe = prender->physics_pipe;
+        if (atomic_load_explicit(&prender->variant_ready, memory_order_acquire))
+        {
+                pipe = prender->physics_variant;
+        }
+
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, pipe);
+        vkCmdBindDescriptorSets(
+                cmd_buf,
+                VK_PIPELINE_BIND_POINT_COMPUTE,
+                prender->pipe_layout,
+                0,
+                1,
+                &prender->scene_desc,
+                0,
+                NULL);
+
+        for (uint32_t i = 0; i < nsteps; i++)
+        {
+                /* the pool has pairs for the clock's step budget only */
+                VkQueryPool pool =
+                        i < RENDERER_PHYSICS_MAX_STEPS ? timestamp_pool : VK_NULL_HANDLE;
+                uint32_t idx_query = RENDERER_QUERY_PHYSICS + 2 * i;
+
+                renderer_write_timestamp(cmd_buf, pool, idx_query, false);
+                renderer_record_physics_step(prender, cmd_buf);
+                renderer_write_timestamp(cmd_buf, pool, idx_query, true);
+
+                if (points_buf)
+                {
+                        renderer_record_points_readback(prender, cmd_buf, points_buf, i);
+                }
+        }
+
+        renderer_physics_barrier(cmd_buf, VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT);
+}
+
+static void renderer_push_camera(renderer_t *prender, VkCommandBuffer cmd_buf)
+{
+        renderer_camera_push_t push = {
+                .dt = prender->dt, .occlusion = prender->pyramid_valid};
+        memcpy(push.proj_mat, prender->proj_mat, sizeof push.proj_mat);
+        memcpy(push.view_mat, prender->view_mat, sizeof push.view_mat);
+        memcpy(push.prev_view_proj, prender->prev_view_proj, sizeof push.prev_view_proj);
+
+        vkCmdPushConstants(
+                cmd_buf,
+                prender->pipe_layout,
+                VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
+                        VK_SHADER_STAGE_COMPUTE_BIT,
+                0,
+                sizeof push,
+                &push);
+}
+
+/*
+ * Rebuilds the draw list on the device, a thread per instance appending a
+ * draw of its meshlet unless the meshlet is outside the frustum, faces away
+ * from the camera or is behind the last frame's depth in the hi-z pyramid.
+ * Must be recorded outside a rendering scope, the draws follow with
+ * renderer_record_draw.
+ */
+void renderer_record_cull(renderer_t *prender, VkCommandBuffer cmd_buf)
+{
+        renderer_scene_t *pscene = &prender->scene;
+        if (!pscene->ninstances)
+        {
+                return;
+        }
+
+        /* the last frame's draws are read before the list is rebuilt */
+        VkMemoryBarrier2 barrier = {
+                .sType        = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                                VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT |
+                                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT};
+        VkDependencyInfo dep_info = {
+                .sType              = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .memoryBarrierCount = 1,
+                .pMemoryBarriers    = &barrier};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+
+        vkCmdFillBuffer(
+                cmd_buf,
+                prender->scene_buf,
+                sizeof(uint32_t) * pscene->idx_ndraw,
+                sizeof(uint32_t) * DIV_UP(pscene->ninstances, RENDERER_DRAW_BATCH),
+                0);
+
+        barrier = (VkMemoryBarrier2){
+                .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask  = VK_PIPELINE_STAGE_2_CLEAR_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                                 VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, prender->cull_pipe);
+        vkCmdBindDescriptorSets(
+                cmd_buf,
+                VK_PIPELINE_BIND_POINT_COMPUTE,
+                prender->pipe_layout,
+                0,
+                2,
+                (VkDescriptorSet[]){prender->scene_desc, prender->ppyramid_descs[0]},
+                0,
+                NULL);
+        renderer_push_camera(prender, cmd_buf);
+        vkCmdDispatch(
+                cmd_buf, DIV_UP(pscene->ninstances, RENDERER_SZCULL_WORKGROUP), 1, 1);
+
+        barrier = (VkMemoryBarrier2){
+                .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                .dstStageMask  = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                                VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+                .dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT |
+                                 VK_ACCESS_2_SHADER_STORAGE_READ_BIT};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+}
+
+/*
+ * Every visible instance of batch idx_batch in one call, the vertex shader
+ * pulls its vertices and model matrix from scene_buf by gl_VertexIndex and
+ * gl_InstanceIndex, which cull.comp set to the instance's object.
+ */
+void renderer_record_draw(
+        renderer_t *prender, VkCommandBuffer cmd_buf, uint32_t idx_batch)
+{
+        renderer_scene_t *pscene = &prender->scene;
+        uint32_t first           = idx_batch * RENDERER_DRAW_BATCH;
+        if (first >= pscene->ninstances)
+        {
+                return;
+        }
+
+        vkCmdBindPipeline(
+                cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, prender->graphics_pipe);
+        vkCmdBindDescriptorSets(
+                cmd_buf,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                prender->pipe_layout,
+                0,
+                1,
+                &prender->scene_desc,
+                0,
+                NULL);
+        renderer_push_camera(prender, cmd_buf);
+
+        vkCmdBindIndexBuffer(
+                cmd_buf,
+                prender->scene_buf,
+                sizeof(uint32_t) * pscene->idx_indices,
+                VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexedIndirectCount(
+                cmd_buf,
+                prender->scene_buf,
+                sizeof(uint32_t) * pscene->idx_draw +
+                        sizeof(VkDrawIndexedIndirectCommand) * first,
+                prender->scene_buf,
+                sizeof(uint32_t) * (pscene->idx_ndraw + idx_batch),
+                MIN(pscene->ninstances - first, RENDERER_DRAW_BATCH),
+                sizeof(VkDrawIndexedIndirectCommand));
+}
+
+/* column major like the camera, pdst = pa * pb */
+static void renderer_mat4_mul(float *pdst, const float *pa, const float *pb)
+{
+        for (uint32_t c = 0; c < 4; c++)
+        {
+                for (uint32_t r = 0; r < 4; r++)
+                {
+                        float sum = 0.0f;
+                        for (uint32_t k = 0; k < 4; k++)
+                        {
+                                sum += pa[k * 4 + r] * pb[c * 4 + k];
+                        }
+                        pdst[c * 4 + r] = sum;
+                }
+        }
+}
+
+/*
+ * Reduces the frame's depth into the hi-z pyramid, a dispatch per level
+ * each reading the one above. The next frame's cull tests against it
+ * under the camera it was drawn with. Must follow the draws outside their
+ * rendering scope, the depth attachment is left for sampling.
+ */
+void renderer_record_pyramid(renderer_t *prender, VkCommandBuffer cmd_buf)
+{
+        VkImageMemoryBarrier2 pbarriers[2] = {
+                {.sType        = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                 .srcStageMask = VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                 .srcAccessMask       = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                 .dstStageMask        = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                 .dstAccessMask       = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                 .oldLayout           = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                 .newLayout           = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                 .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                 .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                 .image               = prender->depth_img,
+                 .subresourceRange    = {
+                            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+                            .levelCount = 1,
+                            .layerCount = 1}},
+                /* this frame's cull is done reading the last pyramid */
+                {.sType         = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                 .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                 .srcAccessMask = VK_ACCESS_2_NONE,
+                 .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                 .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                 .oldLayout     = VK_IMAGE_LAYOUT_GENERAL,
+                 .newLayout     = VK_IMAGE_LAYOUT_GENERAL,
+                 .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                 .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                 .image               = prender->pyramid_img,
+                 .subresourceRange    = {
+                            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                            .levelCount = prender->npyramid_levels,
+                            .layerCount = 1}}};
+        VkDependencyInfo dep_info = {
+                .sType                   = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .imageMemoryBarrierCount = 2,
+                .pImageMemoryBarriers    = pbarriers};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+
+        /* each level is sampled by the next one's dispatch and the next frame's cull */
+        VkMemoryBarrier2 barrier = {
+                .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                .dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT};
+        dep_info = (VkDependencyInfo){
+                .sType              = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .memoryBarrierCount = 1,
+                .pMemoryBarriers    = &barrier};
+
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, prender->pyramid_pipe);
+        for (uint32_t i = 0; i < prender->npyramid_levels; i++)
+        {
+                vkCmdBindDescriptorSets(
+                        cmd_buf,
+                        VK_PIPELINE_BIND_POINT_COMPUTE,
+                        prender->pipe_layout,
+                        1,
+                        1,
+                        &prender->ppyramid_descs[i],
+                        0,
+                        NULL);
+                vkCmdDispatch(
+                        cmd_buf,
+                        DIV_UP(MAX(prender->pyramid_width >> i, 1),
+                               RENDERER_SZPYRAMID_WORKGROUP),
+                        DIV_UP(MAX(prender->pyramid_height >> i, 1),
+                               RENDERER_SZPYRAMID_WORKGROUP),
+                        1);
+                vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+        }
+
+        renderer_mat4_mul(prender->prev_view_proj, prender->proj_mat, prender->view_mat);
+        prender->pyramid_valid = true;
+}
+
+/*
+void renderer_prepare(renderer_t *prender)
+{
+
+        uint32_t sz_meshes =
+                prender->sz_meshes + sizeof(object_t) * prender->nmeshes;
+        uint32_t sz_draws =
+                prender->nobjects * sizeof(VkDrawIndexedIndirectCommand);
+        uint32_t sz_objects = prender->nbojects * sizeof(object_t);
+        VK_TRY(vkCreateBuffer(
+                ldevice,
+                &(VkBufferCreateInfo) {
+                        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                        .size  = sz_meshes + sz_draws + sz_objects +
+                                4 // 4 for the draw count
+                },
+                NULL,
+                &prender->scene_buf));
+
+        VK_TRY(vkBindBufferMemory(
+                prender->ldevice,
+                prender->scene_buf,
+                prender->scene_mem,
+                0));
+
+        void *pmapped = NULL;
+        VK_TRY(vkMapMemory(
+                prender->ldevice,
+                prender->scene_mem,
+                0,
+                prender->sz_meshes,
+                0,
+                &pmapped));
+
+        memcpy(pmapped, pmeshes, prender->sz_meshes);
+
+        vkUnmapMemory(prender->ldevice, prender->scene_mem);
+}
+*/
+
+/* recording tasks of a frame, the draw batches follow the compute passes */
+#define RENDERER_RECORD_PHYSICS 0
+#define RENDERER_RECORD_CULL 1
+#define RENDERER_RECORD_DRAWS 2
+
+static const char *const renderer_record_names[] = {
+        "record physics", "record cull", "record draws"};
+
+typedef struct
+{
+        renderer_t *prender;
+        frame_info_t *pframe_info;
+        uint32_t nsteps;
+} renderer_record_ctx_t;
+
+/* the next free secondary of the worker's pool, allocated on first use */
+static VkCommandBuffer renderer_worker_buffer(
+        renderer_t *prender, renderer_worker_pool_t *ppool)
+{
+        if (ppool->nused == ppool->nbufs)
+        {
+                ppool->pbufs = realloc(
+                        ppool->pbufs, sizeof(VkCommandBuffer) * (ppool->nbufs + 1));
+                if (!ppool->pbufs)
+                {
+                        fprintf(stderr, "Cant grow worker command buffers.\n");
+                        abort();
+                }
+
+                VK_TRY(vkAllocateCommandBuffers(
+                        prender->ldevice,
+                        &(VkCommandBufferAllocateInfo){
+                                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                .commandPool        = ppool->pool,
+                                .level              = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                                .commandBufferCount = 1},
+                        &ppool->pbufs[ppool->nbufs++]));
+        }
+
+        return ppool->pbufs[ppool->nused++];
+}
+
+/*
+ * Records task idx of a frame into a secondary from the running worker's
+ * pool. Draw batches continue the primary's dynamic rendering, so they
+ * inherit its attachment format and set their own viewport and scissor.
+ */
+static void renderer_record_task(void *pctx, uint32_t idx, uint32_t idx_worker)
+{
+        renderer_record_ctx_t *prec = pctx;
+        renderer_t *prender         = prec->prender;
+        VkQueryPool timestamps      = prec->pframe_info->timestamp_pool;
+
+        profiler_scope_t scope = profiler_begin(
+                &prender->profiler,
+                renderer_record_names[MIN(idx, RENDERER_RECORD_DRAWS)],
+                idx_worker);
+
+        VkCommandBuffer cmd_buf = renderer_worker_buffer(
+                prender, &prec->pframe_info->pworker_pools[idx_worker]);
+        bool draw = idx >= RENDERER_RECORD_DRAWS;
+
+        VkCommandBufferInheritanceRenderingInfo rendering_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+                .colorAttachmentCount    = 1,
+                .pColorAttachmentFormats = (VkFormat[]){RENDERER_SWAPCHAIN_IMAGE_FORMAT},
+                .depthAttachmentFormat   = RENDERER_DEPTH_FORMAT,
+                .rasterizationSamples    = VK_SAMPLE_COUNT_1_BIT};
+
+        VK_TRY(vkBeginCommandBuffer(
+                cmd_buf,
+                &(VkCommandBufferBeginInfo){
+                        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                                 (draw ? VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT
+                                       : 0),
+                        .pInheritanceInfo = &(VkCommandBufferInheritanceInfo){
+                                .sType =
+                                        VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+                                .pNext = draw ? &rendering_info : NULL,
+                                .pipelineStatistics = prender->stats_flags}}));
+
+        switch (idx)
+        {
+        case RENDERER_RECORD_PHYSICS:
+                renderer_record_physics(
+                        prender,
+                        cmd_buf,
+                        prec->nsteps,
+                        timestamps,
+                        prec->pframe_info->npoint_steps ? prec->pframe_info->points_buf
+                                                        : VK_NULL_HANDLE);
+                break;
+        case RENDERER_RECORD_CULL:
+                renderer_write_timestamp(cmd_buf, timestamps, RENDERER_QUERY_CULL, false);
+                renderer_record_cull(prender, cmd_buf);
+                renderer_write_timestamp(cmd_buf, timestamps, RENDERER_QUERY_CULL, true);
+                break;
+        default:
+                vkCmdSetViewport(
+                        cmd_buf,
+                        0,
+                        1,
+                        &(VkViewport){
+                                .width    = prender->width,
+                                .height   = prender->height,
+                                .minDepth = 0.0f,
+                                .maxDepth = 1.0f});
+                vkCmdSetScissor(
+                        cmd_buf,
+                        0,
+                        1,
+                        &(VkRect2D){.extent = {prender->width, prender->height}});
+                renderer_record_draw(prender, cmd_buf, idx - RENDERER_RECORD_DRAWS);
+                break;
+        }
+
+        VK_TRY(vkEndCommandBuffer(cmd_buf));
+        prender->psecondaries[idx] = cmd_buf;
+
+        profiler_end(&prender->profiler, &scope);
+}
+
+/*
+ * Records one frame for swapchain image idx_img. Physics, cull and every
+ * draw batch are recorded as secondaries in parallel, the primary only
+ * executes them around the image transitions. Without a scene the image
+ * is only cleared.
+ */
+static void renderer_record_frame(
+        renderer_t *prender, frame_info_t *pframe_info, uint32_t idx_img, uint32_t nsteps)
+{
+        /* without images, headless and zero sized, only the physics is recorded */
+        bool render       = prender->nswapchain_images > 0;
+        uint32_t nbatches = DIV_UP(prender->scene.ninstances, RENDERER_DRAW_BATCH);
+        uint32_t ntasks   = 0;
+        if (prender->scene_buf)
+        {
+                ntasks = render ? RENDERER_RECORD_DRAWS + nbatches : RENDERER_RECORD_CULL;
+        }
+
+        if (ntasks > prender->nsecondary_capacity)
+        {
+                prender->nsecondary_capacity = ntasks;
+                prender->psecondaries        = realloc(
+                        prender->psecondaries, sizeof(VkCommandBuffer) * ntasks);
+                if (!prender->psecondaries)
+                {
+                        fprintf(stderr, "Cant grow secondary command buffers.\n");
+                        abort();
+                }
+        }
+
+        renderer_record_ctx_t rec = {prender, pframe_info, nsteps};
+        if (prender->psched)
+        {
+                atomic_uint counter = 0;
+                scheduler_submit_range(
+                        prender->psched, 0, renderer_record_task, &rec, ntasks, &counter);
+                scheduler_wait(prender->psched, 0, &counter);
+        }
+        else
+        {
+                for (uint32_t i = 0; i < ntasks; i++)
+                {
+                        renderer_record_task(&rec, i, 0);
+                }
+        }
+
+        VkCommandBuffer cmd_buf    = pframe_info->cmd_buf;
+        VkQueryPool timestamp_pool = pframe_info->timestamp_pool;
+        VkQueryPool stats_pool     = pframe_info->stats_pool;
+
+        VK_TRY(vkBeginCommandBuffer(
+                cmd_buf,
+                &(VkCommandBufferBeginInfo){
+                        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT}));
+
+        /* queries the frame leaves unwritten stay unavailable and are skipped */
+        if (timestamp_pool)
+        {
+                vkCmdResetQueryPool(cmd_buf, timestamp_pool, 0, RENDERER_QUERY_COUNT);
+        }
+        if (stats_pool)
+        {
+                vkCmdResetQueryPool(cmd_buf, stats_pool, 0, 1);
+                vkCmdBeginQuery(cmd_buf, stats_pool, 0, 0);
+        }
+        pframe_info->queried = prender->nframe;
+
+        /* the cull binds the pyramid before the first frame has built it */
+        if (render && !prender->pyramid_valid)
+        {
+                VkImageMemoryBarrier2 undef_to_general = {
                         .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-                        .srcStageMask        = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                        .srcAccessMask       = VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                        .dstStageMask        = VK_PIPELINE_STAGE_2_NONE,
-                        .dstAccessMask       = VK_ACCESS_2_MEMORY_READ_BIT,
-                        .oldLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                        .newLayout           = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                        .srcStageMask        = VK_PIPELINE_STAGE_2_NONE,
+                        .dstStageMask        = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        .oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
+                        .newLayout           = VK_IMAGE_LAYOUT_GENERAL,
                         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
                         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-                        .image               = img,
-                        .subresourceRange    = all_img};
+                        .image               = prender->pyramid_img,
+                        .subresourceRange    = {
+                                   .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                   .levelCount = prender->npyramid_levels,
+                                   .layerCount = 1}};
+                vkCmdPipelineBarrier2(
+                        cmd_buf,
+                        &(VkDependencyInfo){
+                                .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                                .imageMemoryBarrierCount = 1,
+                                .pImageMemoryBarriers    = &undef_to_general});
+        }
 
-                dep_info.pImageMemoryBarriers = &color_to_present;
-                vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+        if (pframe_info->points_replay)
+        {
+                renderer_record_points_upload(prender, cmd_buf, pframe_info->points_buf);
+        }
+
+        if (ntasks)
+        {
+                vkCmdExecuteCommands(
+                        cmd_buf,
+                        MIN(ntasks, RENDERER_RECORD_DRAWS),
+                        prender->psecondaries);
+        }
+
+        if (!render)
+        {
+                if (stats_pool)
+                {
+                        vkCmdEndQuery(cmd_buf, stats_pool, 0);
+                }
+                VK_TRY(vkEndCommandBuffer(cmd_buf));
+                return;
+        }
+
+        VkImage img = prender->pswapchain_images[idx_img];
+
+        /* transition image */
+        VkImageSubresourceRange all_img = {
+                .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel   = 0,
+                .levelCount     = 1,
+                .baseArrayLayer = 0,
+                .layerCount     = 1};
+
+        VkImageMemoryBarrier2 undef_to_color = {
+                .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .srcStageMask        = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                .srcAccessMask       = VK_ACCESS_2_NONE,
+                .dstStageMask        = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                .dstAccessMask       = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                .oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
+                .newLayout           = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image               = img,
+                .subresourceRange    = all_img};
+
+        /* the last frame's pyramid build has sampled the depth, it is cleared anyway */
+        VkImageMemoryBarrier2 undef_to_depth = {
+                .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .srcStageMask        = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                .srcAccessMask       = VK_ACCESS_2_NONE,
+                .dstStageMask        = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                                VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                .dstAccessMask       = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                 VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                .oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED,
+                .newLayout           = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image               = prender->depth_img,
+                .subresourceRange    = {
+                           .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+                           .levelCount = 1,
+                           .layerCount = 1}};
+
+        VkImageMemoryBarrier2 pto_attachments[2] = {undef_to_color, undef_to_depth};
+        VkDependencyInfoKHR dep_info             = {
+                .sType                   = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .imageMemoryBarrierCount = 2,
+                .pImageMemoryBarriers    = pto_attachments};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+        renderer_write_timestamp(cmd_buf, timestamp_pool, RENDERER_QUERY_GRAPHICS, false);
+
+        VkRenderingAttachmentInfo color_attachment = {
+                .sType       = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                .imageView   = prender->pswapchain_views[idx_img],
+                .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .loadOp      = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp     = VK_ATTACHMENT_STORE_OP_STORE,
+                .clearValue  = {.color.float32 = {0.0f, 1.0f, 0.0f, 1.0f}}};
+
+        VkRenderingAttachmentInfo depth_attachment = {
+                .sType       = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                .imageView   = prender->depth_view,
+                .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                .loadOp      = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp     = VK_ATTACHMENT_STORE_OP_STORE,
+                .clearValue  = {.depthStencil.depth = 1.0f}};
+
+        vkCmdBeginRendering(
+                cmd_buf,
+                &(VkRenderingInfo){
+                        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+                        .flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT,
+                        .renderArea.extent    = {prender->width, prender->height},
+                        .layerCount           = 1,
+                        .colorAttachmentCount = 1,
+                        .pColorAttachments    = &color_attachment,
+                        .pDepthAttachment     = &depth_attachment});
+
+        if (nbatches && ntasks)
+        {
+                vkCmdExecuteCommands(
+                        cmd_buf, nbatches, &prender->psecondaries[RENDERER_RECORD_DRAWS]);
+        }
+
+        vkCmdEndRendering(cmd_buf);
+        renderer_write_timestamp(cmd_buf, timestamp_pool, RENDERER_QUERY_GRAPHICS, true);
+
+        renderer_write_timestamp(cmd_buf, timestamp_pool, RENDERER_QUERY_PYRAMID, false);
+        renderer_record_pyramid(prender, cmd_buf);
+        renderer_write_timestamp(cmd_buf, timestamp_pool, RENDERER_QUERY_PYRAMID, true);
+
+        /* transition image */
+        VkImageMemoryBarrier2 color_to_frame = {
+                .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .srcStageMask        = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                .srcAccessMask       = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                .dstStageMask        = VK_PIPELINE_STAGE_2_NONE,
+                .dstAccessMask       = VK_ACCESS_2_NONE,
+                .oldLayout           = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .newLayout           = RENDERER_FRAME_LAYOUT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image               = img,
+                .subresourceRange    = all_img};
+
+        dep_info = (VkDependencyInfoKHR){
+                .sType                   = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .imageMemoryBarrierCount = 1,
+                .pImageMemoryBarriers    = &color_to_frame};
+        vkCmdPipelineBarrier2(cmd_buf, &dep_info);
+
+        if (stats_pool)
+        {
+                vkCmdEndQuery(cmd_buf, stats_pool, 0);
+        }
+        VK_TRY(vkEndCommandBuffer(cmd_buf));
+}
+
+/*
+ * Hands a finished frame's queries to the profiler. The device clock is not
+ * calibrated against the host one, the frame's first timestamp is placed at
+ * its submit, so gpu zones line up with the cpu track only roughly.
+ */
+static void renderer_read_queries(renderer_t *prender, frame_info_t *pframe_info)
+{
+        uint64_t nframe = pframe_info->queried;
+        if (!nframe)
+        {
+                return;
+        }
+        pframe_info->queried = 0;
+
+        /* a value and its availability per query, unwritten ones are not ready */
+        VkQueryResultFlags flags =
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+        VkResult res;
+
+        if (pframe_info->timestamp_pool)
+        {
+                uint64_t presults[RENDERER_QUERY_COUNT][2];
+                res = vkGetQueryPoolResults(
+                        prender->ldevice,
+                        pframe_info->timestamp_pool,
+                        0,
+                        RENDERER_QUERY_COUNT,
+                        sizeof presults,
+                        presults,
+                        sizeof *presults,
+                        flags);
+                if (res != VK_NOT_READY)
+                {
+                        VK_TRY(res);
+                }
+
+                /* passes run in this order, ticks count from the first one written */
+                uint32_t porder[] = {
+                        RENDERER_QUERY_PHYSICS,
+                        RENDERER_QUERY_CULL,
+                        RENDERER_QUERY_GRAPHICS,
+                        RENDERER_QUERY_PYRAMID};
+                uint64_t base = 0;
+                for (uint32_t i = sizeof porder / sizeof *porder; i-- > 0;)
+                {
+                        base = presults[porder[i]][1] ? presults[porder[i]][0] : base;
+                }
+
+                for (uint32_t i = 0; i < RENDERER_QUERY_COUNT; i += 2)
+                {
+                        if (!presults[i][1] || !presults[i + 1][1])
+                        {
+                                continue;
+                        }
+
+                        uint64_t mask  = prender->timestamp_mask;
+                        float period   = prender->timestamp_period;
+                        uint64_t begin = pframe_info->submit_time +
+                                         ((presults[i][0] - base) & mask) * period;
+                        uint64_t end = pframe_info->submit_time +
+                                       ((presults[i + 1][0] - base) & mask) * period;
+
+                        const char *pname = "physics step";
+                        if (i == RENDERER_QUERY_CULL)
+                        {
+                                pname = "cull";
+                        }
+                        else if (i == RENDERER_QUERY_GRAPHICS)
+                        {
+                                pname = "graphics";
+                        }
+                        else if (i == RENDERER_QUERY_PYRAMID)
+                        {
+                                pname = "depth pyramid";
+                        }
+
+                        profiler_add_zone(
+                                &prender->profiler,
+                                nframe,
+                                pname,
+                                begin,
+                                end,
+                                PROFILER_TRACK_GPU);
+                }
+        }
+
+        if (pframe_info->stats_pool)
+        {
+                uint64_t pstats[RENDERER_STATS_COUNT + 1];
+                res = vkGetQueryPoolResults(
+                        prender->ldevice,
+                        pframe_info->stats_pool,
+                        0,
+                        1,
+                        sizeof pstats,
+                        pstats,
+                        sizeof pstats,
+                        flags);
+                if (res != VK_NOT_READY)
+                {
+                        VK_TRY(res);
+                }
+
+                if (pstats[RENDERER_STATS_COUNT])
+                {
+                        profiler_set_stats(&prender->profiler, nframe, pstats);
+                }
+        }
+}
+
+/* reads what every slot still holds, the device must be idle */
+void renderer_collect_profile(renderer_t *prender)
+{
+        for (uint32_t i = 0; i < RENDERER_MAX_FRAMES_IN_FLIGHT; i++)
+        {
+                renderer_read_queries(prender, &prender->pframe_infos[i]);
+        }
+}
+
+/* a points_buf per frame slot, for the clock's step budget of the scene's points */
+static void renderer_init_points_bufs(renderer_t *prender)
+{
+        VK_TRY(vkDeviceWaitIdle(prender->ldevice));
+
+        VkDeviceSize sz = sizeof(float) * 3 * MAX(prender->scene.npoint_masses, 1) *
+                          prender->physics_clock.max_steps;
+        for (uint32_t i = 0; i < RENDERER_MAX_FRAMES_IN_FLIGHT; i++)
+        {
+                frame_info_t *pframe_info = &prender->pframe_infos[i];
+                if (pframe_info->points_buf)
+                {
+                        renderer_destroy_buffer(
+                                prender,
+                                pframe_info->points_buf,
+                                &pframe_info->points_alloc);
+                }
+
+                renderer_create_buffer(
+                        prender,
+                        sz,
+                        VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        &pframe_info->points_buf,
+                        &pframe_info->points_alloc);
+                pframe_info->npoint_steps  = 0;
+                pframe_info->points_replay = false;
+        }
+}
+
+/* hands the steps the slot's frame copied back to the recorder, it is done with them */
+static void renderer_collect_points(renderer_t *prender, frame_info_t *pframe_info)
+{
+        size_t szstep = sizeof(float) * 3 * prender->scene.npoint_masses;
+        for (uint32_t i = 0; i < pframe_info->npoint_steps; i++)
+        {
+                memcpy(trajectory_recorder_frame(prender->precorder),
+                       (char *) pframe_info->points_alloc.pmapped + szstep * i,
+                       szstep);
+                trajectory_recorder_submit(prender->precorder);
+        }
+        pframe_info->npoint_steps = 0;
+}
+
+/*
+ * Records every step from the next frame, the recorder's entities being
+ * the ones of renderer_prepare_scene. Steps reach it as their frames
+ * finish, NULL waits for the frames in flight and hands over their steps
+ * before the recorder can be closed. Call again after preparing a new
+ * scene.
+ */
+void renderer_record_trajectory(renderer_t *prender, trajectory_recorder_t *precorder)
+{
+        if (prender->precorder)
+        {
+                VK_TRY(vkDeviceWaitIdle(prender->ldevice));
+                for (uint32_t i = 0; i < RENDERER_MAX_FRAMES_IN_FLIGHT; i++)
+                {
+                        renderer_collect_points(prender, &prender->pframe_infos[i]);
+                }
+        }
+
+        if (precorder && precorder->codec.npoint_masses != prender->scene.npoint_masses)
+        {
+                fprintf(stderr, "Cant record a trajectory of another scene.\n");
+                abort();
+        }
+
+        prender->precorder = precorder;
+        if (precorder)
+        {
+                renderer_init_points_bufs(prender);
+        }
+}
+
+/*
+ * Plays pplayer back from the next frame instead of stepping, a recorded
+ * step per physics step of renderer_t.dt, looping at the end. The player's
+ * points have to be the prepared scene's, NULL hands back to the solver
+ * from where the replay left the points.
+ */
+void renderer_replay_trajectory(renderer_t *prender, trajectory_player_t *pplayer)
+{
+        if (pplayer && pplayer->codec.npoint_masses != prender->scene.npoint_masses)
+        {
+                fprintf(stderr, "Cant replay a trajectory of another scene.\n");
+                abort();
+        }
+
+        prender->pplayer = pplayer;
+        if (pplayer)
+        {
+                renderer_init_points_bufs(prender);
+        }
+}
+
+/*
+ * Copies the prepared scene's positions to ppoints as a trajectory step
+ * has them, the x, y and z streams of every point mass in entity order.
+ * Waits for the device, it is for tools checking where the solver left
+ * the points rather than for frames.
+ */
+void renderer_read_points(renderer_t *prender, float *ppoints)
+{
+        VK_TRY(vkDeviceWaitIdle(prender->ldevice));
+
+        size_t sz = sizeof(float) * 3 * prender->scene.npoint_masses;
+        VkBuffer points_buf;
+        renderer_allocation_t points_alloc;
+        renderer_create_buffer(
+                prender,
+                MAX(sz, sizeof(float)),
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                &points_buf,
+                &points_alloc);
+
+        VkCommandBuffer cmd_buf;
+        create_command_buffers(prender, &cmd_buf, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+        VK_TRY(vkBeginCommandBuffer(
+                cmd_buf,
+                &(VkCommandBufferBeginInfo){
+                        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT}));
+        renderer_record_points_readback(prender, cmd_buf, points_buf, 0);
+        VK_TRY(vkEndCommandBuffer(cmd_buf));
+
+        VK_TRY(vkQueueSubmit(
+                prender->queue,
+                1,
+                &(VkSubmitInfo){
+                        .sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                        .commandBufferCount = 1,
+                        .pCommandBuffers    = &cmd_buf},
+                VK_NULL_HANDLE));
+        VK_TRY(vkQueueWaitIdle(prender->queue));
+
+        vkFreeCommandBuffers(prender->ldevice, prender->cmd_pool, 1, &cmd_buf);
+
+        memcpy(ppoints, points_alloc.pmapped, sz);
+        renderer_destroy_buffer(prender, points_buf, &points_alloc);
+}
 
-                vkEndCommandBuffer(cmd_buf);
+/* decodes nsteps recorded steps and stages the last for the slot's frame */
+static void renderer_replay_points(
+        renderer_t *prender, frame_info_t *pframe_info, uint32_t nsteps)
+{
+        trajectory_player_t *pplayer = prender->pplayer;
+
+        for (uint32_t i = 0; i < nsteps; i++)
+        {
+                if (!trajectory_player_next(pplayer))
+                {
+                        trajectory_player_rewind(pplayer);
+                        if (!trajectory_player_next(pplayer))
+                        {
+                                return;
+                        }
+                }
+                pframe_info->points_replay = true;
+        }
+
+        if (pframe_info->points_replay)
+        {
+                memcpy(pframe_info->points_alloc.pmapped,
+                       pplayer->px,
+                       sizeof(float) * 3 * pplayer->codec.npoint_masses);
         }
 }
 
-void renderer_test2_draw(renderer_t *prender)
+/*
+ * Frames take turns over nframes_in_flight slots. Frame n signals n on
+ * frame_sema, and reusing a slot waits for the frame that last used it, so
+ * the CPU records frame n while the GPU runs up to nframes_in_flight - 1
+ * earlier ones.
+ */
+void renderer_draw(renderer_t *prender)
 {
-        fprintf(stderr, "NFRAME: %llu\n", prender->nframe);
+        uint64_t nframe = prender->nframe;
+        frame_info_t *pframe_info =
+                &prender->pframe_infos[nframe % prender->nframes_in_flight];
+
+        profiler_t *pprof = &prender->profiler;
+        profiler_begin_frame(pprof, nframe);
 
+        profiler_scope_t scope = profiler_begin(pprof, "wait frame", 0);
+        VK_TRY(vkWaitSemaphores(
+                prender->ldevice,
+                &(VkSemaphoreWaitInfo){
+                        .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                        .semaphoreCount = 1,
+                        .pSemaphores    = &prender->frame_sema,
+                        .pValues        = &pframe_info->value},
+                UINT64_MAX));
+        profiler_end(pprof, &scope);
+
+        renderer_read_queries(prender, pframe_info);
+        if (prender->precorder)
+        {
+                renderer_collect_points(prender, pframe_info);
+        }
+
+#ifdef RENDERER_HEADLESS
+        /* offscreen images are reused round robin, the frame wait covers them */
+        uint32_t idx_img =
+                prender->nswapchain_images ? nframe % prender->nswapchain_images : 0;
+#else
+        scope = profiler_begin(pprof, "acquire", 0);
         uint32_t idx_img;
         VK_TRY(vkAcquireNextImageKHR(
                 prender->ldevice,
                 prender->swapchain,
                 RENDERER_VK_TIMEOUT,
-                img_sema,
+                pframe_info->img_sema,
                 VK_NULL_HANDLE,
                 &idx_img));
-        VkImage img = prender->pswapchain_images[idx_img];
-
-
-
+        profiler_end(pprof, &scope);
+#endif
 
-        frame_info_t *pframe_info = &prender->pframe_infos[idx_img];
-
-
-        VkFence last_fence         = plast_info->fence;
-        VkSemaphore last_time_sema = plast_info->time_sema;
-
-        VkSemaphore time_sema   = pframe_info->time_sema;
-        VkSemaphore img_sema    = pframe_info->img_sema;
-        VkFence fence           = pframe_info->fence;
-        VkCommandBuffer cmd_buf = pframe_info->cmd_buf;
-        VkCommandBuffer cmd_buf = prender->pframe_infos[idx_img].cmd_buf;
+        uint32_t nsteps = physics_clock_advance(&prender->physics_clock, prender->dt);
 
+        /* a replay moves the points itself, the solver stays off */
+        pframe_info->points_replay = false;
+        if (prender->pplayer)
+        {
+                renderer_replay_points(prender, pframe_info, nsteps);
+                nsteps = 0;
+        }
+        pframe_info->npoint_steps = prender->precorder ? nsteps : 0;
 
-        /* submit work */
-        VkTimelineSemaphoreSubmitInfo time_sema_info = {
-                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
-                .signalSemaphoreValueCount = 1,
-                .pSignalSemaphoreValues =
-                        (uint64_t[]){RENDERER_TIMELINE_COMMANDS_COMPLETE_VALUE}};
+        scope = profiler_begin(pprof, "record", 0);
 
-        VkSubmitInfo submit_info = {
-                .sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                .pNext              = &time_sema_info,
-                .waitSemaphoreCount = 1,
-                .pWaitSemaphores    = (VkSemaphore[]){img_sema},
-                .pWaitDstStageMask =
-                        (VkPipelineStageFlags[]){VK_PIPELINE_STAGE_2_TRANSFER_BIT},
-                .commandBufferCount   = 1,
-                .pCommandBuffers      = &cmd_buf,
-                .signalSemaphoreCount = 1,
-                .pSignalSemaphores    = &time_sema};
-        VK_TRY(vkQueueSubmit(prender->queue, 1, &submit_info, VK_NULL_HANDLE));
+        /* the slot's last frame is done, its buffers go back to their pools at once */
+        VK_TRY(vkResetCommandPool(prender->ldevice, pframe_info->cmd_pool, 0));
+        for (uint32_t i = 0; i < prender->nworkers; i++)
+        {
+                renderer_worker_pool_t *ppool = &pframe_info->pworker_pools[i];
 
-        /* present frame */
-        time_sema_info.waitSemaphoreValueCount = 1;
-        time_sema_info.pWaitSemaphoreValues =
-                (uint64_t[]){RENDERER_TIMELINE_COMMANDS_COMPLETE_VALUE};
-        time_sema_info.signalSemaphoreValueCount = 0;
+                VK_TRY(vkResetCommandPool(prender->ldevice, ppool->pool, 0));
+                ppool->nused = 0;
+        }
+        renderer_record_frame(prender, pframe_info, idx_img, nsteps);
+        profiler_end(pprof, &scope);
 
-        VkPresentInfoKHR present_info = {
-                .sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-                .pNext              = &time_sema_info,
-                .waitSemaphoreCount = 1,
-                .pWaitSemaphores    = &last_time_sema,
-                .swapchainCount     = 1,
-                .pSwapchains        = &prender->swapchain,
-                .pImageIndices      = &idx_img};
+        scope                    = profiler_begin(pprof, "submit", 0);
+        pframe_info->submit_time = scope.begin;
 
-        VK_TRY(vkQueuePresentKHR(prender->queue, &present_info));
+#ifdef RENDERER_HEADLESS
+        uint64_t upload_value = renderer_flush_uploads(prender);
 
+        VK_TRY(vkQueueSubmit2(
+                prender->queue,
+                1,
+                &(VkSubmitInfo2){
+                        .sType                  = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+                        .waitSemaphoreInfoCount = 1,
+                        .pWaitSemaphoreInfos    = &(VkSemaphoreSubmitInfo){
+                                .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                                .semaphore = prender->upload_sema,
+                                .value     = upload_value,
+                                .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT},
+                        .commandBufferInfoCount = 1,
+                        .pCommandBufferInfos    = &(VkCommandBufferSubmitInfo){
+                                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+                                .commandBuffer = pframe_info->cmd_buf},
+                        .signalSemaphoreInfoCount = 1,
+                        .pSignalSemaphoreInfos    = &(VkSemaphoreSubmitInfo){
+                                .sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                                .semaphore = prender->frame_sema,
+                                .value     = nframe,
+                                .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT}},
+                VK_NULL_HANDLE));
+        pframe_info->value = nframe;
+#else
+        /* present only takes binary semaphores, one per image as it can be reused */
+        VkSemaphore present_sema = prender->ppresent_semas[idx_img];
+        uint64_t upload_value    = renderer_flush_uploads(prender);
+
+        VK_TRY(vkQueueSubmit2(
+                prender->queue,
+                1,
+                &(VkSubmitInfo2){
+                        .sType                  = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+                        .waitSemaphoreInfoCount = 2,
+                        .pWaitSemaphoreInfos    = (VkSemaphoreSubmitInfo[]){
+                                {.sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                                 .semaphore = pframe_info->img_sema,
+                                 .stageMask =
+                                         VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT},
+                                {.sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                                 .semaphore = prender->upload_sema,
+                                 .value     = upload_value,
+                                 .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT}},
+                        .commandBufferInfoCount = 1,
+                        .pCommandBufferInfos    = &(VkCommandBufferSubmitInfo){
+                                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+                                .commandBuffer = pframe_info->cmd_buf},
+                        .signalSemaphoreInfoCount = 2,
+                        .pSignalSemaphoreInfos    = (VkSemaphoreSubmitInfo[]){
+                                {.sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                                 .semaphore = prender->frame_sema,
+                                 .value     = nframe,
+                                 .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT},
+                                {.sType     = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+                                 .semaphore = present_sema,
+                                 .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT}}},
+                VK_NULL_HANDLE));
+        pframe_info->value = nframe;
+        profiler_end(pprof, &scope);
+
+        scope = profiler_begin(pprof, "present", 0);
+        VK_TRY(vkQueuePresentKHR(
+                prender->queue,
+                &(VkPresentInfoKHR){
+                        .sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+                        .waitSemaphoreCount = 1,
+                        .pWaitSemaphores    = &present_sema,
+                        .swapchainCount     = 1,
+                        .pSwapchains        = &prender->swapchain,
+                        .pImageIndices      = &idx_img}));
+#endif
+        profiler_end(pprof, &scope);
+
+        profiler_end_frame(pprof);
         prender->nframe++;
 }
 
-void renderer_load_mesh(renderer_t *prender, char *ppath)
+/* takes effect from the next frame, slots keep the value of their last frame */
+void renderer_set_frames_in_flight(renderer_t *prender, uint32_t n)
+{
+        prender->nframes_in_flight = MIN(MAX(n, 1), RENDERER_MAX_FRAMES_IN_FLIGHT);
+}
+
+/*
+ * Loads an obj through its binary cache, see mesh_load. A cached mesh is
+ * a view of the mapped file, nothing is parsed or copied until
+ * renderer_prepare_scene packs it for the staging ring. Release it with
+ * mesh_free once the scene is prepared.
+ */
+void renderer_load_mesh(renderer_t *prender, const char *ppath, mesh_t *pmesh)
 {
-        char *pchar = ppath;
-        while (*pchar != '\0')
+        if (!mesh_load(ppath, pmesh))
         {
-                while (*pchar++ != ' ')
-                        ;
+                fprintf(stderr, "Cant load mesh %s.\n", ppath);
+                abort();
         }
 }
 
+#if defined(RENDERER_NO_MAIN)
+/* the includer brings its own main, see bench.c */
+#elif defined(RENDERER_HEADLESS)
+/*
+ * usage: [nframes] [width height], no size only steps the simulation and every
+ * frame advances it by the full step budget instead of wall time
+ */
+int main(int argc, char **argv)
+{
+        srand(time(NULL));
+        physics_init_kernels();
+        scheduler_t sched;
+        scheduler_init(&sched, 0);
+
+        uint64_t nframes = RENDERER_HEADLESS_FRAMES;
+        int width        = 0;
+        int height       = 0;
+        if (argc > 1)
+        {
+                nframes = strtoull(argv[1], NULL, 10);
+        }
+        if (argc > 3)
+        {
+                width  = atoi(argv[2]);
+                height = atoi(argv[3]);
+        }
+
+        renderer_t renderer = {};
+        renderer_init(&renderer, "HELLO BRO", width, height, &sched);
+
+        renderer.dt = RENDERER_PHYSICS_STEP * RENDERER_PHYSICS_MAX_STEPS;
+        for (uint64_t i = 0; i < nframes; i++)
+        {
+                renderer_draw(&renderer);
+        }
+
+        VK_TRY(vkDeviceWaitIdle(renderer.ldevice));
+        renderer_save_pipeline_cache(&renderer);
+
+        /* every query has landed once the device is idle */
+        renderer_collect_profile(&renderer);
+        profiler_report(&renderer.profiler, renderer.nframe - 1, stderr);
+        profiler_write_trace(&renderer.profiler, RENDERER_TRACE_PATH);
+
+        scheduler_free(&sched);
+
+        return 0;
+}
+#else
 int main()
 {
         srand(time(NULL));
+        physics_init_kernels();
+        scheduler_t sched;
+        scheduler_init(&sched, 0);
+
         renderer_t renderer = {};
-        renderer_init(&renderer, "HELLO BRO", 800, 600);
+        renderer_init(&renderer, "HELLO BRO", 800, 600, &sched);
+
+        uint64_t last = SDL_GetPerformanceCounter();
 
-        uint32_t n = 2;
-        while (1)
+        uint32_t n   = 2;
+        bool running = true;
+        while (running)
         {
-                renderer_test2_draw(&renderer);
+                SDL_Event event;
+                while (SDL_PollEvent(&event))
+                {
+                        running &= event.type != SDL_QUIT;
+                }
+
+                uint64_t now = SDL_GetPerformanceCounter();
+                renderer.dt  = (float) (now - last) / SDL_GetPerformanceFrequency();
+                last         = now;
+
+                renderer_draw(&renderer);
         }
 
+        VK_TRY(vkDeviceWaitIdle(renderer.ldevice));
+        renderer_save_pipeline_cache(&renderer);
+
+        /* every query has landed once the device is idle */
+        renderer_collect_profile(&renderer);
+        profiler_report(&renderer.profiler, renderer.nframe - 1, stderr);
+        profiler_write_trace(&renderer.profiler, RENDERER_TRACE_PATH);
+
+        scheduler_free(&sched);
+
         return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,8 +1,14 @@
 #version 450
 
+layout (location = 0) in vec3 frag_normal;
+
 layout (location = 0) out vec4 frag_color;
 
 void main()
 {
-        frag_color = vec4(1.0, 1.0, 1.0, 1.0);
-}
\ No newline at end of file
+        // a fixed key light until the light section is filled
+        vec3 light    = normalize(vec3(0.3, 1.0, 0.5));
+        float diffuse = max(dot(normalize(frag_normal), light), 0.0);
+
+        frag_color = vec4(vec3(0.2 + 0.8 * diffuse), 1.0);
+}
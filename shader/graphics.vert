@@ -1,26 +1,59 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+// must match renderer_vertex_t in main.c
+#define VERTEX_POSITION 0
+#define VERTEX_NORMAL 3
+#define VERTEX_STRIDE 6
+
+// must match renderer_object_t in main.c
+#define OBJECT_MODEL_MAT 0
+#define OBJECT_STRIDE 20
 
 layout (push_constant) uniform pc
 {
         float dt;
-        vec3 __padding;
+        uint __padding0, __padding1, __padding2;
         mat4 proj_mat, view_mat;
 };
 
+#include "scene.glsl"
+
+layout (std430, binding = 1) readonly buffer scene_data
+{
+        uint data[];
+};
+
+layout (location = 0) out vec3 frag_normal;
+
+float f32(uint idx)
+{
+        return uintBitsToFloat(data[idx]);
+}
+
+vec3 load_vec3(uint idx)
+{
+        return vec3(f32(idx), f32(idx + 1), f32(idx + 2));
+}
+
+mat4 load_mat4(uint idx)
+{
+        return mat4(
+                f32(idx + 0), f32(idx + 1), f32(idx + 2), f32(idx + 3),
+                f32(idx + 4), f32(idx + 5), f32(idx + 6), f32(idx + 7),
+                f32(idx + 8), f32(idx + 9), f32(idx + 10), f32(idx + 11),
+                f32(idx + 12), f32(idx + 13), f32(idx + 14), f32(idx + 15));
+}
+
+// no vertex input, the draw's vertexOffset and firstInstance pick the data
 void main()
-{       
-
-        // object_t object = objects[gl_InstanceIndex];
-        // gl_Position = proj_mat * view_mat * object.model_mat * vec4(object.pos, 1.0);
-
-        vec3 verts[] = {
-                vec3(1.0, -1.0, -1.0),
-                vec3(1.0, -1.0, 1.0),
-                vec3(-1.0, -1.0, 1.0),
-                vec3(-1.0, -1.0, -1.0),
-                vec3(1.0, 1.0, -1.0),
-                vec3(1.0, 1.0, 1.0)
-        };      
-
-        gl_Position = proj_mat * view_mat * vec4(verts[gl_InstanceIndex], 1.0);
-}
\ No newline at end of file
+{
+        uint object = idx_object + uint(gl_InstanceIndex) * OBJECT_STRIDE;
+        uint vertex = idx_geometry + uint(gl_VertexIndex) * VERTEX_STRIDE;
+
+        mat4 model    = load_mat4(object + OBJECT_MODEL_MAT);
+        vec3 position = load_vec3(vertex + VERTEX_POSITION);
+
+        frag_normal = mat3(model) * load_vec3(vertex + VERTEX_NORMAL);
+        gl_Position = proj_mat * view_mat * model * vec4(position, 1.0);
+}
@@ -0,0 +1,34 @@
+// included by every shader reading scene_buf, binding 0 of set 0
+// must match renderer_scene_t in main.c, every idx_ is a word offset into data
+layout (std430, binding = 0) readonly buffer scene
+{
+        uint npoint_masses;
+        uint nentities;
+        uint idx_entities, idx_point_entities;
+        uint idx_x, idx_y, idx_z;
+        uint idx_vx, idx_vy, idx_vz;
+        uint idx_ax, idx_ay, idx_az;
+        uint idx_mass, idx_inv_mass;
+        uint idx_adjacency, idx_neighbors, idx_k, idx_rest_distance;
+        uint idx_scratch;
+        uint idx_constraint_a, idx_constraint_b, idx_constraint_k;
+        uint idx_constraint_rest, idx_lambda;
+        uint nmeshes, nobjects;
+        uint idx_geometry, idx_indices, idx_meshes;
+        uint idx_draw, idx_ndraw, idx_object, idx_light;
+        uint nmeshlets, ninstances;
+        uint idx_meshlets, idx_instances;
+        uint ncolliding_points, ntriangles, ncollision_items, ncells;
+        float max_radius;
+        uint idx_triangles, idx_corner_offsets, idx_corners, idx_collision_items;
+        uint idx_item_cells, idx_cell_counts, idx_cell_starts, idx_block_sums;
+        uint idx_sorted, idx_triangle_extents, idx_collision_extent;
+        uint idx_anchors, idx_deltas, idx_corner_deltas;
+        uint nclusters, ncluster_members;
+        uint idx_cluster_offsets, idx_cluster_members, idx_cluster_rest;
+        uint idx_cluster_frames, idx_membership_offsets, idx_memberships;
+        float triangle_limit;
+        uint idx_wide_bounds;
+        uint idx_sleep, idx_rest_window, idx_touches;
+        uint idx_awake_points, idx_awake_dispatch;
+};